@@ -0,0 +1,444 @@
+// Synthetic module graph benchmark.
+//
+// Generates a library of modules on disk and measures the main mglsl phases:
+// import, parsing throughput, toposort, assembly and watch/swap latency.
+// Every measurement is printed to stdout as one JSON object per line.
+//
+// To compile simply:
+// # gcc -O2 main.c -o bench && ./bench -n 10000
+//
+// Options:
+//   -n COUNT    number of modules                           (default 2000)
+//   -f FANOUT   requirements per non-leaf module            (default 3)
+//   -d DEPTH    number of dependency layers below the root  (default 6)
+//   -s LINES    GLSL body lines per module                  (default 40)
+//   -r DENSITY  fraction of body lines that are directives  (default 0.05)
+//   -i ITERS    iterations for the repeated measurements    (default 20)
+//   -o DIR      directory to generate the library into      (default mkdtemp)
+//   -k          keep generated files
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "../mglsl.h"
+
+typedef struct {
+    size_t module_count;
+    size_t fanout;
+    size_t depth;
+    size_t body_lines;
+    double directive_density;
+    size_t iterations;
+    const char * dir;
+    int keep;
+} BenchConfig;
+
+static unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Deterministic so that runs are comparable between commits.
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ull;
+
+static size_t rng(size_t bound) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return bound ? (size_t)(rng_state % bound) : 0;
+}
+
+static void report
+    (const char * bench, const BenchConfig * cfg, size_t ops, unsigned long long total_ns, size_t bytes)
+{
+    double ns_per_op = ops ? (double)total_ns / ops : 0.0;
+    double mb_per_s  = total_ns ? (bytes / 1048576.0) / (total_ns / 1e9) : 0.0;
+
+    printf("{\"bench\":\"%s\",\"modules\":%zu,\"fanout\":%zu,\"depth\":%zu,"
+           "\"body_lines\":%zu,\"directive_density\":%.3f,"
+           "\"ops\":%zu,\"total_ns\":%llu,\"ns_per_op\":%.1f,\"bytes\":%zu,\"mb_per_s\":%.2f}\n",
+           bench, cfg->module_count, cfg->fanout, cfg->depth,
+           cfg->body_lines, cfg->directive_density,
+           ops, total_ns, ns_per_op, bytes, mb_per_s);
+    fflush(stdout);
+}
+
+//
+// GENERATOR
+
+// Module 0 is the root, the rest is spread evenly over cfg->depth layers.
+// Every module requires cfg->fanout random modules from the layer below it.
+
+static size_t layer_begin(const BenchConfig * cfg, size_t layer) {
+    if(layer == 0) return 0;
+    size_t per_layer = (cfg->module_count - 1 + cfg->depth - 1) / cfg->depth;
+    size_t begin = 1 + (layer - 1) * per_layer;
+    return begin < cfg->module_count ? begin : cfg->module_count;
+}
+
+static char * generate_module_source(const BenchConfig * cfg, size_t idx, size_t layer) {
+    size_t begin = layer_begin(cfg, layer + 1), end = layer_begin(cfg, layer + 2);
+    size_t fanout = (layer < cfg->depth && end > begin) ? cfg->fanout : 0;
+
+    size_t deps[64];
+    if(fanout > 64) fanout = 64;
+    for(size_t i=0; i<fanout; ++i) deps[i] = begin + rng(end - begin);
+
+    size_t cap = 256 + fanout * 32 + cfg->body_lines * 96;
+    char * src = malloc(cap);
+    size_t len = 0;
+
+    len += snprintf(src + len, cap - len, "#module m%06zu\n", idx);
+
+    if(fanout) {
+        len += snprintf(src + len, cap - len, "#require ");
+        for(size_t i=0; i<fanout; ++i)
+            len += snprintf(src + len, cap - len, i ? ", m%06zu" : "m%06zu", deps[i]);
+        len += snprintf(src + len, cap - len, "\n");
+    }
+
+    len += snprintf(src + len, cap - len, "\n// module %zu of layer %zu\n", idx, layer);
+
+    for(size_t l=0; l<cfg->body_lines; ++l) {
+        int directive = rng(1000) < (size_t)(cfg->directive_density * 1000.0);
+
+        if(directive && fanout)
+            len += snprintf(src + len, cap - len, "#require m%06zu\n", deps[rng(fanout)]);
+        else if(directive)
+            len += snprintf(src + len, cap - len, "#define M%06zu_%zu %zu\n", idx, l, l);
+        else
+            len += snprintf(src + len, cap - len,
+                            "vec4 m%06zu_f%zu(vec4 a, float b) { return a * b + vec4(%zu.0); }\n",
+                            idx, l, l);
+    }
+
+    src[len] = '\0';
+    return src;
+}
+
+static int write_file(const char * path, const char * src) {
+    FILE * file = fopen(path, "w");
+    if(!file) return -1;
+    size_t len = strlen(src);
+    int ok = fwrite(src, 1, len, file) == len;
+    fclose(file);
+    return ok ? 0 : -1;
+}
+
+//
+// BENCHMARKS
+
+static char ** sources;
+static char * file_list;
+static size_t source_bytes;
+
+static int generate(const BenchConfig * cfg) {
+    char path[MGLSL_MAX_PATH_LEN + 1];
+
+    sources = calloc(cfg->module_count, sizeof(char*));
+    file_list = malloc(cfg->module_count * 16 + 1);
+    size_t list_len = 0;
+
+    for(size_t layer=0, idx=0; layer<=cfg->depth; ++layer) {
+        size_t end = layer_begin(cfg, layer + 1);
+        if(layer == cfg->depth) end = cfg->module_count;
+
+        for(; idx<end; ++idx) {
+            sources[idx] = generate_module_source(cfg, idx, layer);
+            source_bytes += strlen(sources[idx]);
+
+            snprintf(path, sizeof(path), "%s/m%06zu.glsl", cfg->dir, idx);
+            if(write_file(path, sources[idx])) {
+                fprintf(stderr, "bench: could not write %s\n", path);
+                return -1;
+            }
+            list_len += sprintf(file_list + list_len, idx ? ",m%06zu.glsl" : "m%06zu.glsl", idx);
+        }
+    }
+    return 0;
+}
+
+static void free_arr(mglsl_ModuleArr arr) {
+    for(size_t i=0; i<arr.size; ++i)
+        mglsl_free_module(arr.data + i);
+    mglsl_free_imported_module_arr(arr);
+}
+
+static int bench_import(const BenchConfig * cfg, mglsl_ModuleArr * arr) {
+    unsigned long long t = now_ns();
+    int ec = mglsl_import_module_file_list_from_string(arr, file_list, cfg->dir);
+    t = now_ns() - t;
+    if(ec) return ec;
+
+    report("import", cfg, cfg->module_count, t, source_bytes);
+    return 0;
+}
+
+// Names and requirements only, as when discovering the graph. Bytes are still
+// those of whole files, to compare against import.
+static int bench_scan(const BenchConfig * cfg) {
+    mglsl_ModuleArr arr;
+    unsigned long long t = now_ns();
+    int ec = mglsl_scan_module_file_list_from_string(&arr, file_list, cfg->dir);
+    t = now_ns() - t;
+    if(ec) return ec;
+
+    free_arr(arr);
+    report("scan", cfg, cfg->module_count, t, source_bytes);
+    return 0;
+}
+
+static int bench_parse(const BenchConfig * cfg) {
+    mglsl_Module * modules = malloc(cfg->module_count * sizeof(mglsl_Module));
+    unsigned long long total = 0;
+    int ec = 0;
+
+    for(size_t it=0; it<cfg->iterations && !ec; ++it) {
+        unsigned long long t = now_ns();
+        size_t created = 0;
+        for(; created<cfg->module_count; ++created)
+            if( (ec = mglsl_create_module_from_source(modules + created, sources[created])) ) break;
+        total += now_ns() - t;
+
+        for(size_t i=0; i<created; ++i)
+            mglsl_free_module(modules + i);
+    }
+    free(modules);
+    if(ec) return ec;
+
+    report("parse", cfg, cfg->module_count * cfg->iterations, total, source_bytes * cfg->iterations);
+    return 0;
+}
+
+// Whole library added to a registry, then a handful of modules removed and
+// added back, as when files appear and disappear during an editing session.
+static int bench_registry(const BenchConfig * cfg) {
+    mglsl_Registry registry;
+    mglsl_Module module;
+    unsigned long long add_total = 0, churn_total = 0;
+    size_t churned = cfg->module_count < 16 ? cfg->module_count : 16;
+    char name[32];
+    int ec = 0;
+
+    mglsl_create_registry(&registry);
+
+    for(size_t i=0; i<cfg->module_count && !ec; ++i) {
+        if( (ec = mglsl_create_module_from_source(&module, sources[i])) ) break;
+        unsigned long long t = now_ns();
+        ec = mglsl_registry_add(NULL, &registry, &module);
+        add_total += now_ns() - t;
+    }
+
+    for(size_t it=0; it<cfg->iterations && !ec; ++it) {
+        for(size_t i=0; i<churned && !ec; ++i) {
+            size_t idx = rng(cfg->module_count);
+            snprintf(name, sizeof(name), "m%06zu", idx);
+            if( (ec = mglsl_create_module_from_source(&module, sources[idx])) ) break;
+
+            unsigned long long t = now_ns();
+            ec = mglsl_registry_remove(&registry, name);
+            if(!ec) ec = mglsl_registry_add(NULL, &registry, &module);
+            churn_total += now_ns() - t;
+        }
+    }
+
+    mglsl_free_registry(&registry);
+    if(ec) return ec;
+
+    report("registry_add", cfg, cfg->module_count, add_total, 0);
+    report("registry_churn", cfg, cfg->iterations * churned, churn_total, 0);
+    return 0;
+}
+
+static int bench_toposort(const BenchConfig * cfg, mglsl_ModuleArr arr) {
+    unsigned long long total = 0;
+    size_t * order = malloc(arr.size * sizeof(size_t));
+    if(!order) return MGLSL_E_ALLOC;
+
+    for(size_t it=0; it<cfg->iterations; ++it) {
+        size_t root_idx, order_len;
+        unsigned long long t = now_ns();
+        _mglsl_Graph graph;
+        int ec = _mglsl_build_graph(&graph, arr);
+        if(!ec) ec = _mglsl_find_module(&root_idx, "m000000", arr);
+        if(!ec) ec = _mglsl_toposort_modules(order, &order_len, root_idx, &graph, arr, NULL, _MGLSL_ALL_STAGES);
+        _mglsl_free_graph(&graph);
+        total += now_ns() - t;
+        if(ec) { free(order); return ec; }
+    }
+    free(order);
+
+    report("toposort", cfg, cfg->iterations, total, 0);
+    return 0;
+}
+
+static int bench_assemble(const BenchConfig * cfg, mglsl_ModuleArr arr, const char * bench, unsigned int flags) {
+    mglsl_AssembleOptions options;
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+    unsigned long long total = 0;
+    size_t bytes = 0;
+
+    for(size_t it=0; it<cfg->iterations; ++it) {
+        char * shader;
+        unsigned long long t = now_ns();
+        int ec = mglsl_assemble_shader_ex(&shader, "m000000", arr, &options);
+        total += now_ns() - t;
+        if(ec) return ec;
+
+        bytes += strlen(shader);
+        mglsl_free_shader(shader);
+    }
+
+    report(bench, cfg, cfg->iterations, total, bytes);
+    return 0;
+}
+
+static int count_bytes(const char * data, size_t len, void * user) {
+    (void)data;
+    *(size_t*)user += len;
+    return 0;
+}
+
+// Same as above, but written in chunks to a sink that only counts them.
+static int bench_assemble_stream(const BenchConfig * cfg, mglsl_ModuleArr arr) {
+    unsigned long long total = 0;
+    size_t bytes = 0;
+
+    for(size_t it=0; it<cfg->iterations; ++it) {
+        unsigned long long t = now_ns();
+        int ec = mglsl_assemble_shader_stream(count_bytes, &bytes, "m000000", arr, NULL);
+        total += now_ns() - t;
+        if(ec) return ec;
+    }
+
+    report("assemble_stream", cfg, cfg->iterations, total, bytes);
+    return 0;
+}
+
+// Polling cost with nothing changed, then latency of picking up and
+// reloading a handful of touched files.
+static int bench_watch_swap(const BenchConfig * cfg, mglsl_ModuleArr arr) {
+    unsigned long long total = 0;
+    int ec;
+
+    for(size_t it=0; it<cfg->iterations; ++it) {
+        unsigned long long t = now_ns();
+        ec = mglsl_file_change_watch(arr);
+        total += now_ns() - t;
+        if(ec) return ec;
+    }
+    report("watch_idle", cfg, cfg->iterations, total, 0);
+
+    size_t touched = cfg->module_count < 16 ? cfg->module_count : 16;
+    unsigned long long watch_total = 0, swap_total = 0;
+
+    for(size_t it=0; it<cfg->iterations; ++it) {
+        for(size_t i=0; i<touched; ++i) {
+            mglsl_Module * module = arr.data + rng(arr.size);
+            struct utimbuf times = { module->mtime + 1, module->mtime + 1 };
+            utime(mglsl_module_path(module), &times);
+        }
+
+        unsigned long long t = now_ns();
+        ec = mglsl_file_change_watch(arr);
+        watch_total += now_ns() - t;
+        if(ec != MGLSL_E_FILE_CHANGED) return ec ? ec : -1;
+
+        t = now_ns();
+        ec = mglsl_swap_dirty_modules(arr);
+        swap_total += now_ns() - t;
+        if(ec) return ec;
+    }
+    report("watch_dirty", cfg, cfg->iterations, watch_total, 0);
+    report("swap", cfg, cfg->iterations * touched, swap_total, 0);
+    return 0;
+}
+
+// Library counters accumulated over the whole run.
+static void report_stats() {
+    mglsl_Stats st;
+    mglsl_get_stats(&st);
+
+    printf("{\"bench\":\"stats\",\"read_ns\":%llu,\"parse_ns\":%llu,\"link_ns\":%llu,"
+           "\"assemble_ns\":%llu,\"bytes_parsed\":%zu,\"bytes_emitted\":%zu,"
+           "\"stat_calls\":%zu,\"read_calls\":%zu,\"module_lookups\":%zu,"
+           "\"string_compares\":%zu,\"peak_live_bytes\":%zu,\"reload_count\":%zu}\n",
+           st.read_ns, st.parse_ns, st.link_ns, st.assemble_ns, st.bytes_parsed, st.bytes_emitted,
+           st.stat_calls, st.read_calls, st.module_lookups, st.string_compares,
+           st.peak_live_bytes, st.reload_count);
+}
+
+static void cleanup(const BenchConfig * cfg) {
+    char path[MGLSL_MAX_PATH_LEN + 1];
+    for(size_t i=0; i<cfg->module_count; ++i) {
+        snprintf(path, sizeof(path), "%s/m%06zu.glsl", cfg->dir, i);
+        unlink(path);
+    }
+    rmdir(cfg->dir);
+}
+
+int main(int argc, char ** argv) {
+    BenchConfig cfg = { 2000, 3, 6, 40, 0.05, 20, NULL, 0 };
+    char tmpdir[] = "/tmp/mglsl-bench-XXXXXX";
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:f:d:s:r:i:o:k")) != -1) {
+        switch(opt) {
+        case 'n': cfg.module_count = strtoul(optarg, NULL, 10); break;
+        case 'f': cfg.fanout = strtoul(optarg, NULL, 10); break;
+        case 'd': cfg.depth = strtoul(optarg, NULL, 10); break;
+        case 's': cfg.body_lines = strtoul(optarg, NULL, 10); break;
+        case 'r': cfg.directive_density = strtod(optarg, NULL); break;
+        case 'i': cfg.iterations = strtoul(optarg, NULL, 10); break;
+        case 'o': cfg.dir = optarg; break;
+        case 'k': cfg.keep = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-n count] [-f fanout] [-d depth] [-s lines] "
+                            "[-r density] [-i iterations] [-o dir] [-k]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(cfg.module_count < 2) cfg.module_count = 2;
+    if(cfg.depth < 1) cfg.depth = 1;
+    if(cfg.iterations < 1) cfg.iterations = 1;
+
+    if(!cfg.dir && !(cfg.dir = mkdtemp(tmpdir))) {
+        perror("bench: mkdtemp");
+        return 1;
+    }
+
+    int ec = generate(&cfg);
+    mglsl_ModuleArr arr;
+
+    if(!ec) ec = bench_parse(&cfg);
+    if(!ec) ec = bench_registry(&cfg);
+    if(!ec) ec = bench_scan(&cfg);
+    if(!ec) ec = bench_import(&cfg, &arr);
+    if(!ec) {
+        ec = bench_toposort(&cfg, arr);
+        if(!ec) ec = bench_assemble(&cfg, arr, "assemble", 0);
+        if(!ec) ec = bench_assemble_stream(&cfg, arr);
+        if(!ec) ec = bench_assemble(&cfg, arr, "assemble_minify", MGLSL_ASSEMBLE_MINIFY_IDENTIFIERS);
+        if(!ec) ec = bench_watch_swap(&cfg, arr);
+        free_arr(arr);
+    }
+
+    if(!ec) report_stats();
+    if(ec) fprintf(stderr, "bench: failed with %d (%s)\n", ec, mglsl_err_desc(ec));
+
+    for(size_t i=0; i<cfg.module_count; ++i) free(sources[i]);
+    free(sources);
+    free(file_list);
+
+    if(!cfg.keep) cleanup(&cfg);
+    return ec ? 1 : 0;
+}
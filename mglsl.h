@@ -19,11 +19,18 @@
 # define MGLSL_MAX_PATH_LEN (255 - 1)
 #endif
 
+#ifndef MGLSL_STREAM_BUF_LEN
+# define MGLSL_STREAM_BUF_LEN 4096
+#endif
+
+#ifndef MGLSL_DIAG_RING_LEN
+# define MGLSL_DIAG_RING_LEN 64
+#endif
+
 
 #ifndef MGLSL_NO_LOGGING
 # ifndef MGLSL_LOG
 #  define MGLSL_LOG(STR) fprintf(stderr, STR)
-#  define _MGLSL_DEFAULT_READ_FILE
 # endif
 #else
 # define _MGLSL_NO_LOGGING
@@ -48,6 +55,21 @@
 # define _MGLSL_DEFAULT_FILE_MTIME
 #endif
 
+// Batches of files are loaded through io_uring on Linux, only if file hooks are not overriden.
+#if defined(MGLSL_IO_URING) && defined(_MGLSL_DEFAULT_READ_FILE) && defined(_MGLSL_DEFAULT_FILE_MTIME)
+# define _MGLSL_IO_URING
+# if !defined(_GNU_SOURCE) && !defined(_DEFAULT_SOURCE)
+#  error mglsl: MGLSL_IO_URING needs _GNU_SOURCE or _DEFAULT_SOURCE defined before any include.
+# endif
+# include <errno.h>
+# include <fcntl.h>        // AT_FDCWD, O_RDONLY
+# include <unistd.h>       // syscall
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+# include <linux/stat.h>   // struct statx
+#endif
+
 
 // DEFS
 
@@ -68,6 +90,61 @@
 # include <time.h> // time_t
 #endif
 
+#ifndef MGLSL_NO_STATS
+# define _MGLSL_STATS
+#endif
+
+#ifdef MGLSL_REFLECTION
+# define _MGLSL_REFLECTION
+#endif
+
+#ifdef MGLSL_COMPRESS_SOURCES
+# define _MGLSL_COMPRESS_SOURCES
+#endif
+
+#ifdef MGLSL_CACHE
+# define _MGLSL_CACHE
+# include <fcntl.h>     // open
+# include <unistd.h>    // write, close, unlink, getpid
+# include <sys/mman.h>  // mmap
+# include <sys/stat.h>
+#endif
+
+#ifdef MGLSL_SHARED_MODULES
+# define _MGLSL_SHARED_MODULES
+# include <errno.h>
+# include <stddef.h>    // offsetof
+# include <fcntl.h>     // O_* flags, fcntl locks
+# include <unistd.h>    // write, lseek, close
+# include <sys/mman.h>  // shm_open, mmap
+# include <sys/stat.h>
+#endif
+
+#ifdef MGLSL_PACK_FILES
+# define _MGLSL_PACK_FILES
+# include <sys/types.h> // dev_t, ino_t
+# include <fcntl.h>     // open
+# include <unistd.h>    // close
+# include <sys/mman.h>  // mmap
+# include <sys/stat.h>
+#endif
+
+#ifdef MGLSL_SDT
+# if defined(__has_include)
+#  if !__has_include(<sys/sdt.h>)
+#   error mglsl: MGLSL_SDT needs sys/sdt.h, it comes with systemtap SDT development package.
+#  endif
+# endif
+# define _MGLSL_SDT
+# include <sys/sdt.h>
+#endif
+
+#ifndef MGLSL_CLOCK_NS
+# include <time.h> // clock_gettime, clock
+# define MGLSL_CLOCK_NS() _mglsl_clock_ns()
+# define _MGLSL_DEFAULT_CLOCK_NS
+#endif
+
 //
 // MEMORY ALLOCATION
 
@@ -96,25 +173,130 @@ static size_t _mglsl_debug_realloc_count = 0;
 static size_t _mglsl_debug_free_count = 0;
 #endif
 
+//
+// STATISTICS
+
+typedef struct {
+    // nanoseconds spent in each phase
+    unsigned long long read_ns;     // MGLSL_READ_FILE and MGLSL_FILE_MTIME
+    unsigned long long parse_ns;    // module source parsing
+    unsigned long long link_ns;     // module lookup and toposort
+    unsigned long long assemble_ns; // writing out the final shader
+
+    size_t bytes_parsed;
+    size_t bytes_emitted;
+
+    size_t stat_calls;
+    size_t read_calls;
+    size_t module_lookups;
+    size_t string_compares;
+
+    size_t live_bytes;
+    size_t peak_live_bytes;
+
+    size_t reload_count;
+} mglsl_Stats;
+
+#ifdef _MGLSL_DEFAULT_CLOCK_NS
+static inline unsigned long long _mglsl_clock_ns(void) {
+# if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+# else
+    return (unsigned long long)clock() * (1000000000ull / CLOCKS_PER_SEC);
+# endif
+}
+#endif
+
+#ifdef _MGLSL_STATS
+static mglsl_Stats _mglsl_stats;
+
+# define _MGLSL_STAT_ADD(FIELD, N) (_mglsl_stats.FIELD += (N))
+# define _MGLSL_STAT_TIMER(VAR) unsigned long long VAR = MGLSL_CLOCK_NS()
+# define _MGLSL_STAT_TIME(FIELD, VAR) (_mglsl_stats.FIELD += MGLSL_CLOCK_NS() - (VAR))
+
+static inline void _mglsl_stats_live(size_t add, size_t sub) {
+    _mglsl_stats.live_bytes += add;
+    _mglsl_stats.live_bytes -= sub;
+    if(_mglsl_stats.live_bytes > _mglsl_stats.peak_live_bytes)
+        _mglsl_stats.peak_live_bytes = _mglsl_stats.live_bytes;
+}
+
+// Allocation size is kept in front of every block so that
+// frees can be accounted for in live bytes. Union makes sure
+// the block that follows stays aligned for anything.
+typedef union { size_t size; void * ptr; long double ld; long long ll; } _mglsl_AllocHeader;
+#else
+# define _MGLSL_STAT_ADD(FIELD, N) MGLSL_NOOP
+# define _MGLSL_STAT_TIMER(VAR) MGLSL_NOOP
+# define _MGLSL_STAT_TIME(FIELD, VAR) MGLSL_NOOP
+# define _mglsl_stats_live(ADD, SUB) ((void)(ADD), (void)(SUB))
+#endif
+
+//
+// TRACEPOINTS
+// Static probes of provider mglsl, they compile to nothing unless MGLSL_SDT is defined.
+// With it each probe is a nop until perf or bpftrace attaches, but its arguments are still
+// computed on every pass, so they are kept to values at hand already.
+
+#ifdef _MGLSL_SDT
+# define _MGLSL_PROBE1(NAME, A) STAP_PROBE1(mglsl, NAME, A)
+# define _MGLSL_PROBE2(NAME, A, B) STAP_PROBE2(mglsl, NAME, A, B)
+# define _MGLSL_PROBE3(NAME, A, B, C) STAP_PROBE3(mglsl, NAME, A, B, C)
+#else
+# define _MGLSL_PROBE1(NAME, A) MGLSL_NOOP
+# define _MGLSL_PROBE2(NAME, A, B) MGLSL_NOOP
+# define _MGLSL_PROBE3(NAME, A, B, C) MGLSL_NOOP
+#endif
+
 void * _mglsl_alloc (size_t size) {
 #if defined(MGLSL_DEBUG)
     _mglsl_debug_alloc_count++;
 #endif
+#ifdef _MGLSL_STATS
+    _mglsl_AllocHeader * header = (_mglsl_AllocHeader*)MGLSL_ALLOC(sizeof(_mglsl_AllocHeader) + size);
+    if(!header) return NULL;
+
+    header->size = size;
+    _mglsl_stats_live(size, 0);
+    return header + 1;
+#else
     return MGLSL_ALLOC(size);
+#endif
 }
 
 void * _mglsl_realloc (void * ptr, size_t size) {
 #if defined(MGLSL_DEBUG)
     _mglsl_debug_realloc_count++;
 #endif
+#ifdef _MGLSL_STATS
+    _mglsl_AllocHeader * header = ptr ? (_mglsl_AllocHeader*)ptr - 1 : NULL;
+    size_t old_size = header ? header->size : 0;
+
+    header = (_mglsl_AllocHeader*)MGLSL_REALLOC(header, sizeof(_mglsl_AllocHeader) + size);
+    if(!header) return NULL;
+
+    header->size = size;
+    _mglsl_stats_live(size, old_size);
+    return header + 1;
+#else
     return MGLSL_REALLOC(ptr, size);
+#endif
 }
 
 void _mglsl_free (void * ptr) {
 #if defined(MGLSL_DEBUG)
     _mglsl_debug_free_count++;
 #endif
+#ifdef _MGLSL_STATS
+    if(!ptr) return;
+    _mglsl_AllocHeader * header = (_mglsl_AllocHeader*)ptr - 1;
+    _mglsl_stats_live(0, header->size);
+    MGLSL_FREE(header);
+#else
     MGLSL_FREE(ptr);
+#endif
 }
 
 //
@@ -136,9 +318,18 @@ enum mglsl_ErrorCode
     MGLSL_E_CIRCULAR_DEP,
     MGLSL_E_MISSING_DEP,
     MGLSL_E_BUF_TOO_SMALL,
-#ifdef _MGLSL_FILE_CHANGE_WATCH
-    MGLSL_E_FILE_CHANGED
-#endif
+    MGLSL_E_FILE_CHANGED = 14,
+
+    // Values are fixed whatever switches are defined, codes travel between processes
+    // built with different ones, e.g. from mglsld.
+    MGLSL_E_LINE_NOT_MAPPED = 15,
+    MGLSL_E_WRITE = 16,
+    MGLSL_E_MODULE_EXISTS = 17,
+    MGLSL_E_CACHE_MISS = 18,
+    MGLSL_E_SHM_EXISTS = 19,
+    MGLSL_E_SHM_NOT_READY = 20,
+    MGLSL_E_PACK_INVALID = 21,
+    MGLSL_E_RELOAD_PENDING = 22
 
 };
 
@@ -159,9 +350,15 @@ struct _mglsl_ErrorDescPair _mglsl_err_desc_map[] =
     {MGLSL_E_CIRCULAR_DEP, "Cirular dependency found"},
     {MGLSL_E_MISSING_DEP, "Missing required module"},
     {MGLSL_E_BUF_TOO_SMALL, "Provided buffer is too small"},
-#ifdef _MGLSL_FILE_CHANGE_WATCH
-    {MGLSL_E_FILE_CHANGED,  "File changed on disk"}
-#endif
+    {MGLSL_E_FILE_CHANGED,  "File changed on disk"},
+    {MGLSL_E_LINE_NOT_MAPPED, "Line does not come from any module"},
+    {MGLSL_E_WRITE, "Writing assembled shader failed"},
+    {MGLSL_E_MODULE_EXISTS, "Module with this name already exists"},
+    {MGLSL_E_CACHE_MISS, "No valid cache entry"},
+    {MGLSL_E_SHM_EXISTS, "Shared modules are already published"},
+    {MGLSL_E_SHM_NOT_READY, "Shared modules are not published"},
+    {MGLSL_E_PACK_INVALID, "Pack is not a valid tar archive"},
+    {MGLSL_E_RELOAD_PENDING, "Reload is not finished yet"},
   
 };
 
@@ -170,95 +367,81 @@ static const int _mglsl_err_desc_map_len = sizeof(_mglsl_err_desc_map)/sizeof(st
 
 const char * mglsl_err_desc(int code) {
     for(int i=0; i<_mglsl_err_desc_map_len; i++) {
-        if(code == _mglsl_err_desc_map[i].code)
+        if(code == (int)_mglsl_err_desc_map[i].code)
             return _mglsl_err_desc_map[i].desc;
     }
     return "Unknown error.";
 }
 
-static int _mglsl_err_code = 0;
-static int _mglsl_err_line = 0;
-static int _mglsl_err_char_offset = 0;
-static const char * _mglsl_err_file = "(unknown)";
-static const char * _mglsl_err_msg = "Success.";
-static const char * _mglsl_err_sec_msg = "";
-static const char * _mglsl_err_level = "error";
-
-
-char * _mglsl_errmsg() {
-    size_t msglen = strlen(_mglsl_err_msg) + strlen(_mglsl_err_sec_msg) + strlen(_mglsl_err_level) + 255; // oof
-
-    char * buf = _mglsl_alloc(msglen);
-    _MGLSL_ASSERT(buf);
-
-    const char * fmt = strlen(_mglsl_err_sec_msg) ?  "mglsl: %s: %s, %s." : "mglsl: %s: %s. %s";
-
-    int result = snprintf(buf, msglen, fmt, _mglsl_err_level, _mglsl_err_msg, _mglsl_err_sec_msg);
-
-    _MGLSL_ASSERT(result >= 0);
-    
-    return buf; // remember to free it
-}
-
-char * _mglsl_src_errmsg() {
-    size_t msglen =
-        strlen(_mglsl_err_file) + strlen(_mglsl_err_msg) +
-        strlen(_mglsl_err_sec_msg) + strlen(_mglsl_err_level) + 255; // oof
-
-    char * buf = _mglsl_alloc(msglen);
-    _MGLSL_ASSERT(buf);
+// Detail of an error, more specific than its code.
+enum mglsl_DiagDetail
+{
+    MGLSL_DIAG_NONE = 0,
+    MGLSL_DIAG_MODULE_NO_ARG,
+    MGLSL_DIAG_MODULE_REDEFINED,
+    MGLSL_DIAG_MODULE_INVALID_NAME,
+    MGLSL_DIAG_REQUIRE_NO_ARGS,
+    MGLSL_DIAG_REQUIRE_EMPTY_ARG,
+    MGLSL_DIAG_REQUIRE_INVALID_NAME,
+    MGLSL_DIAG_TYPE_NO_ARGS,
+    MGLSL_DIAG_TYPE_INVALID,
+    MGLSL_DIAG_KEYWORD_TOO_LONG,
+    MGLSL_DIAG_NO_NAME,
+    MGLSL_DIAG_LIST_WHITESPACE,
+    MGLSL_DIAG_DEFINE_INVALID_NAME,
+    MGLSL_DIAG_DEFINE_MULTILINE,
+};
 
-    const char * fmt = strlen(_mglsl_err_sec_msg) ?  "%s:%d:%d: %s: %s, %s." : "%s:%d:%d: %s: %s. %s";
+static const char * _mglsl_diag_detail_desc[] =
+{
+    "",
+    "'module' directive without module name argument",
+    "redefined module name",
+    "invalid module name",
+    "'require' directive without any arguments",
+    "'require' directive argument cannot be empty",
+    "one of 'require' directive arguments is not valid module name",
+    "'type' directive without any arguments",
+    "one of 'type' directive arguments is not a shader stage",
+    "preprocessor directive keyword is too long",
+    "could not infer the name and module source does not contain valid 'module' directive",
+    "list entry cannot contain whitespace",
+    "define name is not valid identifier",
+    "define value cannot span multiple lines",
+};
 
-    int result =
-        snprintf(buf, msglen, fmt,
-                 _mglsl_err_file, _mglsl_err_line, _mglsl_err_char_offset, _mglsl_err_level, _mglsl_err_msg, _mglsl_err_sec_msg);
-    _MGLSL_ASSERT(result >= 0);
-    
-    return buf; // remember to free it
-}
+// Context of the next error, set right before it is returned. Detail and name are
+// consumed by the error, file stays for all errors found while parsing it.
+static const char * _mglsl_err_file = NULL; // source file being parsed, NULL if in memory
+static unsigned int _mglsl_err_detail = MGLSL_DIAG_NONE;
+static const char * _mglsl_err_name = NULL; // module or file the error is about
 
 
 //
 // LOGGING 
 
-// library errors
-#ifndef _MGLSL_NO_LOGGING
-static int _mglsl_log_err(int code) {
-    _mglsl_err_msg = mglsl_err_desc(code);
-
-    char * msg = _mglsl_errmsg();
-    MGLSL_LOG(msg);
+// Errors are recorded in diagnostics ring, and logged unless MGLSL_NO_LOGGING is defined.
+static int _mglsl_diag_push(int code, unsigned int line, unsigned int column);
 
-    _MGLSL_ASSERT(msg);
-    _mglsl_free(msg);
-    return code;
+// library errors
+static inline int _mglsl_log_err(int code) {
+    return _mglsl_diag_push(code, 0, 0);
 }
-#else
-# define _mglsl_log_err(CODE) CODE
-#endif
 
 // errors in parsed source, displayed with file, line and char offset for fast jumps
-#ifndef _MGLSL_NO_LOGGING
-static int _mglsl_log_src_err(int line, int char_offset, int code) {
-    _mglsl_err_line = line;
-    _mglsl_err_char_offset = char_offset;
-    _mglsl_err_msg = mglsl_err_desc(code);
-
-    char * msg = _mglsl_src_errmsg();
-    MGLSL_LOG(msg);
-
-    _MGLSL_ASSERT(msg);
-    _mglsl_free(msg);
-    return code;
+static inline int _mglsl_log_src_err(int line, int char_offset, int code) {
+    return _mglsl_diag_push(code, (unsigned int)line, (unsigned int)char_offset);
 }
-#else
-# define _mglsl_log_src_err(LINE, OFFSET, CODE) CODE
-#endif
 
 
 enum mglsl_ShaderType { NONE, VERT, FRAG, GEOM, COMP, TESS_CTRL, TESS_EVAL };
 
+#define MGLSL_SHADER_TYPE_COUNT 7
+
+// Mask of shader stages, bit per mglsl_ShaderType from VERT up to TESS_EVAL.
+#define MGLSL_STAGE(TYPE) (1u << (TYPE))
+#define _MGLSL_ALL_STAGES 0xffu
+
 enum mglsl_ModuleFlags {
     // for topo sorting
     MGLSL_PERM_MARK = (1 << 0),
@@ -266,24 +449,104 @@ enum mglsl_ModuleFlags {
 
 #ifdef _MGLSL_FILE_CHANGE_WATCH
     MGLSL_DIRTY = (1 << 2),
+
+    // only directives at the top of the file were parsed, source is NULL until body is loaded
+    MGLSL_HEADER_ONLY = (1 << 3),
+#endif
+
+#ifdef _MGLSL_SHARED_MODULES
+    // source, line runs and dependency conditions are in shared memory, not owned
+    _MGLSL_SHARED = (1 << 6),
 #endif
+
+    // created and not yet freed
+    _MGLSL_ALIVE = (1 << 7),
+};
+
+// Parsed source is split into runs of lines which are consecutive in the original
+// source as well, new run starts after every stripped directive.
+typedef struct {
+    unsigned int line;     // first line of the run in parsed source
+    unsigned int src_line; // the same line in original source
+} _mglsl_LineRun;
+
+// Id of interned string, 0 stands for no string.
+typedef unsigned int mglsl_StrId;
+
+// Error recorded in diagnostics ring, message is only formatted with mglsl_format_diag.
+typedef struct {
+    int code;            // mglsl_ErrorCode
+    unsigned int detail; // mglsl_DiagDetail
+    mglsl_StrId file;    // parsed file, 0 if error is not in source or source is in memory
+    mglsl_StrId name;    // module or file the error is about, 0 if none
+    unsigned int line;   // 0 if error is not in source
+    unsigned int column;
+} mglsl_Diag;
+
+#ifdef _MGLSL_REFLECTION
+enum mglsl_ReflectKind {
+    MGLSL_REFLECT_UNIFORM = 1,
+    MGLSL_REFLECT_BUFFER,
+    MGLSL_REFLECT_IN,
+    MGLSL_REFLECT_OUT,
+    MGLSL_REFLECT_STRUCT,
+    MGLSL_REFLECT_MEMBER, // member of the struct or block it follows
 };
 
+// Array length or layout qualifier which is not there.
+#define MGLSL_REFLECT_NONE (-1)
+
+// Top-level declaration of interface variable, interface block or struct. Blocks and
+// structs are followed by their members, variables declared together get a record each.
 typedef struct {
-    size_t _sort_idx;
+    unsigned char kind;       // mglsl_ReflectKind
+    unsigned char is_block;   // interface block, name is its instance name (0 if none) and type block name
+    unsigned short members;   // number of members following the record
+    mglsl_StrId name;
+    mglsl_StrId type;
+    int array_len;            // 0 if unsized or not a literal
+    int binding, location, set;
+    unsigned int module_idx;  // module of the declaration, only set in merged reflection
+} mglsl_ReflectDecl;
 
-    char name[MGLSL_MAX_NAME_LEN + 1];
-    enum mglsl_ShaderType type;
+typedef struct {
+    mglsl_ReflectDecl * data;
+    size_t size;
+} mglsl_Reflection;
+#endif
 
+typedef struct {
     char * source;
 
-    char ** deps;
+#ifdef _MGLSL_COMPRESS_SOURCES
+    size_t _source_len; // of parsed source
+    size_t _packed_len; // if not 0, source is compressed to that many bytes
+#endif
+
+    mglsl_StrId * deps; // names of required modules
     size_t deps_len;
 
+    // Condition under which each dependency is required, taken from '#if' blocks
+    // around its '#require'. NULL for unconditional ones, array is NULL if all are.
+    char ** deps_cond;
+
+    _mglsl_LineRun * _line_runs;
+    size_t _line_runs_len;
+
+#ifdef _MGLSL_REFLECTION
+    mglsl_ReflectDecl * _reflect; // top-level declarations, see mglsl_module_reflection
+    size_t _reflect_len;
+#endif
+
 #ifdef _MGLSL_FILE_CHANGE_WATCH
-    char path[MGLSL_MAX_PATH_LEN + 1];
     time_t mtime;
+    mglsl_StrId path;
 #endif
+#ifdef _MGLSL_CACHE
+    unsigned long long _digest; // of parsed source and line runs, see _mglsl_module_digest
+#endif
+    mglsl_StrId name;
+    unsigned char stages; // MGLSL_STAGE mask from '#type', 0 if module is used in all stages
     unsigned char flags;
 
 } mglsl_Module;
@@ -293,11 +556,142 @@ typedef struct {
     size_t size;
 } mglsl_ModuleArr;
 
+// Refers to module in registry until it is removed, 0 is never valid.
+typedef unsigned long long mglsl_ModuleHandle;
+
+typedef struct {
+    unsigned int idx; // index of the module, or of next free slot
+    unsigned int gen; // bumped whenever module of the slot is removed
+} _mglsl_RegistrySlot;
+
+// Growable set of uniquely named modules. Modules are kept contiguous, so they move
+// when other ones are removed, handles stay valid though.
+typedef struct {
+    mglsl_Module * data;
+    size_t size;
+    size_t cap;
+
+    unsigned int * _slot_of; // slot of each module
+    _mglsl_RegistrySlot * _slots;
+    size_t _slots_len, _slots_cap;
+    unsigned int _free_slot;
+
+    // module index by name id
+    unsigned int * _by_name;
+    size_t _by_name_len;
+} mglsl_Registry;
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+typedef struct {
+    mglsl_Module module; // reloaded module, once it is read
+    size_t module_idx;   // of module it replaces
+    time_t mtime;        // of file when it was read
+    int state;
+} _mglsl_ReloadEntry;
+
+// Reload spread over many calls, has to be zeroed before first one.
+typedef struct {
+    _mglsl_ReloadEntry * _entries;
+    size_t _entries_len, _entries_cap;
+    unsigned char * _queued; // per module, whether it is in one of entries
+    size_t _queued_len;
+    unsigned long long _ns_per_module;
+} mglsl_Reload;
+#endif
+
 typedef struct {
     const char ** data;
     size_t size;
 } mglsl_StringArr;
 
+enum mglsl_AssembleFlags {
+    // '#line <line> <module index>' is emitted wherever assembled source stops
+    // following consecutive lines of one module file
+    MGLSL_ASSEMBLE_LINE_DIRECTIVES = (1 << 0),
+
+    // functions, structs and globals not reachable from 'main', interface
+    // declarations or preprocessor directives are dropped from assembled shader
+    MGLSL_ASSEMBLE_STRIP_UNUSED = (1 << 1),
+
+    // comments are stripped, whitespace and blank lines collapsed, preprocessor
+    // directives are left intact; with line map or line directives lines are kept
+    MGLSL_ASSEMBLE_MINIFY = (1 << 2),
+
+    // implies MGLSL_ASSEMBLE_MINIFY, function parameters and local variables get
+    // short names of form _[a-z]+, which become reserved; names used by macro bodies are kept
+    MGLSL_ASSEMBLE_MINIFY_IDENTIFIERS = (1 << 3),
+};
+
+#define MGLSL_LINE_MAP_NO_MODULE ((unsigned int)-1)
+
+// Line map stores one entry per run of assembled lines coming from consecutive
+// lines of one module, lines inside the run are recovered from the offset to its start.
+// Runs are used instead of delta-encoded (output line, source line) pairs: a module
+// body is a handful of runs, split only where directives were stripped, so it is
+// about as small, and absolute run starts keep lookups a binary search where deltas
+// would have to be summed up to the looked up line first.
+typedef struct {
+    unsigned int line;       // first line of the run in assembled shader
+    unsigned int module_idx; // index into module array or MGLSL_LINE_MAP_NO_MODULE
+    unsigned int src_line;   // line in module source the run starts at
+} mglsl_LineMapRun;
+
+typedef struct {
+    mglsl_LineMapRun * data;
+    size_t size;
+} mglsl_LineMap;
+
+typedef struct {
+    unsigned int flags;       // mglsl_AssembleFlags
+    mglsl_LineMap * line_map; // if not NULL line map of assembled shader is returned here
+
+    // MGLSL_STAGE mask, modules typed for none of these stages are left out together with
+    // requirements only they lead to. 0 includes modules of all stages.
+    unsigned int stages;
+
+#ifdef _MGLSL_REFLECTION
+    // if not NULL reflection of modules in assembled shader is returned here, in their order
+    mglsl_Reflection * reflection;
+#endif
+} mglsl_AssembleOptions;
+
+// Receives assembled shader in consecutive chunks, non-zero return stops assembly.
+typedef int mglsl_WriteProc(const char * data, size_t len, void * user);
+
+typedef struct {
+    const char * name;
+    const char * value; // NULL or empty defines name without value
+} mglsl_Define;
+
+typedef struct {
+    const mglsl_Define * data;
+    size_t size;
+} mglsl_DefineArr;
+
+typedef struct {
+    size_t module_idx;
+    const char * name;
+    const char * path; // NULL if module was not created from file
+    size_t line;
+} mglsl_SourceLoc;
+
+#ifdef _MGLSL_CACHE
+typedef struct {
+    const char * data; // null-terminated
+    size_t size;
+    void * _map;       // mapped cache entry, NULL if data was assembled
+    size_t _map_len;
+} mglsl_CachedShader;
+#endif
+
+#ifdef _MGLSL_SHARED_MODULES
+typedef struct {
+    mglsl_ModuleArr modules; // valid until detached, their sources are read-only
+    void * _map;
+    size_t _map_len;
+} mglsl_SharedModules;
+#endif
+
 
 //
 // INTERFACE
@@ -309,17 +703,85 @@ int mglsl_create_module_from_file
 int mglsl_create_module_from_source
     (mglsl_Module * module, const char * src);
 
+int mglsl_create_module_from_source_len
+    (mglsl_Module * module, const char * src, size_t src_len);
+
 int mglsl_free_module
     (mglsl_Module * module);
 
+const char * mglsl_module_name
+    (const mglsl_Module * module);
+
+const char * mglsl_module_path
+    (const mglsl_Module * module);
+
+enum mglsl_ShaderType mglsl_module_type
+    (const mglsl_Module * module);
+
+const char * mglsl_module_dep
+    (const mglsl_Module * module, size_t dep_idx);
+
+const char * mglsl_str
+    (mglsl_StrId id);
+
+mglsl_StrId mglsl_str_id
+    (const char * str);
+
 //
 
 int mglsl_assemble_shader
     (char ** bufptr, const char * root_module_name, mglsl_ModuleArr module_arr);
 
+int mglsl_assemble_shader_ex
+    (char ** bufptr, const char * root_module_name, mglsl_ModuleArr module_arr,
+     const mglsl_AssembleOptions * options);
+
+int mglsl_assemble_shader_stream
+    (mglsl_WriteProc * write, void * user, const char * root_module_name, mglsl_ModuleArr module_arr,
+     const mglsl_AssembleOptions * options);
+
+int mglsl_assemble_shader_variant
+    (char ** bufptr, const char * root_module_name, mglsl_ModuleArr module_arr,
+     mglsl_DefineArr defines, const mglsl_AssembleOptions * options);
+
+int mglsl_assemble_shader_variants
+    (char ** bufs, const char * root_module_name, mglsl_ModuleArr module_arr,
+     const mglsl_DefineArr * variants, size_t variant_count, const mglsl_AssembleOptions * options);
+
+int mglsl_assemble_program
+    (char ** bufs, const char * root_module_name, mglsl_ModuleArr module_arr,
+     unsigned int stages, const mglsl_AssembleOptions * options);
+
 int mglsl_free_shader
     (char * buf);
 
+int mglsl_line_map_lookup
+    (mglsl_SourceLoc * loc, const mglsl_LineMap * line_map, mglsl_ModuleArr module_arr, size_t line);
+
+int mglsl_free_line_map
+    (mglsl_LineMap * line_map);
+
+#ifdef _MGLSL_CACHE
+int mglsl_cache_load
+    (mglsl_CachedShader * shader, const char * cache_dir, const char * root_module_name,
+     const mglsl_AssembleOptions * options);
+
+int mglsl_assemble_shader_cached
+    (mglsl_CachedShader * shader, const char * cache_dir, const char * root_module_name,
+     mglsl_ModuleArr module_arr, const mglsl_AssembleOptions * options);
+
+int mglsl_free_cached_shader
+    (mglsl_CachedShader * shader);
+#endif
+
+#ifdef _MGLSL_REFLECTION
+mglsl_Reflection mglsl_module_reflection
+    (const mglsl_Module * module);
+
+int mglsl_free_reflection
+    (mglsl_Reflection * reflection);
+#endif
+
 //
 
 int mglsl_import_module_file_list_from_array
@@ -333,6 +795,90 @@ int mglsl_import_module_file_list_from_file
 
 int mglsl_free_imported_module_arr(mglsl_ModuleArr module_arr);
 
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+int mglsl_scan_module_from_file
+    (mglsl_Module * module, const char * filepath);
+
+int mglsl_load_module_body
+    (mglsl_Module * module);
+
+int mglsl_scan_module_file_list_from_array
+    (mglsl_ModuleArr * module_arr, mglsl_StringArr arr, const char * search_paths);
+
+int mglsl_scan_module_file_list_from_string
+    (mglsl_ModuleArr * module_arr, const char * str, const char * search_paths);
+
+int mglsl_scan_module_file_list_from_file
+    (mglsl_ModuleArr * module_arr, const char * filename, const char * search_paths);
+#endif
+
+#ifdef _MGLSL_SHARED_MODULES
+int mglsl_publish_shared_modules
+    (const char * shm_name, mglsl_ModuleArr module_arr);
+
+int mglsl_attach_shared_modules
+    (mglsl_SharedModules * shared, const char * shm_name);
+
+int mglsl_detach_shared_modules
+    (mglsl_SharedModules * shared);
+
+int mglsl_unlink_shared_modules
+    (const char * shm_name);
+#endif
+
+#ifdef _MGLSL_PACK_FILES
+int mglsl_mount_pack
+    (const char * pack_path, const char * mount_dir);
+
+int mglsl_unmount_pack
+    (const char * pack_path);
+#endif
+
+//
+
+int mglsl_create_registry
+    (mglsl_Registry * registry);
+
+int mglsl_free_registry
+    (mglsl_Registry * registry);
+
+int mglsl_registry_add
+    (mglsl_ModuleHandle * handle, mglsl_Registry * registry, mglsl_Module * module);
+
+int mglsl_registry_replace
+    (mglsl_Registry * registry, mglsl_ModuleHandle handle, mglsl_Module * module);
+
+int mglsl_registry_remove
+    (mglsl_Registry * registry, const char * module_name);
+
+int mglsl_registry_find
+    (mglsl_ModuleHandle * handle, mglsl_Registry * registry, const char * module_name);
+
+int mglsl_registry_reindex
+    (mglsl_Registry * registry);
+
+mglsl_Module * mglsl_registry_get
+    (const mglsl_Registry * registry, mglsl_ModuleHandle handle);
+
+mglsl_ModuleArr mglsl_registry_modules
+    (const mglsl_Registry * registry);
+
+//
+
+int mglsl_get_stats(mglsl_Stats * stats);
+
+int mglsl_reset_stats(void);
+
+//
+
+size_t mglsl_get_diags
+    (mglsl_Diag * diags, size_t max_count);
+
+int mglsl_format_diag
+    (char * buf, size_t buf_len, const mglsl_Diag * diag);
+
+int mglsl_clear_diags(void);
+
 //
  
 #ifdef _MGLSL_FILE_CHANGE_WATCH
@@ -342,6 +888,12 @@ int mglsl_file_change_watch
 
 int mglsl_swap_dirty_modules
     (mglsl_ModuleArr modules);
+
+int mglsl_swap_dirty_modules_budgeted
+    (mglsl_Reload * reload, mglsl_ModuleArr modules, unsigned long long budget_us);
+
+int mglsl_free_reload
+    (mglsl_Reload * reload);
 #endif
  
 //
@@ -360,7 +912,7 @@ static inline int _mglsl_is_number(char c) {
 }
 
 static inline int _mglsl_is_letter(char c) {
-    return (65 <= c && c < 91) || (97 <= c && c < 122);
+    return (65 <= c && c < 91) || (97 <= c && c < 123);
 }
 
 
@@ -386,6 +938,11 @@ static inline const char * _mglsl_cur_skip_line(const char * cur) {
     return cur;
 }
 
+static inline const char * _mglsl_cur_skip_lines(const char * cur, size_t count) {
+    while(count-- && *cur != '\0') cur = _mglsl_cur_skip_line(cur);
+    return cur;
+}
+
 static inline const char * _mglsl_cur_skip_white(const char * cur) {
     while(_mglsl_is_white(*cur) && *cur != '\0') cur++;
     return cur;
@@ -412,9 +969,34 @@ static inline const char * _mglsl_cur_skip_space(const char * cur) {
     return cur;
 }
 
+// Skips whitespace and comments, counts newlines and returns beginning of the line it stops in.
+static const char * _mglsl_cur_skip_filler(const char * cur, int * nlptr, const char ** line_begin)
+{
+    for(;;) {
+        if(*cur == '\n') {
+            (*nlptr)++;
+            *line_begin = ++cur;
+        } else if(_mglsl_is_white(*cur)) {
+            cur++;
+        } else if(cur[0] == '/' && cur[1] == '/') {
+            while(*cur != '\0' && *cur != '\n') cur++;
+        } else if(cur[0] == '/' && cur[1] == '*') {
+            for(cur += 2; *cur != '\0' && !(cur[0] == '*' && cur[1] == '/'); cur++) {
+                if(*cur == '\n') {
+                    (*nlptr)++;
+                    *line_begin = cur + 1;
+                }
+            }
+            if(*cur != '\0') cur += 2;
+        } else {
+            return cur;
+        }
+    }
+}
+
 //
 
-// Splits str by character c, returns array of pointers to str.
+// Splits str by character c, returns array of pointers to str. Errors are logged.
 // Argument str is expected to be comma delimited list of contagious nonwhite strings.
 // All whitespace between strings and commas is dropped, strings are terminated
 // with '\0' by replacing characters in str.
@@ -425,7 +1007,7 @@ static int _mglsl_split
     size_t arr_len = 1, arr_idx = 0;
     for(size_t i=0; i<strlen(str); i++) if(str[i] == c) arr_len++;
 
-    const char ** arr = _mglsl_alloc(arr_len * sizeof(char*));
+    const char ** arr = (const char**)_mglsl_alloc(arr_len * sizeof(char*));
 
     if(!arr) return _mglsl_log_err(MGLSL_E_ALLOC);
 
@@ -457,9 +1039,12 @@ static int _mglsl_split
             *(cur++) = '\0';
             while(*cur != c && *cur) {
                 if(!_mglsl_is_white(*cur)) {
+                    const char * line_begin = cur;
+                    while(line_begin != str && line_begin[-1] != '\n') line_begin--;
 
-                    _mglsl_err_line = line;
-                    return MGLSL_E_SYNTAX;
+                    _mglsl_free((void*)arr);
+                    _mglsl_err_detail = MGLSL_DIAG_LIST_WHITESPACE;
+                    return _mglsl_log_src_err(line, cur - line_begin, MGLSL_E_SYNTAX);
                 }
                 cur++;
             }
@@ -476,855 +1061,6741 @@ static int _mglsl_split
 }
 
 //
-// MODULE UTIL
+// GLSL LEXER
+// Just enough of GLSL to tell declarations apart. Comments are skipped and
+// preprocessor directives are returned as single tokens spanning whole line.
+
+enum _mglsl_TokenKind {
+    _MGLSL_TOK_END = 0,
+    _MGLSL_TOK_IDENT,
+    _MGLSL_TOK_NUMBER,
+    _MGLSL_TOK_PUNCT,
+    _MGLSL_TOK_DIRECTIVE,
+};
 
-static int _mglsl_find_module(size_t * idxptr, const char * module_name, mglsl_ModuleArr module_arr)
-{
-    _MGLSL_ASSERT(module_name);
-    if(!module_arr.data) return MGLSL_E_MODULE_NOT_FOUND;
+typedef struct {
+    enum _mglsl_TokenKind kind;
+    const char * begin;
+    const char * end;
+} _mglsl_Token;
 
-    for(size_t i=0; i<module_arr.size; i++) {
-        if( !strcmp(module_name, module_arr.data[i].name) ) {
-            if(idxptr) *idxptr = i;
-            return MGLSL_E_SUCCESS;
-        }
-    }
+static inline int _mglsl_is_ident_char(char c) {
+    return _mglsl_is_letter(c) || _mglsl_is_number(c) || c == '_';
+}
 
-    return MGLSL_E_MODULE_NOT_FOUND;
+static inline int _mglsl_tok_is(const _mglsl_Token * tok, const char * str) {
+    size_t len = tok->end - tok->begin;
+    return *str == *tok->begin && strlen(str) == len && !memcmp(tok->begin, str, len);
 }
 
-//
-// INDIVIDUAL KEYWORD PARSERS
+static inline int _mglsl_tok_is_punct(const _mglsl_Token * tok, char c) {
+    return tok->kind == _MGLSL_TOK_PUNCT && *tok->begin == c;
+}
 
-#define _MGLSL_PROC_SIGNATURE(NAME, ...) int NAME(__VA_ARGS__)
-#define _MGLSL_PARSE_PP_DIRECTIVE_PROC_SIGNATURE(NAME)                        \
-    _MGLSL_PROC_SIGNATURE(NAME, mglsl_Module * module, char * args)
+// Is there only space between cur and beginning of its line
+static inline int _mglsl_is_line_begin(const char * buf, const char * cur) {
+    while(cur > buf && _mglsl_is_space(cur[-1])) cur--;
+    return cur == buf || cur[-1] == '\n';
+}
 
-typedef _MGLSL_PARSE_PP_DIRECTIVE_PROC_SIGNATURE(_mglsl_ParsePPDirectiveProc);
+static const char * _mglsl_lex
+    (_mglsl_Token * tok, const char * buf, const char * cur, const char * end)
+{
+    for(;;) {
+        while(cur < end && _mglsl_is_white(*cur)) cur++;
+
+        if(end - cur >= 2 && cur[0] == '/' && cur[1] == '/') {
+            while(cur < end && *cur != '\n') cur++;
+        } else if(end - cur >= 2 && cur[0] == '/' && cur[1] == '*') {
+            cur += 2;
+            while(end - cur >= 2 && !(cur[0] == '*' && cur[1] == '/')) cur++;
+            cur = end - cur >= 2 ? cur + 2 : end;
+        } else break;
+    }
 
-//
-//
-
-_MGLSL_PARSE_PP_DIRECTIVE_PROC_SIGNATURE(_mglsl_parse_ppdir_module) {
-    if(!args) {
-        _mglsl_err_sec_msg = "'module' directive without module name argument";
-        return MGLSL_E_SYNTAX;
-    }
-
-    if(strlen(module->name)) {
-        _mglsl_err_sec_msg = "redefined module name";
-        return MGLSL_E_SEMANTIC;
-    }
+    tok->begin = cur;
 
-    if(!_mglsl_is_valid_name(args)) {
-        _mglsl_err_sec_msg = "invalid module name";
-        return MGLSL_E_SYNTAX;
-    }
+    if(cur >= end) {
+        tok->kind = _MGLSL_TOK_END;
 
+    } else if(*cur == '#' && _mglsl_is_line_begin(buf, cur)) {
+        tok->kind = _MGLSL_TOK_DIRECTIVE;
+        while(cur < end && *cur != '\n') {
+            // line continuation
+            if(*cur == '\\' && cur + 1 < end && (cur[1] == '\n' || cur[1] == '\r')) {
+                cur++;
+                if(*cur == '\r' && cur + 1 < end && cur[1] == '\n') cur++;
+            }
+            cur++;
+        }
 
-    strcpy(module->name, args);
-    return MGLSL_E_SUCCESS;
-}
+    } else if(_mglsl_is_letter(*cur) || *cur == '_') {
+        tok->kind = _MGLSL_TOK_IDENT;
+        while(cur < end && _mglsl_is_ident_char(*cur)) cur++;
 
-//
-//
+    } else if(_mglsl_is_number(*cur) || (*cur == '.' && cur + 1 < end && _mglsl_is_number(cur[1]))) {
+        tok->kind = _MGLSL_TOK_NUMBER;
+        while(cur < end) {
+            if((*cur == 'e' || *cur == 'E') && cur + 1 < end && (cur[1] == '+' || cur[1] == '-')) cur += 2;
+            else if(_mglsl_is_ident_char(*cur) || *cur == '.') cur++;
+            else break;
+        }
 
-_MGLSL_PARSE_PP_DIRECTIVE_PROC_SIGNATURE(_mglsl_parse_ppdir_require) {
-    if(!args) {
-        _mglsl_err_sec_msg = "'require' directive without any arguments";
-        return MGLSL_E_SYNTAX;
+    } else {
+        tok->kind = _MGLSL_TOK_PUNCT;
+        cur++;
     }
 
-    char * cur = args;
-    size_t strbuf_overalloc = 64;
-
-    int deps_count = 1;
-    while(*cur != '\0') if(*(cur++) == ',') deps_count++;
+    tok->end = cur;
+    return cur;
+}
 
-    size_t args_len = strlen(args);
+//
+// STRING TABLE
+// Module names and paths are interned and modules refer to them by ids. Strings are
+// never moved nor removed, pointers to them stay valid until the table is released
+// together with the last module.
 
-    char * strbuf, * strbuf_cur;
-    size_t strbuf_len, strbuf_old_len, strbuf_left;
+#define _MGLSL_STR_BLOCK_SIZE 4096
 
-    if(module->deps_len != 0) {
-        if(module->deps == NULL) return MGLSL_E_MODULE_CORRUPT;
+// Strings are stored one after another in blocks, block header is followed by its characters.
+typedef struct _mglsl_StrBlock {
+    struct _mglsl_StrBlock * next;
+    size_t len, cap;
+} _mglsl_StrBlock;
 
-        module->deps = _mglsl_realloc(module->deps, sizeof(char*) * (module->deps_len + deps_count));
-        if(module->deps == NULL) return MGLSL_E_REALLOC;
+typedef struct {
+    _mglsl_StrBlock * blocks;
 
-        strbuf = module->deps[0];
+    const char ** strs; // by id, id 0 is not used
+    size_t strs_len, strs_cap;
 
-        char * last_dep = module->deps[module->deps_len - 1];
-        strbuf_old_len = (last_dep + strlen(last_dep) + 1) - strbuf;
-        strbuf_len = strbuf_old_len + args_len + 2 + strbuf_overalloc;
-        strbuf_left = strbuf_len - strbuf_old_len;
+    mglsl_StrId * slots; // open addressing, 0 marks empty slot
+    size_t slots_cap;
 
-        if(module->deps[0] == NULL) return MGLSL_E_MODULE_CORRUPT;
+    size_t users; // live modules
+} _mglsl_StrTab;
 
-        char * old_anchor = module->deps[0];
-        char * new_anchor = _mglsl_realloc(module->deps[0], strbuf_len);
-        if(module->deps == NULL) return MGLSL_E_REALLOC;
+static _mglsl_StrTab _mglsl_strtab;
 
-        if(new_anchor != old_anchor)// repoint pointers
-            for(int i=0; i<module->deps_len; i++)
-                module->deps[i] = new_anchor + (module->deps[i] - old_anchor);
+static inline size_t _mglsl_hash(const char * str, size_t len) {
+    size_t hash = (size_t)14695981039346656037ull;
+    for(size_t i=0; i<len; i++) hash = (hash ^ (unsigned char)str[i]) * (size_t)1099511628211ull;
+    return hash;
+}
 
-        strbuf = module->deps[0];
-        strbuf_cur = strbuf + strbuf_old_len;
+static inline const char * _mglsl_str(mglsl_StrId id) {
+    _MGLSL_ASSERT(id < _mglsl_strtab.strs_len);
+    return id ? _mglsl_strtab.strs[id] : NULL;
+}
 
-    } else {
-        if(module->deps != NULL) return MGLSL_E_MODULE_CORRUPT;
+static mglsl_StrId * _mglsl_strtab_slot(const char * str, size_t len) {
+    size_t mask = _mglsl_strtab.slots_cap - 1;
+    size_t slot = _mglsl_hash(str, len) & mask;
 
-        module->deps = _mglsl_alloc(sizeof(char*) * deps_count);
-        if(module->deps == NULL) return MGLSL_E_ALLOC;
+    for(;; slot = (slot + 1) & mask) {
+        mglsl_StrId id = _mglsl_strtab.slots[slot];
+        if(!id) return _mglsl_strtab.slots + slot;
 
-        strbuf_old_len = 0;
-        strbuf_len = strbuf_left = args_len + 2 + strbuf_overalloc;
+        const char * other = _mglsl_strtab.strs[id];
+        _MGLSL_STAT_ADD(string_compares, 1);
+        if(!strncmp(other, str, len) && other[len] == '\0') return _mglsl_strtab.slots + slot;
+    }
+}
 
-        module->deps[0] = _mglsl_alloc(strbuf_len);
-        if(module->deps == NULL) return MGLSL_E_ALLOC;
+// Id of the string or 0 if it was never interned.
+static mglsl_StrId _mglsl_str_lookup(const char * str, size_t len) {
+    if(!_mglsl_strtab.slots_cap) return 0;
+    return *_mglsl_strtab_slot(str, len);
+}
 
-        strbuf = strbuf_cur = module->deps[0];
+static int _mglsl_strtab_grow(void) {
+    if(_mglsl_strtab.strs_len == _mglsl_strtab.strs_cap) {
+        size_t cap = _mglsl_strtab.strs_cap ? _mglsl_strtab.strs_cap * 2 : 64;
+        const char ** strs = _mglsl_strtab.strs ?
+            (const char**)_mglsl_realloc((void*)_mglsl_strtab.strs, cap * sizeof(char*)) :
+            (const char**)_mglsl_alloc(cap * sizeof(char*));
+        if(!strs) return MGLSL_E_REALLOC;
+
+        if(!_mglsl_strtab.strs) strs[_mglsl_strtab.strs_len++] = NULL;
+        _mglsl_strtab.strs = strs;
+        _mglsl_strtab.strs_cap = cap;
     }
 
-    size_t dep_index = 0, dep_repeat = 0;
+    // kept at most half full
+    if(_mglsl_strtab.strs_len * 2 >= _mglsl_strtab.slots_cap) {
+        size_t cap = _mglsl_strtab.slots_cap ? _mglsl_strtab.slots_cap * 2 : 128;
+        mglsl_StrId * slots = (mglsl_StrId*)_mglsl_alloc(cap * sizeof(mglsl_StrId));
+        if(!slots) return MGLSL_E_ALLOC;
+        memset(slots, 0, cap * sizeof(mglsl_StrId));
 
-    for(cur = args;;) {
-        char * arg = cur = (char*)_mglsl_cur_skip_white(cur);
-
-        while( !_mglsl_is_white(*cur) && *cur != ',' && *cur != '\0') cur++;
-        size_t arg_len = cur - arg;
+        if(_mglsl_strtab.slots) _mglsl_free(_mglsl_strtab.slots);
+        _mglsl_strtab.slots = slots;
+        _mglsl_strtab.slots_cap = cap;
 
-        if(arg_len == 0) {
-            _mglsl_err_sec_msg = "'require' directive argument cannot be empty";
-            return MGLSL_E_SYNTAX;
+        for(mglsl_StrId id=1; id<_mglsl_strtab.strs_len; id++) {
+            const char * str = _mglsl_strtab.strs[id];
+            *_mglsl_strtab_slot(str, strlen(str)) = id;
         }
+    }
 
-        _MGLSL_ASSERT(strbuf_left > (arg_len + 1));
-        strbuf_left -= (arg_len + 1);
-
-        char * dep = strbuf_cur;
+    return MGLSL_E_SUCCESS;
+}
 
-        int already = 0;
-        for(int i=0; i<module->deps_len; i++)
-            if(already = !strncmp(arg, module->deps[i], arg_len)) break;
+static int _mglsl_intern(mglsl_StrId * idptr, const char * str, size_t len)
+{
+    int ec = _mglsl_strtab_grow();
+    if(ec) return ec;
 
-        if(!already) {
-            memcpy(strbuf_cur, arg, arg_len);
-            strbuf_cur[arg_len] = '\0';
-            strbuf_cur += arg_len + 1;
+    mglsl_StrId * slot = _mglsl_strtab_slot(str, len);
+    if(*slot) {
+        *idptr = *slot;
+        return MGLSL_E_SUCCESS;
+    }
 
-            module->deps[module->deps_len + dep_index++] = dep;
+    _mglsl_StrBlock * block = _mglsl_strtab.blocks;
 
-            if(!_mglsl_is_valid_name(dep)) {
-                _mglsl_err_sec_msg = "one of 'require' directive arguments is not valid module name";
-                return MGLSL_E_SYNTAX;
-            }
-        } else {
-            dep_repeat++;
-            //TODO(kacper): add warning that module requirement is repeated
-        }
+    if(!block || block->cap - block->len < len + 1) {
+        size_t cap = len + 1 > _MGLSL_STR_BLOCK_SIZE ? len + 1 : _MGLSL_STR_BLOCK_SIZE;
+        block = (_mglsl_StrBlock*)_mglsl_alloc(sizeof(_mglsl_StrBlock) + cap);
+        if(!block) return MGLSL_E_ALLOC;
 
-        while(*cur != ',' && *cur != '\0') {
-            if(!_mglsl_is_white(*cur)) {
-                _mglsl_err_sec_msg = "one of 'require' directive arguments is not valid module name";
-                return MGLSL_E_SYNTAX;
-            }
-            cur++;
-        }
-        if(*cur == '\0') break;
-        else cur++;
+        block->next = _mglsl_strtab.blocks;
+        block->len = 0;
+        block->cap = cap;
+        _mglsl_strtab.blocks = block;
     }
 
-    _MGLSL_ASSERT(module->deps[0] == strbuf);
-    _MGLSL_ASSERT(deps_count == dep_index + dep_repeat);
-    module->deps_len += dep_index;
+    char * copy = (char*)(block + 1) + block->len;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    block->len += len + 1;
 
-    return 0;
+    *slot = *idptr = (mglsl_StrId)_mglsl_strtab.strs_len;
+    _mglsl_strtab.strs[_mglsl_strtab.strs_len++] = copy;
+    return MGLSL_E_SUCCESS;
 }
 
-//
-//
+// Bumped whenever a module is created or freed, swaps do both. Cached module graph is
+// only reused while it stays the same.
+static size_t _mglsl_modules_gen = 1;
 
-_MGLSL_PARSE_PP_DIRECTIVE_PROC_SIGNATURE(_mglsl_parse_ppdir_type) { return 0; }
+static void _mglsl_free_graph_cache(void);
 
-struct _mglsl_KeywordProcPair { const char * keyword; _mglsl_ParsePPDirectiveProc * proc; };
+static void _mglsl_strtab_acquire(void) {
+    _mglsl_strtab.users++;
+    _mglsl_modules_gen++;
+}
 
-#define _MGLSL_MAX_PP_KEYWORD_LEN 32
-static struct _mglsl_KeywordProcPair _mglsl_keyword_proc_map[] =
-    {
-     {"module", _mglsl_parse_ppdir_module},
-     {"require", _mglsl_parse_ppdir_require},
-     {"type", _mglsl_parse_ppdir_type}
-    };
+static void _mglsl_strtab_release(void) {
+    _MGLSL_ASSERT(_mglsl_strtab.users);
+    _mglsl_modules_gen++;
+    if(--_mglsl_strtab.users) return;
 
-static const int _mglsl_keyword_proc_map_len = sizeof(_mglsl_keyword_proc_map)/sizeof(struct _mglsl_KeywordProcPair);
+    _mglsl_free_graph_cache();
 
-//
-//
+    while(_mglsl_strtab.blocks) {
+        _mglsl_StrBlock * next = _mglsl_strtab.blocks->next;
+        _mglsl_free(_mglsl_strtab.blocks);
+        _mglsl_strtab.blocks = next;
+    }
+    if(_mglsl_strtab.strs) _mglsl_free((void*)_mglsl_strtab.strs);
+    if(_mglsl_strtab.slots) _mglsl_free(_mglsl_strtab.slots);
 
-static int _mglsl_parse(mglsl_Module * module, const char * src)
-{
-    size_t src_len = strlen(src);
-    char * clean_src = _mglsl_alloc(src_len + 1);
+    memset(&_mglsl_strtab, 0, sizeof(_mglsl_strtab));
+}
 
-    if(!clean_src)
-        return _mglsl_log_err(MGLSL_E_ALLOC);
+//
+// DIAGNOSTICS
+// Errors are kept in a ring of the last MGLSL_DIAG_RING_LEN records. Strings are kept as
+// interned ids, so recording an error allocates only the first time a file or name shows
+// up in one. Ring keeps the string table alive until it is cleared.
 
-    size_t clean_src_len = 0;
+static mglsl_Diag _mglsl_diags[MGLSL_DIAG_RING_LEN];
+static size_t _mglsl_diags_len = 0;
+static size_t _mglsl_diags_next = 0;
 
-    const char * cur = src;
+// Id of str, interned unless out of memory already. 0 if it could not be interned.
+static mglsl_StrId _mglsl_diag_str(const char * str, int code)
+{
+    if(!str) return 0;
 
-    int line = 0;
-    int _char_offset = 0;
-    while(*cur != '\0') {
-        const char * line_begin = cur;
-        line++;
-        cur = _mglsl_cur_skip_space(cur);
+    size_t len = strlen(str);
+    mglsl_StrId id = _mglsl_str_lookup(str, len);
+    if(!id && code != MGLSL_E_ALLOC && code != MGLSL_E_REALLOC && _mglsl_intern(&id, str, len)) id = 0;
+    return id;
+}
 
-        if (*cur == '#') {
-            cur++;
-            cur = _mglsl_cur_skip_space(cur);
+static int _mglsl_diag_push(int code, unsigned int line, unsigned int column)
+{
+    if(!_mglsl_diags_len) _mglsl_strtab_acquire();
 
-            char * keyword_end = (char*)_mglsl_cur_skip_nonwhite(cur);
-            size_t keyword_len = keyword_end - cur;
+    mglsl_Diag * diag = _mglsl_diags + _mglsl_diags_next;
+    _mglsl_diags_next = (_mglsl_diags_next + 1) % MGLSL_DIAG_RING_LEN;
+    if(_mglsl_diags_len < MGLSL_DIAG_RING_LEN) _mglsl_diags_len++;
 
-            char keyword[_MGLSL_MAX_PP_KEYWORD_LEN + 1];
+    diag->code = code;
+    diag->detail = _mglsl_err_detail;
+    diag->file = line ? _mglsl_diag_str(_mglsl_err_file, code) : 0;
+    diag->name = _mglsl_diag_str(_mglsl_err_name, code);
+    diag->line = line;
+    diag->column = column;
 
-            if(keyword_len > _MGLSL_MAX_PP_KEYWORD_LEN) {
-                _mglsl_err_line = line;
-                _mglsl_err_char_offset = cur - line_begin;
+    _mglsl_err_detail = MGLSL_DIAG_NONE;
+    _mglsl_err_name = NULL;
 
-                _MGLSL_ASSERT(clean_src); _mglsl_free(clean_src);
-                return _mglsl_log_err(MGLSL_E_SYNTAX);
-            }
+#ifndef _MGLSL_NO_LOGGING
+    char msg[2 * MGLSL_MAX_PATH_LEN + 256];
+    mglsl_format_diag(msg, sizeof(msg), diag);
+    MGLSL_LOG(msg);
+#endif
+    return code;
+}
 
-            memcpy(keyword, cur, keyword_len);
-            keyword[keyword_len] = '\0';
+// Copies up to max_count most recent records, oldest first. Returns number of records
+// copied, or number of records in the ring if diags is NULL.
+size_t mglsl_get_diags(mglsl_Diag * diags, size_t max_count)
+{
+    if(!diags) return _mglsl_diags_len;
 
-            for(int i=0; i<_mglsl_keyword_proc_map_len; i++) {
+    size_t count = max_count < _mglsl_diags_len ? max_count : _mglsl_diags_len;
+    size_t idx = (_mglsl_diags_next + MGLSL_DIAG_RING_LEN - count) % MGLSL_DIAG_RING_LEN;
 
-                if( strcmp(keyword, _mglsl_keyword_proc_map[i].keyword) ) continue;
+    for(size_t i=0; i<count; i++, idx = (idx + 1) % MGLSL_DIAG_RING_LEN)
+        diags[i] = _mglsl_diags[idx];
+    return count;
+}
 
-                char * args_buf = NULL;
-                char * args_begin = (char*)_mglsl_cur_skip_space(keyword_end);
-                size_t args_buflen = _mglsl_cur_skip_line(args_begin) - args_begin;
+// Works like snprintf. Strings of the record stay valid until diagnostics are cleared.
+int mglsl_format_diag(char * buf, size_t buf_len, const mglsl_Diag * diag)
+{
+    _MGLSL_ASSERT(diag);
 
-                if(*args_begin != '\0' && args_buflen > 1) {
+    const char * detail = diag->detail < sizeof(_mglsl_diag_detail_desc)/sizeof(char*) ?
+        _mglsl_diag_detail_desc[diag->detail] : "";
+    const char * name = diag->name && diag->name < _mglsl_strtab.strs_len ? _mglsl_str(diag->name) : "";
+    const char * file = diag->file && diag->file < _mglsl_strtab.strs_len ? _mglsl_str(diag->file) : "(memory)";
 
-                    // \n at the end accounts for null terminator
-                    args_buf = (char*)_mglsl_alloc(args_buflen); 
+    const char * detail_sep = *detail ? ", " : "";
+    const char * name_sep = *name ? ", " : "";
 
-                    if(!args_buf) {
-                        _mglsl_free(clean_src);
-                        return _mglsl_log_src_err(line, cur - line_begin, MGLSL_E_ALLOC);
-                    }
+    if(diag->line)
+        return snprintf(buf, buf_len, "%s:%u:%u: error: %s%s%s%s%s.", file, diag->line, diag->column,
+                        mglsl_err_desc(diag->code), detail_sep, detail, name_sep, name);
 
-                    memcpy(args_buf, args_begin, args_buflen - 1);
-                    args_buf[args_buflen - 1] = '\0';
-                }
+    return snprintf(buf, buf_len, "mglsl: error: %s%s%s%s%s.",
+                    mglsl_err_desc(diag->code), detail_sep, detail, name_sep, name);
+}
 
-                int ec = _mglsl_keyword_proc_map[i].proc(module, args_buf);
+int mglsl_clear_diags(void)
+{
+    if(_mglsl_diags_len) _mglsl_strtab_release();
 
-                if(args_buf) _mglsl_free(args_buf);
+    _mglsl_diags_len = 0;
+    _mglsl_diags_next = 0;
+    return MGLSL_E_SUCCESS;
+}
 
-                if(ec) {
-                    _mglsl_free(clean_src);
-                    return _mglsl_log_src_err(line, args_begin - line_begin, ec);
-                }
+//
+// MODULE UTIL
 
-                break;
-            }
-        } else {
-            // everything we don't process is written back 
-            size_t line_len = _mglsl_cur_skip_line(cur) - line_begin;
-            memcpy(clean_src + clean_src_len, line_begin, line_len);
-            clean_src_len += line_len;
-        }
+static int _mglsl_find_module_id(size_t * idxptr, mglsl_StrId name, mglsl_ModuleArr module_arr)
+{
+    _MGLSL_STAT_ADD(module_lookups, 1);
+    if(!module_arr.data || !name) return MGLSL_E_MODULE_NOT_FOUND;
 
-        cur = _mglsl_cur_skip_line(cur);
+    for(size_t i=0; i<module_arr.size; i++) {
+        if(module_arr.data[i].name == name) {
+            if(idxptr) *idxptr = i;
+            return MGLSL_E_SUCCESS;
+        }
     }
-    _MGLSL_ASSERT(clean_src); 
 
-    module->source = clean_src = _mglsl_realloc(clean_src, clean_src_len + 1);
-    clean_src[clean_src_len] = '\0';
+    return MGLSL_E_MODULE_NOT_FOUND;
+}
 
-    return MGLSL_E_SUCCESS;
+static int _mglsl_find_module(size_t * idxptr, const char * module_name, mglsl_ModuleArr module_arr)
+{
+    _MGLSL_ASSERT(module_name);
+    return _mglsl_find_module_id(idxptr, _mglsl_str_lookup(module_name, strlen(module_name)), module_arr);
 }
 
 //
-// FILE INTERFACE
-
-#ifdef _MGLSL_DEFAULT_READ_FILE
-static int _mglsl_read_file(void ** bufptr, size_t * size, const char * filepath) {
-    FILE * file = fopen(filepath, "r");
+// MODULE GRAPH
+// Dependency graph of module array in dense arrays, so that traversal does not need to
+// touch modules themselves. Edges of module i are dep_idx[dep_begin[i]] up to
+// dep_idx[dep_begin[i + 1]], in order of requirement. Graph of the last array resolved
+// is kept until any module is created or freed, or another array is resolved. Modules
+// moved around within the array are told apart by names and requirements of each index.
 
-    if(!file)
-        return MGLSL_E_FILE_OPEN;
+#define _MGLSL_NO_MODULE ((unsigned int)-1)
 
-    fseek(file, 0L, SEEK_END);
-    size_t filesize = ftell(file);
-    rewind(file);
+typedef struct {
+    unsigned int * dep_begin;
+    unsigned int * dep_idx;        // _MGLSL_NO_MODULE for missing modules
+    const char ** dep_cond;        // NULL for unconditional edges
+    unsigned char * marks;         // MGLSL_PERM_MARK and MGLSL_TEMP_MARK
+    unsigned char * stages;        // MGLSL_STAGE mask, all bits set for untyped modules
+    size_t size;
+} _mglsl_Graph;
 
-    char * buf = _mglsl_alloc(filesize + 1);
+static void _mglsl_free_graph(_mglsl_Graph * graph)
+{
+    if(graph->dep_begin) _mglsl_free(graph->dep_begin);
+    if(graph->dep_idx) _mglsl_free(graph->dep_idx);
+    if(graph->dep_cond) _mglsl_free((void*)graph->dep_cond);
+    if(graph->marks) _mglsl_free(graph->marks);
+    if(graph->stages) _mglsl_free(graph->stages);
+    memset(graph, 0, sizeof(_mglsl_Graph));
+}
 
-    if(filesize != fread(buf, sizeof(char), filesize, file)) {
-        fclose(file);
-        return MGLSL_E_FILE_READ;
+static int _mglsl_build_graph(_mglsl_Graph * graph, mglsl_ModuleArr module_arr)
+{
+    memset(graph, 0, sizeof(_mglsl_Graph));
+    graph->size = module_arr.size;
+
+    size_t edges = 0;
+    for(size_t i=0; i<module_arr.size; i++) edges += module_arr.data[i].deps_len;
+
+    // module index by name id, first of modules with the same name wins
+    size_t by_name_len = _mglsl_strtab.strs_len + 1;
+    unsigned int * by_name = (unsigned int*)_mglsl_alloc(by_name_len * sizeof(unsigned int));
+
+    graph->dep_begin = (unsigned int*)_mglsl_alloc((module_arr.size + 1) * sizeof(unsigned int));
+    graph->dep_idx = (unsigned int*)_mglsl_alloc((edges + 1) * sizeof(unsigned int));
+    graph->dep_cond = (const char**)_mglsl_alloc((edges + 1) * sizeof(char*));
+    graph->marks = (unsigned char*)_mglsl_alloc(module_arr.size + 1);
+    graph->stages = (unsigned char*)_mglsl_alloc(module_arr.size + 1);
+
+    if(!by_name || !graph->dep_begin || !graph->dep_idx || !graph->dep_cond || !graph->marks || !graph->stages) {
+        if(by_name) _mglsl_free(by_name);
+        _mglsl_free_graph(graph);
+        return MGLSL_E_ALLOC;
     }
 
-    buf[filesize] = '\0';
+    memset(by_name, 0xff, by_name_len * sizeof(unsigned int));
+    for(size_t i=module_arr.size; i-- > 0;) {
+        mglsl_StrId name = module_arr.data[i].name;
+        if(name < by_name_len) by_name[name] = (unsigned int)i;
+    }
 
-    fclose(file);
+    size_t edge = 0;
+    for(size_t i=0; i<module_arr.size; i++) {
+        const mglsl_Module * module = module_arr.data + i;
+        graph->dep_begin[i] = (unsigned int)edge;
+        graph->stages[i] = module->stages ? module->stages : (unsigned char)_MGLSL_ALL_STAGES;
+
+        for(size_t d=0; d<module->deps_len; d++, edge++) {
+            mglsl_StrId dep = module->deps[d];
+            graph->dep_idx[edge] = dep < by_name_len ? by_name[dep] : _MGLSL_NO_MODULE;
+            graph->dep_cond[edge] = module->deps_cond ? module->deps_cond[d] : NULL;
+        }
+    }
+    graph->dep_begin[module_arr.size] = (unsigned int)edge;
 
-    *bufptr = buf;
-    *size = filesize;
+    _mglsl_free(by_name);
     return MGLSL_E_SUCCESS;
 }
-#endif
 
+static struct {
+    _mglsl_Graph graph;
+    const mglsl_Module * data; // array graph was built for
+    size_t size;
+    mglsl_StrId * names;       // name and requirements of module at each index at build
+    const mglsl_StrId ** deps;
+    size_t gen;                // _mglsl_modules_gen at build, 0 if nothing is cached
+    int busy;                  // handed out to a traversal
+} _mglsl_graph_cache;
+
+static void _mglsl_free_graph_cache(void) {
+    if(_mglsl_graph_cache.busy) return;
+    _mglsl_free_graph(&_mglsl_graph_cache.graph);
+    if(_mglsl_graph_cache.names) _mglsl_free(_mglsl_graph_cache.names);
+    if(_mglsl_graph_cache.deps) _mglsl_free((void*)_mglsl_graph_cache.deps);
+    _mglsl_graph_cache.names = NULL;
+    _mglsl_graph_cache.deps = NULL;
+    _mglsl_graph_cache.gen = 0;
+}
 
-#ifdef _MGLSL_DEFAULT_CONCAT_PATH
-static int _mglsl_concat_path
-    (char * buf, size_t buflen, const char * a, const char * b) 
+static int _mglsl_graph_cache_matches(mglsl_ModuleArr module_arr)
 {
-    _MGLSL_ASSERT(a && b);
+    if(_mglsl_graph_cache.gen != _mglsl_modules_gen || _mglsl_graph_cache.data != module_arr.data ||
+       _mglsl_graph_cache.size != module_arr.size) return 0;
 
-    size_t alen = strlen(a), blen = strlen(b);
+    for(size_t i=0; i<module_arr.size; i++) {
+        if(_mglsl_graph_cache.names[i] != module_arr.data[i].name ||
+           _mglsl_graph_cache.deps[i] != module_arr.data[i].deps) return 0;
+    }
+    return 1;
+}
 
-    // If any of our two strings have no length, we dont need slash.
-    // If one of them have it, we dont need it either.
-    int slash_between =
-        (alen && a[alen - 1] != '/') && (blen && b[blen - 1] != '/');
+// Graph is a shallow copy of the cached one, it has to be given back with _mglsl_release_graph.
+static int _mglsl_acquire_graph(_mglsl_Graph * graph, mglsl_ModuleArr module_arr)
+{
+    // held by traversal further up the stack, e.g. assembly started from write callback
+    if(_mglsl_graph_cache.busy) return _mglsl_build_graph(graph, module_arr);
 
-    size_t len = alen + blen + slash_between + 1;
+    if(!_mglsl_graph_cache_matches(module_arr)) {
+        _mglsl_free_graph_cache();
 
-    if(buflen < len)
-        return MGLSL_E_BUF_TOO_SMALL;
+        _mglsl_graph_cache.names = (mglsl_StrId*)_mglsl_alloc((module_arr.size + 1) * sizeof(mglsl_StrId));
+        _mglsl_graph_cache.deps = (const mglsl_StrId**)_mglsl_alloc((module_arr.size + 1) * sizeof(mglsl_StrId*));
 
-    // NOTE(kacper): Calling memcpy with count zero is fine btw.
-    char * cur = buf;
+        int ec = _mglsl_graph_cache.names && _mglsl_graph_cache.deps ?
+            _mglsl_build_graph(&_mglsl_graph_cache.graph, module_arr) : MGLSL_E_ALLOC;
+        if(ec) {
+            _mglsl_free_graph_cache();
+            memset(graph, 0, sizeof(_mglsl_Graph));
+            return ec;
+        }
 
-    memcpy(cur, a, alen);
-    cur += alen;
+        for(size_t i=0; i<module_arr.size; i++) {
+            _mglsl_graph_cache.names[i] = module_arr.data[i].name;
+            _mglsl_graph_cache.deps[i] = module_arr.data[i].deps;
+        }
+        _mglsl_graph_cache.data = module_arr.data;
+        _mglsl_graph_cache.size = module_arr.size;
+        _mglsl_graph_cache.gen = _mglsl_modules_gen;
+    }
 
-    if(slash_between) *(cur++) = '/';
+    _mglsl_graph_cache.busy = 1;
+    *graph = _mglsl_graph_cache.graph;
+    return MGLSL_E_SUCCESS;
+}
 
-    memcpy(cur, b, blen);
-    cur += blen;
+static int _mglsl_graph_is_cached(const _mglsl_Graph * graph) {
+    return _mglsl_graph_cache.busy && graph->dep_begin == _mglsl_graph_cache.graph.dep_begin;
+}
 
-    *(cur++) = '\0';
+static void _mglsl_release_graph(_mglsl_Graph * graph)
+{
+    if(_mglsl_graph_is_cached(graph)) _mglsl_graph_cache.busy = 0;
+    else _mglsl_free_graph(graph);
+    memset(graph, 0, sizeof(_mglsl_Graph));
+}
 
-    _MGLSL_ASSERT(cur - buf == len);
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+// After modules of the array were replaced, graph stays acquired unless this fails.
+static int _mglsl_rebuild_graph(_mglsl_Graph * graph, mglsl_ModuleArr module_arr)
+{
+    int cached = _mglsl_graph_is_cached(graph);
+    if(cached) {
+        _mglsl_graph_cache.busy = 0;
+        _mglsl_free_graph_cache();
+        memset(graph, 0, sizeof(_mglsl_Graph));
+        return _mglsl_acquire_graph(graph, module_arr);
+    }
 
-    return MGLSL_E_SUCCESS;
+    _mglsl_free_graph(graph);
+    return _mglsl_build_graph(graph, module_arr);
 }
 #endif
 
-#ifdef _MGLSL_DEFAULT_FILE_MTIME
-static int _mglsl_file_mtime(time_t * mtime, const char * filepath) {
-    struct stat attr;
-    memset(&attr, 0, sizeof(attr));
-    if( stat(filepath, &attr) ) return MGLSL_E_FILE_NOT_FOUND;
+//
+// CONDITIONAL BLOCKS
+// Parser follows '#if' blocks so that requirements inside of them are conditional.
+// Condition of a block branch is kept as preprocessor expression: negated conditions
+// of branches before it followed by its own condition. Variant defines cannot tell what
+// macros the module '#define's or '#undef's itself stand for, so branches referring to
+// any of these are followed always. Those of other modules are left to evaluation.
 
-    if(mtime) *mtime = attr.st_mtime;
+#define _MGLSL_MAX_COND_DEPTH 16
+#define _MGLSL_MAX_COND_LEN 255
+#define _MGLSL_MAX_LOCAL_MACROS 64
 
-    return MGLSL_E_SUCCESS;
-}
-#endif
+typedef struct {
+    char prev[_MGLSL_MAX_COND_LEN + 1]; // "!(a)&&!(b)" for branches already passed
+    char cur[_MGLSL_MAX_COND_LEN + 1];  // "(c)", empty in '#else'
+    int unknown;                        // too long to follow, taken as always true
+} _mglsl_CondBlock;
 
-//
-// FILE CHANGE WATCH
+typedef struct {
+    _mglsl_CondBlock blocks[_MGLSL_MAX_COND_DEPTH];
+    int depth; // blocks deeper than _MGLSL_MAX_COND_DEPTH are counted but not followed
 
+    // hashes of macros defined or undefined by the module so far, past the last one
+    // every branch counts as referring to them
+    size_t local_macros[_MGLSL_MAX_LOCAL_MACROS];
+    int local_macros_len;
+} _mglsl_CondStack;
 
+// Blocks open at the line being parsed, NULL outside of _mglsl_parse.
+static _mglsl_CondStack * _mglsl_parse_cond_stack = NULL;
 
-//
-// TOPOLOGICAL SORT
+static void _mglsl_cond_cat(_mglsl_CondBlock * block, char * dst, const char * str, size_t len)
+{
+    size_t dst_len = strlen(dst);
+    if(dst_len + len > _MGLSL_MAX_COND_LEN) {
+        block->unknown = 1;
+        return;
+    }
+    memcpy(dst + dst_len, str, len);
+    dst[dst_len + len] = '\0';
+}
 
-static int _mglsl_toposort_rec_visit
-    (size_t depth, mglsl_Module * module, mglsl_ModuleArr module_arr)
+static int _mglsl_cond_refers_local(const _mglsl_CondStack * stack, const char * expr, const char * end)
 {
-    _MGLSL_ASSERT(module);
-    _MGLSL_ASSERT(module_arr.data);
+    if(stack->local_macros_len > _MGLSL_MAX_LOCAL_MACROS) return 1;
 
-    if(module->flags & MGLSL_TEMP_MARK) {
-        _mglsl_err_sec_msg = module->name;
-        return MGLSL_E_CIRCULAR_DEP;
+    for(const char * cur = expr; cur < end;) {
+        if(!_mglsl_is_ident_char(*cur)) { cur++; continue; }
+
+        const char * name = cur;
+        while(cur < end && _mglsl_is_ident_char(*cur)) cur++;
+        if(_mglsl_is_number(*name)) continue;
+
+        size_t hash = _mglsl_hash(name, cur - name);
+        for(int i=0; i<stack->local_macros_len; i++)
+            if(stack->local_macros[i] == hash) return 1;
     }
+    return 0;
+}
 
-    module->flags |= MGLSL_TEMP_MARK;
+// Follows conditional directive, args are whatever is after the keyword up to end of line.
+static void _mglsl_cond_directive(_mglsl_CondStack * stack, const char * keyword, const char * args)
+{
+    int is_if = !strcmp(keyword, "if"), is_ifdef = !strcmp(keyword, "ifdef"),
+        is_ifndef = !strcmp(keyword, "ifndef"), is_elif = !strcmp(keyword, "elif"),
+        is_else = !strcmp(keyword, "else"), is_endif = !strcmp(keyword, "endif");
+
+    _mglsl_CondBlock * block;
+
+    if(!strcmp(keyword, "define") || !strcmp(keyword, "undef")) {
+        const char * name_end = args;
+        while(_mglsl_is_ident_char(*name_end)) name_end++;
+        if(name_end == args) return;
+
+        // one past the capacity marks overflow
+        if(stack->local_macros_len < _MGLSL_MAX_LOCAL_MACROS)
+            stack->local_macros[stack->local_macros_len++] = _mglsl_hash(args, name_end - args);
+        else
+            stack->local_macros_len = _MGLSL_MAX_LOCAL_MACROS + 1;
+        return;
+    }
 
-    int ec; size_t module_idx;
+    if(is_if || is_ifdef || is_ifndef) {
+        if(stack->depth++ >= _MGLSL_MAX_COND_DEPTH) return;
+        block = stack->blocks + stack->depth - 1;
+        block->prev[0] = block->cur[0] = '\0';
+        block->unknown = 0;
 
-    for(size_t i=0; i<module->deps_len; i++) {
-        int ec = _mglsl_find_module(&module_idx, module->deps[i], module_arr);
-        if(ec) {
-            _mglsl_err_sec_msg = module->deps[i];
-            return MGLSL_E_MISSING_DEP;
-        }
+    } else if(is_elif || is_else || is_endif) {
+        // stray ones are left for the GLSL compiler to report
+        if(stack->depth == 0) return;
+        if(is_endif) { stack->depth--; return; }
+        if(stack->depth > _MGLSL_MAX_COND_DEPTH) return;
+
+        block = stack->blocks + stack->depth - 1;
+
+        // branch after '#else' is an error anyway
+        if(!block->cur[0]) { block->unknown = 1; return; }
 
-        _MGLSL_ASSERT(module_idx < module_arr.size);
+        if(block->prev[0]) _mglsl_cond_cat(block, block->prev, "&&", 2);
+        _mglsl_cond_cat(block, block->prev, "!", 1);
+        _mglsl_cond_cat(block, block->prev, block->cur, strlen(block->cur));
+        block->cur[0] = '\0';
 
-        mglsl_Module * dep = module_arr.data + module_idx;
+        if(is_else) return;
 
-        ec = _mglsl_toposort_rec_visit(depth + 1, dep, module_arr);
-        if(ec) return MGLSL_E_CIRCULAR_DEP;
+    } else return;
 
+    // expression ends where line or comment does
+    const char * end = args;
+    while(*end != '\0' && *end != '\n' && !(end[0] == '/' && (end[1] == '/' || end[1] == '*'))) end++;
+    while(end > args && _mglsl_is_white(end[-1])) end--;
+
+    if(_mglsl_cond_refers_local(stack, args, end)) {
+        block->unknown = 1;
+        return;
     }
 
-    module->flags &= ~MGLSL_TEMP_MARK;
-    module->flags |= MGLSL_PERM_MARK;
+    if(is_ifdef || is_ifndef) {
+        const char * name_end = args;
+        while(_mglsl_is_ident_char(*name_end)) name_end++;
 
-    module->_sort_idx = depth;
+        if(is_ifndef) _mglsl_cond_cat(block, block->cur, "!", 1);
+        _mglsl_cond_cat(block, block->cur, "defined(", 8);
+        _mglsl_cond_cat(block, block->cur, args, name_end - args);
+        _mglsl_cond_cat(block, block->cur, ")", 1);
+    } else {
+        _mglsl_cond_cat(block, block->cur, "(", 1);
+        _mglsl_cond_cat(block, block->cur, args, end - args);
+        _mglsl_cond_cat(block, block->cur, ")", 1);
+    }
+}
 
+// Returns condition of the current line in newly allocated string, or NULL if it is unconditional.
+static int _mglsl_cond_current(char ** condptr, const _mglsl_CondStack * stack)
+{
+    int depth = stack->depth < _MGLSL_MAX_COND_DEPTH ? stack->depth : _MGLSL_MAX_COND_DEPTH;
+    size_t len = 0;
+
+    for(int i=0; i<depth; i++) {
+        const _mglsl_CondBlock * block = stack->blocks + i;
+        if(!block->unknown) len += strlen(block->prev) + strlen(block->cur) + 4;
+    }
+
+    *condptr = NULL;
+    if(len == 0) return MGLSL_E_SUCCESS;
+
+    char * cond = (char*)_mglsl_alloc(len + 1);
+    if(!cond) return MGLSL_E_ALLOC;
+    cond[0] = '\0';
+
+    for(int i=0; i<depth; i++) {
+        const _mglsl_CondBlock * block = stack->blocks + i;
+        if(block->unknown) continue;
+
+        if(block->prev[0]) {
+            if(cond[0]) strcat(cond, "&&");
+            strcat(cond, block->prev);
+        }
+        if(block->cur[0]) {
+            if(cond[0]) strcat(cond, "&&");
+            strcat(cond, block->cur);
+        }
+    }
+
+    if(!cond[0]) {
+        _mglsl_free(cond);
+        return MGLSL_E_SUCCESS;
+    }
+
+    *condptr = cond;
+    return MGLSL_E_SUCCESS;
+}
+
+static char * _mglsl_cond_dup(const char * cond)
+{
+    size_t len = strlen(cond);
+    char * dup = (char*)_mglsl_alloc(len + 1);
+    if(dup) memcpy(dup, cond, len + 1);
+    return dup;
+}
+
+//
+// INDIVIDUAL KEYWORD PARSERS
+
+#define _MGLSL_PROC_SIGNATURE(NAME, ...) int NAME(__VA_ARGS__)
+#define _MGLSL_PARSE_PP_DIRECTIVE_PROC_SIGNATURE(NAME)                        \
+    _MGLSL_PROC_SIGNATURE(NAME, mglsl_Module * module, char * args)
+
+typedef _MGLSL_PARSE_PP_DIRECTIVE_PROC_SIGNATURE(_mglsl_ParsePPDirectiveProc);
+
+//
+//
+
+_MGLSL_PARSE_PP_DIRECTIVE_PROC_SIGNATURE(_mglsl_parse_ppdir_module) {
+    if(!args) {
+        _mglsl_err_detail = MGLSL_DIAG_MODULE_NO_ARG;
+        return MGLSL_E_SYNTAX;
+    }
+
+    if(module->name) {
+        _mglsl_err_detail = MGLSL_DIAG_MODULE_REDEFINED;
+        return MGLSL_E_SEMANTIC;
+    }
+
+    if(!_mglsl_is_valid_name(args)) {
+        _mglsl_err_detail = MGLSL_DIAG_MODULE_INVALID_NAME;
+        return MGLSL_E_SYNTAX;
+    }
+
+    return _mglsl_intern(&module->name, args, strlen(args));
+}
+
+//
+//
+
+static int _mglsl_parse_require_args(mglsl_Module * module, char * args, const char * cond)
+{
+    char * cur = args;
+
+    size_t deps_count = 1;
+    while(*cur != '\0') if(*(cur++) == ',') deps_count++;
+
+    size_t size = sizeof(mglsl_StrId) * (module->deps_len + deps_count);
+    mglsl_StrId * deps = module->deps ?
+        (mglsl_StrId*)_mglsl_realloc(module->deps, size) : (mglsl_StrId*)_mglsl_alloc(size);
+    if(!deps) return MGLSL_E_REALLOC;
+    module->deps = deps;
+
+    // conditions are only kept once there is a conditional requirement
+    if(cond || module->deps_cond) {
+        size = sizeof(char*) * (module->deps_len + deps_count);
+        char ** deps_cond = module->deps_cond ?
+            (char**)_mglsl_realloc(module->deps_cond, size) : (char**)_mglsl_alloc(size);
+        if(!deps_cond) return MGLSL_E_REALLOC;
+
+        if(!module->deps_cond) memset(deps_cond, 0, sizeof(char*) * module->deps_len);
+        memset(deps_cond + module->deps_len, 0, sizeof(char*) * deps_count);
+        module->deps_cond = deps_cond;
+    }
+
+    for(cur = args;;) {
+        char * arg = cur = (char*)_mglsl_cur_skip_white(cur);
+
+        while( !_mglsl_is_white(*cur) && *cur != ',' && *cur != '\0') cur++;
+        size_t arg_len = cur - arg;
+
+        if(arg_len == 0) {
+            _mglsl_err_detail = MGLSL_DIAG_REQUIRE_EMPTY_ARG;
+            return MGLSL_E_SYNTAX;
+        }
+
+        char arg_end = arg[arg_len];
+        arg[arg_len] = '\0';
+        int valid = _mglsl_is_valid_name(arg);
+        arg[arg_len] = arg_end;
+
+        if(!valid) {
+            _mglsl_err_detail = MGLSL_DIAG_REQUIRE_INVALID_NAME;
+            return MGLSL_E_SYNTAX;
+        }
+
+        mglsl_StrId dep;
+        int ec = _mglsl_intern(&dep, arg, arg_len);
+        if(ec) return ec;
+
+        size_t already = 0;
+        while(already < module->deps_len && module->deps[already] != dep) already++;
+
+        if(already == module->deps_len) {
+            if(cond && !(module->deps_cond[already] = _mglsl_cond_dup(cond)))
+                return MGLSL_E_ALLOC;
+
+            module->deps[module->deps_len++] = dep;
+        } else {
+            //TODO(kacper): add warning that module requirement is repeated
+
+            // required under either of the conditions
+            char * old_cond = module->deps_cond ? module->deps_cond[already] : NULL;
+            if(old_cond) {
+                char * either = NULL;
+                if(cond) {
+                    size_t either_len = strlen(old_cond) + strlen(cond) + 6;
+                    either = (char*)_mglsl_alloc(either_len + 1);
+                    if(!either) return MGLSL_E_ALLOC;
+                    snprintf(either, either_len + 1, "(%s)||(%s)", old_cond, cond);
+                }
+                _mglsl_free(old_cond);
+                module->deps_cond[already] = either;
+            }
+        }
+
+        while(*cur != ',' && *cur != '\0') {
+            if(!_mglsl_is_white(*cur)) {
+                _mglsl_err_detail = MGLSL_DIAG_REQUIRE_INVALID_NAME;
+                return MGLSL_E_SYNTAX;
+            }
+            cur++;
+        }
+        if(*cur == '\0') break;
+        else cur++;
+    }
+
+    return 0;
+}
+
+_MGLSL_PARSE_PP_DIRECTIVE_PROC_SIGNATURE(_mglsl_parse_ppdir_require) {
+    if(!args) {
+        _mglsl_err_detail = MGLSL_DIAG_REQUIRE_NO_ARGS;
+        return MGLSL_E_SYNTAX;
+    }
+
+    char * cond = NULL;
+    if(_mglsl_parse_cond_stack) {
+        int ec = _mglsl_cond_current(&cond, _mglsl_parse_cond_stack);
+        if(ec) return ec;
+    }
+
+    int ec = _mglsl_parse_require_args(module, args, cond);
+
+    if(cond) _mglsl_free(cond);
+    return ec;
+}
+
+//
+//
+
+struct _mglsl_StageName { const char * name; enum mglsl_ShaderType type; };
+
+static const struct _mglsl_StageName _mglsl_stage_names[] =
+    {
+     {"vert", VERT}, {"vertex", VERT},
+     {"frag", FRAG}, {"fragment", FRAG},
+     {"geom", GEOM}, {"geometry", GEOM},
+     {"comp", COMP}, {"compute", COMP},
+     {"tesc", TESS_CTRL}, {"tess_ctrl", TESS_CTRL},
+     {"tese", TESS_EVAL}, {"tess_eval", TESS_EVAL},
+    };
+
+// Comma separated list of stages module is used in, repeated directives add up.
+_MGLSL_PARSE_PP_DIRECTIVE_PROC_SIGNATURE(_mglsl_parse_ppdir_type) {
+    if(!args) {
+        _mglsl_err_detail = MGLSL_DIAG_TYPE_NO_ARGS;
+        return MGLSL_E_SYNTAX;
+    }
+
+    for(char * cur = args;;) {
+        const char * arg = cur = (char*)_mglsl_cur_skip_white(cur);
+
+        while(!_mglsl_is_white(*cur) && *cur != ',' && *cur != '\0') cur++;
+        size_t arg_len = cur - arg;
+
+        size_t i = 0, count = sizeof(_mglsl_stage_names)/sizeof(struct _mglsl_StageName);
+        for(; i<count; i++) {
+            const char * name = _mglsl_stage_names[i].name;
+            if(!strncmp(name, arg, arg_len) && name[arg_len] == '\0') break;
+        }
+
+        if(!arg_len || i == count) {
+            _mglsl_err_detail = MGLSL_DIAG_TYPE_INVALID;
+            return MGLSL_E_SYNTAX;
+        }
+        module->stages |= (unsigned char)MGLSL_STAGE(_mglsl_stage_names[i].type);
+
+        cur = (char*)_mglsl_cur_skip_white(cur);
+        if(*cur == '\0') break;
+        if(*cur != ',') {
+            _mglsl_err_detail = MGLSL_DIAG_TYPE_INVALID;
+            return MGLSL_E_SYNTAX;
+        }
+        cur++;
+    }
+
+    return MGLSL_E_SUCCESS;
+}
+
+struct _mglsl_KeywordProcPair { const char * keyword; _mglsl_ParsePPDirectiveProc * proc; };
+
+#define _MGLSL_MAX_PP_KEYWORD_LEN 32
+static struct _mglsl_KeywordProcPair _mglsl_keyword_proc_map[] =
+    {
+     {"module", _mglsl_parse_ppdir_module},
+     {"require", _mglsl_parse_ppdir_require},
+     {"type", _mglsl_parse_ppdir_type}
+    };
+
+static const int _mglsl_keyword_proc_map_len = sizeof(_mglsl_keyword_proc_map)/sizeof(struct _mglsl_KeywordProcPair);
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+// Whether directives at the top of buf, which is beginning of a file, are followed
+// by a line of code, so rest of the file is not needed to scan it.
+static int _mglsl_header_complete(const char * cur)
+{
+    for(;;) {
+        int nl = 0;
+        const char * line_begin = cur;
+        cur = _mglsl_cur_skip_filler(cur, &nl, &line_begin);
+
+        if(*cur == '\0') return 0;
+        if(*cur != '#') return 1;
+
+        cur = _mglsl_cur_skip_line(cur);
+        if(cur[-1] != '\n') return 0;
+    }
+}
+#endif
+
+//
+// REFLECTION
+// Top-level declarations of parsed source are gone through with the lexer, uniforms,
+// buffers, inputs, outputs and structs are recorded. Everything else (functions, constants,
+// precision statements) is skipped up to its end. Directives are skipped as well, so
+// declarations in both branches of '#if' are recorded.
+
+#ifdef _MGLSL_REFLECTION
+
+typedef struct {
+    mglsl_Module * module;
+    const char * buf;
+    const char * cur;
+    const char * end;
+    _mglsl_Token tok; // current token, never a directive
+    int ec;
+} _mglsl_Reflector;
+
+static const char * _mglsl_reflect_skipped_qualifiers[] = {
+    "const", "flat", "smooth", "noperspective", "centroid", "sample", "patch", "invariant",
+    "precise", "highp", "mediump", "lowp", "coherent", "volatile", "restrict", "readonly",
+    "writeonly", "shared", "varying",
+};
+
+static const char * _mglsl_reflect_lex(_mglsl_Reflector * rf, _mglsl_Token * tok, const char * cur) {
+    do cur = _mglsl_lex(tok, rf->buf, cur, rf->end);
+    while(tok->kind == _MGLSL_TOK_DIRECTIVE);
+    return cur;
+}
+
+static inline void _mglsl_reflect_next(_mglsl_Reflector * rf) {
+    rf->cur = _mglsl_reflect_lex(rf, &rf->tok, rf->cur);
+}
+
+static inline int _mglsl_reflect_at(const _mglsl_Reflector * rf, char c) {
+    return _mglsl_tok_is_punct(&rf->tok, c);
+}
+
+// Value of integer literal, 0 if token is something else.
+static int _mglsl_reflect_int(const _mglsl_Token * tok)
+{
+    if(tok->kind != _MGLSL_TOK_NUMBER) return 0;
+
+    const char * c = tok->begin;
+    long long value = 0;
+    int base = 10;
+
+    if(tok->end - c > 2 && c[0] == '0' && (c[1] == 'x' || c[1] == 'X')) {
+        base = 16;
+        c += 2;
+    } else if(tok->end - c > 1 && c[0] == '0') {
+        base = 8;
+    }
+
+    for(; c < tok->end; c++) {
+        int digit;
+        char lower = *c | 32;
+
+        if(_mglsl_is_number(*c) && *c - '0' < base) digit = *c - '0';
+        else if(base == 16 && lower >= 'a' && lower <= 'f') digit = lower - 'a' + 10;
+        else if(lower == 'u' && c + 1 == tok->end) break;
+        else return 0;
+
+        value = value * base + digit;
+        if(value > 0x7fffffff) return 0;
+    }
+
+    return (int)value;
+}
+
+static mglsl_StrId _mglsl_reflect_id(_mglsl_Reflector * rf, const _mglsl_Token * tok) {
+    mglsl_StrId id = 0;
+    if(!rf->ec) rf->ec = _mglsl_intern(&id, tok->begin, tok->end - tok->begin);
+    return id;
+}
+
+// Returns index of new record, or -1 if out of memory.
+static long _mglsl_reflect_push(_mglsl_Reflector * rf, const mglsl_ReflectDecl * decl)
+{
+    mglsl_Module * module = rf->module;
+    size_t len = module->_reflect_len;
+
+    if(rf->ec) return -1;
+
+    // capacity is the next power of two, as with line runs
+    if((len & (len - 1)) == 0) {
+        size_t cap = len ? len * 2 : 1;
+        mglsl_ReflectDecl * decls = len ?
+            (mglsl_ReflectDecl*)_mglsl_realloc(module->_reflect, cap * sizeof(mglsl_ReflectDecl)) :
+            (mglsl_ReflectDecl*)_mglsl_alloc(cap * sizeof(mglsl_ReflectDecl));
+        if(!decls) {
+            rf->ec = MGLSL_E_REALLOC;
+            return -1;
+        }
+        module->_reflect = decls;
+    }
+
+    module->_reflect[len] = *decl;
+    module->_reflect_len++;
+    return (long)len;
+}
+
+// Skips up to the end of declaration: past ';', or past function body. Stops at
+// closing bracket which was not opened in it.
+static void _mglsl_reflect_skip(_mglsl_Reflector * rf)
+{
+    int depth = 0, body = 0, after_paren = 0;
+
+    for(; rf->tok.kind != _MGLSL_TOK_END; _mglsl_reflect_next(rf)) {
+        char c = rf->tok.kind == _MGLSL_TOK_PUNCT ? *rf->tok.begin : 0;
+
+        if(c == '{' && !depth && after_paren) body = 1;
+
+        if(c == '(' || c == '[' || c == '{') {
+            depth++;
+        } else if(c == ')' || c == ']' || c == '}') {
+            if(!depth) return;
+            if(!--depth && body) {
+                _mglsl_reflect_next(rf);
+                return;
+            }
+        } else if(c == ';' && !depth) {
+            _mglsl_reflect_next(rf);
+            return;
+        }
+
+        after_paren = c == ')';
+    }
+}
+
+// Array dimensions after declarator or type, length of the first one is returned.
+static int _mglsl_reflect_array(_mglsl_Reflector * rf)
+{
+    int array_len = MGLSL_REFLECT_NONE;
+
+    while(_mglsl_reflect_at(rf, '[')) {
+        _mglsl_Token size = { _MGLSL_TOK_END, NULL, NULL };
+        int depth = 1;
+
+        _mglsl_reflect_next(rf);
+        if(rf->tok.kind == _MGLSL_TOK_NUMBER) {
+            size = rf->tok;
+            _mglsl_reflect_next(rf);
+        }
+
+        // literal sizes only, expressions give 0
+        if(array_len == MGLSL_REFLECT_NONE)
+            array_len = _mglsl_reflect_at(rf, ']') ? _mglsl_reflect_int(&size) : 0;
+
+        for(; depth && rf->tok.kind != _MGLSL_TOK_END; _mglsl_reflect_next(rf)) {
+            if(_mglsl_reflect_at(rf, '[')) depth++;
+            else if(_mglsl_reflect_at(rf, ']')) depth--;
+        }
+    }
+
+    return array_len;
+}
+
+// Layout and storage qualifiers in front of declaration, kind is set by storage qualifier.
+static void _mglsl_reflect_qualifiers(_mglsl_Reflector * rf, mglsl_ReflectDecl * decl)
+{
+    _mglsl_Token * tok = &rf->tok;
+
+    for(; tok->kind == _MGLSL_TOK_IDENT; _mglsl_reflect_next(rf)) {
+
+        if(_mglsl_tok_is(tok, "layout")) {
+            _mglsl_reflect_next(rf);
+            if(!_mglsl_reflect_at(rf, '(')) return;
+            _mglsl_reflect_next(rf);
+
+            while(tok->kind != _MGLSL_TOK_END && !_mglsl_reflect_at(rf, ')')) {
+                int * field = NULL;
+                if(_mglsl_tok_is(tok, "binding")) field = &decl->binding;
+                else if(_mglsl_tok_is(tok, "location")) field = &decl->location;
+                else if(_mglsl_tok_is(tok, "set")) field = &decl->set;
+
+                _mglsl_reflect_next(rf);
+
+                if(_mglsl_reflect_at(rf, '=')) {
+                    _mglsl_reflect_next(rf);
+                    if(field && tok->kind == _MGLSL_TOK_NUMBER) *field = _mglsl_reflect_int(tok);
+
+                    // value may be an expression
+                    int depth = 0;
+                    while(tok->kind != _MGLSL_TOK_END &&
+                          (depth || !(_mglsl_reflect_at(rf, ',') || _mglsl_reflect_at(rf, ')')))) {
+                        if(_mglsl_reflect_at(rf, '(')) depth++;
+                        else if(_mglsl_reflect_at(rf, ')')) depth--;
+                        _mglsl_reflect_next(rf);
+                    }
+                }
+
+                if(_mglsl_reflect_at(rf, ',')) _mglsl_reflect_next(rf);
+            }
+            if(tok->kind == _MGLSL_TOK_END) return;
+            continue;
+        }
+
+        if(_mglsl_tok_is(tok, "uniform")) decl->kind = MGLSL_REFLECT_UNIFORM;
+        else if(_mglsl_tok_is(tok, "buffer")) decl->kind = MGLSL_REFLECT_BUFFER;
+        else if(_mglsl_tok_is(tok, "in") || _mglsl_tok_is(tok, "attribute")) decl->kind = MGLSL_REFLECT_IN;
+        else if(_mglsl_tok_is(tok, "out")) decl->kind = MGLSL_REFLECT_OUT;
+        else {
+            size_t count = sizeof(_mglsl_reflect_skipped_qualifiers) / sizeof(char*), i = 0;
+            while(i < count && !_mglsl_tok_is(tok, _mglsl_reflect_skipped_qualifiers[i])) i++;
+            if(i == count) return;
+        }
+    }
+}
+
+// Comma separated declarators following type, each gets its own record.
+static void _mglsl_reflect_declarators
+    (_mglsl_Reflector * rf, const mglsl_ReflectDecl * decl, long parent)
+{
+    int type_array_len = _mglsl_reflect_array(rf);
+
+    while(!rf->ec && rf->tok.kind == _MGLSL_TOK_IDENT) {
+        mglsl_ReflectDecl var = *decl;
+        var.name = _mglsl_reflect_id(rf, &rf->tok);
+        _mglsl_reflect_next(rf);
+
+        var.array_len = _mglsl_reflect_array(rf);
+        if(var.array_len == MGLSL_REFLECT_NONE) var.array_len = type_array_len;
+
+        if(_mglsl_reflect_push(rf, &var) >= 0 && parent >= 0)
+            rf->module->_reflect[parent].members++;
+
+        // initializer
+        int depth = 0;
+        while(rf->tok.kind != _MGLSL_TOK_END &&
+              (depth || !(_mglsl_reflect_at(rf, ',') || _mglsl_reflect_at(rf, ';')))) {
+            if(_mglsl_reflect_at(rf, '(') || _mglsl_reflect_at(rf, '{')) depth++;
+            else if(_mglsl_reflect_at(rf, ')') || _mglsl_reflect_at(rf, '}')) {
+                if(!depth) return;
+                depth--;
+            }
+            _mglsl_reflect_next(rf);
+        }
+
+        if(!_mglsl_reflect_at(rf, ',')) break;
+        _mglsl_reflect_next(rf);
+    }
+}
+
+// Members of struct or block between braces, current token is the opening one.
+static void _mglsl_reflect_members(_mglsl_Reflector * rf, long parent)
+{
+    _mglsl_reflect_next(rf);
+
+    while(!rf->ec && rf->tok.kind != _MGLSL_TOK_END && !_mglsl_reflect_at(rf, '}')) {
+        const char * begin = rf->tok.begin;
+
+        mglsl_ReflectDecl member;
+        memset(&member, 0, sizeof(member));
+        member.binding = member.location = member.set = MGLSL_REFLECT_NONE;
+
+        _mglsl_reflect_qualifiers(rf, &member);
+        member.kind = MGLSL_REFLECT_MEMBER;
+        member.binding = member.set = MGLSL_REFLECT_NONE;
+
+        if(rf->tok.kind == _MGLSL_TOK_IDENT) {
+            member.type = _mglsl_reflect_id(rf, &rf->tok);
+            _mglsl_reflect_next(rf);
+            _mglsl_reflect_declarators(rf, &member, parent);
+        }
+
+        _mglsl_reflect_skip(rf);
+        if(rf->tok.begin == begin) _mglsl_reflect_next(rf);
+    }
+
+    _mglsl_reflect_next(rf);
+}
+
+static void _mglsl_reflect_decl(_mglsl_Reflector * rf)
+{
+    mglsl_ReflectDecl decl;
+    memset(&decl, 0, sizeof(decl));
+    decl.array_len = decl.binding = decl.location = decl.set = MGLSL_REFLECT_NONE;
+
+    _mglsl_reflect_qualifiers(rf, &decl);
+
+    if(rf->tok.kind != _MGLSL_TOK_IDENT) {
+        _mglsl_reflect_skip(rf);
+        return;
+    }
+
+    if(_mglsl_tok_is(&rf->tok, "struct")) {
+        _mglsl_reflect_next(rf);
+        if(rf->tok.kind != _MGLSL_TOK_IDENT) {
+            _mglsl_reflect_skip(rf);
+            return;
+        }
+
+        mglsl_ReflectDecl def = decl;
+        def.kind = MGLSL_REFLECT_STRUCT;
+        def.name = _mglsl_reflect_id(rf, &rf->tok);
+        def.array_len = def.binding = def.location = def.set = MGLSL_REFLECT_NONE;
+        decl.type = def.name;
+
+        long s = _mglsl_reflect_push(rf, &def);
+        _mglsl_reflect_next(rf);
+        if(_mglsl_reflect_at(rf, '{')) _mglsl_reflect_members(rf, s);
+
+    } else if(decl.kind) {
+        _mglsl_Token peek;
+        _mglsl_reflect_lex(rf, &peek, rf->cur);
+
+        decl.type = _mglsl_reflect_id(rf, &rf->tok);
+        _mglsl_reflect_next(rf);
+
+        if(_mglsl_tok_is_punct(&peek, '{')) {
+            decl.is_block = 1;
+            long b = _mglsl_reflect_push(rf, &decl);
+            _mglsl_reflect_members(rf, b);
+
+            if(b >= 0 && rf->tok.kind == _MGLSL_TOK_IDENT) {
+                rf->module->_reflect[b].name = _mglsl_reflect_id(rf, &rf->tok);
+                _mglsl_reflect_next(rf);
+                rf->module->_reflect[b].array_len = _mglsl_reflect_array(rf);
+            }
+            decl.kind = 0;
+        }
+    }
+
+    // variables with storage qualifier, struct definitions may declare them too
+    if(decl.kind) _mglsl_reflect_declarators(rf, &decl, -1);
+
+    _mglsl_reflect_skip(rf);
+}
+
+static int _mglsl_reflect(mglsl_Module * module)
+{
+    _mglsl_Reflector rf;
+    memset(&rf, 0, sizeof(rf));
+    rf.module = module;
+    rf.buf = rf.cur = module->source;
+    rf.end = module->source + strlen(module->source);
+
+    _mglsl_reflect_next(&rf);
+
+    while(!rf.ec && rf.tok.kind != _MGLSL_TOK_END) {
+        const char * begin = rf.tok.begin;
+        _mglsl_reflect_decl(&rf);
+
+        // stray closing bracket
+        if(rf.tok.begin == begin) _mglsl_reflect_next(&rf);
+    }
+
+    return rf.ec;
+}
+
+#endif
+
+//
+//
+
+static int _mglsl_push_line_run(mglsl_Module * module, unsigned int line, unsigned int src_line)
+{
+    size_t len = module->_line_runs_len;
+
+    // capacity is the next power of two, grow whenever length reaches one
+    if((len & (len - 1)) == 0) {
+        size_t cap = len ? len * 2 : 1;
+        _mglsl_LineRun * runs = len ?
+            (_mglsl_LineRun*)_mglsl_realloc(module->_line_runs, cap * sizeof(_mglsl_LineRun)) :
+            (_mglsl_LineRun*)_mglsl_alloc(cap * sizeof(_mglsl_LineRun));
+        if(!runs) return MGLSL_E_REALLOC;
+        module->_line_runs = runs;
+    }
+
+    module->_line_runs[len].line = line;
+    module->_line_runs[len].src_line = src_line;
+    module->_line_runs_len++;
+    return MGLSL_E_SUCCESS;
+}
+
+//
+// SOURCE COMPRESSION
+// Parsed sources are kept compressed in LZ4 block format, greedy matching with a small
+// hash table. GLSL text compresses well and decompression is a mere sequence of copies.
+
+#ifdef _MGLSL_COMPRESS_SOURCES
+#define _MGLSL_LZ_HASH_BITS 12
+#define _MGLSL_LZ_MAX_OFFSET 65535
+
+static inline unsigned int _mglsl_lz_read32(const unsigned char * p) {
+    unsigned int v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// Length which did not fit into 4 bits of the token goes on in bytes of 255.
+static unsigned char * _mglsl_lz_put_len(unsigned char * out, size_t len) {
+    for(; len >= 255; len -= 255) *out++ = 255;
+    *out++ = (unsigned char)len;
+    return out;
+}
+
+static unsigned char * _mglsl_lz_put_literals
+    (unsigned char * out, unsigned char * token, const unsigned char * lit, size_t lit_len)
+{
+    *token = (unsigned char)((lit_len < 15 ? lit_len : 15) << 4);
+    if(lit_len >= 15) out = _mglsl_lz_put_len(out, lit_len - 15);
+    memcpy(out, lit, lit_len);
+    return out + lit_len;
+}
+
+// Worst case output is len + len/255 + 16 bytes.
+static size_t _mglsl_lz_compress(unsigned char * out, const unsigned char * src, size_t len)
+{
+    unsigned int table[1 << _MGLSL_LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    // format wants last match to start at least 12 bytes before the end
+    // and last 5 bytes to be literals
+    const unsigned char * end = src + len;
+    const unsigned char * match_limit = len > 12 ? end - 12 : src;
+    const unsigned char * anchor = src, * cur = src;
+    unsigned char * op = out;
+
+    while(cur < match_limit) {
+        unsigned int seq = _mglsl_lz_read32(cur);
+        unsigned int h = (seq * 2654435761u) >> (32 - _MGLSL_LZ_HASH_BITS);
+        const unsigned char * ref = src + table[h];
+        table[h] = (unsigned int)(cur - src);
+
+        if(ref >= cur || cur - ref > _MGLSL_LZ_MAX_OFFSET || _mglsl_lz_read32(ref) != seq) {
+            cur++;
+            continue;
+        }
+
+        size_t offset = cur - ref;
+        const unsigned char * match_end = cur + 4;
+        while(match_end < end - 5 && *match_end == match_end[-offset]) match_end++;
+
+        unsigned char * token = op++;
+        op = _mglsl_lz_put_literals(op, token, anchor, cur - anchor);
+
+        *op++ = (unsigned char)(offset & 0xff);
+        *op++ = (unsigned char)(offset >> 8);
+
+        size_t match_len = match_end - cur - 4;
+        *token |= match_len < 15 ? match_len : 15;
+        if(match_len >= 15) op = _mglsl_lz_put_len(op, match_len - 15);
+
+        cur = anchor = match_end;
+    }
+
+    unsigned char * token = op++;
+    op = _mglsl_lz_put_literals(op, token, anchor, end - anchor);
+    return op - out;
+}
+
+// Copies in 8 byte steps, up to 7 bytes past len may be written.
+static inline void _mglsl_lz_wild_copy(unsigned char * dst, const unsigned char * src, size_t len) {
+    unsigned char * end = dst + len;
+    do { memcpy(dst, src, 8); dst += 8; src += 8; } while(dst < end);
+}
+
+// Fails unless data decompresses to exactly out_len bytes. Sources are not
+// trusted, attached shared modules come from another process.
+static int _mglsl_lz_decompress(char * out, size_t out_len, const char * packed, size_t packed_len)
+{
+    const unsigned char * ip = (const unsigned char*)packed, * ip_end = ip + packed_len;
+    unsigned char * op = (unsigned char*)out, * op_end = op + out_len;
+    unsigned char b;
+
+    // most literal runs and matches are short, fixed size copies which overrun
+    // them are much cheaper, as long as there is room for that on both sides
+    for(;;) {
+        if(ip == ip_end) return MGLSL_E_MODULE_CORRUPT;
+        unsigned int token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if(lit_len == 15) do {
+            if(ip == ip_end) return MGLSL_E_MODULE_CORRUPT;
+            lit_len += b = *ip++;
+        } while(b == 255);
+
+        if(lit_len > (size_t)(ip_end - ip) || lit_len > (size_t)(op_end - op))
+            return MGLSL_E_MODULE_CORRUPT;
+
+        if(lit_len <= 16 && ip + 16 <= ip_end && op + 16 <= op_end) {
+            memcpy(op, ip, 16);
+        } else {
+            memcpy(op, ip, lit_len);
+        }
+        op += lit_len;
+        ip += lit_len;
+
+        if(ip == ip_end) break;
+        if(ip_end - ip < 2) return MGLSL_E_MODULE_CORRUPT;
+
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if(!offset || offset > (size_t)(op - (unsigned char*)out)) return MGLSL_E_MODULE_CORRUPT;
+
+        size_t match_len = token & 15;
+        if(match_len == 15) do {
+            if(ip == ip_end) return MGLSL_E_MODULE_CORRUPT;
+            match_len += b = *ip++;
+        } while(b == 255);
+        match_len += 4;
+
+        if(match_len > (size_t)(op_end - op)) return MGLSL_E_MODULE_CORRUPT;
+
+        // matches closer than their length repeat what they copy, so they go byte by byte
+        const unsigned char * ref = op - offset;
+        if(offset >= 8 && op + match_len + 8 <= op_end) _mglsl_lz_wild_copy(op, ref, match_len);
+        else if(offset >= match_len) memcpy(op, ref, match_len);
+        else for(size_t i=0; i<match_len; i++) op[i] = ref[i];
+        op += match_len;
+    }
+
+    return op == op_end ? MGLSL_E_SUCCESS : MGLSL_E_MODULE_CORRUPT;
+}
+
+// Replaces parsed source of module with compressed one, unless it does not get smaller.
+static void _mglsl_pack_source(mglsl_Module * module)
+{
+    size_t len = strlen(module->source);
+    module->_source_len = len;
+    module->_packed_len = 0;
+
+    unsigned char * packed = (unsigned char*)_mglsl_alloc(len + len / 255 + 16);
+    if(!packed) return; // stays uncompressed
+
+    size_t packed_len = _mglsl_lz_compress(packed, (const unsigned char*)module->source, len);
+    if(packed_len >= len) {
+        _mglsl_free(packed);
+        return;
+    }
+
+    char * shrunk = (char*)_mglsl_realloc(packed, packed_len);
+    _mglsl_free(module->source);
+    module->source = shrunk ? shrunk : (char*)packed;
+    module->_packed_len = packed_len;
+}
+#endif
+
+static inline size_t _mglsl_source_len(const mglsl_Module * module) {
+#ifdef _MGLSL_COMPRESS_SOURCES
+    if(module->_packed_len) return module->_source_len;
+#endif
+    return strlen(module->source);
+}
+
+#ifdef _MGLSL_CACHE
+static unsigned long long _mglsl_module_digest(const mglsl_Module * module);
+#endif
+
+// Source is parsed in its own copy, which is compacted in place into parsed source,
+// kept lines only ever move towards its beginning. Source ends at src_len or '\0'.
+// Module is only scanned with header_only, parser then stops at the first line of code.
+static int _mglsl_parse(mglsl_Module * module, const char * src, size_t src_len, int header_only)
+{
+    _MGLSL_STAT_ADD(bytes_parsed, src_len);
+    char * clean_src = NULL;
+    const char * cur = src;
+
+    // header is only read, source is expected to be null-terminated then
+    if(!header_only) {
+        clean_src = (char*)_mglsl_alloc(src_len + 1);
+
+        if(!clean_src)
+            return _mglsl_log_err(MGLSL_E_ALLOC);
+
+        memcpy(clean_src, src, src_len);
+        clean_src[src_len] = '\0';
+        cur = clean_src;
+    }
+
+    size_t clean_src_len = 0;
+
+    int line = 0, clean_line = 0, first_ec = MGLSL_E_SUCCESS;
+    while(*cur != '\0') {
+        const char * line_begin = cur;
+        int keep = 1;
+        line++;
+
+        if(header_only) {
+            int nl = 0;
+            cur = _mglsl_cur_skip_filler(cur, &nl, &line_begin);
+            line += nl;
+            if(*cur != '#') break;
+        }
+
+        cur = _mglsl_cur_skip_space(cur);
+
+        if (*cur == '#') {
+            cur++;
+            cur = _mglsl_cur_skip_space(cur);
+
+            char * keyword_end = (char*)cur;
+            while(_mglsl_is_ident_char(*keyword_end)) keyword_end++;
+            size_t keyword_len = keyword_end - cur;
+
+            char keyword[_MGLSL_MAX_PP_KEYWORD_LEN + 1];
+
+            if(keyword_len > _MGLSL_MAX_PP_KEYWORD_LEN) {
+                _mglsl_err_detail = MGLSL_DIAG_KEYWORD_TOO_LONG;
+                if(!first_ec) first_ec = MGLSL_E_SYNTAX;
+                _mglsl_log_src_err(line, cur - line_begin, MGLSL_E_SYNTAX);
+
+                cur = _mglsl_cur_skip_line(cur);
+                continue;
+            }
+
+            memcpy(keyword, cur, keyword_len);
+            keyword[keyword_len] = '\0';
+
+            for(int i=0; i<_mglsl_keyword_proc_map_len; i++) {
+
+                _MGLSL_STAT_ADD(string_compares, 1);
+                if( strcmp(keyword, _mglsl_keyword_proc_map[i].keyword) ) continue;
+
+                keep = 0;
+
+                char * args_buf = NULL;
+                char * args_begin = (char*)_mglsl_cur_skip_space(keyword_end);
+                size_t args_len = _mglsl_cur_skip_line(args_begin) - args_begin;
+
+                // last line does not have to end with \n
+                if(args_len && args_begin[args_len - 1] == '\n') args_len--;
+
+                if(args_len) {
+                    args_buf = (char*)_mglsl_alloc(args_len + 1);
+
+                    if(!args_buf) {
+                        if(clean_src) _mglsl_free(clean_src);
+                        return _mglsl_log_src_err(line, cur - line_begin, MGLSL_E_ALLOC);
+                    }
+
+                    memcpy(args_buf, args_begin, args_len);
+                    args_buf[args_len] = '\0';
+                }
+
+                int ec = _mglsl_keyword_proc_map[i].proc(module, args_buf);
+
+                if(args_buf) _mglsl_free(args_buf);
+
+                // parsing goes on to report all errors at once, unless out of memory
+                if(ec) {
+                    if(!first_ec) first_ec = ec;
+                    _mglsl_log_src_err(line, args_begin - line_begin, ec);
+
+                    if(ec == MGLSL_E_ALLOC || ec == MGLSL_E_REALLOC) {
+                        if(clean_src) _mglsl_free(clean_src);
+                        return ec;
+                    }
+                }
+
+                break;
+            }
+
+            if(keep && _mglsl_parse_cond_stack)
+                _mglsl_cond_directive(_mglsl_parse_cond_stack, keyword, _mglsl_cur_skip_space(keyword_end));
+        }
+
+        // found before the line is moved over
+        const char * line_end = _mglsl_cur_skip_line(cur);
+
+        // everything we don't process is written back, other preprocessor directives included
+        if(keep && clean_src) {
+            clean_line++;
+
+            size_t runs_len = module->_line_runs_len;
+            _mglsl_LineRun * last = runs_len ? module->_line_runs + runs_len - 1 : NULL;
+
+            if(!last || last->src_line + (clean_line - last->line) != (unsigned int)line) {
+                if(_mglsl_push_line_run(module, clean_line, line)) {
+                    _mglsl_free(clean_src);
+                    return _mglsl_log_err(MGLSL_E_REALLOC);
+                }
+            }
+
+            size_t line_len = line_end - line_begin;
+            memmove(clean_src + clean_src_len, line_begin, line_len);
+            clean_src_len += line_len;
+        }
+
+        cur = line_end;
+    }
+
+    if(first_ec) {
+        if(clean_src) _mglsl_free(clean_src);
+        return first_ec;
+    }
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+    if(!clean_src) {
+        module->flags |= MGLSL_HEADER_ONLY;
+        return MGLSL_E_SUCCESS;
+    }
+#endif
+
+    module->source = clean_src = (char*)_mglsl_realloc(clean_src, clean_src_len + 1);
+    clean_src[clean_src_len] = '\0';
+
+#ifdef _MGLSL_REFLECTION
+    int ec = _mglsl_reflect(module);
+    if(ec) return _mglsl_log_err(ec);
+#endif
+
+#ifdef _MGLSL_COMPRESS_SOURCES
+    _mglsl_pack_source(module);
+#endif
+
+#ifdef _MGLSL_CACHE
+    module->_digest = _mglsl_module_digest(module);
+#endif
+
+    return MGLSL_E_SUCCESS;
+}
+
+//
+// FILE INTERFACE
+
+#ifdef _MGLSL_DEFAULT_READ_FILE
+static int _mglsl_read_file(void ** bufptr, size_t * size, const char * filepath) {
+    FILE * file = fopen(filepath, "r");
+
+    if(!file)
+        return MGLSL_E_FILE_OPEN;
+
+    fseek(file, 0L, SEEK_END);
+    size_t filesize = ftell(file);
+    rewind(file);
+
+    char * buf = (char*)MGLSL_ALLOC(filesize + 1);
+    if(!buf) {
+        fclose(file);
+        return MGLSL_E_ALLOC;
+    }
+
+    if(filesize != fread(buf, sizeof(char), filesize, file)) {
+        MGLSL_FREE(buf);
+        fclose(file);
+        return MGLSL_E_FILE_READ;
+    }
+
+    buf[filesize] = '\0';
+
+    fclose(file);
+
+    *bufptr = buf;
+    *size = filesize;
+    return MGLSL_E_SUCCESS;
+}
+#endif
+
+
+#ifdef _MGLSL_DEFAULT_CONCAT_PATH
+static int _mglsl_concat_path
+    (char * buf, size_t buflen, const char * a, const char * b) 
+{
+    _MGLSL_ASSERT(a && b);
+
+    size_t alen = strlen(a), blen = strlen(b);
+
+    // If any of our two strings have no length, we dont need slash.
+    // If one of them have it, we dont need it either.
+    int slash_between =
+        (alen && a[alen - 1] != '/') && (blen && b[blen - 1] != '/');
+
+    size_t len = alen + blen + slash_between + 1;
+
+    if(buflen < len)
+        return MGLSL_E_BUF_TOO_SMALL;
+
+    // NOTE(kacper): Calling memcpy with count zero is fine btw.
+    char * cur = buf;
+
+    memcpy(cur, a, alen);
+    cur += alen;
+
+    if(slash_between) *(cur++) = '/';
+
+    memcpy(cur, b, blen);
+    cur += blen;
+
+    *(cur++) = '\0';
+
+    _MGLSL_ASSERT((size_t)(cur - buf) == len);
+
+    return MGLSL_E_SUCCESS;
+}
+#endif
+
+#ifdef _MGLSL_DEFAULT_FILE_MTIME
+static int _mglsl_file_mtime(time_t * mtime, const char * filepath) {
+    struct stat attr;
+    memset(&attr, 0, sizeof(attr));
+    if( stat(filepath, &attr) ) return MGLSL_E_FILE_NOT_FOUND;
+
+    if(mtime) *mtime = attr.st_mtime;
+
+    return MGLSL_E_SUCCESS;
+}
+#endif
+
+//
+// PACK FILES
+// Modules can be shipped in an uncompressed tar archive which is opened once and mapped.
+// Mounted packs are asked before file hooks, by path, through an in-memory index.
+// A pack mounted under a directory owns it, files it has not got are not looked for on disk.
+
+#ifdef _MGLSL_PACK_FILES
+
+#define _MGLSL_TAR_BLOCK 512
+
+typedef struct {
+    const char * path; // mount directory joined with name in archive
+    size_t path_len;
+    const char * data; // inside of the mapping
+    size_t size;
+    time_t mtime;
+} _mglsl_PackEntry;
+
+typedef struct {
+    char * pack_path;
+    char * mount_dir;  // NULL if files are mounted as named in archive
+    size_t mount_dir_len;
+
+    void * map;
+    size_t map_len;
+    dev_t dev;         // to tell when pack file gets replaced
+    ino_t ino;
+    time_t mtime;
+
+    _mglsl_PackEntry * entries;
+    size_t entries_len;
+    size_t * index;    // entry index + 1, zero is empty slot
+    size_t index_mask;
+    char * paths;
+} _mglsl_Pack;
+
+static _mglsl_Pack * _mglsl_packs = NULL;
+static size_t _mglsl_packs_len = 0;
+
+typedef struct {
+    const char * map;
+    size_t map_len;
+    size_t off;
+
+    // current regular file
+    const char * name;
+    size_t name_len;
+    const char * data;
+    size_t size;
+    time_t mtime;
+    char name_buf[155 + 1 + 100];
+} _mglsl_TarReader;
+
+static const char * _mglsl_pack_norm(const char * path, size_t * len) {
+    while(path[0] == '.' && path[1] == '/') {
+        path += 2;
+        while(*path == '/') path++;
+    }
+    *len = strlen(path);
+    return path;
+}
+
+static size_t _mglsl_tar_field_len(const char * field, size_t max_len) {
+    size_t len = 0;
+    while(len < max_len && field[len]) len++;
+    return len;
+}
+
+static int _mglsl_tar_number(size_t * out, const char * field, size_t len) {
+    size_t i = 0, n = 0;
+    while(i < len && field[i] == ' ') i++;
+    if(i == len || field[i] < '0' || field[i] > '7') return 0;
+
+    for(; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        if(n >> (sizeof(size_t) * 8 - 3)) return 0;
+        n = n * 8 + (size_t)(field[i] - '0');
+    }
+    if(i < len && field[i] != ' ' && field[i] != '\0') return 0;
+
+    *out = n;
+    return 1;
+}
+
+// Picks path out of pax extended header records, "<len> path=<value>\n".
+static void _mglsl_tar_pax_path(const char ** path, size_t * path_len, const char * data, size_t size) {
+    size_t off = 0;
+    while(off < size) {
+        size_t rec_len = 0, i = off;
+        while(i < size && data[i] >= '0' && data[i] <= '9' && rec_len <= size)
+            rec_len = rec_len * 10 + (size_t)(data[i++] - '0');
+
+        if(i == off || i >= size || data[i] != ' ' || rec_len > size - off || rec_len < i - off + 2) return;
+
+        const char * kv = data + i + 1;
+        size_t kv_len = off + rec_len - 1 - (i + 1);
+        if(kv_len > 5 && !memcmp(kv, "path=", 5)) {
+            *path = kv + 5;
+            *path_len = kv_len - 5;
+        }
+        off += rec_len;
+    }
+}
+
+// Returns 1 with next regular file read, 0 at the end of archive, -1 if archive is invalid.
+static int _mglsl_tar_next(_mglsl_TarReader * tar) {
+    const char * long_name = NULL;
+    size_t long_name_len = 0;
+
+    for(;;) {
+        if(tar->map_len - tar->off < _MGLSL_TAR_BLOCK) return tar->off == tar->map_len ? 0 : -1;
+
+        const unsigned char * header = (const unsigned char*)tar->map + tar->off;
+
+        // archive ends with zero blocks
+        size_t sum = 0, zero = 1;
+        for(size_t i=0; i<_MGLSL_TAR_BLOCK; i++) {
+            if(header[i]) zero = 0;
+            sum += (i >= 148 && i < 156) ? ' ' : header[i];
+        }
+        if(zero) return 0;
+
+        size_t chksum, size, mtime;
+        if(!_mglsl_tar_number(&chksum, (const char*)header + 148, 8) || chksum != sum) return -1;
+        if(!_mglsl_tar_number(&size, (const char*)header + 124, 12)) return -1;
+        if(!_mglsl_tar_number(&mtime, (const char*)header + 136, 12)) return -1;
+
+        size_t data_off = tar->off + _MGLSL_TAR_BLOCK;
+        if(size > tar->map_len - data_off) return -1;
+
+        const char * data = tar->map + data_off;
+        size_t padded = (size + _MGLSL_TAR_BLOCK - 1) / _MGLSL_TAR_BLOCK * _MGLSL_TAR_BLOCK;
+        tar->off = data_off + (padded < tar->map_len - data_off ? padded : tar->map_len - data_off);
+
+        char type = (char)header[156];
+
+        if(type == 'L') { // GNU long name of the next entry
+            long_name = data;
+            long_name_len = _mglsl_tar_field_len(data, size);
+            continue;
+        }
+        if(type == 'x') { // pax extended header of the next entry
+            _mglsl_tar_pax_path(&long_name, &long_name_len, data, size);
+            continue;
+        }
+        if(type != '0' && type != '\0' && type != '7') {
+            long_name = NULL;
+            continue;
+        }
+
+        if(long_name) {
+            tar->name = long_name;
+            tar->name_len = long_name_len;
+        } else {
+            size_t len = 0;
+            // POSIX ustar keeps leading directories apart, GNU tar uses the field for other things
+            if(!memcmp(header + 257, "ustar\0", 6)) {
+                size_t prefix_len = _mglsl_tar_field_len((const char*)header + 345, 155);
+                memcpy(tar->name_buf, header + 345, prefix_len);
+                len = prefix_len;
+                if(prefix_len) tar->name_buf[len++] = '/';
+            }
+            size_t name_len = _mglsl_tar_field_len((const char*)header, 100);
+            memcpy(tar->name_buf + len, header, name_len);
+
+            tar->name = tar->name_buf;
+            tar->name_len = len + name_len;
+        }
+
+        tar->data = data;
+        tar->size = size;
+        tar->mtime = (time_t)mtime;
+        return 1;
+    }
+}
+
+// Writes path entry is mounted under into buf, returns zero if file cannot be mounted.
+static size_t _mglsl_pack_entry_path(char * buf, const _mglsl_Pack * pack, const _mglsl_TarReader * tar) {
+    char name[MGLSL_MAX_PATH_LEN + 1];
+    if(tar->name_len > MGLSL_MAX_PATH_LEN || memchr(tar->name, '\0', tar->name_len)) return 0;
+
+    memcpy(name, tar->name, tar->name_len);
+    name[tar->name_len] = '\0';
+
+    size_t len;
+    const char * norm = _mglsl_pack_norm(name, &len);
+    if(!len) return 0;
+
+    if(!pack->mount_dir) {
+        memcpy(buf, norm, len + 1);
+        return len;
+    }
+    if(MGLSL_CONCAT_PATH(buf, MGLSL_MAX_PATH_LEN + 1, pack->mount_dir, norm)) return 0;
+
+    norm = _mglsl_pack_norm(buf, &len);
+    memmove(buf, norm, len + 1);
+    return len;
+}
+
+static const _mglsl_PackEntry * _mglsl_pack_find(const _mglsl_Pack * pack, const char * path, size_t path_len) {
+    size_t slot = _mglsl_hash(path, path_len) & pack->index_mask;
+
+    for(; pack->index[slot]; slot = (slot + 1) & pack->index_mask) {
+        const _mglsl_PackEntry * entry = pack->entries + pack->index[slot] - 1;
+        if(entry->path_len == path_len && !memcmp(entry->path, path, path_len)) return entry;
+    }
+    return NULL;
+}
+
+static void _mglsl_pack_unload(_mglsl_Pack * pack) {
+    if(pack->map) munmap(pack->map, pack->map_len);
+    _mglsl_free(pack->entries);
+    _mglsl_free(pack->index);
+    _mglsl_free(pack->paths);
+
+    pack->map = NULL;
+    pack->entries = NULL;
+    pack->index = NULL;
+    pack->paths = NULL;
+}
+
+// Maps pack_path and indexes files in it, pack_path and mount_dir have to be set.
+static int _mglsl_pack_load(_mglsl_Pack * pack) {
+    int fd = open(pack->pack_path, O_RDONLY);
+    if(fd < 0) return MGLSL_E_FILE_OPEN;
+
+    struct stat st;
+    if(fstat(fd, &st)) {
+        close(fd);
+        return MGLSL_E_FILE_READ;
+    }
+
+    pack->dev = st.st_dev;
+    pack->ino = st.st_ino;
+    pack->mtime = st.st_mtime;
+    pack->map_len = (size_t)st.st_size;
+    pack->map = NULL;
+    pack->entries = NULL;
+    pack->index = NULL;
+    pack->paths = NULL;
+
+    if(pack->map_len) {
+        void * map = mmap(NULL, pack->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED) {
+            close(fd);
+            return MGLSL_E_FILE_READ;
+        }
+        pack->map = map;
+    }
+    close(fd);
+
+    char buf[MGLSL_MAX_PATH_LEN + 1];
+    _mglsl_TarReader tar;
+    size_t count = 0, paths_size = 0;
+    int res;
+
+    // once to size everything, then again to fill it in
+    memset(&tar, 0, sizeof(tar));
+    tar.map = (const char*)pack->map;
+    tar.map_len = pack->map_len;
+
+    while((res = _mglsl_tar_next(&tar)) > 0) {
+        size_t len = _mglsl_pack_entry_path(buf, pack, &tar);
+        if(!len) continue;
+        count++;
+        paths_size += len + 1;
+    }
+
+    size_t index_cap = 8;
+    while(index_cap < count * 2) index_cap *= 2;
+
+    int ec = MGLSL_E_SUCCESS;
+    if(res < 0) ec = MGLSL_E_PACK_INVALID;
+    else if(!(pack->entries = (_mglsl_PackEntry*)_mglsl_alloc(count * sizeof(_mglsl_PackEntry) + 1)) ||
+            !(pack->index = (size_t*)_mglsl_alloc(index_cap * sizeof(size_t))) ||
+            !(pack->paths = (char*)_mglsl_alloc(paths_size + 1))) ec = MGLSL_E_ALLOC;
+
+    if(ec) {
+        _mglsl_pack_unload(pack);
+        return ec;
+    }
+
+    memset(pack->index, 0, index_cap * sizeof(size_t));
+    pack->index_mask = index_cap - 1;
+    pack->entries_len = 0;
+
+    memset(&tar, 0, sizeof(tar));
+    tar.map = (const char*)pack->map;
+    tar.map_len = pack->map_len;
+
+    char * cur = pack->paths;
+    while(_mglsl_tar_next(&tar) > 0) {
+        size_t len = _mglsl_pack_entry_path(buf, pack, &tar);
+        if(!len) continue;
+
+        _mglsl_PackEntry * entry = pack->entries + pack->entries_len;
+        memcpy(cur, buf, len + 1);
+        entry->path = cur;
+        entry->path_len = len;
+        entry->data = tar.data;
+        entry->size = tar.size;
+        entry->mtime = tar.mtime;
+        cur += len + 1;
+
+        // files appended later replace earlier ones
+        size_t slot = _mglsl_hash(entry->path, len) & pack->index_mask;
+        for(; pack->index[slot]; slot = (slot + 1) & pack->index_mask) {
+            const _mglsl_PackEntry * other = pack->entries + pack->index[slot] - 1;
+            if(other->path_len == len && !memcmp(other->path, entry->path, len)) break;
+        }
+        pack->index[slot] = ++pack->entries_len;
+    }
+
+    return MGLSL_E_SUCCESS;
+}
+
+// Returns 1 if path is served by a mounted pack, entry is set to NULL if pack has not got it.
+static int _mglsl_pack_lookup(const char * path, const _mglsl_PackEntry ** entry) {
+    if(!_mglsl_packs_len) return 0;
+
+    size_t path_len;
+    path = _mglsl_pack_norm(path, &path_len);
+
+    // packs mounted later come first
+    for(size_t p=_mglsl_packs_len; p-- > 0;) {
+        const _mglsl_Pack * pack = _mglsl_packs + p;
+
+        const _mglsl_PackEntry * found = _mglsl_pack_find(pack, path, path_len);
+        if(found || (pack->mount_dir_len && path_len > pack->mount_dir_len &&
+                     !memcmp(path, pack->mount_dir, pack->mount_dir_len) && path[pack->mount_dir_len] == '/')) {
+            if(entry) *entry = found;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Copies file out so that buffer is the same as one from MGLSL_READ_FILE.
+static int _mglsl_pack_read(void ** bufptr, size_t * sizeptr, const _mglsl_PackEntry * entry) {
+    char * buf = (char*)MGLSL_ALLOC(entry->size + 1);
+    if(!buf) return MGLSL_E_ALLOC;
+
+    memcpy(buf, entry->data, entry->size);
+    buf[entry->size] = '\0';
+
+    *bufptr = buf;
+    *sizeptr = entry->size;
+    return MGLSL_E_SUCCESS;
+}
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+// Remaps packs replaced on disk. Files are compared with their previous version, unchanged
+// ones keep their mtime and changed ones with the same archived mtime (archives built with
+// fixed mtime) get mtime of pack, so that exactly the changed ones are reloaded.
+static int _mglsl_pack_refresh(void) {
+    for(size_t p=0; p<_mglsl_packs_len; p++) {
+        _mglsl_Pack * pack = _mglsl_packs + p;
+
+        // Pack might be missing for a moment while it is replaced,
+        // old mapping stays valid until then.
+        struct stat st;
+        if(stat(pack->pack_path, &st)) continue;
+        if(st.st_dev == pack->dev && st.st_ino == pack->ino &&
+           st.st_mtime == pack->mtime && (size_t)st.st_size == pack->map_len) continue;
+
+        _mglsl_Pack fresh = *pack;
+        int ec = _mglsl_pack_load(&fresh);
+        if(ec) {
+            _mglsl_err_name = pack->pack_path;
+            return _mglsl_log_err(ec);
+        }
+
+        for(size_t i=0; i<fresh.entries_len; i++) {
+            _mglsl_PackEntry * entry = fresh.entries + i;
+            const _mglsl_PackEntry * old = _mglsl_pack_find(pack, entry->path, entry->path_len);
+
+            if(!old) continue;
+
+            if(old->size == entry->size && !memcmp(old->data, entry->data, entry->size))
+                entry->mtime = old->mtime;
+            else if(old->mtime == entry->mtime)
+                entry->mtime = fresh.mtime > old->mtime ? fresh.mtime : old->mtime + 1;
+        }
+
+        _mglsl_pack_unload(pack);
+        *pack = fresh;
+    }
+    return MGLSL_E_SUCCESS;
+}
+#endif
+
+static char * _mglsl_pack_strdup(const char * str, size_t len) {
+    char * dup = (char*)_mglsl_alloc(len + 1);
+    if(!dup) return NULL;
+    memcpy(dup, str, len);
+    dup[len] = '\0';
+    return dup;
+}
+
+// Files in pack become visible as if they were under mount_dir. Mounting a pack
+// again remounts it. With mount_dir NULL files are named as in archive and paths
+// pack has not got are still looked for on disk.
+int mglsl_mount_pack(const char * pack_path, const char * mount_dir)
+{
+    _MGLSL_ASSERT(pack_path);
+
+    _mglsl_Pack pack;
+    memset(&pack, 0, sizeof(pack));
+
+    int ec = MGLSL_E_SUCCESS;
+    pack.pack_path = _mglsl_pack_strdup(pack_path, strlen(pack_path));
+    if(!pack.pack_path) ec = MGLSL_E_ALLOC;
+
+    if(!ec && mount_dir) {
+        size_t len;
+        mount_dir = _mglsl_pack_norm(mount_dir, &len);
+        while(len && mount_dir[len - 1] == '/') len--;
+
+        pack.mount_dir = _mglsl_pack_strdup(mount_dir, len);
+        pack.mount_dir_len = len;
+        if(!pack.mount_dir) ec = MGLSL_E_ALLOC;
+    }
+
+    if(!ec) ec = _mglsl_pack_load(&pack);
+
+    if(!ec) {
+        mglsl_unmount_pack(pack_path);
+
+        _mglsl_Pack * packs = (_mglsl_Pack*)_mglsl_realloc(_mglsl_packs, (_mglsl_packs_len + 1) * sizeof(_mglsl_Pack));
+        if(packs) {
+            _mglsl_packs = packs;
+            _mglsl_packs[_mglsl_packs_len++] = pack;
+            return MGLSL_E_SUCCESS;
+        }
+        ec = MGLSL_E_REALLOC;
+        _mglsl_pack_unload(&pack);
+    }
+
+    _mglsl_free(pack.pack_path);
+    _mglsl_free(pack.mount_dir);
+    _mglsl_err_name = pack_path;
+    return _mglsl_log_err(ec);
+}
+
+// Unmounts pack mounted from pack_path, or every pack if it is NULL.
+int mglsl_unmount_pack(const char * pack_path)
+{
+    int found = 0;
+
+    for(size_t p=0; p<_mglsl_packs_len;) {
+        _mglsl_Pack * pack = _mglsl_packs + p;
+        if(pack_path && strcmp(pack->pack_path, pack_path)) {
+            p++;
+            continue;
+        }
+
+        _mglsl_pack_unload(pack);
+        _mglsl_free(pack->pack_path);
+        _mglsl_free(pack->mount_dir);
+
+        memmove(pack, pack + 1, (_mglsl_packs_len - p - 1) * sizeof(_mglsl_Pack));
+        _mglsl_packs_len--;
+        found = 1;
+    }
+
+    if(!_mglsl_packs_len) {
+        _mglsl_free(_mglsl_packs);
+        _mglsl_packs = NULL;
+    }
+
+    return found || !pack_path ? MGLSL_E_SUCCESS : MGLSL_E_FILE_NOT_FOUND;
+}
+#endif
+
+// All file hooks are called through these two so they can be accounted for.
+// Buffers returned by MGLSL_READ_FILE are only guaranteed to be freeable with MGLSL_FREE,
+// so they are released with _mglsl_free_file_buf rather than _mglsl_free.
+
+static int _mglsl_read(void ** bufptr, size_t * sizeptr, const char * filepath) {
+    _MGLSL_STAT_TIMER(t);
+    int ec;
+#ifdef _MGLSL_PACK_FILES
+    const _mglsl_PackEntry * entry;
+    if(_mglsl_pack_lookup(filepath, &entry)) {
+        ec = entry ? _mglsl_pack_read(bufptr, sizeptr, entry) : MGLSL_E_FILE_OPEN;
+    } else
+#endif
+    {
+        ec = MGLSL_READ_FILE(bufptr, sizeptr, filepath);
+        _MGLSL_STAT_ADD(read_calls, 1);
+    }
+    _MGLSL_STAT_TIME(read_ns, t);
+
+    if(!ec) _mglsl_stats_live(*sizeptr + 1, 0);
+    return ec;
+}
+
+static void _mglsl_free_file_buf(void * buf, size_t size) {
+    _mglsl_stats_live(0, size + 1);
+    MGLSL_FREE(buf);
+}
+
+static int _mglsl_stat(time_t * mtime, const char * filepath) {
+    _MGLSL_STAT_TIMER(t);
+    int ec;
+#ifdef _MGLSL_PACK_FILES
+    const _mglsl_PackEntry * entry;
+    if(_mglsl_pack_lookup(filepath, &entry)) {
+        ec = entry ? MGLSL_E_SUCCESS : MGLSL_E_FILE_NOT_FOUND;
+        if(entry && mtime) *mtime = entry->mtime;
+    } else
+#endif
+    {
+        ec = MGLSL_FILE_MTIME(mtime, filepath);
+        _MGLSL_STAT_ADD(stat_calls, 1);
+    }
+    _MGLSL_STAT_TIME(read_ns, t);
+    return ec;
+}
+
+//
+// BATCH FILE LOADING
+// Imports, change watch and reloads go over many files at once. With io_uring, statx,
+// open, read and close of a whole batch are in flight together and every file is handed
+// over as soon as it is read. Otherwise, or whenever io_uring fails on a file, file
+// hooks are called one file at a time.
+
+typedef struct {
+    const char * path;
+    void * buf; // read data, released with _mglsl_free_file_buf, NULL if only stat was asked for
+    size_t size;
+    time_t mtime;
+    int ec;
+} _mglsl_BatchFile;
+
+// Called once per file in order of completion, buffer belongs to it from now on.
+typedef int _mglsl_BatchFileProc(_mglsl_BatchFile * file, size_t file_idx, void * user);
+
+static int _mglsl_batch_serial
+    (_mglsl_BatchFile * file, size_t file_idx, int read, _mglsl_BatchFileProc * proc, void * user)
+{
+    file->buf = NULL;
+    file->size = 0;
+    file->ec = _mglsl_stat(&file->mtime, file->path);
+    if(!file->ec && read) file->ec = _mglsl_read(&file->buf, &file->size, file->path);
+
+    return proc(file, file_idx, user);
+}
+
+#ifdef _MGLSL_IO_URING
+
+#define _MGLSL_URING_ENTRIES 128
+#define _MGLSL_URING_FILES 32
+
+enum { _MGLSL_URING_STATX, _MGLSL_URING_OPEN, _MGLSL_URING_READ, _MGLSL_URING_CLOSE };
+
+typedef struct {
+    int fd;
+    unsigned sq_entries, sq_tail;
+    unsigned * sq_khead, * sq_ktail, * sq_kmask, * sq_array;
+    unsigned * cq_khead, * cq_ktail, * cq_kmask;
+    struct io_uring_sqe * sqes;
+    struct io_uring_cqe * cqes;
+
+    void * sq_ring, * cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned to_submit;
+} _mglsl_Uring;
+
+// File in flight.
+typedef struct {
+    struct statx stx;
+    size_t file_idx;
+    size_t done;   // bytes read so far
+    int fd;
+    int waiting;   // operations in flight
+    int failed;    // io_uring could not do it, file goes through hooks
+    int used;
+} _mglsl_UringFile;
+
+static void _mglsl_uring_exit(_mglsl_Uring * ring)
+{
+    if(ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if(ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+    if(ring->fd >= 0) close(ring->fd);
+}
+
+static int _mglsl_uring_init(_mglsl_Uring * ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(_mglsl_Uring));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if(ring->fd < 0) return -1;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(single_mmap && ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = single_mmap ? ring->sq_ring :
+        mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe*)
+        mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+
+    if(ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        _mglsl_uring_exit(ring);
+        return -1;
+    }
+
+    char * sq = (char*)ring->sq_ring, * cq = (char*)ring->cq_ring;
+    ring->sq_khead = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_ktail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_kmask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_khead = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_ktail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_kmask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    ring->sq_entries = params.sq_entries;
+    ring->sq_tail = *ring->sq_ktail;
+    return 0;
+}
+
+// Number of operations in flight is kept below ring size, so there is always room.
+// Operation is identified by slot of the file and what it does.
+static struct io_uring_sqe * _mglsl_uring_sqe
+    (_mglsl_Uring * ring, int opcode, int fd, size_t slot, int op)
+{
+    unsigned idx = ring->sq_tail & *ring->sq_kmask;
+    struct io_uring_sqe * sqe = ring->sqes + idx;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = (unsigned char)opcode;
+    sqe->fd = fd;
+    sqe->user_data = ((unsigned long long)slot << 2) | (unsigned long long)op;
+
+    ring->sq_array[idx] = idx;
+    ring->sq_tail++;
+    ring->to_submit++;
+    return sqe;
+}
+
+static int _mglsl_uring_submit_and_wait(_mglsl_Uring * ring)
+{
+    __atomic_store_n(ring->sq_ktail, ring->sq_tail, __ATOMIC_RELEASE);
+
+    _MGLSL_STAT_TIMER(t);
+    long ret;
+    do ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    while(ret < 0 && errno == EINTR);
+    _MGLSL_STAT_TIME(read_ns, t);
+
+    if(ret < 0) return -1;
+    ring->to_submit -= (unsigned)ret < ring->to_submit ? (unsigned)ret : ring->to_submit;
+    return 0;
+}
+
+static int _mglsl_uring_cqe(_mglsl_Uring * ring, unsigned long long * user_data, int * res)
+{
+    unsigned head = *ring->cq_khead;
+    if(head == __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE)) return 0;
+
+    const struct io_uring_cqe * cqe = ring->cqes + (head & *ring->cq_kmask);
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+
+    __atomic_store_n(ring->cq_khead, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static void _mglsl_uring_read_next(_mglsl_Uring * ring, _mglsl_UringFile * uf, _mglsl_BatchFile * file, size_t slot)
+{
+    size_t len = file->size - uf->done;
+    struct io_uring_sqe * sqe = _mglsl_uring_sqe(ring, IORING_OP_READ, uf->fd, slot, _MGLSL_URING_READ);
+    sqe->addr = (unsigned long long)(size_t)((char*)file->buf + uf->done);
+    sqe->len = len < (1u << 30) ? (unsigned)len : (1u << 30);
+    sqe->off = uf->done;
+    uf->waiting = 1;
+}
+
+static int _mglsl_batch_uring
+    (_mglsl_Uring * ring, _mglsl_BatchFile * files, size_t count, int read,
+     _mglsl_BatchFileProc * proc, void * user)
+{
+    // kernel writes into these until operations complete, so they go on heap
+    _mglsl_UringFile * slots = (_mglsl_UringFile*)_mglsl_alloc(_MGLSL_URING_FILES * sizeof(_mglsl_UringFile));
+    if(!slots) return MGLSL_E_ALLOC;
+    memset(slots, 0, _MGLSL_URING_FILES * sizeof(_mglsl_UringFile));
+
+    size_t next = 0, active = 0, closing = 0;
+    int ec = MGLSL_E_SUCCESS;
+
+    while((next < count && !ec) || active || closing) {
+
+        // each file has at most two operations in flight, closes come on top
+        while(!ec && next < count && active < _MGLSL_URING_FILES &&
+              2 * (active + 1) + closing <= ring->sq_entries) {
+#ifdef _MGLSL_PACK_FILES
+            // packed files are in memory already
+            if(_mglsl_pack_lookup(files[next].path, NULL)) {
+                ec = _mglsl_batch_serial(files + next, next, read, proc, user);
+                next++;
+                continue;
+            }
+#endif
+            size_t slot = 0;
+            while(slots[slot].used) slot++;
+
+            _mglsl_UringFile * uf = slots + slot;
+            _mglsl_BatchFile * file = files + next;
+
+            memset(uf, 0, sizeof(_mglsl_UringFile));
+            uf->used = 1;
+            uf->fd = -1;
+            uf->file_idx = next++;
+            file->buf = NULL;
+            file->size = 0;
+            file->ec = MGLSL_E_SUCCESS;
+
+            struct io_uring_sqe * sqe = _mglsl_uring_sqe(ring, IORING_OP_STATX, AT_FDCWD, slot, _MGLSL_URING_STATX);
+            sqe->addr = (unsigned long long)(size_t)file->path;
+            sqe->len = STATX_MTIME | STATX_SIZE;
+            sqe->off = (unsigned long long)(size_t)&uf->stx;
+            uf->waiting++;
+
+            if(read) {
+                sqe = _mglsl_uring_sqe(ring, IORING_OP_OPENAT, AT_FDCWD, slot, _MGLSL_URING_OPEN);
+                sqe->addr = (unsigned long long)(size_t)file->path;
+                sqe->open_flags = O_RDONLY;
+                uf->waiting++;
+            }
+            active++;
+        }
+
+#ifdef _MGLSL_PACK_FILES
+        // nothing to wait for if files taken were all packed
+        if(!active && !closing) continue;
+#endif
+
+        if(_mglsl_uring_submit_and_wait(ring)) {
+            // Operations still in flight may write to slots and buffers,
+            // so these are leaked. Should not ever happen with valid arguments.
+            for(size_t s=0; s<_MGLSL_URING_FILES && !ec; s++)
+                if(slots[s].used) ec = _mglsl_batch_serial(files + slots[s].file_idx, slots[s].file_idx, read, proc, user);
+            for(; next < count && !ec; next++) ec = _mglsl_batch_serial(files + next, next, read, proc, user);
+            return ec;
+        }
+
+        unsigned long long user_data; int res;
+        while(_mglsl_uring_cqe(ring, &user_data, &res)) {
+            int op = (int)(user_data & 3);
+            size_t slot = (size_t)(user_data >> 2);
+
+            if(op == _MGLSL_URING_CLOSE) {
+                closing--;
+                continue;
+            }
+
+            _mglsl_UringFile * uf = slots + slot;
+            _mglsl_BatchFile * file = files + uf->file_idx;
+            uf->waiting--;
+
+            if(op == _MGLSL_URING_STATX) {
+                _MGLSL_STAT_ADD(stat_calls, 1);
+                if(res == -ENOENT || res == -ENOTDIR) file->ec = MGLSL_E_FILE_NOT_FOUND;
+                else if(res < 0) uf->failed = 1;
+                else {
+                    file->mtime = (time_t)uf->stx.stx_mtime.tv_sec;
+                    file->size = (size_t)uf->stx.stx_size;
+                }
+
+            } else if(op == _MGLSL_URING_OPEN) {
+                if(res < 0) uf->failed = 1;
+                else uf->fd = res;
+
+            } else if(op == _MGLSL_URING_READ) {
+                if(res < 0) uf->failed = 1;
+                else if(res == 0) file->size = uf->done; // file got shorter
+                else if((uf->done += (size_t)res) < file->size) {
+                    _mglsl_uring_read_next(ring, uf, file, slot);
+                    continue;
+                }
+            }
+
+            if(uf->waiting) continue;
+
+            // stat and open are done, now read
+            if(read && !ec && !file->ec && !uf->failed && !file->buf) {
+                file->buf = MGLSL_ALLOC(file->size + 1);
+                if(!file->buf) {
+                    file->ec = MGLSL_E_ALLOC;
+                } else if(file->size) {
+                    _mglsl_uring_read_next(ring, uf, file, slot);
+                    continue;
+                }
+            }
+
+            if(uf->fd >= 0) {
+                _mglsl_uring_sqe(ring, IORING_OP_CLOSE, uf->fd, slot, _MGLSL_URING_CLOSE);
+                closing++;
+            }
+
+            uf->used = 0;
+            active--;
+
+            if(uf->failed && !file->ec) {
+                if(file->buf) MGLSL_FREE(file->buf);
+                file->buf = NULL;
+                if(!ec) ec = _mglsl_batch_serial(file, uf->file_idx, read, proc, user);
+                continue;
+            }
+
+            if(file->buf) {
+                ((char*)file->buf)[file->size] = '\0';
+                _MGLSL_STAT_ADD(read_calls, 1);
+                _mglsl_stats_live(file->size + 1, 0);
+            }
+
+            // after an error nobody wants the rest
+            if(ec) {
+                if(file->buf) _mglsl_free_file_buf(file->buf, file->size);
+                continue;
+            }
+
+            if(file->ec && file->buf) {
+                _mglsl_free_file_buf(file->buf, file->size);
+                file->buf = NULL;
+            }
+
+            ec = proc(file, uf->file_idx, user);
+        }
+    }
+
+    _mglsl_free(slots);
+    return ec;
+}
+#endif
+
+// Stats, and reads if read is set, count files. proc is called for each of them
+// and loading stops at first error it returns.
+static int _mglsl_batch_load
+    (_mglsl_BatchFile * files, size_t count, int read, _mglsl_BatchFileProc * proc, void * user)
+{
+#ifdef _MGLSL_IO_URING
+    _mglsl_Uring ring;
+    if(count > 1 && !_mglsl_uring_init(&ring, _MGLSL_URING_ENTRIES)) {
+        int ec = _mglsl_batch_uring(&ring, files, count, read, proc, user);
+        _mglsl_uring_exit(&ring);
+        return ec;
+    }
+#endif
+
+    int ec = MGLSL_E_SUCCESS;
+    for(size_t i=0; i<count && !ec; i++) ec = _mglsl_batch_serial(files + i, i, read, proc, user);
+    return ec;
+}
+
+//
+// FILE CHANGE WATCH
+
+
+
+//
+// CONDITION EVALUATION
+// Conditions of requirements are evaluated against defines of a variant, with the
+// subset of preprocessor expressions which makes sense there. Undefined names are 0,
+// names defined without value are 1 and values are expanded. Whatever does not
+// evaluate is true, module is better required than missing. So are conditions on
+// macros some module of the shader '#define's or '#undef's, defines alone do not
+// decide them, since emitted modules come before the requiring one.
+
+#define _MGLSL_MAX_DEFINE_EXPANSION 16
+
+typedef struct {
+    const mglsl_DefineArr * defines;
+    size_t * macros; // hashes of macros defined or undefined by modules, see _mglsl_collect_macros
+    size_t macros_len;
+    size_t macros_cap;
+} _mglsl_CondEnv;
+
+typedef struct {
+    const char * cur;
+    const _mglsl_CondEnv * env;
+    int expansion;
+    int error;
+} _mglsl_CondEval;
+
+static long long _mglsl_cond_eval_or(_mglsl_CondEval * ev);
+
+static int _mglsl_cond_accept(_mglsl_CondEval * ev, const char * op)
+{
+    size_t len = strlen(op);
+    ev->cur = _mglsl_cur_skip_white(ev->cur);
+    if(strncmp(ev->cur, op, len)) return 0;
+    ev->cur += len;
+    return 1;
+}
+
+static const mglsl_Define * _mglsl_find_define
+    (const mglsl_DefineArr * defines, const char * name, size_t name_len)
+{
+    for(size_t i=0; i<defines->size; i++) {
+        const mglsl_Define * define = defines->data + i;
+        _MGLSL_STAT_ADD(string_compares, 1);
+        if(!strncmp(define->name, name, name_len) && define->name[name_len] == '\0') return define;
+    }
+    return NULL;
+}
+
+static int _mglsl_cond_is_macro(const _mglsl_CondEnv * env, const char * name, size_t name_len)
+{
+    size_t hash = _mglsl_hash(name, name_len);
+    for(size_t i=0; i<env->macros_len; i++)
+        if(env->macros[i] == hash) return 1;
+    return 0;
+}
+
+static long long _mglsl_cond_eval_primary(_mglsl_CondEval * ev)
+{
+    if(_mglsl_cond_accept(ev, "(")) {
+        long long value = _mglsl_cond_eval_or(ev);
+        if(!_mglsl_cond_accept(ev, ")")) ev->error = 1;
+        return value;
+    }
+
+    const char * cur = ev->cur;
+
+    if(_mglsl_is_number(*cur)) {
+        unsigned long long value = 0, base = 10;
+        if(cur[0] == '0' && (cur[1] == 'x' || cur[1] == 'X')) { base = 16; cur += 2; }
+        else if(cur[0] == '0') base = 8;
+
+        for(;; cur++) {
+            int digit;
+            /**/ if(_mglsl_is_number(*cur))   digit = *cur - '0';
+            else if(*cur >= 'a' && *cur <= 'f') digit = *cur - 'a' + 10;
+            else if(*cur >= 'A' && *cur <= 'F') digit = *cur - 'A' + 10;
+            else break;
+
+            if((unsigned)digit >= base) break;
+            value = value * base + digit;
+        }
+
+        while(*cur == 'u' || *cur == 'U') cur++;
+        if(_mglsl_is_ident_char(*cur)) ev->error = 1;
+        ev->cur = cur;
+        return (long long)value;
+    }
+
+    if(!_mglsl_is_letter(*cur) && *cur != '_') {
+        ev->error = 1;
+        return 0;
+    }
+
+    const char * name = cur;
+    while(_mglsl_is_ident_char(*cur)) cur++;
+    size_t name_len = cur - name;
+    ev->cur = cur;
+
+    if(name_len == 7 && !memcmp(name, "defined", 7)) {
+        int paren = _mglsl_cond_accept(ev, "(");
+
+        name = ev->cur = _mglsl_cur_skip_white(ev->cur);
+        while(_mglsl_is_ident_char(*ev->cur)) ev->cur++;
+        name_len = ev->cur - name;
+
+        if(!name_len || (paren && !_mglsl_cond_accept(ev, ")"))) ev->error = 1;
+        if(_mglsl_cond_is_macro(ev->env, name, name_len)) ev->error = 1;
+        return _mglsl_find_define(ev->env->defines, name, name_len) != NULL;
+    }
+
+    if(_mglsl_cond_is_macro(ev->env, name, name_len)) {
+        ev->error = 1;
+        return 0;
+    }
+
+    const mglsl_Define * define = _mglsl_find_define(ev->env->defines, name, name_len);
+    if(!define) return 0;
+    if(!define->value || !*_mglsl_cur_skip_white(define->value)) return 1;
+
+    if(ev->expansion >= _MGLSL_MAX_DEFINE_EXPANSION) {
+        ev->error = 1;
+        return 0;
+    }
+
+    _mglsl_CondEval value_ev = *ev;
+    value_ev.cur = define->value;
+    value_ev.expansion++;
+
+    long long value = _mglsl_cond_eval_or(&value_ev);
+    if(*_mglsl_cur_skip_white(value_ev.cur) != '\0') value_ev.error = 1;
+    if(value_ev.error) ev->error = 1;
+    return value;
+}
+
+static long long _mglsl_cond_eval_unary(_mglsl_CondEval * ev)
+{
+    if(_mglsl_cond_accept(ev, "!")) return !_mglsl_cond_eval_unary(ev);
+    if(_mglsl_cond_accept(ev, "-")) return -_mglsl_cond_eval_unary(ev);
+    if(_mglsl_cond_accept(ev, "+")) return _mglsl_cond_eval_unary(ev);
+    return _mglsl_cond_eval_primary(ev);
+}
+
+static long long _mglsl_cond_eval_mul(_mglsl_CondEval * ev)
+{
+    long long value = _mglsl_cond_eval_unary(ev);
+    for(;;) {
+        if(_mglsl_cond_accept(ev, "*")) value *= _mglsl_cond_eval_unary(ev);
+        else if(_mglsl_cond_accept(ev, "/") || _mglsl_cond_accept(ev, "%")) {
+            char op = ev->cur[-1];
+            long long rhs = _mglsl_cond_eval_unary(ev);
+            if(rhs == 0) { ev->error = 1; return 0; }
+            value = op == '/' ? value / rhs : value % rhs;
+        } else return value;
+    }
+}
+
+static long long _mglsl_cond_eval_add(_mglsl_CondEval * ev)
+{
+    long long value = _mglsl_cond_eval_mul(ev);
+    for(;;) {
+        if(_mglsl_cond_accept(ev, "+")) value += _mglsl_cond_eval_mul(ev);
+        else if(_mglsl_cond_accept(ev, "-")) value -= _mglsl_cond_eval_mul(ev);
+        else return value;
+    }
+}
+
+static long long _mglsl_cond_eval_cmp(_mglsl_CondEval * ev)
+{
+    long long value = _mglsl_cond_eval_add(ev);
+    for(;;) {
+        /**/ if(_mglsl_cond_accept(ev, "==")) value = value == _mglsl_cond_eval_add(ev);
+        else if(_mglsl_cond_accept(ev, "!=")) value = value != _mglsl_cond_eval_add(ev);
+        else if(_mglsl_cond_accept(ev, "<=")) value = value <= _mglsl_cond_eval_add(ev);
+        else if(_mglsl_cond_accept(ev, ">=")) value = value >= _mglsl_cond_eval_add(ev);
+        else if(_mglsl_cond_accept(ev, "<"))  value = value <  _mglsl_cond_eval_add(ev);
+        else if(_mglsl_cond_accept(ev, ">"))  value = value >  _mglsl_cond_eval_add(ev);
+        else return value;
+    }
+}
+
+static long long _mglsl_cond_eval_and(_mglsl_CondEval * ev)
+{
+    long long value = _mglsl_cond_eval_cmp(ev);
+    while(_mglsl_cond_accept(ev, "&&")) {
+        long long rhs = _mglsl_cond_eval_cmp(ev);
+        value = value && rhs;
+    }
+    return value;
+}
+
+static long long _mglsl_cond_eval_or(_mglsl_CondEval * ev)
+{
+    long long value = _mglsl_cond_eval_and(ev);
+    while(_mglsl_cond_accept(ev, "||")) {
+        long long rhs = _mglsl_cond_eval_and(ev);
+        value = value || rhs;
+    }
+    return value;
+}
+
+// Whether requirement with condition cond holds for the defines of env, NULL condition always does.
+static int _mglsl_eval_cond(const char * cond, const _mglsl_CondEnv * env)
+{
+    if(!cond) return 1;
+
+    _mglsl_CondEval ev;
+    ev.cur = cond;
+    ev.env = env;
+    ev.expansion = 0;
+    ev.error = 0;
+
+    long long value = _mglsl_cond_eval_or(&ev);
+    if(*_mglsl_cur_skip_white(ev.cur) != '\0') ev.error = 1;
+
+    return ev.error || value != 0;
+}
+
+static int _mglsl_collect_source_macros(_mglsl_CondEnv * env, const char * src)
+{
+    for(const char * cur = src; *cur != '\0'; cur = _mglsl_cur_skip_line(cur)) {
+        cur = _mglsl_cur_skip_white(cur);
+        if(*cur != '#') continue;
+
+        for(cur++; _mglsl_is_space(*cur); cur++);
+        if(!strncmp(cur, "define", 6)) cur += 6;
+        else if(!strncmp(cur, "undef", 5)) cur += 5;
+        else continue;
+
+        if(!_mglsl_is_space(*cur)) continue;
+        while(_mglsl_is_space(*cur)) cur++;
+
+        const char * name = cur;
+        while(_mglsl_is_ident_char(*cur)) cur++;
+        if(cur == name) continue;
+
+        if(env->macros_len == env->macros_cap) {
+            size_t cap = env->macros_cap ? env->macros_cap * 2 : 16;
+            size_t * macros = (size_t*)_mglsl_realloc(env->macros, cap * sizeof(size_t));
+            if(!macros) return MGLSL_E_REALLOC;
+            env->macros = macros;
+            env->macros_cap = cap;
+        }
+        env->macros[env->macros_len++] = _mglsl_hash(name, cur - name);
+    }
+    return MGLSL_E_SUCCESS;
+}
+
+// Adds macros the modules in order '#define' or '#undef' to env, anywhere in their sources.
+// Lines which only look like directives, e.g. in comments, add more than needed, which is safe.
+static int _mglsl_collect_macros
+    (_mglsl_CondEnv * env, const size_t * order, size_t order_len, mglsl_ModuleArr module_arr)
+{
+    for(size_t i=0; i<order_len; i++) {
+        const mglsl_Module * module = module_arr.data + order[i];
+        int ec;
+
+#ifdef _MGLSL_COMPRESS_SOURCES
+        if(module->_packed_len) {
+            char * source = (char*)_mglsl_alloc(module->_source_len + 1);
+            if(!source) return MGLSL_E_ALLOC;
+
+            ec = _mglsl_lz_decompress(source, module->_source_len, module->source, module->_packed_len);
+            source[module->_source_len] = '\0';
+            if(!ec) ec = _mglsl_collect_source_macros(env, source);
+
+            _mglsl_free(source);
+            if(ec) return ec;
+            continue;
+        }
+#endif
+
+        ec = _mglsl_collect_source_macros(env, module->source);
+        if(ec) return ec;
+    }
+    return MGLSL_E_SUCCESS;
+}
+
+//
+// TOPOLOGICAL SORT
+// Depth first search from the root over module graph, every module is appended to order
+// after all of its dependencies, which makes it the order of emission. Finished modules are
+// never entered again. Requirements with conditions not met by defines are skipped,
+// without defines all of them are followed. So are modules typed for none of stages.
+
+static int _mglsl_toposort_rec_visit
+    (size_t * order, size_t * order_len, size_t module_idx, _mglsl_Graph * graph,
+     mglsl_ModuleArr module_arr, const _mglsl_CondEnv * env, unsigned int stages)
+{
+    _MGLSL_ASSERT(module_idx < graph->size);
+
+    unsigned char * marks = graph->marks + module_idx;
+
+    if(*marks & MGLSL_PERM_MARK) return MGLSL_E_SUCCESS;
+
+    if(*marks & MGLSL_TEMP_MARK) {
+        _mglsl_err_name = _mglsl_str(module_arr.data[module_idx].name);
+        return MGLSL_E_CIRCULAR_DEP;
+    }
+
+    *marks |= MGLSL_TEMP_MARK;
+
+    for(unsigned int e=graph->dep_begin[module_idx]; e<graph->dep_begin[module_idx + 1]; e++) {
+        if(env && !_mglsl_eval_cond(graph->dep_cond[e], env)) continue;
+
+        if(graph->dep_idx[e] == _MGLSL_NO_MODULE) {
+            const mglsl_Module * module = module_arr.data + module_idx;
+            _mglsl_err_name = _mglsl_str(module->deps[e - graph->dep_begin[module_idx]]);
+            return MGLSL_E_MISSING_DEP;
+        }
+        if(!(graph->stages[graph->dep_idx[e]] & stages)) continue;
+
+        int ec = _mglsl_toposort_rec_visit(order, order_len, graph->dep_idx[e], graph, module_arr, env, stages);
+        if(ec) return ec;
+    }
+
+    *marks &= ~MGLSL_TEMP_MARK;
+    *marks |= MGLSL_PERM_MARK;
+
+    order[(*order_len)++] = module_idx;
+
+    return MGLSL_E_SUCCESS;
+}
+
+// Order has to have room for all modules in module_arr.
+static int _mglsl_toposort_modules
+    (size_t * order, size_t * order_len, size_t root_idx, _mglsl_Graph * graph,
+     mglsl_ModuleArr module_arr, const _mglsl_CondEnv * env, unsigned int stages)
+{
+    memset(graph->marks, 0, graph->size);
+
+    _MGLSL_PROBE2(toposort_start, _mglsl_str(module_arr.data[root_idx].name), module_arr.size);
+
+    int ec = MGLSL_E_SUCCESS;
+    *order_len = 0;
+    if(graph->stages[root_idx] & stages)
+        ec = _mglsl_toposort_rec_visit(order, order_len, root_idx, graph, module_arr, env, stages);
+
+    _MGLSL_PROBE3(toposort_done, _mglsl_str(module_arr.data[root_idx].name), *order_len, ec);
+    return ec;
+}
+
+// Order is empty if root module is typed for none of stages, 0 stands for all of them.
+static int _mglsl_resolve
+    (size_t * order, size_t * order_len, const char * root_module_name, _mglsl_Graph * graph,
+     mglsl_ModuleArr module_arr, const _mglsl_CondEnv * env, unsigned int stages)
+{
+    _MGLSL_STAT_TIMER(link_t);
+
+    size_t root_idx;
+    int ec = _mglsl_find_module(&root_idx, root_module_name, module_arr);
+    if(ec) {
+        _mglsl_err_name = root_module_name;
+        return ec;
+    }
+
+    ec = _mglsl_toposort_modules(order, order_len, root_idx, graph, module_arr, env,
+                                 stages ? stages : _MGLSL_ALL_STAGES);
+
+    _MGLSL_STAT_TIME(link_ns, link_t);
+    return ec;
+}
+
+//
+// ASSEMBLY
+
+// Local identifier renamed by minifier.
+typedef struct {
+    const char * name;
+    size_t name_len;
+    char short_name[8];
+    unsigned int active; // how many declarations of it are in scope
+} _mglsl_MinifyName;
+
+typedef struct {
+    size_t name_idx;
+    int depth;
+} _mglsl_MinifyScope;
+
+typedef struct {
+    int rename;
+
+    char last;          // last emitted character, '\n' at the beginning
+    int need_newline;   // after directive
+    _mglsl_Token prev;  // previous token of the same chunk
+    int prev_is_type;
+    int prev_is_dot;
+
+    int depth, paren;
+    unsigned long long code_braces; // bit per brace depth, set for code blocks
+    int struct_braces;              // number of open non-code braces inside functions
+    int fn_params, fn_pending, fn_body;
+    int decl_list, decl_paren;
+    int struct_next;
+
+    // names declared with 'struct' are types too
+    const char ** struct_names;
+    size_t * struct_name_lens;
+    size_t struct_names_len, struct_names_cap;
+
+    _mglsl_MinifyName * names;
+    size_t names_len, names_cap;
+    _mglsl_MinifyScope * scopes;
+    size_t scopes_len, scopes_cap;
+
+    // hashes of identifiers used by macro bodies seen so far, open addressing,
+    // 0 marks empty slot; such locals keep their names so macros still refer to them
+    size_t * macro_words;
+    size_t macro_words_len, macro_words_cap;
+
+#ifdef _MGLSL_COMPRESS_SOURCES
+    // decompressed module sources names above point into, freed together with minifier
+    char ** sources;
+    size_t sources_len, sources_cap;
+#endif
+} _mglsl_Minifier;
+
+typedef struct {
+    char * buf;
+    size_t len;
+    size_t cap;
+    int error;
+
+    // when set, buf is fixed staging buffer handed over to sink whenever it fills up
+    mglsl_WriteProc * sink;
+    void * sink_user;
+    size_t total; // bytes emitted so far, flushed or not
+    char last;    // last emitted character
+
+    // lines are only counted when they are needed for line map or directives
+    int track_lines;
+    unsigned int line;
+    mglsl_LineMap * line_map;
+    size_t line_map_cap;
+
+    _mglsl_Minifier * minify;
+} _mglsl_Emitter;
+
+static void _mglsl_emit_flush(_mglsl_Emitter * em)
+{
+    if(!em->error && em->len && em->sink(em->buf, em->len, em->sink_user))
+        em->error = MGLSL_E_WRITE;
+    em->len = 0;
+}
+
+static void _mglsl_emit_count(_mglsl_Emitter * em, const char * str, size_t len)
+{
+    if(em->track_lines) {
+        const char * cur = str, * end = str + len;
+        while((cur = (const char*)memchr(cur, '\n', end - cur))) { em->line++; cur++; }
+    }
+
+    em->total += len;
+    em->last = str[len - 1];
+}
+
+// Room for len bytes written in place at the end of in-memory output,
+// they are emitted with _mglsl_emit_commit. NULL on error.
+static char * _mglsl_emit_reserve(_mglsl_Emitter * em, size_t len)
+{
+    _MGLSL_ASSERT(!em->sink);
+    if(em->error) return NULL;
+
+    // buffer is sized up front, this only happens when some pass makes output grow
+    if(em->cap - em->len < len) {
+        size_t cap = em->cap * 2 > em->len + len ? em->cap * 2 : em->len + len;
+        char * buf = (char*)_mglsl_realloc(em->buf, cap + 1);
+        if(!buf) { em->error = MGLSL_E_REALLOC; return NULL; }
+        em->buf = buf;
+        em->cap = cap;
+    }
+
+    return em->buf + em->len;
+}
+
+static void _mglsl_emit_commit(_mglsl_Emitter * em, size_t len)
+{
+    if(!len) return;
+    _mglsl_emit_count(em, em->buf + em->len, len);
+    em->len += len;
+}
+
+static void _mglsl_emit_raw(_mglsl_Emitter * em, const char * str, size_t len)
+{
+    if(em->error || !len) return;
+
+    if(em->sink) {
+        _mglsl_emit_count(em, str, len);
+
+        while(len && !em->error) {
+            size_t chunk = em->cap - em->len < len ? em->cap - em->len : len;
+            memcpy(em->buf + em->len, str, chunk);
+            em->len += chunk;
+            str += chunk;
+            len -= chunk;
+            if(em->len == em->cap) _mglsl_emit_flush(em);
+        }
+        return;
+    }
+
+    char * dst = _mglsl_emit_reserve(em, len);
+    if(!dst) return;
+
+    memcpy(dst, str, len);
+    _mglsl_emit_commit(em, len);
+}
+
+//
+// MINIFICATION
+// Done on the fly while emitting, tokens never span emitted chunks since
+// those are whole lines of module sources.
+
+// Lookups below run for every identifier of minified shader, so they switch on
+// first character and compare only candidates of the same length.
+#define _MGLSL_WORD_IS(STR) (len == sizeof(STR) - 1 && !memcmp(s, STR, sizeof(STR) - 1))
+#define _MGLSL_WORD_HAS_PREFIX(STR) (len > sizeof(STR) - 1 && !memcmp(s, STR, sizeof(STR) - 1))
+
+// vectors and matrices end with size, opaque types with anything, e.g. sampler2DArray
+#define _MGLSL_WORD_IS_VEC(STR) (_MGLSL_WORD_HAS_PREFIX(STR) && _mglsl_is_number(s[sizeof(STR) - 1]))
+
+static int _mglsl_is_builtin_type(const _mglsl_Token * tok) {
+    const char * s = tok->begin;
+    size_t len = tok->end - tok->begin;
+
+    switch(*s) {
+    case 'a': return _MGLSL_WORD_IS("atomic_uint");
+    case 'b': return _MGLSL_WORD_IS("bool") || _MGLSL_WORD_IS_VEC("bvec");
+    case 'd': return _MGLSL_WORD_IS("double") || _MGLSL_WORD_IS_VEC("dvec") || _MGLSL_WORD_IS_VEC("dmat");
+    case 'f': return _MGLSL_WORD_IS("float");
+    case 'i': return _MGLSL_WORD_IS("int") || _MGLSL_WORD_IS_VEC("ivec") || _MGLSL_WORD_HAS_PREFIX("image") ||
+                     _MGLSL_WORD_HAS_PREFIX("isampler") || _MGLSL_WORD_HAS_PREFIX("iimage") ||
+                     _MGLSL_WORD_HAS_PREFIX("itexture");
+    case 'm': return _MGLSL_WORD_IS_VEC("mat");
+    case 's': return _MGLSL_WORD_HAS_PREFIX("sampler");
+    case 't': return _MGLSL_WORD_HAS_PREFIX("texture");
+    case 'u': return _MGLSL_WORD_IS("uint") || _MGLSL_WORD_IS_VEC("uvec") || _MGLSL_WORD_HAS_PREFIX("usampler") ||
+                     _MGLSL_WORD_HAS_PREFIX("uimage") || _MGLSL_WORD_HAS_PREFIX("utexture");
+    case 'v': return _MGLSL_WORD_IS("void") || _MGLSL_WORD_IS_VEC("vec");
+    }
+    return 0;
+}
+
+static int _mglsl_minify_is_keyword(const _mglsl_Token * tok) {
+    const char * s = tok->begin;
+    size_t len = tok->end - tok->begin;
+
+    switch(*s) {
+    case 'a': return _MGLSL_WORD_IS("attribute");
+    case 'b': return _MGLSL_WORD_IS("buffer") || _MGLSL_WORD_IS("break");
+    case 'c': return _MGLSL_WORD_IS("const") || _MGLSL_WORD_IS("centroid") || _MGLSL_WORD_IS("coherent") ||
+                     _MGLSL_WORD_IS("case") || _MGLSL_WORD_IS("continue");
+    case 'd': return _MGLSL_WORD_IS("do") || _MGLSL_WORD_IS("default") || _MGLSL_WORD_IS("discard");
+    case 'e': return _MGLSL_WORD_IS("else");
+    case 'f': return _MGLSL_WORD_IS("flat") || _MGLSL_WORD_IS("for") || _MGLSL_WORD_IS("false");
+    case 'h': return _MGLSL_WORD_IS("highp");
+    case 'i': return _MGLSL_WORD_IS("in") || _MGLSL_WORD_IS("inout") || _MGLSL_WORD_IS("invariant") ||
+                     _MGLSL_WORD_IS("if");
+    case 'l': return _MGLSL_WORD_IS("layout") || _MGLSL_WORD_IS("lowp");
+    case 'm': return _MGLSL_WORD_IS("mediump");
+    case 'n': return _MGLSL_WORD_IS("noperspective");
+    case 'o': return _MGLSL_WORD_IS("out");
+    case 'p': return _MGLSL_WORD_IS("patch") || _MGLSL_WORD_IS("precise") || _MGLSL_WORD_IS("precision");
+    case 'r': return _MGLSL_WORD_IS("restrict") || _MGLSL_WORD_IS("readonly") || _MGLSL_WORD_IS("return");
+    case 's': return _MGLSL_WORD_IS("shared") || _MGLSL_WORD_IS("smooth") || _MGLSL_WORD_IS("sample") ||
+                     _MGLSL_WORD_IS("switch") || _MGLSL_WORD_IS("struct");
+    case 't': return _MGLSL_WORD_IS("true");
+    case 'u': return _MGLSL_WORD_IS("uniform");
+    case 'v': return _MGLSL_WORD_IS("varying") || _MGLSL_WORD_IS("volatile");
+    case 'w': return _MGLSL_WORD_IS("writeonly") || _MGLSL_WORD_IS("while");
+    }
+    return 0;
+}
+
+#undef _MGLSL_WORD_IS_VEC
+#undef _MGLSL_WORD_HAS_PREFIX
+#undef _MGLSL_WORD_IS
+
+static int _mglsl_minify_is_struct(const _mglsl_Minifier * mf, const _mglsl_Token * tok) {
+    size_t len = tok->end - tok->begin;
+    for(size_t i=0; i<mf->struct_names_len; i++)
+        if(mf->struct_name_lens[i] == len && !memcmp(mf->struct_names[i], tok->begin, len)) return 1;
+    return 0;
+}
+
+static _mglsl_MinifyName * _mglsl_minify_find(_mglsl_Minifier * mf, const char * name, size_t len) {
+    for(size_t i=0; i<mf->names_len; i++)
+        if(mf->names[i].name_len == len && !memcmp(mf->names[i].name, name, len)) return mf->names + i;
+    return NULL;
+}
+
+// Grows array of given element size, on failure renaming is turned off
+// for the rest of the shader, which is always safe.
+static int _mglsl_minify_grow(_mglsl_Minifier * mf, void ** arr, size_t * cap, size_t len, size_t elem) {
+    if(len < *cap) return 1;
+
+    size_t new_cap = *cap ? *cap * 2 : 16;
+    void * new_arr = *arr ? _mglsl_realloc(*arr, new_cap * elem) : _mglsl_alloc(new_cap * elem);
+    if(!new_arr) { mf->rename = 0; return 0; }
+
+    *arr = new_arr;
+    *cap = new_cap;
+    return 1;
+}
+
+static inline size_t _mglsl_minify_word_hash(const char * word, size_t len) {
+    size_t hash = _mglsl_hash(word, len);
+    return hash ? hash : 1;
+}
+
+static int _mglsl_minify_in_macro(const _mglsl_Minifier * mf, const char * word, size_t len) {
+    if(!mf->macro_words_len) return 0;
+
+    size_t mask = mf->macro_words_cap - 1;
+    size_t hash = _mglsl_minify_word_hash(word, len);
+    for(size_t slot = hash & mask; mf->macro_words[slot]; slot = (slot + 1) & mask)
+        if(mf->macro_words[slot] == hash) return 1;
+    return 0;
+}
+
+static void _mglsl_minify_add_macro_word(_mglsl_Minifier * mf, const char * word, size_t len) {
+    if(_mglsl_minify_in_macro(mf, word, len)) return;
+
+    // kept at most half full
+    if(2 * (mf->macro_words_len + 1) > mf->macro_words_cap) {
+        size_t cap = mf->macro_words_cap ? mf->macro_words_cap * 2 : 64;
+        size_t * words = (size_t*)_mglsl_alloc(cap * sizeof(size_t));
+        if(!words) { mf->rename = 0; return; }
+        memset(words, 0, cap * sizeof(size_t));
+
+        for(size_t i=0; i<mf->macro_words_cap; i++) {
+            size_t hash = mf->macro_words[i], slot = hash & (cap - 1);
+            if(!hash) continue;
+            while(words[slot]) slot = (slot + 1) & (cap - 1);
+            words[slot] = hash;
+        }
+        if(mf->macro_words) _mglsl_free(mf->macro_words);
+        mf->macro_words = words;
+        mf->macro_words_cap = cap;
+    }
+
+    size_t mask = mf->macro_words_cap - 1;
+    size_t hash = _mglsl_minify_word_hash(word, len), slot = hash & mask;
+    while(mf->macro_words[slot]) slot = (slot + 1) & mask;
+    mf->macro_words[slot] = hash;
+    mf->macro_words_len++;
+}
+
+// Collects identifiers of '#define' bodies of module source before it is emitted.
+// Parameters of function-like macros are left out, everything else a body mentions
+// keeps its name, including words in comments, which only makes renaming do less.
+static void _mglsl_minify_scan_macros(_mglsl_Minifier * mf, const char * source, size_t len)
+{
+    const char * cur = source, * end = source + len;
+
+    while(mf->rename && (cur = (const char*)memchr(cur, '#', end - cur))) {
+        const char * hash = cur++;
+        if(!_mglsl_is_line_begin(source, hash)) continue;
+
+        while(cur < end && (*cur == ' ' || *cur == '\t')) cur++;
+        if(end - cur < 7 || memcmp(cur, "define", 6) || _mglsl_is_ident_char(cur[6])) continue;
+        cur += 6;
+
+        _mglsl_Token tok;
+        const char * line_end = _mglsl_lex(&tok, source, hash, end);
+
+        // macro name, then parameters if it is directly followed by '('
+        while(cur < line_end && !_mglsl_is_ident_char(*cur)) cur++;
+        while(cur < line_end && _mglsl_is_ident_char(*cur)) cur++;
+
+        const char * params = NULL, * params_end = NULL;
+        if(cur < line_end && *cur == '(') {
+            params = ++cur;
+            while(cur < line_end && *cur != ')') cur++;
+            params_end = cur;
+        }
+
+        while(cur < line_end) {
+            if(!_mglsl_is_letter(*cur) && *cur != '_') {
+                // numbers with suffixes are not words
+                if(_mglsl_is_number(*cur)) while(cur < line_end && _mglsl_is_ident_char(*cur)) cur++;
+                else cur++;
+                continue;
+            }
+
+            const char * word = cur;
+            while(cur < line_end && _mglsl_is_ident_char(*cur)) cur++;
+            size_t word_len = cur - word;
+
+            int param = 0;
+            for(const char * p = params; p && p < params_end && !param;) {
+                while(p < params_end && !_mglsl_is_ident_char(*p)) p++;
+                const char * name = p;
+                while(p < params_end && _mglsl_is_ident_char(*p)) p++;
+                param = (size_t)(p - name) == word_len && !memcmp(name, word, word_len);
+            }
+            if(!param) _mglsl_minify_add_macro_word(mf, word, word_len);
+        }
+    }
+}
+
+static void _mglsl_minify_end_function(_mglsl_Minifier * mf) {
+    mf->names_len = mf->scopes_len = 0;
+    mf->fn_params = mf->fn_pending = mf->fn_body = 0;
+    mf->decl_list = mf->struct_braces = 0;
+}
+
+static void _mglsl_minify_declare(_mglsl_Minifier * mf, const _mglsl_Token * tok, int depth) {
+    size_t len = tok->end - tok->begin;
+    _mglsl_MinifyName * name = _mglsl_minify_find(mf, tok->begin, len);
+
+    if(!name) {
+        if(!_mglsl_minify_grow(mf, (void**)&mf->names, &mf->names_cap, mf->names_len, sizeof(_mglsl_MinifyName)))
+            return;
+
+        name = mf->names + mf->names_len;
+        name->name = tok->begin;
+        name->name_len = len;
+        name->active = 0;
+
+        // next short name not taken by any name of this function
+        for(size_t n = mf->names_len;; n++) {
+            char buf[8]; size_t i = 0;
+            buf[i++] = '_';
+            for(size_t v = n; i < 7; v = v / 26 - 1) { buf[i++] = 'a' + v % 26; if(v < 26) break; }
+            buf[i] = '\0';
+
+            int taken = 0;
+            for(size_t j=0; j<mf->names_len && !taken; j++)
+                taken = !strcmp(mf->names[j].short_name, buf) ||
+                        (mf->names[j].name_len == i && !memcmp(mf->names[j].name, buf, i));
+            if(taken) continue;
+
+            // names already short enough stay as they are
+            if(len <= i && !_mglsl_minify_find(mf, buf, i)) {
+                int clash = 0;
+                for(size_t j=0; j<mf->names_len && !clash; j++)
+                    clash = strlen(mf->names[j].short_name) == len && !memcmp(mf->names[j].short_name, tok->begin, len);
+                if(!clash && len < sizeof(buf)) {
+                    memcpy(name->short_name, tok->begin, len);
+                    name->short_name[len] = '\0';
+                    break;
+                }
+            }
+            memcpy(name->short_name, buf, i + 1);
+            break;
+        }
+        mf->names_len++;
+    }
+
+    if(!_mglsl_minify_grow(mf, (void**)&mf->scopes, &mf->scopes_cap, mf->scopes_len, sizeof(_mglsl_MinifyScope)))
+        return;
+
+    mf->scopes[mf->scopes_len].name_idx = name - mf->names;
+    mf->scopes[mf->scopes_len].depth = depth;
+    mf->scopes_len++;
+    name->active++;
+}
+
+// Tracks just enough of the structure to know where locals are declared and
+// returns replacement for identifier token or NULL if it is to be kept.
+static const char * _mglsl_minify_track(_mglsl_Minifier * mf, const _mglsl_Token * tok)
+{
+    const char * replacement = NULL;
+    int in_function = mf->fn_params || mf->fn_body;
+    int is_type = 0;
+
+    if(tok->kind == _MGLSL_TOK_IDENT) {
+        if(mf->struct_next) {
+            if(_mglsl_minify_grow(mf, (void**)&mf->struct_names, &mf->struct_names_cap, mf->struct_names_len, sizeof(char*))) {
+                size_t cap = mf->struct_names_cap;
+                // lens array is grown in lockstep with names
+                size_t * lens = (size_t*)(mf->struct_name_lens ?
+                    _mglsl_realloc(mf->struct_name_lens, cap * sizeof(size_t)) : _mglsl_alloc(cap * sizeof(size_t)));
+                if(lens) {
+                    mf->struct_name_lens = lens;
+                    mf->struct_names[mf->struct_names_len] = tok->begin;
+                    mf->struct_name_lens[mf->struct_names_len++] = tok->end - tok->begin;
+                } else mf->rename = 0;
+            }
+            mf->struct_next = 0;
+            is_type = 1;
+
+        } else if(_mglsl_tok_is(tok, "struct")) {
+            mf->struct_next = 1;
+
+        } else if(!mf->prev_is_dot) {
+            is_type = _mglsl_is_builtin_type(tok) || _mglsl_minify_is_struct(mf, tok);
+
+            int declaration = in_function && !is_type && !mf->struct_braces &&
+                (mf->prev_is_type || (mf->decl_list && _mglsl_tok_is_punct(&mf->prev, ',') && mf->paren == mf->decl_paren)) &&
+                !_mglsl_minify_is_keyword(tok) && !_mglsl_minify_in_macro(mf, tok->begin, tok->end - tok->begin);
+
+            if(declaration) {
+                _mglsl_minify_declare(mf, tok, mf->fn_body ? mf->depth : 1);
+                if(mf->fn_body) {
+                    mf->decl_list = 1;
+                    mf->decl_paren = mf->paren;
+                }
+            }
+
+            _mglsl_MinifyName * name = in_function ? _mglsl_minify_find(mf, tok->begin, tok->end - tok->begin) : NULL;
+            if(name && name->active) replacement = name->short_name;
+        }
+
+    } else if(tok->kind == _MGLSL_TOK_PUNCT) {
+        switch(*tok->begin) {
+        case '(':
+            if(mf->depth == 0 && mf->paren == 0 && mf->prev.kind == _MGLSL_TOK_IDENT &&
+               !_mglsl_tok_is(&mf->prev, "layout") && !mf->fn_pending) {
+                _mglsl_minify_end_function(mf);
+                mf->fn_params = 1;
+            }
+            mf->paren++;
+            break;
+        case ')':
+            if(mf->paren > 0) mf->paren--;
+            if(mf->paren < mf->decl_paren) mf->decl_list = 0;
+            if(mf->depth == 0 && mf->paren == 0 && mf->fn_params) {
+                mf->fn_params = 0;
+                mf->fn_pending = 1;
+            }
+            break;
+        case '{': {
+            int code;
+            if(mf->depth == 0) {
+                code = mf->fn_pending;
+                mf->fn_body = code;
+                mf->fn_pending = 0;
+            } else {
+                code = mf->prev.kind == _MGLSL_TOK_END || _mglsl_tok_is_punct(&mf->prev, ')') ||
+                    _mglsl_tok_is_punct(&mf->prev, '{') || _mglsl_tok_is_punct(&mf->prev, '}') ||
+                    _mglsl_tok_is_punct(&mf->prev, ';') || _mglsl_tok_is_punct(&mf->prev, ':') ||
+                    _mglsl_tok_is(&mf->prev, "else") || _mglsl_tok_is(&mf->prev, "do");
+            }
+
+            mf->depth++;
+            if(mf->depth < 64) {
+                if(code) mf->code_braces |= 1ull << mf->depth;
+                else mf->code_braces &= ~(1ull << mf->depth);
+            }
+            if(!code && mf->fn_body) mf->struct_braces++;
+            mf->decl_list = 0;
+            break;
+        }
+        case '}': {
+            int code = mf->depth < 64 && (mf->code_braces >> mf->depth) & 1;
+            if(!code && mf->struct_braces) mf->struct_braces--;
+            if(mf->depth > 0) mf->depth--;
+
+            // declarations of the closed block go out of scope
+            while(mf->scopes_len && mf->scopes[mf->scopes_len - 1].depth > mf->depth) {
+                mf->scopes_len--;
+                mf->names[mf->scopes[mf->scopes_len].name_idx].active--;
+            }
+            if(mf->depth == 0 && mf->fn_body) _mglsl_minify_end_function(mf);
+            mf->decl_list = 0;
+            break;
+        }
+        case ';':
+            mf->decl_list = 0;
+            if(mf->depth == 0) _mglsl_minify_end_function(mf);
+            break;
+        }
+    }
+
+    mf->prev_is_type = is_type;
+    mf->prev_is_dot = _mglsl_tok_is_punct(tok, '.');
+    mf->prev = *tok;
+    return replacement;
+}
+
+static inline int _mglsl_minify_is_op(char c) {
+    return c && strchr("+-*/%<>=!&|^~?:", c) != NULL;
+}
+
+static inline int _mglsl_minify_is_word(char c) {
+    return _mglsl_is_ident_char(c) || c == '.';
+}
+
+static void _mglsl_minify(_mglsl_Emitter * em, const char * str, size_t len)
+{
+    _mglsl_Minifier * mf = em->minify;
+    const char * cur = str, * end = str + len;
+    _mglsl_Token tok;
+
+    for(;;) {
+        const char * gap = cur;
+        cur = _mglsl_lex(&tok, str, cur, end);
+
+        int newlines = 0;
+        if(em->track_lines)
+            for(const char * c = gap; c < tok.begin; c++) newlines += *c == '\n';
+
+        for(int i=0; i<newlines; i++) _mglsl_emit_raw(em, "\n", 1);
+        if(newlines) mf->last = '\n', mf->need_newline = 0;
+
+        if(tok.kind == _MGLSL_TOK_END) break;
+
+        if(tok.kind == _MGLSL_TOK_DIRECTIVE) {
+            if(mf->last != '\n') _mglsl_emit_raw(em, "\n", 1);
+            _mglsl_emit_raw(em, tok.begin, tok.end - tok.begin);
+            mf->last = tok.end[-1];
+            mf->need_newline = 1;
+            continue;
+        }
+
+        const char * text = tok.begin;
+        size_t text_len = tok.end - tok.begin;
+
+        if(mf->rename) {
+            const char * replacement = _mglsl_minify_track(mf, &tok);
+            if(replacement) { text = replacement; text_len = strlen(replacement); }
+        }
+
+        if(mf->need_newline) {
+            _mglsl_emit_raw(em, "\n", 1);
+            mf->last = '\n';
+            mf->need_newline = 0;
+
+        } else if(gap != tok.begin) {
+            // space is kept only where tokens would otherwise merge
+            char first = *text;
+            if((_mglsl_minify_is_word(mf->last) && _mglsl_minify_is_word(first)) ||
+               (_mglsl_minify_is_op(mf->last) && _mglsl_minify_is_op(first)))
+                _mglsl_emit_raw(em, " ", 1);
+        }
+
+        _mglsl_emit_raw(em, text, text_len);
+        mf->last = text[text_len - 1];
+    }
+}
+
+static void _mglsl_minify_free(_mglsl_Minifier * mf) {
+    if(mf->struct_names) _mglsl_free((void*)mf->struct_names);
+    if(mf->struct_name_lens) _mglsl_free(mf->struct_name_lens);
+    if(mf->names) _mglsl_free(mf->names);
+    if(mf->scopes) _mglsl_free(mf->scopes);
+    if(mf->macro_words) _mglsl_free(mf->macro_words);
+#ifdef _MGLSL_COMPRESS_SOURCES
+    for(size_t i=0; i<mf->sources_len; i++) _mglsl_free(mf->sources[i]);
+    if(mf->sources) _mglsl_free(mf->sources);
+#endif
+}
+
+//
+//
+
+static void _mglsl_emit(_mglsl_Emitter * em, const char * str, size_t len)
+{
+    if(em->minify) _mglsl_minify(em, str, len);
+    else _mglsl_emit_raw(em, str, len);
+}
+
+static inline int _mglsl_emit_at_line_begin(const _mglsl_Emitter * em) {
+    return em->total == 0 || em->last == '\n';
+}
+
+// Starts new line map run at the beginning of the next emitted line.
+static void _mglsl_emit_map_run(_mglsl_Emitter * em, unsigned int module_idx, unsigned int src_line)
+{
+    if(!em->line_map) return;
+
+    mglsl_LineMap * map = em->line_map;
+    unsigned int line = em->line + !_mglsl_emit_at_line_begin(em);
+
+    if(map->size) {
+        mglsl_LineMapRun * last = map->data + map->size - 1;
+
+        if(last->line == line) map->size--;
+        else if(last->module_idx == module_idx &&
+                last->src_line + (line - last->line) == src_line) return;
+    }
+
+    _MGLSL_ASSERT(map->size < em->line_map_cap);
+    map->data[map->size].line = line;
+    map->data[map->size].module_idx = module_idx;
+    map->data[map->size].src_line = src_line;
+    map->size++;
+}
+
+static void _mglsl_emit_line_directive(_mglsl_Emitter * em, size_t module_idx, unsigned int src_line)
+{
+    char directive[64];
+    if(!_mglsl_emit_at_line_begin(em)) _mglsl_emit(em, "\n", 1);
+
+    _mglsl_emit_map_run(em, MGLSL_LINE_MAP_NO_MODULE, 0);
+    int len = snprintf(directive, sizeof(directive), "#line %u %u\n", src_line, (unsigned int)module_idx);
+    _MGLSL_ASSERT(len > 0 && len < (int)sizeof(directive));
+    _mglsl_emit(em, directive, len);
+}
+
+// Line map runs of module source emitted next as a whole.
+static void _mglsl_emit_map_module_runs(_mglsl_Emitter * em, const mglsl_Module * module, size_t module_idx)
+{
+    unsigned int line = em->line;
+
+    for(size_t r=0; r<module->_line_runs_len; r++) {
+        em->line = line + module->_line_runs[r].line - 1;
+        _mglsl_emit_map_run(em, module_idx, module->_line_runs[r].src_line);
+    }
+    em->line = line;
+}
+
+// Emits parsed source of module, null-terminated.
+static void _mglsl_emit_source
+    (_mglsl_Emitter * em, const mglsl_Module * module, size_t module_idx,
+     const char * source, size_t source_len, unsigned int flags)
+{
+    // macros of earlier modules may be used by later ones, so words are kept for the whole shader
+    if(em->minify && em->minify->rename) _mglsl_minify_scan_macros(em->minify, source, source_len);
+
+    if(!(flags & MGLSL_ASSEMBLE_LINE_DIRECTIVES)) {
+        _mglsl_emit_map_module_runs(em, module, module_idx);
+        _mglsl_emit(em, source, source_len);
+        return;
+    }
+
+    const char * cur = source;
+
+    for(size_t r=0; r<module->_line_runs_len; r++) {
+        const _mglsl_LineRun * run = module->_line_runs + r;
+        unsigned int src_line = run->src_line;
+
+        const char * end = r + 1 < module->_line_runs_len ?
+            _mglsl_cur_skip_lines(cur, run[1].line - run->line) : source + source_len;
+
+        // '#version' has to stay first, so the directive goes right after it
+        const char * hash = _mglsl_cur_skip_space(cur);
+        if(*hash == '#' && !strncmp(_mglsl_cur_skip_space(hash + 1), "version", 7)) {
+            const char * version_end = _mglsl_cur_skip_line(cur);
+
+            _mglsl_emit_map_run(em, module_idx, src_line++);
+            _mglsl_emit(em, cur, version_end - cur);
+            cur = version_end;
+            if(cur == end) continue;
+        }
+
+        _mglsl_emit_line_directive(em, module_idx, src_line);
+        _mglsl_emit_map_run(em, module_idx, src_line);
+        _mglsl_emit(em, cur, end - cur);
+        cur = end;
+    }
+}
+
+#ifdef _MGLSL_COMPRESS_SOURCES
+static void _mglsl_emit_packed_source
+    (_mglsl_Emitter * em, const mglsl_Module * module, size_t module_idx, unsigned int flags)
+{
+    size_t len = module->_source_len;
+
+    // decompressed straight into output when it goes there unchanged
+    if(!em->sink && !em->minify && !(flags & MGLSL_ASSEMBLE_LINE_DIRECTIVES)) {
+        _mglsl_emit_map_module_runs(em, module, module_idx);
+
+        char * dst = _mglsl_emit_reserve(em, len);
+        if(!dst) return;
+
+        em->error = _mglsl_lz_decompress(dst, len, module->source, module->_packed_len);
+        if(!em->error) _mglsl_emit_commit(em, len);
+        return;
+    }
+
+    char * source = (char*)_mglsl_alloc(len + 1);
+    if(!source) {
+        if(!em->error) em->error = MGLSL_E_ALLOC;
+        return;
+    }
+
+    int ec = _mglsl_lz_decompress(source, len, module->source, module->_packed_len);
+    source[len] = '\0';
+
+    if(!ec) _mglsl_emit_source(em, module, module_idx, source, len, flags);
+    else if(!em->error) em->error = ec;
+
+    // renaming keeps referring to names of earlier modules, e.g. struct types
+    _mglsl_Minifier * mf = em->minify;
+    if(mf && mf->rename &&
+       _mglsl_minify_grow(mf, (void**)&mf->sources, &mf->sources_cap, mf->sources_len, sizeof(char*))) {
+        mf->sources[mf->sources_len++] = source;
+        return;
+    }
+    _mglsl_free(source);
+}
+#endif
+
+static void _mglsl_emit_module
+    (_mglsl_Emitter * em, const mglsl_Module * module, size_t module_idx, unsigned int flags)
+{
+#ifdef _MGLSL_MODULE_HEADER_COMMENT
+    char header[MGLSL_MAX_NAME_LEN + 32];
+    int header_len = snprintf(header, sizeof(header), "\n// ==== %s module ====\n", _mglsl_str(module->name));
+    _MGLSL_ASSERT(header_len > 0 && header_len < (int)sizeof(header));
+
+    _mglsl_emit_map_run(em, MGLSL_LINE_MAP_NO_MODULE, 0);
+    _mglsl_emit(em, header, header_len);
+#endif
+
+#ifdef _MGLSL_COMPRESS_SOURCES
+    if(module->_packed_len) {
+        _mglsl_emit_packed_source(em, module, module_idx, flags);
+        return;
+    }
+#endif
+
+    _mglsl_emit_source(em, module, module_idx, module->source, strlen(module->source), flags);
+}
+
+//
+// DEAD CODE ELIMINATION
+// Assembled shader is split into top-level items: declarations ending with ';',
+// function definitions ending with '}' and preprocessor directives. Items are
+// kept if they are reachable by identifiers from roots, which are 'main', interface
+// declarations, directives (macros may use anything) and whatever could not be classified.
+
+typedef struct {
+    const char * begin;
+    const char * end;
+    unsigned char root;
+    unsigned char keep;
+} _mglsl_DceItem;
+
+typedef struct {
+    const char * name;
+    size_t name_len;
+    size_t item;
+    size_t next; // next declaration of the same name or (size_t)-1
+} _mglsl_DceDecl;
+
+typedef struct {
+    _mglsl_DceItem * items;
+    size_t items_len, items_cap;
+
+    _mglsl_DceDecl * decls;
+    size_t decls_len, decls_cap;
+
+    size_t * table; // heads of declaration chains, open addressing
+    size_t table_cap;
+} _mglsl_Dce;
+
+static const char * _mglsl_dce_root_keywords[] = {
+    "main", "in", "out", "uniform", "buffer", "layout", "attribute", "varying",
+    "shared", "precision", "invariant", "precise", "subroutine"
+};
+
+static int _mglsl_dce_push_item(_mglsl_Dce * dce, const char * begin, const char * end, int root) {
+    if(dce->items_len == dce->items_cap) {
+        size_t cap = dce->items_cap ? dce->items_cap * 2 : 64;
+        _mglsl_DceItem * items = (_mglsl_DceItem*)(dce->items ?
+            _mglsl_realloc(dce->items, cap * sizeof(_mglsl_DceItem)) : _mglsl_alloc(cap * sizeof(_mglsl_DceItem)));
+        if(!items) return MGLSL_E_ALLOC;
+        dce->items = items;
+        dce->items_cap = cap;
+    }
+
+    _mglsl_DceItem * item = dce->items + dce->items_len++;
+    item->begin = begin;
+    item->end = end;
+    item->root = item->keep = (unsigned char)root;
+    return MGLSL_E_SUCCESS;
+}
+
+// Declaration belongs to the item that is going to be pushed next.
+static int _mglsl_dce_push_decl(_mglsl_Dce * dce, const _mglsl_Token * tok) {
+    if(dce->decls_len == dce->decls_cap) {
+        size_t cap = dce->decls_cap ? dce->decls_cap * 2 : 64;
+        _mglsl_DceDecl * decls = (_mglsl_DceDecl*)(dce->decls ?
+            _mglsl_realloc(dce->decls, cap * sizeof(_mglsl_DceDecl)) : _mglsl_alloc(cap * sizeof(_mglsl_DceDecl)));
+        if(!decls) return MGLSL_E_ALLOC;
+        dce->decls = decls;
+        dce->decls_cap = cap;
+    }
+
+    _mglsl_DceDecl * decl = dce->decls + dce->decls_len++;
+    decl->name = tok->begin;
+    decl->name_len = tok->end - tok->begin;
+    decl->item = dce->items_len;
+    decl->next = (size_t)-1;
+    return MGLSL_E_SUCCESS;
+}
+
+static size_t * _mglsl_dce_lookup(_mglsl_Dce * dce, const char * name, size_t name_len) {
+    size_t mask = dce->table_cap - 1;
+    size_t slot = _mglsl_hash(name, name_len) & mask;
+
+    for(;; slot = (slot + 1) & mask) {
+        size_t head = dce->table[slot];
+        if(head == (size_t)-1) return dce->table + slot;
+
+        _mglsl_DceDecl * decl = dce->decls + head;
+        if(decl->name_len == name_len && !memcmp(decl->name, name, name_len))
+            return dce->table + slot;
+    }
+}
+
+// Splits buffer into items, returns MGLSL_E_SYNTAX if braces or parentheses don't match up,
+// which may happen e.g. with conditional compilation inside of declarations.
+static int _mglsl_dce_split(_mglsl_Dce * dce, const char * buf, size_t len)
+{
+    const char * cur = buf, * end = buf + len;
+    const char * item_begin = NULL;
+
+    int depth = 0, paren = 0, ec;
+    int fn, fn_body, init, root;
+    _mglsl_Token tok, prev;
+
+    for(;;) {
+        cur = _mglsl_lex(&tok, buf, cur, end);
+        if(tok.kind == _MGLSL_TOK_END) break;
+
+        if(tok.kind == _MGLSL_TOK_DIRECTIVE) {
+            if(!item_begin && (ec = _mglsl_dce_push_item(dce, tok.begin, tok.end, 1))) return ec;
+            continue;
+        }
+
+        if(!item_begin) {
+            item_begin = tok.begin;
+            fn = fn_body = init = root = 0;
+            prev.kind = _MGLSL_TOK_END;
+        }
+
+        int top = depth == 0 && paren == 0, item_end = 0;
+
+        if(tok.kind == _MGLSL_TOK_IDENT && top) {
+            for(size_t i=0; i<sizeof(_mglsl_dce_root_keywords)/sizeof(char*); i++)
+                if(_mglsl_tok_is(&tok, _mglsl_dce_root_keywords[i])) root = 1;
+
+            if(prev.kind == _MGLSL_TOK_IDENT && _mglsl_tok_is(&prev, "struct") &&
+               (ec = _mglsl_dce_push_decl(dce, &tok))) return ec;
+
+        } else if(tok.kind == _MGLSL_TOK_PUNCT) {
+            int prev_ident = prev.kind == _MGLSL_TOK_IDENT && !fn && !init;
+
+            switch(*tok.begin) {
+            case '(':
+                if(top && !fn && !init && prev.kind == _MGLSL_TOK_IDENT && !_mglsl_tok_is(&prev, "layout")) {
+                    if((ec = _mglsl_dce_push_decl(dce, &prev))) return ec;
+                    fn = 1;
+                }
+                paren++;
+                break;
+            case ')':
+                if(--paren < 0) return MGLSL_E_SYNTAX;
+                break;
+            case '{':
+                if(top) fn_body = fn && _mglsl_tok_is_punct(&prev, ')');
+                depth++;
+                break;
+            case '}':
+                if(--depth < 0) return MGLSL_E_SYNTAX;
+                if(depth == 0 && paren == 0 && fn_body) item_end = 1;
+                break;
+            case '=':
+                if(top && prev_ident && (ec = _mglsl_dce_push_decl(dce, &prev))) return ec;
+                if(top) init = 1;
+                break;
+            case ',':
+                if(top && prev_ident && (ec = _mglsl_dce_push_decl(dce, &prev))) return ec;
+                if(top) init = 0;
+                break;
+            case '[':
+                if(top && prev_ident && (ec = _mglsl_dce_push_decl(dce, &prev))) return ec;
+                break;
+            case ';':
+                if(top && prev_ident && (ec = _mglsl_dce_push_decl(dce, &prev))) return ec;
+                if(top) item_end = 1;
+                break;
+            }
+        }
+
+        if(item_end) {
+            // 'main' has to be declared by the item, not just mentioned
+            for(size_t i=dce->decls_len; i-- > 0 && dce->decls[i].item == dce->items_len;)
+                if(dce->decls[i].name_len == 4 && !memcmp(dce->decls[i].name, "main", 4)) root = 1;
+
+            if((ec = _mglsl_dce_push_item(dce, item_begin, tok.end, root))) return ec;
+            item_begin = NULL;
+        }
+
+        prev = tok;
+    }
+
+    if(depth || paren) return MGLSL_E_SYNTAX;
+
+    // unterminated tail is kept as it is
+    if(item_begin && (ec = _mglsl_dce_push_item(dce, item_begin, end, 1))) return ec;
+
+    return MGLSL_E_SUCCESS;
+}
+
+static int _mglsl_dce_mark(_mglsl_Dce * dce, const char * buf)
+{
+    dce->table_cap = 16;
+    while(dce->table_cap < dce->decls_len * 2) dce->table_cap *= 2;
+
+    dce->table = (size_t*)_mglsl_alloc(dce->table_cap * sizeof(size_t));
+    if(!dce->table) return MGLSL_E_ALLOC;
+    memset(dce->table, 0xff, dce->table_cap * sizeof(size_t));
+
+    // chains are built back to front so they come out in source order
+    for(size_t i=dce->decls_len; i-- > 0;) {
+        size_t * head = _mglsl_dce_lookup(dce, dce->decls[i].name, dce->decls[i].name_len);
+        dce->decls[i].next = *head;
+        *head = i;
+    }
+
+    // every item gets on the stack at most once
+    size_t * stack = (size_t*)_mglsl_alloc((dce->items_len + 1) * sizeof(size_t));
+    if(!stack) return MGLSL_E_ALLOC;
+    size_t stack_len = 0;
+
+    for(size_t i=0; i<dce->items_len; i++)
+        if(dce->items[i].keep) stack[stack_len++] = i;
+
+    while(stack_len) {
+        _mglsl_DceItem * item = dce->items + stack[--stack_len];
+        const char * cur = item->begin;
+        _mglsl_Token tok, prev;
+        prev.kind = _MGLSL_TOK_END;
+
+        for(;;) {
+            cur = _mglsl_lex(&tok, buf, cur, item->end);
+            if(tok.kind == _MGLSL_TOK_END) break;
+
+            // identifiers in directives count too, macros may refer to anything
+            const char * tcur = tok.begin, * tend = tok.end;
+            if(tok.kind == _MGLSL_TOK_DIRECTIVE) tcur++;
+
+            while(tcur < tend) {
+                _mglsl_Token ident = tok;
+                if(tok.kind == _MGLSL_TOK_DIRECTIVE) {
+                    tcur = _mglsl_lex(&ident, buf, tcur, tend);
+                    if(ident.kind == _MGLSL_TOK_END) break;
+                } else tcur = tend;
+
+                // member access and swizzles are not references
+                int member = _mglsl_tok_is_punct(&prev, '.');
+                prev = ident;
+                if(ident.kind != _MGLSL_TOK_IDENT || member) continue;
+
+                size_t * head = _mglsl_dce_lookup(dce, ident.begin, ident.end - ident.begin);
+                for(size_t d=*head; d != (size_t)-1; d = dce->decls[d].next) {
+                    _mglsl_DceItem * target = dce->items + dce->decls[d].item;
+                    if(!target->keep) {
+                        target->keep = 1;
+                        stack[stack_len++] = dce->decls[d].item;
+                    }
+                }
+            }
+        }
+    }
+
+    _mglsl_free(stack);
+    return MGLSL_E_SUCCESS;
+}
+
+// Removes unused items from buf in place. If preserve_lines is set, removed items
+// leave their newlines behind, so that line map and line directives stay correct.
+static int _mglsl_strip_unused(char * buf, size_t * lenptr, int preserve_lines)
+{
+    _mglsl_Dce dce;
+    memset(&dce, 0, sizeof(dce));
+
+    int ec = _mglsl_dce_split(&dce, buf, *lenptr);
+    if(!ec) ec = _mglsl_dce_mark(&dce, buf);
+
+    if(!ec) {
+        char * w = buf;
+        const char * r = buf, * end = buf + *lenptr;
+
+        for(size_t i=0; i<dce.items_len; i++) {
+            _mglsl_DceItem * item = dce.items + i;
+
+            memmove(w, r, item->begin - r);
+            w += item->begin - r;
+
+            if(item->keep) {
+                memmove(w, item->begin, item->end - item->begin);
+                w += item->end - item->begin;
+            } else if(preserve_lines) {
+                for(const char * c = item->begin; c < item->end; c++)
+                    if(*c == '\n') *(w++) = '\n';
+            }
+            r = item->end;
+
+            // item had its own lines, don't leave them behind empty
+            if(!item->keep && !preserve_lines && _mglsl_is_line_begin(buf, w)) {
+                const char * after = r;
+                while(after < end && _mglsl_is_space(*after)) after++;
+                if(after < end && *after == '\n') r = after + 1;
+            }
+        }
+
+        memmove(w, r, end - r);
+        w += end - r;
+        *lenptr = w - buf;
+    }
+
+    if(dce.items) _mglsl_free(dce.items);
+    if(dce.decls) _mglsl_free(dce.decls);
+    if(dce.table) _mglsl_free(dce.table);
+
+    // shader the pass could not make sense of is left as it is
+    return ec == MGLSL_E_SYNTAX ? MGLSL_E_SUCCESS : ec;
+}
+
+//
+// LIBRARY INTERFACE IMPLEMENTATION
+
+static int _mglsl_create_module
+    (mglsl_Module * module, const char * src, size_t src_len, int header_only)
+{
+    int ec;
+    _MGLSL_ASSERT(module);
+
+    memset(module, 0, sizeof(mglsl_Module));
+
+    _mglsl_strtab_acquire();
+    module->flags |= _MGLSL_ALIVE;
+
+    _mglsl_CondStack cond_stack;
+    cond_stack.depth = 0;
+    cond_stack.local_macros_len = 0;
+    _mglsl_parse_cond_stack = &cond_stack;
+
+    _MGLSL_PROBE2(parse_start, _mglsl_err_file, src_len);
+    _MGLSL_STAT_TIMER(t);
+    ec = _mglsl_parse(module, src, src_len, header_only);
+    _MGLSL_STAT_TIME(parse_ns, t);
+    _MGLSL_PROBE3(parse_done, ec ? NULL : _mglsl_str(module->name), src_len, ec);
+
+    _mglsl_parse_cond_stack = NULL;
+    if(ec != MGLSL_E_SUCCESS) {
+        mglsl_free_module(module);
+        return ec;
+    }
+
+    return MGLSL_E_SUCCESS;
+}
+
+//
+//
+
+int mglsl_create_module_from_source(mglsl_Module * module, const char * src)
+{
+    return mglsl_create_module_from_source_len(module, src, strlen(src));
+}
+
+// Source does not have to be null-terminated.
+int mglsl_create_module_from_source_len(mglsl_Module * module, const char * src, size_t src_len)
+{
+    _mglsl_err_file = NULL;
+    int ret = _mglsl_create_module(module, src, src_len, 0);
+    if(ret) return ret;
+
+    if(!module->name) {
+        _mglsl_err_detail = MGLSL_DIAG_NO_NAME;
+        mglsl_free_module(module);
+        return _mglsl_log_err(MGLSL_E_MODULE_NONAME);
+    }
+
+    return MGLSL_E_SUCCESS;
+}
+
+//
+//
+
+// Creates module from source of file at filepath, read already, see _mglsl_parse for header_only.
+static int _mglsl_create_module_from_file_buf
+    (mglsl_Module * module, const char * filepath, const char * src, time_t mtime, int header_only)
+{
+    int ec;
+
+    _mglsl_err_file = filepath;
+
+    ec = _mglsl_create_module(module, src, strlen(src), header_only);
+    if(ec) return ec;
+
+    if(!module->name) {
+        size_t filepath_len = strlen(filepath);
+        size_t basename_idx = 0, ext_idx = 0;
+
+        for(size_t i=0; i<filepath_len; i++) {
+            if(filepath[i] == '/') basename_idx = ext_idx = i + 1;
+            if(filepath[i] == '.') ext_idx = i;
+        }
+        if(basename_idx == ext_idx) ext_idx = filepath_len;
+        size_t basename_len = ext_idx - basename_idx;
+
+        if(basename_len) {
+            ec = _mglsl_intern(&module->name, filepath + basename_idx, basename_len);
+        } else {
+            _mglsl_err_detail = MGLSL_DIAG_NO_NAME;
+            _mglsl_err_name = filepath;
+            ec = MGLSL_E_MODULE_NONAME;
+        }
+
+        if(ec) {
+            mglsl_free_module(module);
+            return _mglsl_log_err(ec);
+        }
+    }
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+    module->mtime = mtime;
+
+    ec = _mglsl_intern(&module->path, filepath, strlen(filepath));
+    if(ec) {
+        mglsl_free_module(module);
+        return _mglsl_log_err(ec);
+    }
+#else
+    (void)mtime;
+#endif
+
+    return MGLSL_E_SUCCESS;
+}
+
+int mglsl_create_module_from_file(mglsl_Module * module, const char * filepath)
+{
+    void * filebuf; size_t filesize; time_t mtime = 0; int ec;
+
+    _mglsl_err_file = filepath;
+
+    ec = _mglsl_read(&filebuf, &filesize, filepath);
+    if(ec != MGLSL_E_SUCCESS) {
+        _mglsl_err_name = filepath;
+        return _mglsl_log_err(ec);
+    }
+
+    _MGLSL_ASSERT(strlen((const char*)filebuf) == filesize);
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+    ec = _mglsl_stat(&mtime, filepath);
+    _MGLSL_ASSERT(!ec); // Opened this file moment ago, don't fail please
+#endif
+
+    ec = _mglsl_create_module_from_file_buf(module, filepath, (const char*)filebuf, mtime, 0);
+
+    _mglsl_free_file_buf(filebuf, filesize);
+    return ec;
+}
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+
+#ifndef _MGLSL_SCAN_CHUNK
+# define _MGLSL_SCAN_CHUNK 512
+#endif
+
+// Reads file in growing chunks until directives at its top are read, with custom
+// MGLSL_READ_FILE whole file is read instead.
+static int _mglsl_scan_module_file(mglsl_Module * module, const char * filepath, time_t mtime)
+{
+    int ec = MGLSL_E_SUCCESS;
+
+    _mglsl_err_file = filepath;
+
+#ifdef _MGLSL_DEFAULT_READ_FILE
+    _MGLSL_STAT_TIMER(t);
+    FILE * file = NULL;
+    char * buf = NULL;
+    size_t len = 0, cap = 0;
+    int packed = 0;
+
+# ifdef _MGLSL_PACK_FILES
+    // packed files are in memory already, nothing is saved by reading them in chunks
+    packed = _mglsl_pack_lookup(filepath, NULL);
+    if(packed) ec = _mglsl_read((void**)&buf, &len, filepath);
+# endif
+
+    // unbuffered, so that only chunks asked for are read
+    if(!packed) {
+        _MGLSL_STAT_ADD(read_calls, 1);
+        file = fopen(filepath, "rb");
+        if(!file) ec = MGLSL_E_FILE_OPEN;
+        else setvbuf(file, NULL, _IONBF, 0);
+    }
+
+    while(!ec && file) {
+        cap = cap ? cap * 2 : _MGLSL_SCAN_CHUNK;
+        char * grown = buf ? (char*)_mglsl_realloc(buf, cap + 1) : (char*)_mglsl_alloc(cap + 1);
+        if(!grown) {
+            ec = MGLSL_E_REALLOC;
+            break;
+        }
+        buf = grown;
+
+        len += fread(buf + len, 1, cap - len, file);
+        buf[len] = '\0';
+
+        if(len < cap) {
+            if(ferror(file)) ec = MGLSL_E_FILE_READ;
+            break;
+        }
+        if(_mglsl_header_complete(buf)) break;
+    }
+
+    if(file) fclose(file);
+    if(!packed) _MGLSL_STAT_TIME(read_ns, t);
+#else
+    void * buf = NULL;
+    size_t len = 0;
+    ec = _mglsl_read(&buf, &len, filepath);
+#endif
+
+    if(ec) {
+        if(buf) _mglsl_free(buf);
+        _mglsl_err_name = filepath;
+        return _mglsl_log_err(ec);
+    }
+
+    ec = _mglsl_create_module_from_file_buf(module, filepath, (const char*)buf, mtime, 1);
+
+#ifdef _MGLSL_DEFAULT_READ_FILE
+    if(packed) _mglsl_free_file_buf(buf, len);
+    else _mglsl_free(buf);
+#else
+    _mglsl_free_file_buf(buf, len);
+#endif
+    return ec;
+}
+
+// Parses name, requirements and stages only, whatever follows the first line of code is
+// not read. Body is loaded once module is resolved for assembly, or by mglsl_load_module_body.
+int mglsl_scan_module_from_file(mglsl_Module * module, const char * filepath)
+{
+    _MGLSL_ASSERT(module && filepath);
+    time_t mtime = 0;
+
+    int ec = _mglsl_stat(&mtime, filepath);
+    if(ec) {
+        _mglsl_err_name = filepath;
+        return _mglsl_log_err(ec);
+    }
+
+    return _mglsl_scan_module_file(module, filepath, mtime);
+}
+
+static int _mglsl_same_deps(const mglsl_Module * a, const mglsl_Module * b)
+{
+    if(a->deps_len != b->deps_len || a->stages != b->stages) return 0;
+
+    for(size_t d=0; d<a->deps_len; d++) {
+        const char * a_cond = a->deps_cond ? a->deps_cond[d] : NULL;
+        const char * b_cond = b->deps_cond ? b->deps_cond[d] : NULL;
+
+        if(a->deps[d] != b->deps[d]) return 0;
+        if((a_cond || b_cond) && (!a_cond || !b_cond || strcmp(a_cond, b_cond))) return 0;
+    }
+
+    return 1;
+}
+
+// Module is replaced by one parsed from whole file, changed is set if requirements
+// turned out to differ from these in the header.
+static int _mglsl_load_body(mglsl_Module * module, int * changed)
+{
+    mglsl_Module full;
+
+    int ec = mglsl_create_module_from_file(&full, _mglsl_str(module->path));
+    if(ec) return ec;
+
+    if(!_mglsl_same_deps(module, &full) || module->name != full.name) *changed = 1;
+
+    // keep dirty flag of the scanned one, if file changed since it is reloaded anyway
+    full.flags |= module->flags & MGLSL_DIRTY;
+
+    mglsl_free_module(module);
+    *module = full;
+    return MGLSL_E_SUCCESS;
+}
+
+int mglsl_load_module_body(mglsl_Module * module)
+{
+    _MGLSL_ASSERT(module);
+    int changed = 0;
+    if(!(module->flags & MGLSL_HEADER_ONLY)) return MGLSL_E_SUCCESS;
+    return _mglsl_load_body(module, &changed);
+}
+
+#endif
+
+// Resolves modules and loads bodies of scanned ones among them. Graph is rebuilt
+// after loading, and modules resolved again if loaded ones require something else
+// than their headers said.
+static int _mglsl_resolve_bodies
+    (size_t * order, size_t * order_len, const char * root_module_name, _mglsl_Graph * graph,
+     mglsl_ModuleArr module_arr, const _mglsl_CondEnv * env, unsigned int stages)
+{
+    for(;;) {
+        int ec = _mglsl_resolve(order, order_len, root_module_name, graph, module_arr, env, stages);
+        if(ec) return ec;
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+        int loaded = 0, changed = 0;
+
+        for(size_t i=0; i<*order_len; i++) {
+            mglsl_Module * module = module_arr.data + order[i];
+            if(!(module->flags & MGLSL_HEADER_ONLY)) continue;
+
+            ec = _mglsl_load_body(module, &changed);
+            if(ec) return ec;
+            loaded = 1;
+        }
+
+        if(!loaded) return MGLSL_E_SUCCESS;
+
+        // conditions of edges are owned by modules which were just replaced
+        ec = _mglsl_rebuild_graph(graph, module_arr);
+        if(ec || !changed) return ec;
+#else
+        return MGLSL_E_SUCCESS;
+#endif
+    }
+}
+
+//
+//
+
+int mglsl_free_module(mglsl_Module * module) {
+#ifdef _MGLSL_SHARED_MODULES
+    int owned = !(module->flags & _MGLSL_SHARED);
+#else
+    int owned = 1;
+#endif
+ 
+    if(module->deps) {
+        _mglsl_free(module->deps);
+    }
+
+    if(module->deps_cond) {
+        for(size_t i=0; owned && i<module->deps_len; i++)
+            if(module->deps_cond[i]) _mglsl_free(module->deps_cond[i]);
+        _mglsl_free(module->deps_cond);
+    }
+
+    if(module->source && owned) {
+        _mglsl_free(module->source);
+    }
+
+    if(module->_line_runs && owned) {
+        _mglsl_free(module->_line_runs);
+    }
+
+#ifdef _MGLSL_REFLECTION
+    if(module->_reflect) {
+        _mglsl_free(module->_reflect);
+    }
+#endif
+
+    // names stay interned until the last module is gone
+    if(module->flags & _MGLSL_ALIVE) _mglsl_strtab_release();
+
+    memset(module, 0, sizeof(mglsl_Module));
+    return MGLSL_E_SUCCESS;
+}
+
+//
+//
+
+// Strings of the table are freed with the last module, unless diagnostics still refer to them.
+const char * mglsl_module_name(const mglsl_Module * module) {
+    return _mglsl_str(module->name);
+}
+
+const char * mglsl_module_path(const mglsl_Module * module) {
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+    return _mglsl_str(module->path);
+#else
+    (void)module;
+    return NULL;
+#endif
+}
+
+// Replaces former type field, which '#type' never set.
+enum mglsl_ShaderType mglsl_module_type(const mglsl_Module * module) {
+    for(int type = VERT; type < MGLSL_SHADER_TYPE_COUNT; type++)
+        if(module->stages == MGLSL_STAGE(type)) return (enum mglsl_ShaderType)type;
+    return NONE;
+}
+
+const char * mglsl_module_dep(const mglsl_Module * module, size_t dep_idx) {
+    _MGLSL_ASSERT(dep_idx < module->deps_len);
+    return _mglsl_str(module->deps[dep_idx]);
+}
+
+// Valid as long as any module is alive, or diagnostics refer to it.
+const char * mglsl_str(mglsl_StrId id) {
+    return id && id < _mglsl_strtab.strs_len ? _mglsl_str(id) : NULL;
+}
+
+// Returns 0 if no module has this string, so ids can be looked up once and compared after.
+mglsl_StrId mglsl_str_id(const char * str) {
+    return _mglsl_str_lookup(str, strlen(str));
+}
+
+#ifdef _MGLSL_REFLECTION
+// Valid until module is freed, it is not to be freed with mglsl_free_reflection.
+mglsl_Reflection mglsl_module_reflection(const mglsl_Module * module) {
+    mglsl_Reflection reflection;
+    reflection.data = module->_reflect;
+    reflection.size = module->_reflect_len;
+    return reflection;
+}
+
+int mglsl_free_reflection(mglsl_Reflection * reflection) {
+    if(reflection->data) _mglsl_free(reflection->data);
+    reflection->data = NULL;
+    reflection->size = 0;
+    return MGLSL_E_SUCCESS;
+}
+
+// Concatenates reflection of modules in given order, records get index of their module.
+static int _mglsl_reflect_merge
+    (mglsl_Reflection * reflection, const size_t * order, size_t order_len, mglsl_ModuleArr module_arr)
+{
+    size_t size = 0;
+    for(size_t i=0; i<order_len; i++)
+        size += module_arr.data[order[i]]._reflect_len;
+
+    reflection->data = NULL;
+    reflection->size = 0;
+    if(!size) return MGLSL_E_SUCCESS;
+
+    reflection->data = (mglsl_ReflectDecl*)_mglsl_alloc(size * sizeof(mglsl_ReflectDecl));
+    if(!reflection->data) return MGLSL_E_ALLOC;
+
+    for(size_t i=0; i<order_len; i++) {
+        const mglsl_Module * module = module_arr.data + order[i];
+
+        for(size_t r=0; r<module->_reflect_len; r++) {
+            mglsl_ReflectDecl * decl = reflection->data + reflection->size++;
+            *decl = module->_reflect[r];
+            decl->module_idx = (unsigned int)order[i];
+        }
+    }
+
+    return MGLSL_E_SUCCESS;
+}
+#endif
+
+// Emits modules in given order into emitter with its buffer already set up.
+// Line map is freed on error.
+static int _mglsl_assemble_emit
+    (_mglsl_Emitter * em, const size_t * order, size_t order_len,
+     mglsl_ModuleArr module_arr, unsigned int flags, mglsl_LineMap * line_map)
+{
+    size_t run_count = 0;
+    for(size_t i=0; i<order_len; i++)
+        run_count += module_arr.data[order[i]]._line_runs_len;
+
+    em->line = 1;
+    em->track_lines = line_map || (flags & MGLSL_ASSEMBLE_LINE_DIRECTIVES);
+
+    _mglsl_Minifier minifier;
+    if(flags & (MGLSL_ASSEMBLE_MINIFY | MGLSL_ASSEMBLE_MINIFY_IDENTIFIERS)) {
+        memset(&minifier, 0, sizeof(minifier));
+        minifier.last = '\n';
+        minifier.rename = (flags & MGLSL_ASSEMBLE_MINIFY_IDENTIFIERS) != 0;
+        em->minify = &minifier;
+    }
+
+    if(line_map) {
+        // header, then per run: directive, '#version' split and the run itself, then the end
+        em->line_map_cap = order_len + 3 * run_count + 1;
+        em->line_map = line_map;
+        line_map->size = 0;
+        line_map->data = (mglsl_LineMapRun*)_mglsl_alloc(em->line_map_cap * sizeof(mglsl_LineMapRun));
+        if(!line_map->data) {
+            em->minify = NULL;
+            return MGLSL_E_ALLOC;
+        }
+    }
+
+    for(size_t i=0; i<order_len; i++)
+        _mglsl_emit_module(em, module_arr.data + order[i], order[i], flags);
+
+    // closes the last run, lines past the end are not mapped
+    _mglsl_emit_map_run(em, MGLSL_LINE_MAP_NO_MODULE, 0);
+
+    if(em->minify) _mglsl_minify_free(em->minify);
+    em->minify = NULL;
+
+    if(em->error && line_map) mglsl_free_line_map(line_map);
+    return em->error;
+}
+
+// Emits modules in given order. Errors are returned, not logged.
+static int _mglsl_assemble
+    (char ** bufptr, size_t * lenptr, const size_t * order, size_t order_len,
+     mglsl_ModuleArr module_arr, unsigned int flags, mglsl_LineMap * line_map)
+{
+    _MGLSL_STAT_TIMER(assemble_t);
+
+    size_t bufsize = 0, run_count = 0;
+
+    for(size_t i=0; i<order_len; i++) {
+        const mglsl_Module * module = module_arr.data + order[i];
+        _MGLSL_ASSERT(module->source);
+
+        run_count += module->_line_runs_len;
+        bufsize += _mglsl_source_len(module);
+    }
+
+#ifdef _MGLSL_MODULE_HEADER_COMMENT
+    size_t comment_header_max_len = MGLSL_MAX_NAME_LEN + 32;
+    bufsize += comment_header_max_len * order_len; 
+#endif
+
+    // '#line' directive together with a newline that may precede it
+    if(flags & MGLSL_ASSEMBLE_LINE_DIRECTIVES)
+        bufsize += 64 * run_count;
+
+    _mglsl_Emitter em;
+    memset(&em, 0, sizeof(em));
+
+    em.cap = bufsize;
+    em.buf = (char*)_mglsl_alloc(bufsize + 1);
+    if(!em.buf) return MGLSL_E_ALLOC;
+
+    int ec = _mglsl_assemble_emit(&em, order, order_len, module_arr, flags, line_map);
+
+    if(!ec && (flags & MGLSL_ASSEMBLE_STRIP_UNUSED)) {
+        ec = _mglsl_strip_unused(em.buf, &em.len, em.track_lines);
+        if(ec && line_map) mglsl_free_line_map(line_map);
+    }
+
+    if(ec) {
+        _mglsl_free(em.buf);
+        return ec;
+    }
+
+    char * buf = em.buf;
+    size_t buflen = em.len;
+
+    buf[buflen] = '\0';
+    buf = (char*)_mglsl_realloc(buf, buflen + 1);
+    if(!buf) {
+        if(line_map) mglsl_free_line_map(line_map);
+        return MGLSL_E_REALLOC;
+    }
+
+    _MGLSL_STAT_ADD(bytes_emitted, buflen);
+    _MGLSL_STAT_TIME(assemble_ns, assemble_t);
+
+    *bufptr = buf;
+    if(lenptr) *lenptr = buflen;
+    return MGLSL_E_SUCCESS;
+}
+
+// Same as above, but output goes to write through a fixed staging buffer.
+static int _mglsl_assemble_stream
+    (mglsl_WriteProc * write, void * user, size_t * lenptr, const size_t * order, size_t order_len,
+     mglsl_ModuleArr module_arr, unsigned int flags, mglsl_LineMap * line_map)
+{
+    // Stripping needs the whole shader at once, so it is assembled
+    // in memory as usual and written in one go.
+    if(flags & MGLSL_ASSEMBLE_STRIP_UNUSED) {
+        char * buf; size_t len;
+        int ec = _mglsl_assemble(&buf, &len, order, order_len, module_arr, flags, line_map);
+        if(ec) return ec;
+
+        if(len && write(buf, len, user)) {
+            ec = MGLSL_E_WRITE;
+            if(line_map) mglsl_free_line_map(line_map);
+        }
+        _mglsl_free(buf);
+        if(!ec && lenptr) *lenptr = len;
+        return ec;
+    }
+
+    _MGLSL_STAT_TIMER(assemble_t);
+
+    char staging[MGLSL_STREAM_BUF_LEN];
+
+    _mglsl_Emitter em;
+    memset(&em, 0, sizeof(em));
+    em.buf = staging;
+    em.cap = sizeof(staging);
+    em.sink = write;
+    em.sink_user = user;
+
+    int ec = _mglsl_assemble_emit(&em, order, order_len, module_arr, flags, line_map);
+
+    if(!ec) {
+        _mglsl_emit_flush(&em);
+        ec = em.error;
+        if(ec && line_map) mglsl_free_line_map(line_map);
+    }
+    if(ec) return ec;
+
+    _MGLSL_STAT_ADD(bytes_emitted, em.total);
+    _MGLSL_STAT_TIME(assemble_ns, assemble_t);
+
+    if(lenptr) *lenptr = em.total;
+    return MGLSL_E_SUCCESS;
+}
+
+// Writes shader of a variant: assembled body with '#define' block of the variant in front,
+// or right after '#version' if body starts with one. Line map of the body is shifted along.
+static int _mglsl_insert_defines
+    (char ** bufptr, mglsl_LineMap * line_map, const char * body, size_t body_len,
+     const mglsl_LineMap * body_map, const mglsl_DefineArr * defines)
+{
+    size_t block_len = 0;
+
+    for(size_t i=0; i<defines->size; i++) {
+        const mglsl_Define * define = defines->data + i;
+        const char * name = define->name;
+
+        int valid = name && (_mglsl_is_letter(*name) || *name == '_');
+        for(const char * c = name; valid && *c; c++) valid = _mglsl_is_ident_char(*c);
+        if(!valid) {
+            _mglsl_err_detail = MGLSL_DIAG_DEFINE_INVALID_NAME;
+            return MGLSL_E_SYNTAX;
+        }
+
+        if(define->value && (strchr(define->value, '\n') || strchr(define->value, '\r'))) {
+            _mglsl_err_detail = MGLSL_DIAG_DEFINE_MULTILINE;
+            return MGLSL_E_SYNTAX;
+        }
+
+        // '#define <name> <value>\n'
+        block_len += 8 + strlen(name) + (define->value ? 1 + strlen(define->value) : 0) + 1;
+    }
+
+    const char * insert = body;
+    int newline_before = 0;
+
+    _mglsl_Token tok;
+    _mglsl_lex(&tok, body, body, body + body_len);
+    if(tok.kind == _MGLSL_TOK_DIRECTIVE && !strncmp(_mglsl_cur_skip_space(tok.begin + 1), "version", 7)) {
+        insert = tok.end;
+        if(insert < body + body_len) insert++;
+        else newline_before = 1;
+    }
+
+    size_t head_len = insert - body;
+    size_t len = body_len + newline_before + block_len;
+
+    char * buf = (char*)_mglsl_alloc(len + 1);
+    if(!buf) return MGLSL_E_ALLOC;
+
+    char * cur = buf;
+    memcpy(cur, body, head_len);
+    cur += head_len;
+    if(newline_before) *(cur++) = '\n';
+
+    for(size_t i=0; i<defines->size; i++) {
+        const mglsl_Define * define = defines->data + i;
+        int written = define->value ?
+            snprintf(cur, len + 1 - (cur - buf), "#define %s %s\n", define->name, define->value) :
+            snprintf(cur, len + 1 - (cur - buf), "#define %s\n", define->name);
+        _MGLSL_ASSERT(written > 0);
+        cur += written;
+    }
+
+    memcpy(cur, insert, body_len - head_len);
+    cur += body_len - head_len;
+    *cur = '\0';
+    _MGLSL_ASSERT((size_t)(cur - buf) == len);
+
+    if(line_map && body_map) {
+        unsigned int insert_line = 1 + newline_before;
+        for(const char * c = body; c < insert; c++) if(*c == '\n') insert_line++;
+
+        unsigned int block_lines = (unsigned int)defines->size;
+
+        line_map->size = 0;
+        line_map->data = (mglsl_LineMapRun*)_mglsl_alloc((body_map->size + 2) * sizeof(mglsl_LineMapRun));
+        if(!line_map->data) {
+            _mglsl_free(buf);
+            return MGLSL_E_ALLOC;
+        }
+
+        mglsl_LineMapRun * runs = line_map->data;
+        size_t r = 0;
+
+        for(; r<body_map->size && body_map->data[r].line < insert_line; r++)
+            runs[line_map->size++] = body_map->data[r];
+
+        if(block_lines) {
+            runs[line_map->size].line = insert_line;
+            runs[line_map->size].module_idx = MGLSL_LINE_MAP_NO_MODULE;
+            runs[line_map->size].src_line = 0;
+            line_map->size++;
+
+            // run cut in two by the block goes on after it
+            if(r > 0 && (r == body_map->size || body_map->data[r].line > insert_line)) {
+                const mglsl_LineMapRun * cut = body_map->data + r - 1;
+                runs[line_map->size].line = insert_line + block_lines;
+                runs[line_map->size].module_idx = cut->module_idx;
+                runs[line_map->size].src_line = cut->src_line + (insert_line - cut->line);
+                line_map->size++;
+            }
+        }
+
+        for(; r<body_map->size; r++) {
+            runs[line_map->size] = body_map->data[r];
+            runs[line_map->size++].line += block_lines;
+        }
+    }
+
+    *bufptr = buf;
+    return MGLSL_E_SUCCESS;
+}
+
+//
+//
+
+int mglsl_assemble_shader
+    (char ** bufptr, const char * root_module_name, mglsl_ModuleArr module_arr)
+{
+    return mglsl_assemble_shader_ex(bufptr, root_module_name, module_arr, NULL);
+}
+
+// Resolves modules required by root and assembles them into buffer, or to write if it is set.
+static int _mglsl_assemble_root
+    (char ** bufptr, mglsl_WriteProc * write, void * user, const char * root_module_name,
+     mglsl_ModuleArr module_arr, const mglsl_AssembleOptions * options)
+{
+    _MGLSL_PROBE2(assemble_start, root_module_name, module_arr.size);
+
+    _mglsl_Graph graph;
+    int ec = _mglsl_acquire_graph(&graph, module_arr);
+    if(ec) {
+        _MGLSL_PROBE3(assemble_done, root_module_name, (size_t)0, ec);
+        return _mglsl_log_err(ec);
+    }
+
+    unsigned int flags = options ? options->flags : 0;
+    unsigned int stages = options ? options->stages : 0;
+    mglsl_LineMap * line_map = options ? options->line_map : NULL;
+
+    size_t order_len, len = 0;
+    size_t * order = (size_t*)_mglsl_alloc((module_arr.size + 1) * sizeof(size_t));
+    if(!order) ec = MGLSL_E_ALLOC;
+
+    if(!ec) ec = _mglsl_resolve_bodies(order, &order_len, root_module_name, &graph, module_arr, NULL, stages);
+
+#ifdef _MGLSL_REFLECTION
+    mglsl_Reflection * reflection = options ? options->reflection : NULL;
+    if(!ec && reflection) ec = _mglsl_reflect_merge(reflection, order, order_len, module_arr);
+#endif
+
+    if(!ec) ec = write ?
+        _mglsl_assemble_stream(write, user, &len, order, order_len, module_arr, flags, line_map) :
+        _mglsl_assemble(bufptr, &len, order, order_len, module_arr, flags, line_map);
+
+#ifdef _MGLSL_REFLECTION
+    if(ec && reflection) mglsl_free_reflection(reflection);
+#endif
+
+    if(order) _mglsl_free(order);
+    _mglsl_release_graph(&graph);
+
+    _MGLSL_PROBE3(assemble_done, root_module_name, len, ec);
+    return ec ? _mglsl_log_err(ec) : MGLSL_E_SUCCESS;
+}
+
+int mglsl_assemble_shader_ex
+    (char ** bufptr, const char * root_module_name, mglsl_ModuleArr module_arr,
+     const mglsl_AssembleOptions * options)
+{
+    _MGLSL_ASSERT(bufptr);
+    return _mglsl_assemble_root(bufptr, NULL, NULL, root_module_name, module_arr, options);
+}
+
+// Peak memory does not depend on shader size, only on MGLSL_STREAM_BUF_LEN.
+int mglsl_assemble_shader_stream
+    (mglsl_WriteProc * write, void * user, const char * root_module_name, mglsl_ModuleArr module_arr,
+     const mglsl_AssembleOptions * options)
+{
+    _MGLSL_ASSERT(write);
+    return _mglsl_assemble_root(NULL, write, user, root_module_name, module_arr, options);
+}
+
+int mglsl_assemble_shader_variant
+    (char ** bufptr, const char * root_module_name, mglsl_ModuleArr module_arr,
+     mglsl_DefineArr defines, const mglsl_AssembleOptions * options)
+{
+    return mglsl_assemble_shader_variants(bufptr, root_module_name, module_arr, &defines, 1, options);
+}
+
+// Variants which agree on every condition met on the way from the root resolve
+// to the same modules, these are resolved and assembled once per group.
+
+int mglsl_assemble_shader_variants
+    (char ** bufs, const char * root_module_name, mglsl_ModuleArr module_arr,
+     const mglsl_DefineArr * variants, size_t variant_count, const mglsl_AssembleOptions * options)
+{
+    _MGLSL_ASSERT(bufs && (variants || !variant_count));
+
+    unsigned int flags = options ? options->flags : 0;
+    unsigned int stages = options ? options->stages : 0;
+    mglsl_LineMap * line_maps = options ? options->line_map : NULL;
+#ifdef _MGLSL_REFLECTION
+    mglsl_Reflection * reflections = options ? options->reflection : NULL;
+#endif
+
+    for(size_t v=0; v<variant_count; v++) {
+        bufs[v] = NULL;
+        if(line_maps) {
+            line_maps[v].data = NULL;
+            line_maps[v].size = 0;
+        }
+#ifdef _MGLSL_REFLECTION
+        if(reflections) {
+            reflections[v].data = NULL;
+            reflections[v].size = 0;
+        }
+#endif
+    }
+
+    size_t order_len, conds_len = 0, conds_cap = 0;
+    size_t * order = (size_t*)_mglsl_alloc((module_arr.size + 1) * sizeof(size_t));
+    size_t * leaders = (size_t*)_mglsl_alloc((variant_count + 1) * sizeof(size_t));
+    const char ** conds = NULL;
+    unsigned char * keys = NULL;
+
+    _mglsl_CondEnv env;
+    memset(&env, 0, sizeof(env));
+
+    _mglsl_Graph graph;
+    int ec = _mglsl_acquire_graph(&graph, module_arr);
+    if(!ec && (!order || !leaders)) ec = MGLSL_E_ALLOC;
+
+    // all modules any of the variants may need
+    if(!ec) ec = _mglsl_resolve_bodies(order, &order_len, root_module_name, &graph, module_arr, NULL, stages);
+    if(!ec) ec = _mglsl_collect_macros(&env, order, order_len, module_arr);
+
+    if(!ec) {
+        for(size_t i=0; i<order_len; i++) {
+            const mglsl_Module * module = module_arr.data + order[i];
+            if(module->deps_cond) conds_cap += module->deps_len;
+        }
+
+        conds = (const char**)_mglsl_alloc((conds_cap + 1) * sizeof(char*));
+        if(!conds) ec = MGLSL_E_ALLOC;
+    }
+
+    // distinct conditions on the way
+    if(!ec) {
+        for(size_t i=0; i<order_len; i++) {
+            const mglsl_Module * module = module_arr.data + order[i];
+
+            for(size_t d=0; module->deps_cond && d<module->deps_len; d++) {
+                const char * cond = module->deps_cond[d];
+                if(!cond) continue;
+
+                size_t c = 0;
+                while(c < conds_len && strcmp(conds[c], cond)) c++;
+                if(c == conds_len) conds[conds_len++] = cond;
+            }
+        }
+
+        keys = (unsigned char*)_mglsl_alloc(variant_count * conds_len + 1);
+        if(!keys) ec = MGLSL_E_ALLOC;
+    }
+
+    if(!ec) {
+        for(size_t v=0; v<variant_count; v++) {
+            unsigned char * key = keys + v * conds_len;
+            env.defines = variants + v;
+            for(size_t c=0; c<conds_len; c++) key[c] = (unsigned char)_mglsl_eval_cond(conds[c], &env);
+
+            leaders[v] = v;
+            for(size_t w=0; w<v; w++) {
+                if(leaders[w] == w && !memcmp(keys + w * conds_len, key, conds_len)) {
+                    leaders[v] = w;
+                    break;
+                }
+            }
+        }
+    }
+
+    for(size_t v=0; !ec && v<variant_count; v++) {
+        if(leaders[v] != v) continue;
+
+        char * body = NULL;
+        size_t body_len;
+        mglsl_LineMap body_map;
+        memset(&body_map, 0, sizeof(body_map));
+
+        env.defines = variants + v;
+        ec = _mglsl_resolve(order, &order_len, root_module_name, &graph, module_arr, &env, stages);
+        if(!ec) ec = _mglsl_assemble(&body, &body_len, order, order_len, module_arr, flags,
+                                     line_maps ? &body_map : NULL);
+
+        for(size_t w=v; !ec && w<variant_count; w++) {
+            if(leaders[w] != v) continue;
+            ec = _mglsl_insert_defines(bufs + w, line_maps ? line_maps + w : NULL,
+                                       body, body_len, line_maps ? &body_map : NULL, variants + w);
+#ifdef _MGLSL_REFLECTION
+            if(!ec && reflections) ec = _mglsl_reflect_merge(reflections + w, order, order_len, module_arr);
+#endif
+        }
+
+        if(body) _mglsl_free(body);
+        if(body_map.data) mglsl_free_line_map(&body_map);
+    }
+
+    _mglsl_release_graph(&graph);
+    if(order) _mglsl_free(order);
+    if(leaders) _mglsl_free(leaders);
+    if(conds) _mglsl_free((void*)conds);
+    if(keys) _mglsl_free(keys);
+    if(env.macros) _mglsl_free(env.macros);
+
+    if(ec) {
+        for(size_t v=0; v<variant_count; v++) {
+            if(bufs[v]) _mglsl_free(bufs[v]);
+            bufs[v] = NULL;
+            if(line_maps && line_maps[v].data) mglsl_free_line_map(line_maps + v);
+#ifdef _MGLSL_REFLECTION
+            if(reflections) mglsl_free_reflection(reflections + v);
+#endif
+        }
+        return _mglsl_log_err(ec);
+    }
+
+    return MGLSL_E_SUCCESS;
+}
+
+// Modules of all stages are resolved at once, every stage then gets modules it is reached
+// in, which are found in one pass over resolved modules from the root down. Edges always
+// lead towards the beginning of the order, so the order stays valid for every stage.
+
+int mglsl_assemble_program
+    (char ** bufs, const char * root_module_name, mglsl_ModuleArr module_arr,
+     unsigned int stages, const mglsl_AssembleOptions * options)
+{
+    _MGLSL_ASSERT(bufs);
+
+    unsigned int flags = options ? options->flags : 0;
+    mglsl_LineMap * line_maps = options ? options->line_map : NULL;
+#ifdef _MGLSL_REFLECTION
+    mglsl_Reflection * reflections = options ? options->reflection : NULL;
+#endif
+
+    for(int t=0; t<MGLSL_SHADER_TYPE_COUNT; t++) {
+        bufs[t] = NULL;
+        if(line_maps) {
+            line_maps[t].data = NULL;
+            line_maps[t].size = 0;
+        }
+#ifdef _MGLSL_REFLECTION
+        if(reflections) {
+            reflections[t].data = NULL;
+            reflections[t].size = 0;
+        }
+#endif
+    }
+    stages &= _MGLSL_ALL_STAGES & ~MGLSL_STAGE(NONE);
+    if(!stages) return MGLSL_E_SUCCESS;
+
+    size_t order_len;
+    size_t * order = (size_t*)_mglsl_alloc(2 * (module_arr.size + 1) * sizeof(size_t));
+    unsigned char * reach = (unsigned char*)_mglsl_alloc(module_arr.size + 1);
+
+    _mglsl_Graph graph;
+    int ec = _mglsl_acquire_graph(&graph, module_arr);
+    if(!ec && (!order || !reach)) ec = MGLSL_E_ALLOC;
+
+    if(!ec) ec = _mglsl_resolve_bodies(order, &order_len, root_module_name, &graph, module_arr, NULL, stages);
+
+    // stages each module is needed in, root comes last
+    if(!ec && order_len) {
+        memset(reach, 0, module_arr.size);
+        reach[order[order_len - 1]] = graph.stages[order[order_len - 1]] & stages;
+
+        for(size_t i=order_len; i-- > 0;) {
+            size_t m = order[i];
+            for(unsigned int e=graph.dep_begin[m]; e<graph.dep_begin[m + 1]; e++) {
+                unsigned int d = graph.dep_idx[e];
+                reach[d] |= reach[m] & graph.stages[d];
+            }
+        }
+    }
+
+    size_t * stage_order = order ? order + module_arr.size + 1 : NULL;
+
+    for(int t=VERT; !ec && order_len && t<MGLSL_SHADER_TYPE_COUNT; t++) {
+        if(!(reach[order[order_len - 1]] & MGLSL_STAGE(t))) continue;
+
+        size_t stage_order_len = 0;
+        for(size_t i=0; i<order_len; i++)
+            if(reach[order[i]] & MGLSL_STAGE(t)) stage_order[stage_order_len++] = order[i];
+
+        ec = _mglsl_assemble(bufs + t, NULL, stage_order, stage_order_len, module_arr, flags,
+                             line_maps ? line_maps + t : NULL);
+#ifdef _MGLSL_REFLECTION
+        if(!ec && reflections) ec = _mglsl_reflect_merge(reflections + t, stage_order, stage_order_len, module_arr);
+#endif
+    }
+
+    _mglsl_release_graph(&graph);
+    if(order) _mglsl_free(order);
+    if(reach) _mglsl_free(reach);
+
+    if(ec) {
+        for(int t=0; t<MGLSL_SHADER_TYPE_COUNT; t++) {
+            if(bufs[t]) _mglsl_free(bufs[t]);
+            bufs[t] = NULL;
+            if(line_maps && line_maps[t].data) mglsl_free_line_map(line_maps + t);
+#ifdef _MGLSL_REFLECTION
+            if(reflections) mglsl_free_reflection(reflections + t);
+#endif
+        }
+        return _mglsl_log_err(ec);
+    }
+
+    return MGLSL_E_SUCCESS;
+}
+
+//
+//
+
+int mglsl_free_shader(char * buf) {
+    _MGLSL_ASSERT(buf);
+    _mglsl_free(buf);
+    return MGLSL_E_SUCCESS;
+}
+
+//
+//
+
+int mglsl_line_map_lookup
+    (mglsl_SourceLoc * loc, const mglsl_LineMap * line_map, mglsl_ModuleArr module_arr, size_t line)
+{
+    _MGLSL_ASSERT(loc && line_map);
+
+    // last run starting at or before the line
+    size_t lo = 0, hi = line_map->size;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(line_map->data[mid].line <= line) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if(lo == 0) return MGLSL_E_LINE_NOT_MAPPED;
+
+    const mglsl_LineMapRun * run = line_map->data + lo - 1;
+    if(run->module_idx == MGLSL_LINE_MAP_NO_MODULE) return MGLSL_E_LINE_NOT_MAPPED;
+    if(run->module_idx >= module_arr.size) return MGLSL_E_MODULE_NOT_FOUND;
+
+    const mglsl_Module * module = module_arr.data + run->module_idx;
+
+    loc->module_idx = run->module_idx;
+    loc->name = mglsl_module_name(module);
+    loc->path = mglsl_module_path(module);
+    loc->line = run->src_line + (line - run->line);
+    return MGLSL_E_SUCCESS;
+}
+
+int mglsl_free_line_map(mglsl_LineMap * line_map) {
+    _MGLSL_ASSERT(line_map);
+    if(line_map->data) _mglsl_free(line_map->data);
+    line_map->data = NULL;
+    line_map->size = 0;
+    return MGLSL_E_SUCCESS;
+}
+
+//
+// SHADER CACHE
+// Entry in cache directory holds assembled shader together with what it was assembled
+// from: root name, options, digest of resolved modules and identities (path, size, mtime)
+// of their files. Entries are written to temporary file which is then renamed over the
+// entry, so processes sharing the directory only ever see complete entries. Hits are
+// mapped, not read.
+
+#ifdef _MGLSL_CACHE
+
+#define _MGLSL_CACHE_VERSION 1
+#define _MGLSL_CACHE_HASH_SEED 14695981039346656037ull
+
+#ifdef _MGLSL_MODULE_HEADER_COMMENT
+# define _MGLSL_CACHE_CONFIG 1u
+#else
+# define _MGLSL_CACHE_CONFIG 0u
+#endif
+
+// Entry is header, file of every module in order, root name, paths and shader.
+// Strings are null-terminated.
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    unsigned int config;       // switches the output depends on
+    unsigned int flags;
+    unsigned int stages;
+    unsigned int module_count;
+    unsigned int root_len;
+    unsigned long long digest; // resolved modules, see _mglsl_cache_digest
+    unsigned long long paths_len;
+    unsigned long long shader_len;
+} _mglsl_CacheHeader;
+
+// Module file, path_len is 0 if module was not created from file.
+typedef struct {
+    long long mtime;
+    unsigned long long size;
+    unsigned long long path_len;
+} _mglsl_CacheFile;
+
+static const char _mglsl_cache_magic[8] = "mglslc";
+
+static unsigned long long _mglsl_cache_hash(unsigned long long hash, const void * data, size_t len) {
+    const unsigned char * bytes = (const unsigned char*)data;
+    for(size_t i=0; i<len; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Computed once when module is parsed or attached, so digests of resolved modules
+// only combine these.
+static unsigned long long _mglsl_module_digest(const mglsl_Module * module)
+{
+    unsigned long long hash = _MGLSL_CACHE_HASH_SEED;
+#ifdef _MGLSL_COMPRESS_SOURCES
+    if(module->_packed_len)
+        hash = _mglsl_cache_hash(hash, module->source, module->_packed_len);
+    else
+#endif
+    hash = _mglsl_cache_hash(hash, module->source, strlen(module->source) + 1);
+    return _mglsl_cache_hash(hash, module->_line_runs, module->_line_runs_len * sizeof(_mglsl_LineRun));
+}
+
+// Module indices are part of it as '#line' directives refer to them.
+static unsigned long long _mglsl_cache_digest
+    (const size_t * order, size_t order_len, mglsl_ModuleArr module_arr)
+{
+    unsigned long long hash = _MGLSL_CACHE_HASH_SEED;
+
+    for(size_t i=0; i<order_len; i++) {
+        const mglsl_Module * module = module_arr.data + order[i];
+        const char * name = _mglsl_str(module->name);
+        unsigned long long idx = order[i];
+
+        hash = _mglsl_cache_hash(hash, &idx, sizeof(idx));
+        hash = _mglsl_cache_hash(hash, name, strlen(name) + 1);
+        hash = _mglsl_cache_hash(hash, &module->_digest, sizeof(module->_digest));
+    }
+
+    return hash;
+}
+
+// Entry of root and options is <cache_dir>/<hash of both>.mglslc
+static int _mglsl_cache_path
+    (char * buf, const char * cache_dir, const char * root_module_name, unsigned int flags, unsigned int stages)
+{
+    unsigned long long key = _MGLSL_CACHE_HASH_SEED;
+    key = _mglsl_cache_hash(key, root_module_name, strlen(root_module_name) + 1);
+    key = _mglsl_cache_hash(key, &flags, sizeof(flags));
+    key = _mglsl_cache_hash(key, &stages, sizeof(stages));
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.mglslc", key);
+    return MGLSL_CONCAT_PATH(buf, MGLSL_MAX_PATH_LEN + 1, cache_dir, name);
+}
+
+// Maps entry if it is complete and of given root and options, returns its header.
+static int _mglsl_cache_map
+    (mglsl_CachedShader * shader, const _mglsl_CacheHeader ** headerptr, const char * path,
+     const char * root_module_name, unsigned int flags, unsigned int stages)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return MGLSL_E_CACHE_MISS;
+
+    struct stat st;
+    void * map = MAP_FAILED;
+    if(!fstat(fd, &st) && (size_t)st.st_size >= sizeof(_mglsl_CacheHeader))
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    _MGLSL_STAT_ADD(read_calls, 1);
+
+    if(map == MAP_FAILED) return MGLSL_E_CACHE_MISS;
+
+    const _mglsl_CacheHeader * header = (const _mglsl_CacheHeader*)map;
+    const _mglsl_CacheFile * files = (const _mglsl_CacheFile*)(header + 1);
+    const char * end = (const char*)map + st.st_size;
+
+    size_t root_len = strlen(root_module_name);
+    int valid =
+        !memcmp(header->magic, _mglsl_cache_magic, sizeof(header->magic)) &&
+        header->version == _MGLSL_CACHE_VERSION && header->config == _MGLSL_CACHE_CONFIG &&
+        header->flags == flags && header->stages == stages && header->root_len == root_len &&
+        (unsigned long long)(end - (const char*)files) / sizeof(_mglsl_CacheFile) >= header->module_count;
+
+    const char * root = valid ? (const char*)(files + header->module_count) : end;
+
+    // sizes of all parts have to add up to the size of the entry
+    valid = valid && (unsigned long long)(end - root) > root_len &&
+        (unsigned long long)(end - root) - root_len - 1 > header->paths_len &&
+        (unsigned long long)(end - root) - root_len - 1 - header->paths_len == header->shader_len + 1;
+
+    valid = valid && !memcmp(root, root_module_name, root_len) && !root[root_len] && !end[-1];
+
+    const char * paths = root + root_len + 1;
+    unsigned long long paths_len = 0;
+    for(unsigned int i=0; valid && i<header->module_count; i++) {
+        if(!files[i].path_len) continue;
+        paths_len += files[i].path_len + 1;
+        valid = paths_len <= header->paths_len && !paths[paths_len - 1];
+    }
+    valid = valid && paths_len == header->paths_len;
+
+    if(!valid) {
+        munmap(map, (size_t)st.st_size);
+        return MGLSL_E_CACHE_MISS;
+    }
+
+    shader->data = paths + paths_len;
+    shader->size = (size_t)header->shader_len;
+    shader->_map = map;
+    shader->_map_len = (size_t)st.st_size;
+
+    *headerptr = header;
+    return MGLSL_E_SUCCESS;
+}
+
+// Whether every module of the entry was created from file which did not change since.
+static int _mglsl_cache_files_unchanged(const _mglsl_CacheHeader * header)
+{
+    const _mglsl_CacheFile * files = (const _mglsl_CacheFile*)(header + 1);
+    const char * path = (const char*)(files + header->module_count) + header->root_len + 1;
+
+    for(unsigned int i=0; i<header->module_count; i++) {
+        if(!files[i].path_len) return 0;
+
+        struct stat st;
+        _MGLSL_STAT_ADD(stat_calls, 1);
+        if(stat(path, &st) || (unsigned long long)st.st_size != files[i].size ||
+           (long long)st.st_mtime != files[i].mtime) return 0;
+
+        path += files[i].path_len + 1;
+    }
+
+    return 1;
+}
+
+static int _mglsl_cache_write(int fd, const void * data, size_t len)
+{
+    const char * cur = (const char*)data;
+
+    while(len) {
+        ssize_t written = write(fd, cur, len);
+        if(written <= 0) return MGLSL_E_WRITE;
+        cur += written;
+        len -= (size_t)written;
+    }
+
+    return MGLSL_E_SUCCESS;
+}
+
+// Module files are checked to be the ones modules were created from, otherwise
+// nothing is stored and MGLSL_E_FILE_CHANGED is returned.
+static int _mglsl_cache_store
+    (const char * path, const char * root_module_name, unsigned int flags, unsigned int stages,
+     unsigned long long digest, const size_t * order, size_t order_len, mglsl_ModuleArr module_arr,
+     const char * shader, size_t shader_len)
+{
+    _mglsl_CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, _mglsl_cache_magic, sizeof(header.magic));
+    header.version = _MGLSL_CACHE_VERSION;
+    header.config = _MGLSL_CACHE_CONFIG;
+    header.flags = flags;
+    header.stages = stages;
+    header.module_count = (unsigned int)order_len;
+    header.root_len = (unsigned int)strlen(root_module_name);
+    header.digest = digest;
+    header.shader_len = shader_len;
+
+    _mglsl_CacheFile * files = (_mglsl_CacheFile*)_mglsl_alloc((order_len + 1) * sizeof(_mglsl_CacheFile));
+    if(!files) return MGLSL_E_ALLOC;
+    memset(files, 0, order_len * sizeof(_mglsl_CacheFile));
+
+    int ec = MGLSL_E_SUCCESS;
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+    for(size_t i=0; !ec && i<order_len; i++) {
+        const mglsl_Module * module = module_arr.data + order[i];
+        if(!module->path) continue;
+
+        const char * module_path = _mglsl_str(module->path);
+        struct stat st;
+        _MGLSL_STAT_ADD(stat_calls, 1);
+        if(stat(module_path, &st) || st.st_mtime != module->mtime) {
+            ec = MGLSL_E_FILE_CHANGED;
+            break;
+        }
+
+        files[i].mtime = (long long)st.st_mtime;
+        files[i].size = (unsigned long long)st.st_size;
+        files[i].path_len = strlen(module_path);
+        header.paths_len += files[i].path_len + 1;
+    }
+#else
+    (void)order;
+    (void)module_arr;
+#endif
+
+    char tmp[MGLSL_MAX_PATH_LEN + 1];
+    int fd = -1;
+
+    if(!ec) {
+        int len = snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+        if(len < 0 || len >= (int)sizeof(tmp)) ec = MGLSL_E_BUF_TOO_SMALL;
+    }
+
+    if(!ec) {
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) ec = MGLSL_E_FILE_OPEN;
+    }
+
+    if(!ec) ec = _mglsl_cache_write(fd, &header, sizeof(header));
+    if(!ec) ec = _mglsl_cache_write(fd, files, order_len * sizeof(_mglsl_CacheFile));
+    if(!ec) ec = _mglsl_cache_write(fd, root_module_name, header.root_len + 1);
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+    for(size_t i=0; !ec && i<order_len; i++) {
+        if(files[i].path_len)
+            ec = _mglsl_cache_write(fd, _mglsl_str(module_arr.data[order[i]].path), files[i].path_len + 1);
+    }
+#endif
+
+    if(!ec) ec = _mglsl_cache_write(fd, shader, shader_len + 1);
+
+    // entry has to be on disk before it replaces the old one, or a crash could leave it empty
+    if(!ec && fsync(fd)) ec = MGLSL_E_WRITE;
+    if(fd >= 0 && close(fd) && !ec) ec = MGLSL_E_WRITE;
+    if(!ec && rename(tmp, path)) ec = MGLSL_E_WRITE;
+    if(ec && fd >= 0) unlink(tmp);
+
+    _mglsl_free(files);
+    return ec;
+}
+
+// Misses are not logged, they are not errors.
+int mglsl_cache_load
+    (mglsl_CachedShader * shader, const char * cache_dir, const char * root_module_name,
+     const mglsl_AssembleOptions * options)
+{
+    _MGLSL_ASSERT(shader && cache_dir && root_module_name);
+    memset(shader, 0, sizeof(*shader));
+
+    unsigned int flags = options ? options->flags : 0;
+    unsigned int stages = options ? options->stages : 0;
+
+    char path[MGLSL_MAX_PATH_LEN + 1];
+    int ec = _mglsl_cache_path(path, cache_dir, root_module_name, flags, stages);
+    if(ec) {
+        _mglsl_err_name = cache_dir;
+        return _mglsl_log_err(ec);
+    }
+
+    _MGLSL_STAT_TIMER(t);
+
+    const _mglsl_CacheHeader * header;
+    ec = _mglsl_cache_map(shader, &header, path, root_module_name, flags, stages);
+
+    if(!ec && !_mglsl_cache_files_unchanged(header)) {
+        mglsl_free_cached_shader(shader);
+        ec = MGLSL_E_CACHE_MISS;
+    }
+
+    _MGLSL_STAT_TIME(read_ns, t);
+    return ec;
+}
+
+// Modules are resolved either way, digest of them decides whether entry is still good.
+int mglsl_assemble_shader_cached
+    (mglsl_CachedShader * shader, const char * cache_dir, const char * root_module_name,
+     mglsl_ModuleArr module_arr, const mglsl_AssembleOptions * options)
+{
+    _MGLSL_ASSERT(shader && cache_dir && root_module_name);
+    _MGLSL_ASSERT(!options || !options->line_map);
+#ifdef _MGLSL_REFLECTION
+    _MGLSL_ASSERT(!options || !options->reflection);
+#endif
+    memset(shader, 0, sizeof(*shader));
+
+    unsigned int flags = options ? options->flags : 0;
+    unsigned int stages = options ? options->stages : 0;
+
+    char path[MGLSL_MAX_PATH_LEN + 1];
+    int ec = _mglsl_cache_path(path, cache_dir, root_module_name, flags, stages);
+    if(ec) {
+        _mglsl_err_name = cache_dir;
+        return _mglsl_log_err(ec);
+    }
+
+    _mglsl_Graph graph;
+    ec = _mglsl_acquire_graph(&graph, module_arr);
+    if(ec) return _mglsl_log_err(ec);
+
+    size_t order_len;
+    size_t * order = (size_t*)_mglsl_alloc((module_arr.size + 1) * sizeof(size_t));
+    if(!order) ec = MGLSL_E_ALLOC;
+
+    if(!ec) ec = _mglsl_resolve_bodies(order, &order_len, root_module_name, &graph, module_arr, NULL, stages);
+
+    unsigned long long digest = 0;
+    int hit = 0;
+
+    if(!ec) {
+        digest = _mglsl_cache_digest(order, order_len, module_arr);
+
+        _MGLSL_STAT_TIMER(t);
+        const _mglsl_CacheHeader * header;
+        if(!_mglsl_cache_map(shader, &header, path, root_module_name, flags, stages)) {
+            hit = header->digest == digest;
+            if(!hit) mglsl_free_cached_shader(shader);
+        }
+        _MGLSL_STAT_TIME(read_ns, t);
+    }
+
+    if(!ec && !hit) {
+        char * buf;
+        ec = _mglsl_assemble(&buf, &shader->size, order, order_len, module_arr, flags, NULL);
+
+        if(!ec) {
+            shader->data = buf;
+
+            // shader is there even if it could not be stored
+            int store_ec = _mglsl_cache_store(path, root_module_name, flags, stages, digest,
+                                              order, order_len, module_arr, buf, shader->size);
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+            if(store_ec == MGLSL_E_FILE_CHANGED) store_ec = MGLSL_E_SUCCESS;
+#endif
+            if(store_ec) {
+                _mglsl_err_name = path;
+                _mglsl_log_err(store_ec);
+            }
+        }
+    }
+
+    if(order) _mglsl_free(order);
+    _mglsl_release_graph(&graph);
+    return ec ? _mglsl_log_err(ec) : MGLSL_E_SUCCESS;
+}
+
+int mglsl_free_cached_shader(mglsl_CachedShader * shader) {
+    _MGLSL_ASSERT(shader);
+    if(shader->_map) munmap(shader->_map, shader->_map_len);
+    else if(shader->data) _mglsl_free((void*)shader->data);
+    memset(shader, 0, sizeof(*shader));
+    return MGLSL_E_SUCCESS;
+}
+
+#endif
+
+//
+// SHARED MODULES
+// Parsed modules are published into POSIX shared memory object, so that other processes
+// on the host attach to them instead of importing and parsing their own copies. Segment
+// holds header, table of modules and their data, all referred to by offsets from its
+// beginning, 0 meaning none. Attached modules point into the mapped segment for sources,
+// line runs and dependency conditions, only names are interned into process' string table.
+
+#ifdef _MGLSL_SHARED_MODULES
+
+#define _MGLSL_SHM_VERSION 1
+
+#ifdef _MGLSL_COMPRESS_SOURCES
+# define _MGLSL_SHM_COMPRESS 1u
+#else
+# define _MGLSL_SHM_COMPRESS 0u
+#endif
+#ifdef _MGLSL_REFLECTION
+# define _MGLSL_SHM_REFLECTION 2u
+#else
+# define _MGLSL_SHM_REFLECTION 0u
+#endif
+
+// switches the layout depends on, processes built with different ones do not attach
+#define _MGLSL_SHM_CONFIG (_MGLSL_SHM_COMPRESS | _MGLSL_SHM_REFLECTION | \
+                           (unsigned int)sizeof(_mglsl_LineRun) << 8)
+
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    unsigned int config;
+    unsigned long long size;
+    unsigned long long module_count;
+    unsigned int ready; // set once everything else is written
+    unsigned int pad;
+} _mglsl_ShmHeader;
+
+typedef struct {
+    unsigned long long name;
+    unsigned long long path;        // 0 if module was not created from file
+    long long mtime;
+    unsigned long long source;
+    unsigned long long source_size; // stored bytes, including terminator if not compressed
+    unsigned long long source_len;  // of parsed source if compressed, otherwise 0
+    unsigned long long line_runs;
+    unsigned long long line_runs_len;
+    unsigned long long deps;        // array of name offsets
+    unsigned long long deps_cond;   // array of condition offsets, 0 if all are unconditional
+    unsigned long long deps_len;
+    unsigned long long reflect;     // array of _mglsl_ShmReflectDecl
+    unsigned long long reflect_len;
+    unsigned int stages;
+    unsigned int pad;
+} _mglsl_ShmModule;
+
+#ifdef _MGLSL_REFLECTION
+// Names of reflected declaration are offsets here, its own name and type are 0.
+typedef struct {
+    mglsl_ReflectDecl decl;
+    unsigned long long name;
+    unsigned long long type;
+} _mglsl_ShmReflectDecl;
+#endif
+
+static const char _mglsl_shm_magic[8] = "mglslm";
+
+typedef struct {
+    char * base; // NULL while segment is only measured
+    size_t len;
+} _mglsl_ShmWriter;
+
+// Appends data, or reserves room for it if it is NULL, returns its offset.
+static unsigned long long _mglsl_shm_put(_mglsl_ShmWriter * w, const void * data, size_t len, size_t align)
+{
+    size_t offset = (w->len + align - 1) & ~(align - 1);
+    if(w->base && data && len) memcpy(w->base + offset, data, len);
+    w->len = offset + len;
+    return offset;
+}
+
+static unsigned long long _mglsl_shm_put_str(_mglsl_ShmWriter * w, mglsl_StrId id) {
+    if(!id) return 0;
+    const char * str = _mglsl_str(id);
+    return _mglsl_shm_put(w, str, strlen(str) + 1, 1);
+}
+
+static void _mglsl_shm_set(_mglsl_ShmWriter * w, unsigned long long offset, const void * data, size_t len) {
+    if(w->base) memcpy(w->base + offset, data, len);
+}
+
+// Lays out segment of modules at base, or only measures it if base is NULL. Returns its size.
+static size_t _mglsl_shm_layout(char * base, mglsl_ModuleArr module_arr)
+{
+    _mglsl_ShmWriter w = { base, 0 };
+
+    _mglsl_shm_put(&w, NULL, sizeof(_mglsl_ShmHeader), 8);
+    unsigned long long table = _mglsl_shm_put(&w, NULL, module_arr.size * sizeof(_mglsl_ShmModule), 8);
+
+    for(size_t i=0; i<module_arr.size; i++) {
+        const mglsl_Module * module = module_arr.data + i;
+        _mglsl_ShmModule rec;
+        memset(&rec, 0, sizeof(rec));
+
+        rec.name = _mglsl_shm_put_str(&w, module->name);
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+        rec.path = _mglsl_shm_put_str(&w, module->path);
+        rec.mtime = (long long)module->mtime;
+#endif
+
+        rec.source_size = strlen(module->source) + 1;
+#ifdef _MGLSL_COMPRESS_SOURCES
+        if(module->_packed_len) {
+            rec.source_size = module->_packed_len;
+            rec.source_len = module->_source_len;
+        }
+#endif
+        rec.source = _mglsl_shm_put(&w, module->source, rec.source_size, 1);
+
+        rec.line_runs_len = module->_line_runs_len;
+        rec.line_runs = _mglsl_shm_put(&w, module->_line_runs, module->_line_runs_len * sizeof(_mglsl_LineRun), 8);
+
+        rec.deps_len = module->deps_len;
+        rec.deps = _mglsl_shm_put(&w, NULL, module->deps_len * sizeof(unsigned long long), 8);
+        for(size_t d=0; d<module->deps_len; d++) {
+            unsigned long long dep = _mglsl_shm_put_str(&w, module->deps[d]);
+            _mglsl_shm_set(&w, rec.deps + d * sizeof(dep), &dep, sizeof(dep));
+        }
+
+        if(module->deps_cond) {
+            rec.deps_cond = _mglsl_shm_put(&w, NULL, module->deps_len * sizeof(unsigned long long), 8);
+            for(size_t d=0; d<module->deps_len; d++) {
+                const char * cond = module->deps_cond[d];
+                unsigned long long offset = cond ? _mglsl_shm_put(&w, cond, strlen(cond) + 1, 1) : 0;
+                _mglsl_shm_set(&w, rec.deps_cond + d * sizeof(offset), &offset, sizeof(offset));
+            }
+        }
+
+#ifdef _MGLSL_REFLECTION
+        rec.reflect_len = module->_reflect_len;
+        rec.reflect = _mglsl_shm_put(&w, NULL, module->_reflect_len * sizeof(_mglsl_ShmReflectDecl), 8);
+        for(size_t r=0; r<module->_reflect_len; r++) {
+            _mglsl_ShmReflectDecl decl;
+            decl.decl = module->_reflect[r];
+            decl.name = _mglsl_shm_put_str(&w, decl.decl.name);
+            decl.type = _mglsl_shm_put_str(&w, decl.decl.type);
+            decl.decl.name = decl.decl.type = 0;
+            _mglsl_shm_set(&w, rec.reflect + r * sizeof(decl), &decl, sizeof(decl));
+        }
+#endif
+
+        rec.stages = module->stages;
+        _mglsl_shm_set(&w, table + i * sizeof(rec), &rec, sizeof(rec));
+    }
+
+    if(base) {
+        _mglsl_ShmHeader * header = (_mglsl_ShmHeader*)base;
+        memset(header, 0, sizeof(*header));
+        memcpy(header->magic, _mglsl_shm_magic, sizeof(header->magic));
+        header->version = _MGLSL_SHM_VERSION;
+        header->config = _MGLSL_SHM_CONFIG;
+        header->size = w.len;
+        header->module_count = module_arr.size;
+    }
+
+    return w.len;
+}
+
+static int _mglsl_shm_write(int fd, const void * data, size_t len)
+{
+    const char * cur = (const char*)data;
+
+    while(len) {
+        ssize_t written = write(fd, cur, len);
+        if(written <= 0) return MGLSL_E_WRITE;
+        cur += written;
+        len -= (size_t)written;
+    }
+
+    return MGLSL_E_SUCCESS;
+}
+
+// Publisher holds write lock on the object until it is ready, system drops the lock
+// when publisher dies, so object that is not ready and not locked is abandoned. Object
+// too short to hold the header may not be locked yet, it is never taken as abandoned.
+static int _mglsl_shm_abandoned(const char * shm_name)
+{
+    int fd = shm_open(shm_name, O_RDONLY, 0);
+    if(fd < 0) return 0;
+
+    _mglsl_ShmHeader header;
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+
+    int abandoned = read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) && !header.ready &&
+        !fcntl(fd, F_GETLK, &lock) && lock.l_type == F_UNLCK;
+
+    close(fd);
+    return abandoned;
+}
+
+// Object is created exclusively, whoever creates it first publishes. MGLSL_E_SHM_EXISTS
+// returned to the others is not logged, as it is not an error. Object of publisher that
+// died before finishing is unlinked and published again; should two processes do that
+// at once, both publish and attached modules of either stay valid.
+int mglsl_publish_shared_modules(const char * shm_name, mglsl_ModuleArr module_arr)
+{
+    _MGLSL_ASSERT(shm_name);
+    _mglsl_err_name = shm_name;
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+    for(size_t i=0; i<module_arr.size; i++) {
+        int ec = mglsl_load_module_body(module_arr.data + i);
+        if(ec) return ec;
+    }
+#endif
+
+    size_t size = _mglsl_shm_layout(NULL, module_arr);
+    char * buf = (char*)_mglsl_alloc(size);
+    if(!buf) return _mglsl_log_err(MGLSL_E_ALLOC);
+
+    _mglsl_shm_layout(buf, module_arr);
+
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    int exists = fd < 0 && errno == EEXIST;
+    if(exists && _mglsl_shm_abandoned(shm_name)) {
+        shm_unlink(shm_name);
+        fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        exists = fd < 0 && errno == EEXIST;
+    }
+    if(fd < 0) {
+        _mglsl_free(buf);
+        return exists ? MGLSL_E_SHM_EXISTS : _mglsl_log_err(MGLSL_E_FILE_OPEN);
+    }
+
+    // ready flag is set by a separate write after everything else is in,
+    // so attaching processes see either nothing or all of it
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+
+    unsigned int ready = 1;
+    int ec = fcntl(fd, F_SETLK, &lock) ? MGLSL_E_WRITE : MGLSL_E_SUCCESS;
+    if(!ec) ec = _mglsl_shm_write(fd, buf, size);
+    if(!ec && lseek(fd, (off_t)offsetof(_mglsl_ShmHeader, ready), SEEK_SET) < 0) ec = MGLSL_E_WRITE;
+    if(!ec) ec = _mglsl_shm_write(fd, &ready, sizeof(ready));
+
+    close(fd);
+    _mglsl_free(buf);
+
+    if(ec) {
+        shm_unlink(shm_name);
+        return _mglsl_log_err(ec);
+    }
+    return MGLSL_E_SUCCESS;
+}
+
+typedef struct {
+    const char * base;
+    size_t size;
+} _mglsl_ShmView;
+
+// Whether array of count elements at offset lies within segment and is aligned.
+static int _mglsl_shm_valid(const _mglsl_ShmView * v, unsigned long long offset, unsigned long long count, size_t elem_size)
+{
+    if(offset > v->size || (count && !offset)) return 0;
+    if(offset % (elem_size < 8 ? elem_size : 8)) return 0;
+    return count <= (v->size - offset) / elem_size;
+}
+
+// Null-terminated string at offset, NULL if there is none.
+static const char * _mglsl_shm_str(const _mglsl_ShmView * v, unsigned long long offset)
+{
+    if(!offset || offset >= v->size) return NULL;
+    const char * str = v->base + offset;
+    return memchr(str, '\0', v->size - offset) ? str : NULL;
+}
+
+static int _mglsl_shm_intern(mglsl_StrId * id, const _mglsl_ShmView * v, unsigned long long offset)
+{
+    const char * str = _mglsl_shm_str(v, offset);
+    if(!str) return MGLSL_E_MODULE_CORRUPT;
+    return _mglsl_intern(id, str, strlen(str));
+}
+
+static int _mglsl_shm_intern_name(mglsl_StrId * id, const _mglsl_ShmView * v, unsigned long long offset)
+{
+    const char * str = _mglsl_shm_str(v, offset);
+    if(!str || !_mglsl_is_valid_name(str)) return MGLSL_E_MODULE_CORRUPT;
+    return _mglsl_intern(id, str, strlen(str));
+}
+
+// Everything is checked against the segment as it comes from another process.
+static int _mglsl_shm_attach_module(mglsl_Module * module, const _mglsl_ShmView * v, const _mglsl_ShmModule * rec)
+{
+    int ec;
+
+    memset(module, 0, sizeof(*module));
+    _mglsl_strtab_acquire();
+    module->flags = _MGLSL_ALIVE | _MGLSL_SHARED;
+    module->stages = (unsigned char)rec->stages;
+
+    if((ec = _mglsl_shm_intern_name(&module->name, v, rec->name))) return ec;
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+    if(rec->path && (ec = _mglsl_shm_intern(&module->path, v, rec->path))) return ec;
+    module->mtime = (time_t)rec->mtime;
+#endif
+
+    if(!rec->source_size || !_mglsl_shm_valid(v, rec->source, rec->source_size, 1))
+        return MGLSL_E_MODULE_CORRUPT;
+    module->source = (char*)v->base + rec->source;
+
+#ifdef _MGLSL_COMPRESS_SOURCES
+    if(rec->source_len) {
+        // no more than LZ4 can expand to
+        if(rec->source_len / 255 > rec->source_size) return MGLSL_E_MODULE_CORRUPT;
+        module->_packed_len = rec->source_size;
+        module->_source_len = rec->source_len;
+    } else
+#endif
+    if(rec->source_len || module->source[rec->source_size - 1]) {
+        return MGLSL_E_MODULE_CORRUPT;
+    }
+
+    if(!_mglsl_shm_valid(v, rec->line_runs, rec->line_runs_len, sizeof(_mglsl_LineRun)))
+        return MGLSL_E_MODULE_CORRUPT;
+    module->_line_runs = (_mglsl_LineRun*)(v->base + rec->line_runs);
+    module->_line_runs_len = rec->line_runs_len;
+#ifdef _MGLSL_CACHE
+    module->_digest = _mglsl_module_digest(module);
+#endif
+
+    if(!_mglsl_shm_valid(v, rec->deps, rec->deps_len, sizeof(unsigned long long)) ||
+       (rec->deps_cond && !_mglsl_shm_valid(v, rec->deps_cond, rec->deps_len, sizeof(unsigned long long))))
+        return MGLSL_E_MODULE_CORRUPT;
+
+    if(rec->deps_len) {
+        const unsigned long long * deps = (const unsigned long long*)(v->base + rec->deps);
+
+        module->deps = (mglsl_StrId*)_mglsl_alloc(rec->deps_len * sizeof(mglsl_StrId));
+        if(!module->deps) return MGLSL_E_ALLOC;
+
+        for(; module->deps_len < rec->deps_len; module->deps_len++)
+            if((ec = _mglsl_shm_intern_name(module->deps + module->deps_len, v, deps[module->deps_len]))) return ec;
+    }
+
+    if(rec->deps_cond) {
+        const unsigned long long * conds = (const unsigned long long*)(v->base + rec->deps_cond);
+
+        module->deps_cond = (char**)_mglsl_alloc(rec->deps_len * sizeof(char*));
+        if(!module->deps_cond) return MGLSL_E_ALLOC;
+
+        for(size_t d=0; d<rec->deps_len; d++) {
+            module->deps_cond[d] = (char*)_mglsl_shm_str(v, conds[d]);
+            if(conds[d] && !module->deps_cond[d]) return MGLSL_E_MODULE_CORRUPT;
+        }
+    }
+
+#ifdef _MGLSL_REFLECTION
+    if(!_mglsl_shm_valid(v, rec->reflect, rec->reflect_len, sizeof(_mglsl_ShmReflectDecl)))
+        return MGLSL_E_MODULE_CORRUPT;
+
+    if(rec->reflect_len) {
+        const _mglsl_ShmReflectDecl * decls = (const _mglsl_ShmReflectDecl*)(v->base + rec->reflect);
+
+        module->_reflect = (mglsl_ReflectDecl*)_mglsl_alloc(rec->reflect_len * sizeof(mglsl_ReflectDecl));
+        if(!module->_reflect) return MGLSL_E_ALLOC;
+
+        for(; module->_reflect_len < rec->reflect_len; module->_reflect_len++) {
+            const _mglsl_ShmReflectDecl * decl = decls + module->_reflect_len;
+            mglsl_ReflectDecl * out = module->_reflect + module->_reflect_len;
+            *out = decl->decl;
+            if(decl->name && (ec = _mglsl_shm_intern(&out->name, v, decl->name))) return ec;
+            if(decl->type && (ec = _mglsl_shm_intern(&out->type, v, decl->type))) return ec;
+        }
+    }
+#endif
+
+    return MGLSL_E_SUCCESS;
+}
+
+int mglsl_attach_shared_modules(mglsl_SharedModules * shared, const char * shm_name)
+{
+    _MGLSL_ASSERT(shared && shm_name);
+    memset(shared, 0, sizeof(*shared));
+    _mglsl_err_name = shm_name;
+
+    int fd = shm_open(shm_name, O_RDONLY, 0);
+    if(fd < 0) return errno == ENOENT ? MGLSL_E_SHM_NOT_READY : _mglsl_log_err(MGLSL_E_FILE_OPEN);
+
+    struct stat st;
+    void * map = MAP_FAILED;
+    if(!fstat(fd, &st) && (size_t)st.st_size >= sizeof(_mglsl_ShmHeader))
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    // publisher may not have sized it yet
+    if(map == MAP_FAILED) {
+        close(fd);
+        return MGLSL_E_SHM_NOT_READY;
+    }
+
+    _mglsl_ShmView v = { (const char*)map, (size_t)st.st_size };
+    const _mglsl_ShmHeader * header = (const _mglsl_ShmHeader*)map;
+
+    if(!__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE)) {
+        munmap(map, v.size);
+        close(fd);
+        return MGLSL_E_SHM_NOT_READY;
+    }
+
+    // publisher may have finished between fstat and the ready check, then the object
+    // is complete now and has the size written in the header
+    if(header->size != v.size) {
+        unsigned long long size = header->size;
+        munmap(map, v.size);
+        map = MAP_FAILED;
+        if(!fstat(fd, &st) && (unsigned long long)st.st_size == size)
+            map = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if(map == MAP_FAILED) return MGLSL_E_SHM_NOT_READY;
+        v.base = (const char*)map;
+        v.size = (size_t)size;
+        header = (const _mglsl_ShmHeader*)map;
+    } else close(fd);
+
+    int ec = MGLSL_E_SUCCESS;
+    if(memcmp(header->magic, _mglsl_shm_magic, sizeof(header->magic)) ||
+       header->version != _MGLSL_SHM_VERSION || header->config != _MGLSL_SHM_CONFIG ||
+       header->size != v.size ||
+       !_mglsl_shm_valid(&v, sizeof(*header), header->module_count, sizeof(_mglsl_ShmModule)))
+        ec = MGLSL_E_MODULE_CORRUPT;
+
+    mglsl_ModuleArr * arr = &shared->modules;
+    if(!ec && header->module_count) {
+        arr->data = (mglsl_Module*)_mglsl_alloc(header->module_count * sizeof(mglsl_Module));
+        if(!arr->data) ec = MGLSL_E_ALLOC;
+    }
+
+    const _mglsl_ShmModule * recs = (const _mglsl_ShmModule*)(header + 1);
+    for(size_t i=0; !ec && i<header->module_count; i++) {
+        ec = _mglsl_shm_attach_module(arr->data + i, &v, recs + i);
+        arr->size = i + 1; // partially attached one is freed as well
+    }
+
+    if(ec) {
+        for(size_t i=0; i<arr->size; i++) mglsl_free_module(arr->data + i);
+        if(arr->data) _mglsl_free(arr->data);
+        memset(shared, 0, sizeof(*shared));
+        munmap(map, v.size);
+        return _mglsl_log_err(ec);
+    }
+
+    shared->_map = map;
+    shared->_map_len = v.size;
+    return MGLSL_E_SUCCESS;
+}
+
+int mglsl_detach_shared_modules(mglsl_SharedModules * shared)
+{
+    _MGLSL_ASSERT(shared);
+    mglsl_ModuleArr * arr = &shared->modules;
+
+    for(size_t i=0; i<arr->size; i++) mglsl_free_module(arr->data + i);
+    if(arr->data) _mglsl_free(arr->data);
+    if(shared->_map) munmap(shared->_map, shared->_map_len);
+
+    memset(shared, 0, sizeof(*shared));
+    return MGLSL_E_SUCCESS;
+}
+
+// Attached processes keep their mappings, object is gone once they detach.
+int mglsl_unlink_shared_modules(const char * shm_name)
+{
+    _MGLSL_ASSERT(shm_name);
+    if(shm_unlink(shm_name) && errno != ENOENT) {
+        _mglsl_err_name = shm_name;
+        return _mglsl_log_err(MGLSL_E_WRITE);
+    }
+    return MGLSL_E_SUCCESS;
+}
+
+#endif
+
+//
+//
+// All import_module functions end up calling this one
+
+// Frees modules imported before failure together with the array.
+static void _mglsl_free_import(mglsl_ModuleArr * module_arr, size_t count) {
+    for(size_t i=0; i<count; i++) mglsl_free_module(module_arr->data + i);
+    _mglsl_free(module_arr->data);
+}
+
+typedef struct {
+    mglsl_Module * data;
+    size_t * pending; // module index of each file in the stat batch
+    unsigned char * found;
+    time_t * mtimes;  // of found files
+} _mglsl_Import;
+
+static int _mglsl_import_stat_proc(_mglsl_BatchFile * file, size_t file_idx, void * user) {
+    _mglsl_Import * import = (_mglsl_Import*)user;
+
+    if(file->ec == MGLSL_E_FILE_NOT_FOUND) return MGLSL_E_SUCCESS;
+    if(file->ec) {
+        _mglsl_err_name = file->path;
+        return _mglsl_log_err(file->ec);
+    }
+
+    import->found[import->pending[file_idx]] = 1;
+    import->mtimes[import->pending[file_idx]] = file->mtime;
     return MGLSL_E_SUCCESS;
 }
 
-static int _mglsl_toposort_modules
-    (mglsl_Module * root_module, mglsl_ModuleArr module_arr)
+static int _mglsl_import_read_proc(_mglsl_BatchFile * file, size_t file_idx, void * user) {
+    _mglsl_Import * import = (_mglsl_Import*)user;
+    int ec;
+
+    if(file->ec) {
+        _mglsl_err_name = file->path;
+        return _mglsl_log_err(file->ec);
+    }
+
+    _MGLSL_ASSERT(strlen((const char*)file->buf) == file->size);
+
+    ec = _mglsl_create_module_from_file_buf(import->data + file_idx, file->path, (const char*)file->buf, file->mtime, 0);
+    _mglsl_free_file_buf(file->buf, file->size);
+    return ec;
+}
+
+// Each search path is a round, all modules not found yet are looked up in it at once.
+// Found ones are then read in one more batch, or only scanned one by one with scan.
+static int _mglsl_import_module_file_list_from_array
+    (mglsl_ModuleArr * module_arr, mglsl_StringArr modules, mglsl_StringArr search_paths, int scan)
+{
+    int ec = MGLSL_E_SUCCESS;
+    size_t count = modules.size, path_stride = MGLSL_MAX_PATH_LEN + 1;
+
+    module_arr->data = (mglsl_Module*)_mglsl_alloc(count * sizeof(mglsl_Module));
+    if(!module_arr->data)
+        return _mglsl_log_err(MGLSL_E_ALLOC);
+    memset(module_arr->data, 0, count * sizeof(mglsl_Module));
+    module_arr->size = count;
+
+    void * scratch = _mglsl_alloc(count * (sizeof(_mglsl_BatchFile) + sizeof(time_t) + sizeof(size_t) + 1 + path_stride));
+    if(!scratch) {
+        _mglsl_free_import(module_arr, count);
+        return _mglsl_log_err(MGLSL_E_ALLOC);
+    }
+
+    _mglsl_BatchFile * files = (_mglsl_BatchFile*)scratch;
+    _mglsl_Import import = { module_arr->data, NULL, NULL, (time_t*)(files + count) };
+    import.pending = (size_t*)(import.mtimes + count);
+    import.found = (unsigned char*)(import.pending + count);
+    char * paths = (char*)(import.found + count);
+    memset(import.found, 0, count);
+
+    for(int p_idx=-1; p_idx < (int)search_paths.size && !ec; ++p_idx) {
+        const char * dir = p_idx < 0 ? "" : search_paths.data[p_idx];
+        size_t pending = 0;
+
+        for(size_t m_idx=0; m_idx < count; ++m_idx) {
+            if(import.found[m_idx]) continue;
+
+            char * pathbuf = paths + m_idx * path_stride;
+
+            ec = MGLSL_CONCAT_PATH(pathbuf, path_stride, dir, modules.data[m_idx]);
+            if(ec) {
+                _mglsl_err_name = modules.data[m_idx];
+                ec = _mglsl_log_err(ec);
+                break;
+            }
+
+            files[pending].path = pathbuf;
+            import.pending[pending++] = m_idx;
+        }
+        if(ec || !pending) break;
+
+        ec = _mglsl_batch_load(files, pending, 0, _mglsl_import_stat_proc, &import);
+    }
+
+    for(size_t m_idx=0; m_idx < count && !ec; ++m_idx) {
+        if(!import.found[m_idx]) {
+            _mglsl_err_name = modules.data[m_idx];
+            ec = _mglsl_log_err(MGLSL_E_FILE_NOT_FOUND);
+        }
+        files[m_idx].path = paths + m_idx * path_stride;
+    }
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+    for(size_t m_idx=0; m_idx < count && !ec && scan; ++m_idx)
+        ec = _mglsl_scan_module_file(import.data + m_idx, files[m_idx].path, import.mtimes[m_idx]);
+#else
+    _MGLSL_ASSERT(!scan);
+#endif
+    if(!ec && !scan)
+        ec = _mglsl_batch_load(files, count, 1, _mglsl_import_read_proc, &import);
+
+    _mglsl_free(scratch);
+    if(ec) _mglsl_free_import(module_arr, count);
+    return ec;
+}
+
+static int _mglsl_import_module_file_list_from_string
+    (mglsl_ModuleArr * module_arr, const char * str, const char * search_paths, int scan)
+{
+    _MGLSL_ASSERT(str);
+
+    size_t str_len = strlen(str);
+    size_t sp_len = strlen(search_paths);
+
+    if(str_len == 0) return MGLSL_E_SUCCESS;
+
+    // joint search_paths and str buffer, less freeing, less fragmentation
+    char * buf = (char*)_mglsl_alloc(str_len + sp_len + 2);
+    if(!buf) return _mglsl_log_err(MGLSL_E_ALLOC);
+
+    char * sp_buf = buf + str_len + 1;
+
+    memcpy(buf, str, str_len);
+    buf[str_len] = '\0';
+
+    memcpy(sp_buf, search_paths, sp_len);
+    buf[str_len + sp_len + 1] = '\0';
+
+    int ec;
+
+    mglsl_StringArr arr, sp_arr;
+
+    ec = _mglsl_split(&arr, buf, ',');
+    if(ec) {
+        _MGLSL_ASSERT(buf); _mglsl_free(buf);
+        return ec;
+    }
+
+    ec = _mglsl_split(&sp_arr, sp_buf, ':');
+    if(ec) {
+        _MGLSL_ASSERT(buf); _mglsl_free(arr.data);
+        _MGLSL_ASSERT(buf); _mglsl_free(buf);
+        return ec;
+    }
+
+
+    ec = _mglsl_import_module_file_list_from_array(module_arr, arr, sp_arr, scan);
+
+    _MGLSL_ASSERT(sp_arr.data); _mglsl_free(sp_arr.data);
+    _MGLSL_ASSERT(arr.data); _mglsl_free(arr.data);
+
+    _MGLSL_ASSERT(buf); _mglsl_free(buf);
+    return ec;
+}
+
+//
+//
+
+static int _mglsl_import_module_file_list_from_array_str
+    (mglsl_ModuleArr * module_arr, mglsl_StringArr arr, const char * search_paths, int scan)
+{
+    _MGLSL_ASSERT(arr.data);
+    _mglsl_err_file = NULL;
+
+    if(arr.size == 0) return MGLSL_E_SUCCESS;
+
+    size_t sp_len = strlen(search_paths);
+
+    char * sp_buf = (char*)_mglsl_alloc(sp_len + 1);
+    if(!sp_buf) return _mglsl_log_err(MGLSL_E_ALLOC);
+
+    memcpy(sp_buf, search_paths, sp_len);
+    sp_buf[sp_len] = '\0';
+
+    int ec;
+    mglsl_StringArr sp_arr;
+
+    ec = _mglsl_split(&sp_arr, sp_buf, ':');
+    if(ec) {
+        _MGLSL_ASSERT(sp_buf); _mglsl_free(sp_buf);
+        return ec;
+    }
+ 
+    ec = _mglsl_import_module_file_list_from_array(module_arr, arr, sp_arr, scan);
+
+    _MGLSL_ASSERT(sp_buf); _mglsl_free(sp_buf);
+    return ec;
+}
+
+static int _mglsl_import_module_file_list_from_file
+    (mglsl_ModuleArr * module_arr, const char * filepath, const char * search_paths, int scan)
+{
+    _MGLSL_ASSERT(filepath);
+
+     void * filebuf; size_t filesize; int ec;
+
+    _mglsl_err_file = filepath;
+
+    ec = _mglsl_read(&filebuf, &filesize, filepath);
+    if(ec != MGLSL_E_SUCCESS) {
+        _mglsl_err_name = filepath;
+        return _mglsl_log_err(ec);
+    }
+
+    _MGLSL_ASSERT(strlen((const char*)filebuf) == filesize);
+
+    ec = _mglsl_import_module_file_list_from_string(module_arr, (const char*)filebuf, search_paths, scan);
+
+    _MGLSL_ASSERT(filebuf); _mglsl_free_file_buf(filebuf, filesize);
+    return ec;
+}
+
+//
+//
+
+int mglsl_import_module_file_list_from_array
+    (mglsl_ModuleArr * module_arr, mglsl_StringArr arr, const char * search_paths)
+{
+    return _mglsl_import_module_file_list_from_array_str(module_arr, arr, search_paths, 0);
+}
+
+int mglsl_import_module_file_list_from_string
+    (mglsl_ModuleArr * module_arr, const char * str, const char * search_paths)
+{
+    _MGLSL_ASSERT(str);
+    _mglsl_err_file = NULL;
+    return _mglsl_import_module_file_list_from_string(module_arr, str, search_paths, 0);
+}
+
+int mglsl_import_module_file_list_from_file
+    (mglsl_ModuleArr * module_arr, const char * filepath, const char * search_paths)
+{
+    return _mglsl_import_module_file_list_from_file(module_arr, filepath, search_paths, 0);
+}
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+// Same as above, but modules are only scanned, see mglsl_scan_module_from_file.
+
+int mglsl_scan_module_file_list_from_array
+    (mglsl_ModuleArr * module_arr, mglsl_StringArr arr, const char * search_paths)
+{
+    return _mglsl_import_module_file_list_from_array_str(module_arr, arr, search_paths, 1);
+}
+
+int mglsl_scan_module_file_list_from_string
+    (mglsl_ModuleArr * module_arr, const char * str, const char * search_paths)
 {
-    for(size_t i=0; i<module_arr.size; i++)
-        module_arr.data[i].flags &= ~(MGLSL_PERM_MARK | MGLSL_TEMP_MARK);
-
-    return _mglsl_toposort_rec_visit(0, root_module, module_arr);
+    _MGLSL_ASSERT(str);
+    _mglsl_err_file = NULL;
+    return _mglsl_import_module_file_list_from_string(module_arr, str, search_paths, 1);
 }
 
-
-//
-// LIBRARY INTERFACE IMPLEMENTATION
-
-static int _mglsl_create_module
-    (mglsl_Module * module, const char * src)
+int mglsl_scan_module_file_list_from_file
+    (mglsl_ModuleArr * module_arr, const char * filepath, const char * search_paths)
 {
-    int ec;
-    _MGLSL_ASSERT(module);
-
-    memset(module, 0, sizeof(mglsl_Module));
+    return _mglsl_import_module_file_list_from_file(module_arr, filepath, search_paths, 1);
+}
+#endif
 
-    module->name[0] = '\0';
-    ec = _mglsl_parse(module, src);
-    if(ec != MGLSL_E_SUCCESS) return ec;
+int mglsl_free_imported_module_arr(mglsl_ModuleArr module_arr) {
 
+    _MGLSL_ASSERT(module_arr.data);
+    _mglsl_free(module_arr.data);
+    module_arr.data = NULL;
     return MGLSL_E_SUCCESS;
 }
 
 //
-//
+// MODULE REGISTRY
 
-int mglsl_create_module_from_source(mglsl_Module * module, const char * src)
+// Doubles array until it has room for len + 1 elements.
+static int _mglsl_registry_grow(void ** arr, size_t * cap, size_t len, size_t elem)
 {
-    _mglsl_err_file = "(memory)";
-    int ret = _mglsl_create_module(module, src);
+    if(len < *cap) return MGLSL_E_SUCCESS;
 
-    if(!strlen(module->name)) {
-        _mglsl_err_sec_msg = "could not infer the name and thesource does not contain valid 'module' directive";
-        return MGLSL_E_MODULE_NONAME;
-    }
+    size_t new_cap = *cap ? *cap * 2 : 16;
+    void * new_arr = *arr ? _mglsl_realloc(*arr, new_cap * elem) : _mglsl_alloc(new_cap * elem);
+    if(!new_arr) return *arr ? MGLSL_E_REALLOC : MGLSL_E_ALLOC;
 
-    return ret;
+    *arr = new_arr;
+    *cap = new_cap;
+    return MGLSL_E_SUCCESS;
 }
 
-//
-//
-
-int mglsl_create_module_from_file(mglsl_Module * module, const char * filepath)
+// Makes room in name index for given name id.
+static int _mglsl_registry_fit_name(mglsl_Registry * registry, mglsl_StrId name)
 {
-    void * filebuf; size_t filesize; int ec;
+    if(name < registry->_by_name_len) return MGLSL_E_SUCCESS;
 
-    _mglsl_err_file = filepath;
+    // grows along with string table, which is at least as big as any id in it
+    size_t len = _mglsl_strtab.strs_len + 1;
+    if(len < registry->_by_name_len * 2) len = registry->_by_name_len * 2;
+    _MGLSL_ASSERT(name < len);
 
-    ec = MGLSL_READ_FILE(&filebuf, &filesize, filepath);
-    if(ec != MGLSL_E_SUCCESS) {
-        _mglsl_err_file = filepath;
-        return _mglsl_log_err(ec);
-    }
+    unsigned int * by_name = (unsigned int*)(registry->_by_name ?
+        _mglsl_realloc(registry->_by_name, len * sizeof(unsigned int)) :
+        _mglsl_alloc(len * sizeof(unsigned int)));
+    if(!by_name) return registry->_by_name ? MGLSL_E_REALLOC : MGLSL_E_ALLOC;
 
-    _MGLSL_ASSERT(strlen(filebuf) == filesize);
+    for(size_t i=registry->_by_name_len; i<len; i++) by_name[i] = _MGLSL_NO_MODULE;
+    registry->_by_name = by_name;
+    registry->_by_name_len = len;
+    return MGLSL_E_SUCCESS;
+}
 
-    _mglsl_err_file = filepath;
+// Name index is kept up to date by registry functions, this is only needed after
+// modules were renamed through mglsl_registry_modules, e.g. by mglsl_swap_dirty_modules.
+int mglsl_registry_reindex(mglsl_Registry * registry)
+{
+    for(size_t i=0; i<registry->_by_name_len; i++) registry->_by_name[i] = _MGLSL_NO_MODULE;
 
-    int ret = _mglsl_create_module(module, filebuf);
+    for(size_t i=0; i<registry->size; i++) {
+        mglsl_StrId name = registry->data[i].name;
 
+        int ec = _mglsl_registry_fit_name(registry, name);
+        if(ec) return _mglsl_log_err(ec);
 
-    if(!strlen(module->name)) {
-        size_t filepath_len = strlen(filepath);
-        int basename_idx = 0, ext_idx = 0;
+        registry->_by_name[name] = (unsigned int)i;
+    }
+    return MGLSL_E_SUCCESS;
+}
 
-        for(int i=0; i<filepath_len; i++) {
-            if(filepath[i] == '/') basename_idx = ext_idx = i + 1;
-            if(filepath[i] == '.') ext_idx = i;
-        }
-        if(basename_idx == ext_idx) ext_idx = filepath_len - 1;
-        int basename_len = ext_idx - basename_idx; 
+static int _mglsl_registry_lookup(size_t * idxptr, mglsl_Registry * registry, mglsl_StrId name)
+{
+    _MGLSL_STAT_ADD(module_lookups, 1);
 
-        char basename_buf[MGLSL_MAX_NAME_LEN + 1];
-        memcpy(basename_buf, filepath + basename_idx, basename_len);
-        basename_buf[basename_len] = '\0';
+    for(int retry = 0; name && name < registry->_by_name_len; retry++) {
+        unsigned int idx = registry->_by_name[name];
+        if(idx == _MGLSL_NO_MODULE) break;
 
-        if(basename_len) {
-            strcpy(module->name, basename_buf);
-        } else {
-            _mglsl_err_sec_msg = "could not infer the name and module source does not contain valid 'module' directive";
-            return _mglsl_log_err(MGLSL_E_MODULE_NONAME);
+        if(idx < registry->size && registry->data[idx].name == name) {
+            *idxptr = idx;
+            return MGLSL_E_SUCCESS;
         }
-    }
 
-#ifdef _MGLSL_FILE_CHANGE_WATCH
-    ec = MGLSL_FILE_MTIME(&module->mtime, filepath);
-    _MGLSL_ASSERT(!ec); // Opened this file moment ago, don't fail please
+        // modules were replaced through mglsl_registry_modules
+        if(retry || mglsl_registry_reindex(registry))
+            return _mglsl_find_module_id(idxptr, name, mglsl_registry_modules(registry));
+    }
 
-    size_t filepath_len = strlen(filepath);
-    _MGLSL_ASSERT(filepath_len < MGLSL_MAX_PATH_LEN);
+    return MGLSL_E_MODULE_NOT_FOUND;
+}
 
-    memcpy(module->path, filepath, filepath_len);
-    module->path[filepath_len] = '\0';
-#endif
+static size_t _mglsl_registry_handle_idx(const mglsl_Registry * registry, mglsl_ModuleHandle handle)
+{
+    size_t slot = (size_t)(handle & 0xffffffffu);
+    unsigned int gen = (unsigned int)(handle >> 32);
 
-    _mglsl_free(filebuf);
-    return ret;
+    if(slot >= registry->_slots_len || registry->_slots[slot].gen != gen) return (size_t)-1;
+    return registry->_slots[slot].idx;
 }
 
-//
-//
-
-int mglsl_free_module(mglsl_Module * module) {
- 
-    if(module->deps_len) {
-        _MGLSL_ASSERT(module->deps != NULL && module->deps[0] != NULL);
+static int _mglsl_registry_check_name
+    (mglsl_Registry * registry, const mglsl_Module * module, size_t self_idx)
+{
+    size_t idx;
 
-// NOTE(kacper): Assumption is made that &(deps[0]) is the address with which memory region of this array can be freed.    
-//               As well as that &(deps[0][0]) is the address to contagious memory region
-//               to which all pointers in this array point, and can be freed with it.
-        _mglsl_free(module->deps[0]);
-        _mglsl_free(module->deps);
-    }
+    if(!module->name) return MGLSL_E_MODULE_NONAME;
 
-    if(module->source) {
-        _mglsl_free(module->source);
+    if(!_mglsl_registry_lookup(&idx, registry, module->name) && idx != self_idx) {
+        _mglsl_err_name = _mglsl_str(module->name);
+        return MGLSL_E_MODULE_EXISTS;
     }
+    return MGLSL_E_SUCCESS;
+}
 
+int mglsl_create_registry(mglsl_Registry * registry)
+{
+    _MGLSL_ASSERT(registry);
+    memset(registry, 0, sizeof(mglsl_Registry));
+    registry->_free_slot = _MGLSL_NO_MODULE;
     return MGLSL_E_SUCCESS;
 }
 
-int mglsl_assemble_shader
-    (char ** bufptr, const char * root_module_name, mglsl_ModuleArr module_arr)
+int mglsl_free_registry(mglsl_Registry * registry)
 {
-    _MGLSL_ASSERT(bufptr);
-    int ec;
+    for(size_t i=0; i<registry->size; i++) mglsl_free_module(registry->data + i);
 
-    size_t root_idx;
-    ec = _mglsl_find_module(&root_idx, root_module_name, module_arr);
-    if(ec) {
-        _mglsl_err_sec_msg = root_module_name;
-        return _mglsl_log_err(ec);
-    }
+    if(registry->data) _mglsl_free(registry->data);
+    if(registry->_slot_of) _mglsl_free(registry->_slot_of);
+    if(registry->_slots) _mglsl_free(registry->_slots);
+    if(registry->_by_name) _mglsl_free(registry->_by_name);
+
+    memset(registry, 0, sizeof(mglsl_Registry));
+    return MGLSL_E_SUCCESS;
+}
 
-    ec = _mglsl_toposort_modules(module_arr.data + root_idx, module_arr); 
+// Module is moved into registry and zeroed, registry frees it from now on.
+int mglsl_registry_add
+    (mglsl_ModuleHandle * handle, mglsl_Registry * registry, mglsl_Module * module)
+{
+    int ec = _mglsl_registry_check_name(registry, module, (size_t)-1);
+    if(!ec) ec = _mglsl_registry_fit_name(registry, module->name);
     if(ec) return _mglsl_log_err(ec);
 
-    size_t max_sort_idx = 0, bufsize = 0, module_count = 0;
+    size_t idx = registry->size, cap = registry->cap;
 
-    for(size_t i=0; i<module_arr.size; i++) {
-        if(module_arr.data[i].flags & MGLSL_PERM_MARK) {
-            _MGLSL_ASSERT(module_arr.data[i].source);
+    // slots of modules grow together with modules
+    ec = _mglsl_registry_grow((void**)&registry->data, &registry->cap, idx, sizeof(mglsl_Module));
+    if(!ec && registry->cap != cap) {
+        unsigned int * slot_of = (unsigned int*)(registry->_slot_of ?
+            _mglsl_realloc(registry->_slot_of, registry->cap * sizeof(unsigned int)) :
+            _mglsl_alloc(registry->cap * sizeof(unsigned int)));
 
-            module_count++;
-            bufsize += strlen(module_arr.data[i].source);
-            if(module_arr.data[i]._sort_idx > max_sort_idx)
-                max_sort_idx = module_arr.data[i]._sort_idx;
+        if(slot_of) registry->_slot_of = slot_of;
+        else {
+            ec = registry->_slot_of ? MGLSL_E_REALLOC : MGLSL_E_ALLOC;
+            registry->cap = cap; // modules have more room than that, which is harmless
         }
     }
+    if(!ec && registry->_free_slot == _MGLSL_NO_MODULE)
+        ec = _mglsl_registry_grow((void**)&registry->_slots, &registry->_slots_cap,
+                                  registry->_slots_len, sizeof(_mglsl_RegistrySlot));
+    if(ec) return _mglsl_log_err(ec);
 
-    for(size_t i=0; i<module_arr.size; i++)
-        if(module_arr.data[i].flags & MGLSL_PERM_MARK)
-            module_arr.data[i]._sort_idx = max_sort_idx - module_arr.data[i]._sort_idx;
+    unsigned int slot;
+    if(registry->_free_slot != _MGLSL_NO_MODULE) {
+        slot = registry->_free_slot;
+        registry->_free_slot = registry->_slots[slot].idx;
+    } else {
+        slot = (unsigned int)registry->_slots_len++;
+        registry->_slots[slot].gen = 1;
+    }
 
-#ifdef _MGLSL_MODULE_HEADER_COMMENT
-    const char * comment_header_fmt = "\n// ==== %s module ====\n";
-    size_t comment_header_max_len = 127;
-    char comment_header_buf[comment_header_max_len + 1];
-    bufsize += comment_header_max_len * module_count; 
-#endif
+    memcpy(registry->data + idx, module, sizeof(mglsl_Module));
+    memset(module, 0, sizeof(mglsl_Module));
 
-    char * buf = _mglsl_alloc(bufsize + 1);
-    if(!buf) return _mglsl_log_err(MGLSL_E_ALLOC);
+    registry->_slots[slot].idx = (unsigned int)idx;
+    registry->_slot_of[idx] = slot;
+    registry->size++;
 
-    size_t buflen = 0;
+    registry->_by_name[registry->data[idx].name] = (unsigned int)idx;
 
-    for(size_t d=0; d < max_sort_idx + 1; d++) {
-        for(size_t i=0; i<module_arr.size; i++) {
-            mglsl_Module * module = module_arr.data + i;
+    if(handle) *handle = ((mglsl_ModuleHandle)registry->_slots[slot].gen << 32) | slot;
+    return MGLSL_E_SUCCESS;
+}
+
+// Module behind the handle is freed and new one takes its place and handle.
+int mglsl_registry_replace
+    (mglsl_Registry * registry, mglsl_ModuleHandle handle, mglsl_Module * module)
+{
+    size_t idx = _mglsl_registry_handle_idx(registry, handle);
+    if(idx == (size_t)-1) return _mglsl_log_err(MGLSL_E_MODULE_NOT_FOUND);
 
-            if(module->flags & MGLSL_PERM_MARK && module->_sort_idx == d) { 
+    int ec = _mglsl_registry_check_name(registry, module, idx);
+    if(!ec) ec = _mglsl_registry_fit_name(registry, module->name);
+    if(ec) return _mglsl_log_err(ec);
 
-#           ifdef _MGLSL_MODULE_HEADER_COMMENT
-                int comment_header_len =
-                    snprintf(comment_header_buf, comment_header_max_len, comment_header_fmt, module->name);
+    mglsl_StrId old_name = registry->data[idx].name;
+    if(old_name < registry->_by_name_len && registry->_by_name[old_name] == idx)
+        registry->_by_name[old_name] = _MGLSL_NO_MODULE;
 
-                _MGLSL_ASSERT(comment_header_len > 0);
+    mglsl_free_module(registry->data + idx);
+    memcpy(registry->data + idx, module, sizeof(mglsl_Module));
+    memset(module, 0, sizeof(mglsl_Module));
 
-                _MGLSL_ASSERT(bufsize - buflen >= comment_header_len);
-                memcpy(buf + buflen, comment_header_buf, comment_header_len);
-                buflen += comment_header_len;
-#           endif
+    registry->_by_name[registry->data[idx].name] = (unsigned int)idx;
+    return MGLSL_E_SUCCESS;
+}
 
-                size_t src_len = strlen(module->source);
+// Last module takes place of the removed one.
+int mglsl_registry_remove(mglsl_Registry * registry, const char * module_name)
+{
+    _MGLSL_ASSERT(module_name);
 
-                _MGLSL_ASSERT(bufsize - buflen >= src_len);
-                memcpy(buf + buflen, module->source, src_len);
-                buflen += src_len;
-            }
-        }
+    size_t idx;
+    int ec = _mglsl_registry_lookup(&idx, registry, _mglsl_str_lookup(module_name, strlen(module_name)));
+    if(ec) {
+        _mglsl_err_name = module_name;
+        return _mglsl_log_err(ec);
     }
 
-    buf[buflen] = '\0';
-    buf = _mglsl_realloc(buf, buflen + 1);
-    if(!buf) return _mglsl_log_err(MGLSL_E_REALLOC);
+    unsigned int slot = registry->_slot_of[idx];
+    _mglsl_RegistrySlot * s = registry->_slots + slot;
+    if(!++s->gen) s->gen = 1;
+    s->idx = registry->_free_slot;
+    registry->_free_slot = slot;
 
-    *bufptr = buf;
-    return MGLSL_E_SUCCESS;
-}
+    mglsl_StrId name = registry->data[idx].name;
+    if(name < registry->_by_name_len) registry->_by_name[name] = _MGLSL_NO_MODULE;
+    mglsl_free_module(registry->data + idx);
 
-//
-//
+    size_t last = --registry->size;
+    if(idx != last) {
+        memcpy(registry->data + idx, registry->data + last, sizeof(mglsl_Module));
+        registry->_slot_of[idx] = registry->_slot_of[last];
+        registry->_slots[registry->_slot_of[idx]].idx = (unsigned int)idx;
 
-int mglsl_free_shader(char * buf) {
-    _MGLSL_ASSERT(buf);
-    _mglsl_free(buf);
+        name = registry->data[idx].name;
+        if(name < registry->_by_name_len) registry->_by_name[name] = (unsigned int)idx;
+    }
     return MGLSL_E_SUCCESS;
 }
 
-//
-//
-// All import_module functions end up calling this one
-
-static int _mglsl_import_module_file_list_from_array
-    (mglsl_ModuleArr * module_arr, mglsl_StringArr modules, mglsl_StringArr search_paths)
+int mglsl_registry_find
+    (mglsl_ModuleHandle * handle, mglsl_Registry * registry, const char * module_name)
 {
-    int ec;
-    char pathbuf[MGLSL_MAX_PATH_LEN + 1];
-    void * filebuf; size_t bufsize;
-
-    module_arr->data = _mglsl_alloc(modules.size * sizeof(mglsl_Module));
-    if(!module_arr->data)
-        return _mglsl_log_err(MGLSL_E_ALLOC);
-
-    module_arr->size = modules.size;
-    size_t idx = 0;
-
-    for(size_t m_idx=0; m_idx < modules.size; ++m_idx) {
-        int found = 0;
-        _mglsl_err_sec_msg = modules.data[m_idx];
+    _MGLSL_ASSERT(handle && module_name);
 
-        for(int p_idx=-1; p_idx < (int)search_paths.size; ++p_idx) {
-            const char * dir = p_idx < 0 ? "" : search_paths.data[p_idx];
+    size_t idx;
+    int ec = _mglsl_registry_lookup(&idx, registry, _mglsl_str_lookup(module_name, strlen(module_name)));
+    if(ec) return ec;
 
-            ec = MGLSL_CONCAT_PATH(pathbuf, MGLSL_MAX_PATH_LEN + 1,
-                                   dir, modules.data[m_idx]);
-            if(ec) {
-                _mglsl_free(module_arr->data);
-                return ec;
-            }
+    unsigned int slot = registry->_slot_of[idx];
+    *handle = ((mglsl_ModuleHandle)registry->_slots[slot].gen << 32) | slot;
+    return MGLSL_E_SUCCESS;
+}
 
-            ec = MGLSL_FILE_MTIME(NULL, pathbuf);
+// Returns NULL if module of the handle was removed.
+mglsl_Module * mglsl_registry_get(const mglsl_Registry * registry, mglsl_ModuleHandle handle)
+{
+    size_t idx = _mglsl_registry_handle_idx(registry, handle);
+    return idx == (size_t)-1 ? NULL : registry->data + idx;
+}
 
-            if(ec == MGLSL_E_SUCCESS) {
+// Valid until registry is changed.
+mglsl_ModuleArr mglsl_registry_modules(const mglsl_Registry * registry)
+{
+    mglsl_ModuleArr arr = { registry->data, registry->size };
+    return arr;
+}
 
-                ec = mglsl_create_module_from_file(module_arr->data + (idx++), pathbuf);
+//
+//
+ 
+int mglsl_get_stats(mglsl_Stats * stats) {
+    _MGLSL_ASSERT(stats);
+#ifdef _MGLSL_STATS
+    memcpy(stats, &_mglsl_stats, sizeof(mglsl_Stats));
+#else
+    memset(stats, 0, sizeof(mglsl_Stats));
+#endif
+    return MGLSL_E_SUCCESS;
+}
 
-                if(ec) {
-                    _mglsl_free(module_arr->data);
-                    return ec;
-                } else {
-                    found = 1; break; }
-                
-            } else if(ec == MGLSL_E_FILE_NOT_FOUND) {
-                continue;
+// Live bytes are not reset, memory allocated before the reset is still there.
+int mglsl_reset_stats(void) {
+#ifdef _MGLSL_STATS
+    size_t live_bytes = _mglsl_stats.live_bytes;
+    memset(&_mglsl_stats, 0, sizeof(mglsl_Stats));
+    _mglsl_stats.live_bytes = _mglsl_stats.peak_live_bytes = live_bytes;
+#endif
+    return MGLSL_E_SUCCESS;
+}
 
-            } else {
-                _mglsl_free(module_arr->data);
-                return _mglsl_log_err(ec);
-            }
-        }
+#ifdef _MGLSL_FILE_CHANGE_WATCH
 
-        if(!found) {
-            _mglsl_free(module_arr->data);
-            return _mglsl_log_err(MGLSL_E_FILE_NOT_FOUND);
-        }
+typedef struct {
+    mglsl_ModuleArr modules;
+    size_t * module_idx;
+    int anydirty;
+} _mglsl_Watch;
+
+static int _mglsl_watch_stat_proc(_mglsl_BatchFile * file, size_t file_idx, void * user) {
+    _mglsl_Watch * watch = (_mglsl_Watch*)user;
+    mglsl_Module * module = watch->modules.data + watch->module_idx[file_idx];
+
+    if(file->ec) {
+        _mglsl_err_name = file->path;
+        return _mglsl_log_err(file->ec);
     }
 
+    if(module->mtime != file->mtime) {
+        module->mtime = file->mtime;
+        module->flags |= MGLSL_DIRTY;
+        watch->anydirty = 1;
+        _MGLSL_PROBE2(module_changed, _mglsl_str(module->name), file->path);
+    }
     return MGLSL_E_SUCCESS;
 }
 
-static int _mglsl_import_module_file_list_from_string
-    (mglsl_ModuleArr * module_arr, const char * str, const char * search_paths)
-{
-    _MGLSL_ASSERT(str);
-    _mglsl_err_file = "(memory)";
-
-    size_t str_len = strlen(str);
-    size_t sp_len = strlen(search_paths);
+static int _mglsl_swap_read_proc(_mglsl_BatchFile * file, size_t file_idx, void * user) {
+    _mglsl_Watch * watch = (_mglsl_Watch*)user;
+    mglsl_Module * module = watch->modules.data + watch->module_idx[file_idx];
+    mglsl_Module new_module; int ec;
 
-    if(str_len == 0) return MGLSL_E_SUCCESS;
+    if(file->ec) {
+        _mglsl_err_name = file->path;
+        return _mglsl_log_err(file->ec);
+    }
 
-    // joint search_paths and str buffer, less freeing, less fragmentation
-    char * buf = _mglsl_alloc(str_len + sp_len + 2);
-    if(!buf) return _mglsl_log_err(MGLSL_E_ALLOC);
+    ec = _mglsl_create_module_from_file_buf(&new_module, file->path, (const char*)file->buf, file->mtime, 0);
+    _mglsl_free_file_buf(file->buf, file->size);
+    if(ec) return ec;
 
-    char * sp_buf = buf + str_len + 1;
+    _MGLSL_PROBE2(module_swapped, _mglsl_str(new_module.name), file->size);
+    mglsl_free_module(module);
 
-    memcpy(buf, str, str_len);
-    buf[str_len] = '\0';
+    memcpy(module, &new_module, sizeof(mglsl_Module));
+    _MGLSL_STAT_ADD(reload_count, 1);
+    return MGLSL_E_SUCCESS;
+}
 
-    memcpy(sp_buf, search_paths, sp_len);
-    buf[str_len + sp_len + 1] = '\0';
+// Batches modules with flag set (any module with path if flag is 0), read or only stated.
+static int _mglsl_watch_batch
+    (mglsl_ModuleArr modules, unsigned flag, int read, _mglsl_BatchFileProc * proc, _mglsl_Watch * watch)
+{
+    size_t count = 0;
+    for(size_t i=0; i<modules.size; ++i)
+        if(modules.data[i].path && (!flag || (modules.data[i].flags & flag))) count++;
 
-    int ec;
+    if(!count) return MGLSL_E_SUCCESS;
 
-    mglsl_StringArr arr, sp_arr;
+    _mglsl_BatchFile * files = (_mglsl_BatchFile*)_mglsl_alloc(count * (sizeof(_mglsl_BatchFile) + sizeof(size_t)));
+    if(!files) return _mglsl_log_err(MGLSL_E_ALLOC);
 
-    ec = _mglsl_split(&arr, buf, ',');
-    if(ec) {
-        _MGLSL_ASSERT(buf); _mglsl_free(buf);
-        return _mglsl_log_err(ec);
-    }
+    watch->modules = modules;
+    watch->module_idx = (size_t*)(files + count);
 
-    ec = _mglsl_split(&sp_arr, sp_buf, ':');
-    if(ec) {
-        _MGLSL_ASSERT(buf); _mglsl_free(arr.data);
-        _MGLSL_ASSERT(buf); _mglsl_free(buf);
-        return _mglsl_log_err(ec);
+    count = 0;
+    for(size_t i=0; i<modules.size; ++i) {
+        if(modules.data[i].path && (!flag || (modules.data[i].flags & flag))) {
+            files[count].path = _mglsl_str(modules.data[i].path);
+            watch->module_idx[count++] = i;
+        }
     }
 
+    int ec = _mglsl_batch_load(files, count, read, proc, watch);
+    _mglsl_free(files);
+    return ec;
+}
 
-    ec = _mglsl_import_module_file_list_from_array(module_arr, arr, sp_arr);
+int mglsl_file_change_watch(mglsl_ModuleArr modules) {
+    _mglsl_Watch watch;
+    memset(&watch, 0, sizeof(watch));
+    _MGLSL_PROBE1(watch_start, modules.size);
+
+    int ec = MGLSL_E_SUCCESS;
+#ifdef _MGLSL_PACK_FILES
+    // packs replaced on disk are remapped first, their files are stated right after
+    ec = _mglsl_pack_refresh();
+#endif
 
-    _MGLSL_ASSERT(sp_arr.data); _mglsl_free(sp_arr.data);
-    _MGLSL_ASSERT(arr.data); _mglsl_free(arr.data);
+    if(!ec) ec = _mglsl_watch_batch(modules, 0, 0, _mglsl_watch_stat_proc, &watch);
+    if(!ec && watch.anydirty) ec = MGLSL_E_FILE_CHANGED;
 
-    _MGLSL_ASSERT(buf); _mglsl_free(buf);
+    _MGLSL_PROBE2(watch_done, modules.size, ec);
     return ec;
 }
 
-//
-//
-
-int mglsl_import_module_file_list_from_array
-    (mglsl_ModuleArr * module_arr, mglsl_StringArr arr, const char * search_paths)
-{
-    _MGLSL_ASSERT(arr.data);
-    _mglsl_err_file = "(memory)";
+int mglsl_swap_dirty_modules(mglsl_ModuleArr modules) {
+    _mglsl_Watch watch;
+    memset(&watch, 0, sizeof(watch));
+    _MGLSL_PROBE1(swap_start, modules.size);
 
-    if(arr.size == 0) return MGLSL_E_SUCCESS;
+    int ec = _mglsl_watch_batch(modules, MGLSL_DIRTY, 1, _mglsl_swap_read_proc, &watch);
 
-    size_t sp_len = strlen(search_paths);
+    _MGLSL_PROBE2(swap_done, modules.size, ec);
+    return ec;
+}
 
-    char * sp_buf = _mglsl_alloc(sp_len + 1);
-    if(!sp_buf) return _mglsl_log_err(MGLSL_E_ALLOC);
+//
+// BUDGETED RELOAD
+// Dirty modules are read and parsed a few at a time, into entries of the reload. Modules
+// stay as they are until every module of the change set is ready, then all are swapped at once.
 
-    memcpy(sp_buf, search_paths, sp_len);
-    sp_buf[sp_len] = '\0';
+enum { _MGLSL_RELOAD_TODO, _MGLSL_RELOAD_READY, _MGLSL_RELOAD_FAILED };
 
-    int ec;
-    mglsl_StringArr sp_arr;
+static int _mglsl_reload_read(_mglsl_ReloadEntry * entry, const mglsl_Module * module)
+{
+    const char * path = _mglsl_str(module->path);
+    void * buf = NULL;
+    size_t size = 0;
 
-    ec = _mglsl_split(&sp_arr, sp_buf, ':');
+    entry->mtime = module->mtime;
+    int ec = _mglsl_stat(&entry->mtime, path);
+    if(!ec) ec = _mglsl_read(&buf, &size, path);
     if(ec) {
-        _MGLSL_ASSERT(sp_buf); _mglsl_free(sp_buf);
+        _mglsl_err_name = path;
         return _mglsl_log_err(ec);
     }
- 
-    ec = _mglsl_import_module_file_list_from_array(module_arr, arr, sp_arr);
 
-    _MGLSL_ASSERT(sp_buf); _mglsl_free(sp_buf);
+    ec = _mglsl_create_module_from_file_buf(&entry->module, path, (const char*)buf, entry->mtime, 0);
+    _mglsl_free_file_buf(buf, size);
     return ec;
 }
 
-int mglsl_import_module_file_list_from_string
-    (mglsl_ModuleArr * module_arr, const char * str, const char * search_paths)
+// Does at most budget_us of reading and parsing, but always at least one module. Returns
+// MGLSL_E_RELOAD_PENDING, which is not logged, until all modules dirty so far are reloaded.
+// Modules have to stay where they are meanwhile. Module which fails to reload holds the rest
+// back until its file changes again, or the reload is freed.
+int mglsl_swap_dirty_modules_budgeted(mglsl_Reload * reload, mglsl_ModuleArr modules, unsigned long long budget_us)
 {
-    _MGLSL_ASSERT(str);
-    _mglsl_err_file = "(memory)";
-    return _mglsl_import_module_file_list_from_string(module_arr, str, search_paths);
-}
+    _MGLSL_ASSERT(reload);
+    unsigned long long start = MGLSL_CLOCK_NS(), budget_ns = budget_us * 1000ull;
 
-int mglsl_import_module_file_list_from_file
-    (mglsl_ModuleArr * module_arr, const char * filepath, const char * search_paths)
-{
-    _MGLSL_ASSERT(filepath);
-    _mglsl_err_file = filepath;
+    if(reload->_queued_len < modules.size) {
+        unsigned char * queued = (unsigned char*)_mglsl_realloc(reload->_queued, modules.size);
+        if(!queued) return _mglsl_log_err(MGLSL_E_REALLOC);
 
-     void * filebuf; size_t filesize; int ec;
+        memset(queued + reload->_queued_len, 0, modules.size - reload->_queued_len);
+        reload->_queued = queued;
+        reload->_queued_len = modules.size;
+    }
 
-    _mglsl_err_file = filepath;
+    // modules which got dirty since last call join the change set
+    for(size_t i=0; i<modules.size; i++) {
+        if(!(modules.data[i].flags & MGLSL_DIRTY) || !modules.data[i].path || reload->_queued[i]) continue;
 
-    ec = MGLSL_READ_FILE(&filebuf, &filesize, filepath);
-    if(ec != MGLSL_E_SUCCESS) {
-        _mglsl_err_file = filepath;
-        return _mglsl_log_err(ec);
-    }
+        if(reload->_entries_len == reload->_entries_cap) {
+            size_t cap = reload->_entries_cap ? reload->_entries_cap * 2 : 16;
+            _mglsl_ReloadEntry * entries = (_mglsl_ReloadEntry*)_mglsl_realloc(reload->_entries, cap * sizeof(_mglsl_ReloadEntry));
+            if(!entries) return _mglsl_log_err(MGLSL_E_REALLOC);
 
-    _MGLSL_ASSERT(strlen(filebuf) == filesize);
+            reload->_entries = entries;
+            reload->_entries_cap = cap;
+        }
 
-    ec = _mglsl_import_module_file_list_from_string(module_arr, filebuf, search_paths);
+        _mglsl_ReloadEntry * entry = reload->_entries + reload->_entries_len++;
+        memset(entry, 0, sizeof(_mglsl_ReloadEntry));
+        entry->module_idx = i;
+        reload->_queued[i] = 1;
+    }
 
-    _MGLSL_ASSERT(filebuf); _mglsl_free(filebuf);
-    return ec;
-}
+    int ec = MGLSL_E_SUCCESS;
+    size_t done = 0, ready = 0;
 
-int mglsl_free_imported_module_arr(mglsl_ModuleArr module_arr) {
+    for(size_t e=0; e<reload->_entries_len; e++) {
+        _mglsl_ReloadEntry * entry = reload->_entries + e;
+        mglsl_Module * module = modules.data + entry->module_idx;
 
-    _MGLSL_ASSERT(module_arr.data);
-    _mglsl_free(module_arr.data);
-    module_arr.data = NULL;
-    return MGLSL_E_SUCCESS;
-}
- 
-#ifdef _MGLSL_FILE_CHANGE_WATCH
+        // file changed again after it was read
+        if(entry->state != _MGLSL_RELOAD_TODO && module->mtime != entry->mtime) {
+            if(entry->state == _MGLSL_RELOAD_READY) mglsl_free_module(&entry->module);
+            entry->state = _MGLSL_RELOAD_TODO;
+        }
 
-int mglsl_file_change_watch(mglsl_ModuleArr modules) {
-    for(size_t i=0; i<modules.size; ++i){
-        mglsl_Module * module = modules.data + i;
-    }
+        if(entry->state == _MGLSL_RELOAD_READY) ready++;
+        if(entry->state != _MGLSL_RELOAD_TODO || ec) continue;
 
-    int anydirty = 0, ec;
+        // next module is started only if it is expected to fit
+        unsigned long long now = MGLSL_CLOCK_NS();
+        if(done && now - start + reload->_ns_per_module > budget_ns) continue;
 
-    for(size_t i=0; i<modules.size; ++i){
-        mglsl_Module * module = modules.data + i;
+        int read_ec = _mglsl_reload_read(entry, module);
 
-        if(module->path[0]) {
-            time_t new_mtime;
-            ec = MGLSL_FILE_MTIME(&new_mtime, module->path);
-            if(ec) return _mglsl_log_err(ec);
+        unsigned long long took = MGLSL_CLOCK_NS() - now;
+        reload->_ns_per_module = reload->_ns_per_module ? (reload->_ns_per_module * 3 + took) / 4 : took;
+        done++;
 
-            if(module->mtime != new_mtime) {
-                module->mtime = new_mtime;
-                module->flags |= MGLSL_DIRTY;
-                anydirty = 1;
-            }
+        // so that change watch tells when file changes from what was read
+        module->mtime = entry->mtime;
+
+        if(read_ec) {
+            entry->state = _MGLSL_RELOAD_FAILED;
+            ec = read_ec;
+        } else {
+            entry->state = _MGLSL_RELOAD_READY;
+            ready++;
         }
     }
 
-    return anydirty ? MGLSL_E_FILE_CHANGED : MGLSL_E_SUCCESS;
-}
+    if(ec) return ec;
+    if(ready < reload->_entries_len) return MGLSL_E_RELOAD_PENDING;
 
-int mglsl_swap_dirty_modules(mglsl_ModuleArr modules) {
-    mglsl_Module new_module; int ec;
+    for(size_t e=0; e<reload->_entries_len; e++) {
+        _mglsl_ReloadEntry * entry = reload->_entries + e;
+        mglsl_Module * module = modules.data + entry->module_idx;
 
-    for(size_t i=0; i<modules.size; ++i){
-        mglsl_Module * module = modules.data + i;
+        mglsl_free_module(module);
+        memcpy(module, &entry->module, sizeof(mglsl_Module));
+        reload->_queued[entry->module_idx] = 0;
+        _MGLSL_STAT_ADD(reload_count, 1);
+    }
+    reload->_entries_len = 0;
 
-        if(module->flags & MGLSL_DIRTY) {
+    return MGLSL_E_SUCCESS;
+}
 
-            _MGLSL_ASSERT(module->path[0]);
-            ec = mglsl_create_module_from_file(&new_module, module->path);
-            if(ec) return _mglsl_log_err(ec);
+// Drops modules reloaded so far, those still dirty are reloaded by next reload.
+int mglsl_free_reload(mglsl_Reload * reload)
+{
+    _MGLSL_ASSERT(reload);
 
-            _MGLSL_ASSERT(!mglsl_free_module(module));
+    for(size_t e=0; e<reload->_entries_len; e++)
+        if(reload->_entries[e].state == _MGLSL_RELOAD_READY) mglsl_free_module(&reload->_entries[e].module);
 
-            memcpy(module, &new_module, sizeof(mglsl_Module));
-        }
-    }
+    _mglsl_free(reload->_entries);
+    _mglsl_free(reload->_queued);
+    memset(reload, 0, sizeof(mglsl_Reload));
     return MGLSL_E_SUCCESS;
 }
 #endif
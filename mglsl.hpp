@@ -0,0 +1,1048 @@
+#ifndef _LIBMGLSL_HPP_
+#define _LIBMGLSL_HPP_
+
+// C++17 wrapper around mglsl.h, include it instead of mglsl.h in exactly one translation unit.
+// Ownership is tied to move-only objects, names and sources are taken as string_view, errors
+// are still returned as mglsl_ErrorCode so nothing here throws.
+
+#include <cstddef>     // std::max_align_t
+#include <cstring>     // std::memcpy
+#include <string>
+#include <string_view>
+#include <type_traits> // std::remove_reference_t
+#include <utility>     // std::exchange, std::forward
+#include <memory_resource>
+#if __has_include(<span>)
+# include <span>
+#endif
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+# define _MGLSL_HPP_ASYNC
+# include <atomic>
+# include <condition_variable>
+# include <coroutine>
+# include <deque>
+# include <exception>  // std::terminate
+# include <mutex>
+# include <thread>
+# include <vector>
+#endif
+
+//
+// MEMORY ALLOCATION
+// Unless allocation hooks are already set up every allocation of the library goes to
+// std::pmr::memory_resource chosen with mglsl::set_memory_resource.
+
+#if !defined(MGLSL_ALLOC) && !defined(MGLSL_REALLOC) && !defined(MGLSL_FREE)
+# define _MGLSL_HPP_PMR
+
+namespace mglsl {
+namespace detail {
+
+// Memory resource and size are kept in front of every block since MGLSL_FREE gets only the
+// pointer and the resource may have been changed since the block was allocated.
+struct alignas(std::max_align_t) AllocHeader {
+    std::pmr::memory_resource * resource;
+    std::size_t size;
+};
+
+inline std::pmr::memory_resource * current_resource = nullptr;
+
+inline std::pmr::memory_resource * resource() {
+    return current_resource ? current_resource : std::pmr::get_default_resource();
+}
+
+inline void * alloc(std::size_t size) {
+    std::pmr::memory_resource * res = resource();
+    void * block;
+    try {
+        block = res->allocate(sizeof(AllocHeader) + size, alignof(AllocHeader));
+    } catch(...) {
+        return nullptr;
+    }
+    AllocHeader * header = static_cast<AllocHeader *>(block);
+    header->resource = res;
+    header->size = size;
+    return header + 1;
+}
+
+inline void free(void * ptr) {
+    if(!ptr) return;
+    AllocHeader * header = static_cast<AllocHeader *>(ptr) - 1;
+    header->resource->deallocate(header, sizeof(AllocHeader) + header->size, alignof(AllocHeader));
+}
+
+inline void * realloc(void * ptr, std::size_t size) {
+    if(!ptr) return alloc(size);
+    AllocHeader * header = static_cast<AllocHeader *>(ptr) - 1;
+    if(size <= header->size) return ptr;
+
+    void * new_ptr = alloc(size);
+    if(!new_ptr) return nullptr;
+    std::memcpy(new_ptr, ptr, header->size);
+    free(ptr);
+    return new_ptr;
+}
+
+} // namespace detail
+} // namespace mglsl
+
+# define MGLSL_ALLOC(SIZE) (mglsl::detail::alloc(SIZE))
+# define MGLSL_REALLOC(PTR, SIZE) (mglsl::detail::realloc(PTR, SIZE))
+# define MGLSL_FREE(PTR) (mglsl::detail::free(PTR))
+#endif
+
+#include "mglsl.h"
+
+namespace mglsl {
+
+#ifdef _MGLSL_HPP_PMR
+// Resource used for allocations from now on, nullptr means std::pmr::get_default_resource().
+// Blocks are always returned to the resource they came from. Returns previous resource.
+inline std::pmr::memory_resource * set_memory_resource(std::pmr::memory_resource * resource) {
+    return std::exchange(detail::current_resource, resource);
+}
+
+inline std::pmr::memory_resource * memory_resource() {
+    return detail::resource();
+}
+#endif
+
+namespace detail {
+
+// Most of the C interface wants null-terminated names.
+template<std::size_t N>
+inline int copy_cstr(char (&buf)[N], std::string_view str) {
+    if(str.size() >= N) return MGLSL_E_BUF_TOO_SMALL;
+    std::memcpy(buf, str.data(), str.size());
+    buf[str.size()] = '\0';
+    return MGLSL_E_SUCCESS;
+}
+
+struct SpanSink {
+    char * data;
+    std::size_t size;
+    std::size_t len;
+};
+
+inline int span_sink_write(const char * data, std::size_t len, void * user) {
+    SpanSink * sink = static_cast<SpanSink *>(user);
+    if(len > sink->size - sink->len) return 1;
+    std::memcpy(sink->data + sink->len, data, len);
+    sink->len += len;
+    return 0;
+}
+
+template<typename F>
+inline int callable_write(const char * data, std::size_t len, void * user) {
+    return (*static_cast<F *>(user))(std::string_view(data, len)) ? 0 : 1;
+}
+
+} // namespace detail
+
+//
+// SHADER
+// Assembled shader, optionally with its line map.
+
+class Shader {
+public:
+    Shader() = default;
+    Shader(const Shader &) = delete;
+    Shader & operator=(const Shader &) = delete;
+
+    Shader(Shader && other) noexcept
+        : buf_(std::exchange(other.buf_, nullptr)),
+          size_(std::exchange(other.size_, 0)),
+          line_map_(std::exchange(other.line_map_, mglsl_LineMap{})) {}
+
+    Shader & operator=(Shader && other) noexcept {
+        if(this != &other) {
+            reset();
+            buf_ = std::exchange(other.buf_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            line_map_ = std::exchange(other.line_map_, mglsl_LineMap{});
+        }
+        return *this;
+    }
+
+    ~Shader() { reset(); }
+
+    void reset() {
+        if(buf_) mglsl_free_shader(buf_);
+        if(line_map_.data) mglsl_free_line_map(&line_map_);
+        buf_ = nullptr;
+        size_ = 0;
+        line_map_ = mglsl_LineMap{};
+    }
+
+    std::string_view view() const { return std::string_view(buf_ ? buf_ : "", size_); }
+    const char * c_str() const { return buf_ ? buf_ : ""; }
+    std::size_t size() const { return size_; }
+
+    // Empty unless requested at assembly.
+    const mglsl_LineMap & line_map() const { return line_map_; }
+
+    explicit operator bool() const { return buf_ != nullptr; }
+
+private:
+    friend class ModuleSet;
+
+    char * buf_ = nullptr;
+    std::size_t size_ = 0;
+    mglsl_LineMap line_map_ = {};
+};
+
+//
+// MODULE SET
+// Owns uniquely named modules, backed by mglsl_Registry so handles survive removals.
+
+class ModuleSet {
+public:
+    ModuleSet() { mglsl_create_registry(&reg_); }
+    ModuleSet(const ModuleSet &) = delete;
+    ModuleSet & operator=(const ModuleSet &) = delete;
+
+    ModuleSet(ModuleSet && other) noexcept : reg_(other.reg_) {
+        mglsl_create_registry(&other.reg_);
+    }
+
+    ModuleSet & operator=(ModuleSet && other) noexcept {
+        if(this != &other) {
+            mglsl_free_registry(&reg_);
+            reg_ = other.reg_;
+            mglsl_create_registry(&other.reg_);
+        }
+        return *this;
+    }
+
+    ~ModuleSet() { mglsl_free_registry(&reg_); }
+
+    [[nodiscard]] int add_source(std::string_view src, mglsl_ModuleHandle * handle = nullptr) {
+        mglsl_Module module;
+        int err = mglsl_create_module_from_source_len(&module, src.data(), src.size());
+        if(err) return err;
+        return add(&module, handle);
+    }
+
+    [[nodiscard]] int add_file(std::string_view filepath, mglsl_ModuleHandle * handle = nullptr) {
+        char path[MGLSL_MAX_PATH_LEN + 1];
+        int err = detail::copy_cstr(path, filepath);
+        if(err) return err;
+
+        mglsl_Module module;
+        err = mglsl_create_module_from_file(&module, path);
+        if(err) return err;
+        return add(&module, handle);
+    }
+
+    // Comma separated list of module files, see mglsl_import_module_file_list_from_string.
+    [[nodiscard]] int import_files(std::string_view file_list, std::string_view search_paths = {}) {
+        std::pmr::string list(file_list, resource());
+        std::pmr::string paths(search_paths, resource());
+
+        mglsl_ModuleArr arr = {};
+        int err = mglsl_import_module_file_list_from_string(&arr, list.c_str(), paths.c_str());
+        if(err) return err;
+
+        // modules are moved into registry one by one, whatever is left after failure is freed
+        for(size_t i = 0; i < arr.size; ++i) {
+            if(!err) err = mglsl_registry_add(nullptr, &reg_, &arr.data[i]);
+            if(err) mglsl_free_module(&arr.data[i]);
+        }
+        mglsl_free_imported_module_arr(arr);
+        return err;
+    }
+
+    [[nodiscard]] int replace_source(mglsl_ModuleHandle handle, std::string_view src) {
+        mglsl_Module module;
+        int err = mglsl_create_module_from_source_len(&module, src.data(), src.size());
+        if(err) return err;
+        err = mglsl_registry_replace(&reg_, handle, &module);
+        if(err) mglsl_free_module(&module);
+        return err;
+    }
+
+    [[nodiscard]] int remove(std::string_view module_name) {
+        char name[MGLSL_MAX_NAME_LEN + 1];
+        int err = detail::copy_cstr(name, module_name);
+        if(err) return MGLSL_E_MODULE_NOT_FOUND;
+        return mglsl_registry_remove(&reg_, name);
+    }
+
+    [[nodiscard]] int find(mglsl_ModuleHandle * handle, std::string_view module_name) {
+        char name[MGLSL_MAX_NAME_LEN + 1];
+        int err = detail::copy_cstr(name, module_name);
+        if(err) return MGLSL_E_MODULE_NOT_FOUND;
+        return mglsl_registry_find(handle, &reg_, name);
+    }
+
+    // NULL if module of the handle was removed.
+    mglsl_Module * get(mglsl_ModuleHandle handle) const { return mglsl_registry_get(&reg_, handle); }
+
+    std::size_t size() const { return reg_.size; }
+
+    // Valid until the set is modified.
+    mglsl_ModuleArr modules() const { return mglsl_registry_modules(&reg_); }
+
+    [[nodiscard]] int assemble(Shader & shader, std::string_view root_module_name,
+                               unsigned int flags = 0, bool line_map = false) const {
+        char root[MGLSL_MAX_NAME_LEN + 1];
+        int err = detail::copy_cstr(root, root_module_name);
+        if(err) return MGLSL_E_MODULE_NOT_FOUND;
+
+        Shader out;
+        mglsl_AssembleOptions options = {};
+        options.flags = flags;
+        options.line_map = line_map ? &out.line_map_ : nullptr;
+        err = mglsl_assemble_shader_ex(&out.buf_, root, modules(), &options);
+        if(err) return err;
+        out.size_ = std::strlen(out.buf_);
+        shader = std::move(out);
+        return MGLSL_E_SUCCESS;
+    }
+
+    // Assembles into caller memory without allocating the shader, MGLSL_E_BUF_TOO_SMALL if it
+    // does not fit. Output is not null-terminated, its length is returned in written.
+    [[nodiscard]] int assemble_into(char * data, std::size_t size, std::size_t * written,
+                                    std::string_view root_module_name, unsigned int flags = 0) const {
+        detail::SpanSink sink = {data, size, 0};
+        int err = assemble_stream_raw(detail::span_sink_write, &sink, root_module_name, flags);
+        if(written) *written = sink.len;
+        return err == MGLSL_E_WRITE ? MGLSL_E_BUF_TOO_SMALL : err;
+    }
+
+#ifdef __cpp_lib_span
+    [[nodiscard]] int assemble_into(std::span<char> buf, std::size_t * written,
+                                    std::string_view root_module_name, unsigned int flags = 0) const {
+        return assemble_into(buf.data(), buf.size(), written, root_module_name, flags);
+    }
+#endif
+
+    // write is called as bool(std::string_view) with consecutive chunks, false stops assembly.
+    template<typename F>
+    [[nodiscard]] int assemble_stream(F && write, std::string_view root_module_name,
+                                      unsigned int flags = 0) const {
+        using Fn = std::remove_reference_t<F>;
+        return assemble_stream_raw(detail::callable_write<Fn>, const_cast<void *>(static_cast<const void *>(&write)),
+                                   root_module_name, flags);
+    }
+
+#ifdef _MGLSL_FILE_CHANGE_WATCH
+    [[nodiscard]] int watch() { return mglsl_file_change_watch(modules()); }
+
+    [[nodiscard]] int swap_dirty() {
+        int err = mglsl_swap_dirty_modules(modules());
+        // swapped modules may have been renamed
+        int reindex_err = mglsl_registry_reindex(&reg_);
+        return err ? err : reindex_err;
+    }
+#endif
+
+    mglsl_Registry & registry() { return reg_; }
+    const mglsl_Registry & registry() const { return reg_; }
+
+private:
+    mglsl_Registry reg_;
+
+    static std::pmr::memory_resource * resource() {
+#ifdef _MGLSL_HPP_PMR
+        return memory_resource();
+#else
+        return std::pmr::get_default_resource();
+#endif
+    }
+
+    int add(mglsl_Module * module, mglsl_ModuleHandle * handle) {
+        int err = mglsl_registry_add(handle, &reg_, module);
+        if(err) mglsl_free_module(module);
+        return err;
+    }
+
+    int assemble_stream_raw(mglsl_WriteProc * write, void * user,
+                            std::string_view root_module_name, unsigned int flags) const {
+        char root[MGLSL_MAX_NAME_LEN + 1];
+        int err = detail::copy_cstr(root, root_module_name);
+        if(err) return MGLSL_E_MODULE_NOT_FOUND;
+
+        mglsl_AssembleOptions options = {};
+        options.flags = flags;
+        return mglsl_assemble_shader_stream(write, user, root, modules(), &options);
+    }
+};
+
+} // namespace mglsl
+
+//
+// ASYNC
+// C++20 only. Module loads, file list imports and assembly as coroutines for job systems.
+// Files are read through mglsl::IoBackend and coroutines are resumed by mglsl::Executor, so
+// any number of loads can be in flight on a few threads without blocking them on I/O.
+// The library itself is not thread-safe, every call made here holds mglsl::library_mutex().
+
+#ifdef _MGLSL_HPP_ASYNC
+
+namespace mglsl {
+
+// Lock it around library calls made from other threads while async operations may be running.
+inline std::mutex & library_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+class Executor {
+public:
+    virtual ~Executor() = default;
+
+    // Resumes handle on any thread, possibly before returning.
+    virtual void post(std::coroutine_handle<> handle) = 0;
+};
+
+// Resumes on the posting thread, which after a read is the thread that completed it.
+class InlineExecutor final : public Executor {
+public:
+    void post(std::coroutine_handle<> handle) override { handle.resume(); }
+};
+
+// Same contract as MGLSL_READ_FILE, on success data is null-terminated, allocated with
+// MGLSL_ALLOC and owned by whoever gets the result. mtime is used by file change watch.
+struct ReadResult {
+    int err;
+    char * data;
+    std::size_t size;
+    time_t mtime;
+};
+
+using ReadDone = void(void * user, ReadResult result);
+
+class IoBackend {
+public:
+    virtual ~IoBackend() = default;
+
+    // Reads whole file, done is called exactly once from any thread, possibly before returning.
+    // Path stays valid until then. Missing files have to fail with MGLSL_E_FILE_NOT_FOUND, search
+    // paths are tried until a file is found.
+    virtual void read_file(const char * path, ReadDone * done, void * user) = 0;
+};
+
+// Reads with MGLSL_FILE_MTIME and MGLSL_READ_FILE on its own threads, so blocking reads never
+// run on the executor. File hooks have to be thread-safe, mounted packs are read under the lock.
+class ThreadIo final : public IoBackend {
+public:
+    explicit ThreadIo(unsigned int thread_count = 4) {
+        if(!thread_count) thread_count = 1;
+        for(unsigned int i = 0; i < thread_count; ++i) threads_.emplace_back([this] { run(); });
+    }
+
+    ThreadIo(const ThreadIo &) = delete;
+    ThreadIo & operator=(const ThreadIo &) = delete;
+
+    // Queued reads are finished first.
+    ~ThreadIo() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        for(std::thread & thread : threads_) thread.join();
+    }
+
+    void read_file(const char * path, ReadDone * done, void * user) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(Request{path, done, user});
+        }
+        cond_.notify_one();
+    }
+
+private:
+    struct Request {
+        const char * path;
+        ReadDone * done;
+        void * user;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Request> queue_;
+    std::vector<std::thread> threads_;
+    bool stop_ = false;
+
+    static ReadResult read(const char * path) {
+        ReadResult result = {};
+        void * buf = nullptr;
+#ifdef _MGLSL_PACK_FILES
+        {
+            std::lock_guard<std::mutex> lock(library_mutex());
+            const _mglsl_PackEntry * entry;
+            if(_mglsl_pack_lookup(path, &entry)) {
+                if(!entry) {
+                    result.err = MGLSL_E_FILE_NOT_FOUND;
+                } else {
+                    result.err = _mglsl_pack_read(&buf, &result.size, entry);
+                    result.data = static_cast<char *>(buf);
+                    result.mtime = entry->mtime;
+                }
+                return result;
+            }
+        }
+#endif
+        result.err = MGLSL_FILE_MTIME(&result.mtime, path);
+        if(!result.err) result.err = MGLSL_READ_FILE(&buf, &result.size, path);
+        if(!result.err) result.data = static_cast<char *>(buf);
+        return result;
+    }
+
+    void run() {
+        for(;;) {
+            Request req;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+                if(queue_.empty()) return;
+                req = queue_.front();
+                queue_.pop_front();
+            }
+            req.done(req.user, read(req.path));
+        }
+    }
+};
+
+// Executor resumes coroutines, io reads files. Both have to outlive every operation using them.
+struct AsyncContext {
+    Executor & executor;
+    IoBackend & io;
+};
+
+// Coroutine returning mglsl_ErrorCode, started when awaited. Arguments taken by reference or
+// as string_view have to stay alive until it completes.
+class [[nodiscard]] Task {
+public:
+    struct promise_type {
+        int result = MGLSL_E_SUCCESS;
+        std::coroutine_handle<> continuation;
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                std::coroutine_handle<> next = handle.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(int err) noexcept { result = err; }
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    Task(const Task &) = delete;
+    Task & operator=(const Task &) = delete;
+
+    Task(Task && other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+    Task & operator=(Task && other) noexcept {
+        if(this != &other) {
+            if(handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    ~Task() { if(handle_) handle_.destroy(); }
+
+    auto operator co_await() noexcept {
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+                handle.promise().continuation = continuation;
+                return handle;
+            }
+            int await_resume() noexcept { return handle.promise().result; }
+        };
+        return Awaiter{handle_};
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+// Runs eagerly and frees itself, for fan-out and for waiting outside of coroutines.
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+struct ScheduleOp {
+    Executor * executor;
+
+    bool await_ready() noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) { executor->post(handle); }
+    void await_resume() noexcept {}
+};
+
+struct ReadOp {
+    AsyncContext * ctx;
+    const char * path;
+    ReadResult result = {};
+    std::coroutine_handle<> handle;
+
+    ReadOp(AsyncContext * async_ctx, const char * filepath) : ctx(async_ctx), path(filepath) {}
+
+    static void done(void * user, ReadResult result) {
+        ReadOp * op = static_cast<ReadOp *>(user);
+        op->result = result;
+        op->ctx->executor.post(op->handle);
+    }
+
+    bool await_ready() noexcept { return false; }
+    // nothing is touched after read_file, the coroutine may be running already
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        handle = awaiting;
+        ctx->io.read_file(path, done, this);
+    }
+    ReadResult await_resume() noexcept { return result; }
+};
+
+// Awaited once after count tasks were started, resumes when all of them arrived.
+struct Join {
+    std::atomic<std::size_t> pending;
+    Executor * executor;
+    std::coroutine_handle<> waiter;
+
+    Join(std::size_t count, Executor * exec) : pending(count + 1), executor(exec) {}
+
+    void arrive() {
+        if(pending.fetch_sub(1, std::memory_order_acq_rel) == 1) executor->post(waiter);
+    }
+
+    bool await_ready() noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        waiter = handle;
+        return pending.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+    void await_resume() noexcept {}
+};
+
+inline DetachedTask spawn(Task task, int * result, Join * join) {
+    *result = co_await task;
+    join->arrive();
+}
+
+struct SyncWait {
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done = false;
+    int result = MGLSL_E_SUCCESS;
+};
+
+inline DetachedTask sync_run(Task task, SyncWait * wait) {
+    int err = co_await task;
+    std::lock_guard<std::mutex> lock(wait->mutex);
+    wait->result = err;
+    wait->done = true;
+    wait->cond.notify_one();
+}
+
+// Parses file read by the backend, like mglsl_create_module_from_file. Takes the buffer.
+inline int create_module_from_read(mglsl_Module * module, const char * path, ReadResult file) {
+    std::lock_guard<std::mutex> lock(library_mutex());
+    if(file.err) {
+        _mglsl_err_file = path;
+        _mglsl_err_name = path;
+        return _mglsl_log_err(file.err);
+    }
+    int err = _mglsl_create_module_from_file_buf(module, path, file.data, file.mtime, 0);
+    MGLSL_FREE(file.data);
+    return err;
+}
+
+inline std::pmr::memory_resource * scratch_resource() {
+#ifdef _MGLSL_HPP_PMR
+    return memory_resource();
+#else
+    return std::pmr::get_default_resource();
+#endif
+}
+
+inline int log_err(const char * name, int err) {
+    std::lock_guard<std::mutex> lock(library_mutex());
+    _mglsl_err_file = nullptr;
+    _mglsl_err_name = name;
+    return _mglsl_log_err(err);
+}
+
+// First file found in search paths, the empty path implied before them, like imports do.
+inline Task find_and_load(AsyncContext ctx, mglsl_Module * module, const char * name, mglsl_StringArr search_paths) {
+    char path[MGLSL_MAX_PATH_LEN + 1];
+    for(int p_idx = -1; p_idx < (int)search_paths.size; ++p_idx) {
+        const char * dir = p_idx < 0 ? "" : search_paths.data[p_idx];
+
+        int err = MGLSL_CONCAT_PATH(path, sizeof(path), dir, name);
+        if(err) co_return log_err(name, err);
+
+        ReadResult file = co_await ReadOp{&ctx, path};
+        if(file.err == MGLSL_E_FILE_NOT_FOUND) continue;
+        co_return create_module_from_read(module, path, file);
+    }
+    co_return log_err(name, MGLSL_E_FILE_NOT_FOUND);
+}
+
+} // namespace detail
+
+// Blocks the calling thread until task completes, for code outside of coroutines. Executor must
+// not need the calling thread to make progress.
+inline int sync_wait(Task task) {
+    detail::SyncWait wait;
+    detail::sync_run(std::move(task), &wait);
+    std::unique_lock<std::mutex> lock(wait.mutex);
+    wait.cond.wait(lock, [&] { return wait.done; });
+    return wait.result;
+}
+
+// mglsl_create_module_from_file without blocking, module is owned by the caller on success.
+inline Task load_module(AsyncContext ctx, mglsl_Module * module, std::string_view filepath) {
+    char path[MGLSL_MAX_PATH_LEN + 1];
+    int err = detail::copy_cstr(path, filepath);
+    if(err) co_return err;
+
+    co_return detail::create_module_from_read(module, path, co_await detail::ReadOp{&ctx, path});
+}
+
+inline Task add_file_async(AsyncContext ctx, ModuleSet & set, std::string_view filepath,
+                           mglsl_ModuleHandle * handle = nullptr) {
+    mglsl_Module module;
+    int err = co_await load_module(ctx, &module, filepath);
+    if(err) co_return err;
+
+    std::lock_guard<std::mutex> lock(library_mutex());
+    err = mglsl_registry_add(handle, &set.registry(), &module);
+    if(err) mglsl_free_module(&module);
+    co_return err;
+}
+
+// ModuleSet::import_files with every file loaded at once. Nothing is added unless all of them
+// were loaded, then modules are moved into the set one by one.
+inline Task import_files_async(AsyncContext ctx, ModuleSet & set, std::string_view file_list,
+                               std::string_view search_paths = {}) {
+    if(file_list.empty()) co_return MGLSL_E_SUCCESS;
+
+    std::pmr::memory_resource * res = detail::scratch_resource();
+    std::pmr::string list(file_list, res);
+    std::pmr::string paths(search_paths, res);
+
+    mglsl_StringArr names = {}, dirs = {};
+    int err;
+    {
+        std::lock_guard<std::mutex> lock(library_mutex());
+        _mglsl_err_file = nullptr;
+        err = _mglsl_split(&names, list.data(), ',');
+        if(!err) err = _mglsl_split(&dirs, paths.data(), ':');
+        if(err && names.data) _mglsl_free(names.data);
+    }
+    if(err) co_return err;
+
+    std::pmr::vector<mglsl_Module> modules(names.size, mglsl_Module{}, res);
+    std::pmr::vector<int> errs(names.size, MGLSL_E_SUCCESS, res);
+
+    detail::Join join(names.size, &ctx.executor);
+    for(std::size_t i = 0; i < names.size; ++i)
+        detail::spawn(detail::find_and_load(ctx, &modules[i], names.data[i], dirs), &errs[i], &join);
+    co_await join;
+
+    std::lock_guard<std::mutex> lock(library_mutex());
+    for(std::size_t i = 0; i < names.size && !err; ++i) err = errs[i];
+
+    for(std::size_t i = 0; i < names.size; ++i) {
+        if(errs[i]) continue;
+        int add_err = err ? err : mglsl_registry_add(nullptr, &set.registry(), &modules[i]);
+        if(add_err) mglsl_free_module(&modules[i]);
+        if(!err) err = add_err;
+    }
+
+    _mglsl_free(dirs.data);
+    _mglsl_free(names.data);
+    co_return err;
+}
+
+// Assembly is resumed on the executor, serialized with every other library call.
+inline Task assemble_async(AsyncContext ctx, const ModuleSet & set, Shader & shader,
+                           std::string_view root_module_name, unsigned int flags = 0,
+                           bool line_map = false) {
+    co_await detail::ScheduleOp{&ctx.executor};
+    std::lock_guard<std::mutex> lock(library_mutex());
+    co_return set.assemble(shader, root_module_name, flags, line_map);
+}
+
+} // namespace mglsl
+
+#endif
+
+//
+// STATIC ASSEMBLY
+// C++20 only. Modules embedded as string literals are parsed and assembled during compilation
+// with the same rules as mglsl_create_module_from_source and mglsl_assemble_shader, so built-in
+// shaders cost nothing at runtime. Syntax errors, missing modules and circular dependencies
+// fail compilation.
+
+#if __cplusplus >= 202002L && defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+
+namespace mglsl {
+
+// Literal usable as template argument.
+template<std::size_t N>
+struct Literal {
+    char data[N] = {};
+
+    constexpr Literal(const char (&str)[N]) {
+        for(std::size_t i = 0; i < N; ++i) data[i] = str[i];
+    }
+
+    // Ends at the first '\0', like sources given to mglsl_create_module_from_source.
+    constexpr std::string_view view() const {
+        std::size_t len = 0;
+        while(len < N && data[len] != '\0') ++len;
+        return std::string_view(data, len);
+    }
+};
+
+template<std::size_t N>
+struct StaticShader {
+    char data[N + 1] = {};
+
+    constexpr std::string_view view() const { return std::string_view(data, N); }
+    constexpr const char * c_str() const { return data; }
+    constexpr std::size_t size() const { return N; }
+};
+
+namespace detail {
+namespace static_asm {
+
+// Not constexpr, so reaching any of these during compilation is a compile error naming it.
+inline void syntax_error(const char * msg) { (void)msg; }
+inline void semantic_error(const char * msg) { (void)msg; }
+inline void module_not_found(std::string_view name) { (void)name; }
+inline void missing_dep(std::string_view name) { (void)name; }
+inline void circular_dep(std::string_view name) { (void)name; }
+
+constexpr bool is_space(char c) { return c == ' ' || c == '\t'; }
+constexpr bool is_white(char c) { return is_space(c) || c == '\f' || c == '\n' || c == '\r' || c == '\v'; }
+constexpr bool is_number(char c) { return '0' <= c && c <= '9'; }
+constexpr bool is_letter(char c) { return ('A' <= c && c <= 'Z') || ('a' <= c && c <= 'z'); }
+constexpr bool is_ident_char(char c) { return is_letter(c) || is_number(c) || c == '_'; }
+
+constexpr bool is_valid_name(std::string_view str) {
+    if(str.empty() || str.size() > MGLSL_MAX_NAME_LEN || is_number(str[0]) || str[0] == '-') return false;
+    for(char c : str)
+        if(!is_letter(c) && !is_number(c) && c != '_' && c != '-') return false;
+    return true;
+}
+
+constexpr std::size_t skip_space(std::string_view src, std::size_t pos) {
+    while(pos < src.size() && is_space(src[pos])) ++pos;
+    return pos;
+}
+
+constexpr std::size_t skip_line(std::string_view src, std::size_t pos) {
+    while(pos < src.size()) if(src[pos++] == '\n') break;
+    return pos;
+}
+
+enum class Line { KEEP, MODULE, REQUIRE, TYPE };
+
+// Mirrors _mglsl_parse, proc gets every line with its kind and directive arguments.
+template<typename F>
+constexpr void for_each_line(std::string_view src, F && proc) {
+    for(std::size_t pos = 0; pos < src.size();) {
+        std::size_t line_begin = pos, cur = skip_space(src, pos);
+        Line kind = Line::KEEP;
+        std::string_view args;
+
+        if(cur < src.size() && src[cur] == '#') {
+            cur = skip_space(src, cur + 1);
+
+            std::size_t keyword_end = cur;
+            while(keyword_end < src.size() && is_ident_char(src[keyword_end])) ++keyword_end;
+            std::string_view keyword = src.substr(cur, keyword_end - cur);
+
+            if(keyword.size() > 32) syntax_error("preprocessor keyword too long");
+
+            /**/ if(keyword == "module") kind = Line::MODULE;
+            else if(keyword == "require") kind = Line::REQUIRE;
+            else if(keyword == "type") kind = Line::TYPE;
+
+            std::size_t args_begin = skip_space(src, keyword_end);
+            std::size_t args_end = skip_line(src, args_begin);
+            if(args_end > args_begin && src[args_end - 1] == '\n') --args_end;
+            args = src.substr(args_begin, args_end - args_begin);
+        }
+
+        pos = skip_line(src, cur);
+        proc(kind, src.substr(line_begin, pos - line_begin), args);
+    }
+}
+
+// Mirrors _mglsl_parse_ppdir_type, stages do not matter for assembly of all of them.
+constexpr void check_type(std::string_view args) {
+    constexpr std::string_view stages[] = {"vert", "vertex", "frag", "fragment", "geom", "geometry",
+                                           "comp", "compute", "tesc", "tess_ctrl", "tese", "tess_eval"};
+    if(args.empty()) syntax_error("'type' directive without any arguments");
+
+    for(std::size_t cur = 0;;) {
+        while(cur < args.size() && is_white(args[cur])) ++cur;
+
+        std::size_t arg_begin = cur;
+        while(cur < args.size() && !is_white(args[cur]) && args[cur] != ',') ++cur;
+        std::string_view arg = args.substr(arg_begin, cur - arg_begin);
+
+        bool valid = false;
+        for(std::string_view stage : stages) valid = valid || arg == stage;
+        if(!valid) syntax_error("one of 'type' directive arguments is not a shader stage");
+
+        while(cur < args.size() && is_white(args[cur])) ++cur;
+        if(cur == args.size()) break;
+        if(args[cur] != ',') syntax_error("one of 'type' directive arguments is not a shader stage");
+        ++cur;
+    }
+}
+
+constexpr std::string_view module_name(std::string_view src) {
+    std::string_view name;
+    for_each_line(src, [&](Line kind, std::string_view, std::string_view args) {
+        if(kind == Line::TYPE) check_type(args);
+        if(kind != Line::MODULE) return;
+        if(args.empty()) syntax_error("'module' directive without module name argument");
+        if(!name.empty()) semantic_error("redefined module name");
+        if(!is_valid_name(args)) syntax_error("invalid module name");
+        name = args;
+    });
+    return name;
+}
+
+// Mirrors _mglsl_parse_require_args.
+template<typename F>
+constexpr void for_each_dep(std::string_view src, F && proc) {
+    for_each_line(src, [&](Line kind, std::string_view, std::string_view args) {
+        if(kind != Line::REQUIRE) return;
+        if(args.empty()) syntax_error("'require' directive without any arguments");
+
+        for(std::size_t cur = 0;;) {
+            while(cur < args.size() && is_white(args[cur])) ++cur;
+
+            std::size_t arg_begin = cur;
+            while(cur < args.size() && !is_white(args[cur]) && args[cur] != ',') ++cur;
+            std::string_view arg = args.substr(arg_begin, cur - arg_begin);
+
+            if(arg.empty()) syntax_error("'require' directive argument cannot be empty");
+            if(!is_valid_name(arg)) syntax_error("one of 'require' directive arguments is not valid module name");
+            proc(arg);
+
+            for(; cur < args.size() && args[cur] != ','; ++cur)
+                if(!is_white(args[cur])) syntax_error("one of 'require' directive arguments is not valid module name");
+            if(cur == args.size()) break;
+            ++cur;
+        }
+    });
+}
+
+// Same resolution as _mglsl_resolve, modules come in order of emission.
+template<std::size_t M>
+struct Assembler {
+    std::string_view srcs[M ? M : 1];
+    std::string_view names[M ? M : 1];
+    unsigned char marks[M ? M : 1] = {};
+    std::size_t order[M ? M : 1] = {};
+    std::size_t order_len = 0;
+
+    static constexpr unsigned char TEMP_MARK = 1, PERM_MARK = 2;
+
+    // first of modules with the same name wins
+    constexpr std::size_t find(std::string_view name) const {
+        for(std::size_t i = 0; i < M; ++i)
+            if(!name.empty() && names[i] == name) return i;
+        return M;
+    }
+
+    constexpr void visit(std::size_t idx) {
+        if(marks[idx] & PERM_MARK) return;
+        if(marks[idx] & TEMP_MARK) circular_dep(names[idx]);
+
+        marks[idx] |= TEMP_MARK;
+        for_each_dep(srcs[idx], [&](std::string_view dep) {
+            std::size_t dep_idx = find(dep);
+            if(dep_idx == M) missing_dep(dep);
+            visit(dep_idx);
+        });
+        marks[idx] = PERM_MARK;
+
+        order[order_len++] = idx;
+    }
+
+    // Returns length of assembled shader, it is only written if out is not null.
+    constexpr std::size_t emit(char * out) const {
+        std::size_t len = 0;
+        auto put = [&](std::string_view str) {
+            if(out) for(char c : str) out[len++] = c;
+            else len += str.size();
+        };
+
+        for(std::size_t i = 0; i < order_len; ++i) {
+#ifdef _MGLSL_MODULE_HEADER_COMMENT
+            put("\n// ==== ");
+            put(names[order[i]]);
+            put(" module ====\n");
+#endif
+            for_each_line(srcs[order[i]], [&](Line kind, std::string_view line, std::string_view) {
+                if(kind == Line::KEEP) put(line);
+            });
+        }
+        return len;
+    }
+};
+
+template<Literal Root, Literal... Modules>
+constexpr Assembler<sizeof...(Modules)> resolve() {
+    Assembler<sizeof...(Modules)> as;
+    std::size_t i = 0;
+    ((as.srcs[i] = Modules.view(), as.names[i] = module_name(as.srcs[i]), ++i), ...);
+
+    std::size_t root_idx = as.find(Root.view());
+    if(root_idx == sizeof...(Modules)) module_not_found(Root.view());
+    else as.visit(root_idx);
+    return as;
+}
+
+template<Literal Root, Literal... Modules>
+constexpr auto assemble() {
+    constexpr std::size_t len = resolve<Root, Modules...>().emit(nullptr);
+    StaticShader<len> shader;
+    resolve<Root, Modules...>().emit(shader.data);
+    return shader;
+}
+
+} // namespace static_asm
+} // namespace detail
+
+// Shader assembled from given root module during compilation:
+//   inline constexpr mglsl::Literal common = "#module common\n...";
+//   inline constexpr mglsl::Literal lit = "#module lit\n#require common\n...";
+//   constexpr auto & shader = mglsl::static_shader<"lit", common, lit>; // shader.c_str()
+template<Literal Root, Literal... Modules>
+inline constexpr auto static_shader = detail::static_asm::assemble<Root, Modules...>();
+
+} // namespace mglsl
+
+#endif
+
+#endif // _LIBMGLSL_HPP_
@@ -0,0 +1,121 @@
+// Coroutine loads and assembly, mglsl.hpp built as C++20.
+//
+// # g++ -std=c++20 async.cpp -o async -pthread && ./async
+
+#define MGLSL_DEBUG
+#define MGLSL_NO_LOGGING // missing files are looked up on purpose
+#include "../mglsl.hpp"
+#include "test.h"
+
+#include <string>
+
+#define MODULE_COUNT 16
+
+// Resumes coroutines on a few threads of its own, like a job system would.
+class PoolExecutor final : public mglsl::Executor {
+public:
+    explicit PoolExecutor(int thread_count) {
+        for(int i = 0; i < thread_count; ++i) threads_.emplace_back([this] { run(); });
+    }
+
+    ~PoolExecutor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        for(std::thread & thread : threads_) thread.join();
+    }
+
+    void post(std::coroutine_handle<> handle) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(handle);
+        }
+        cond_.notify_one();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::coroutine_handle<>> queue_;
+    std::vector<std::thread> threads_;
+    bool stop_ = false;
+
+    void run() {
+        for(;;) {
+            std::coroutine_handle<> handle;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+                if(queue_.empty()) return;
+                handle = queue_.front();
+                queue_.pop_front();
+            }
+            handle.resume();
+        }
+    }
+};
+
+static mglsl::Task import_and_assemble(mglsl::AsyncContext ctx, mglsl::ModuleSet & set,
+                                       const std::string & list, mglsl::Shader & shader) {
+    int err = co_await mglsl::import_files_async(ctx, set, list, test_dir());
+    if(err) co_return err;
+    co_return co_await mglsl::assemble_async(ctx, set, shader, "main");
+}
+
+int main() {
+    std::string list = "main.glsl", requires_line = "#require";
+    for(int i = 0; i < MODULE_COUNT; ++i) {
+        std::string name = "m" + std::to_string(i);
+        test_write((name + ".glsl").c_str(),
+                   ("#module " + name + "\nfloat f" + std::to_string(i) + "() { return 1.0; }\n").c_str());
+        list += "," + name + ".glsl";
+        requires_line += (i ? ", " : " ") + name;
+    }
+    test_write("main.glsl", ("#module main\n" + requires_line + "\nvoid main() {}\n").c_str());
+
+    {
+        // io threads may still be returning from post, so they are joined first
+        PoolExecutor pool(3);
+        mglsl::ThreadIo io(4);
+        mglsl::InlineExecutor inline_executor;
+        mglsl::AsyncContext pool_ctx{pool, io};
+        mglsl::AsyncContext inline_ctx{inline_executor, io};
+
+        mglsl::ModuleSet sync_set;
+        mglsl::Shader expected;
+        CHECK_OK(sync_set.import_files(list, test_dir()));
+        CHECK_OK(sync_set.assemble(expected, "main"));
+
+        // every file is loaded at once, the shader is the same as one imported in order
+        for(mglsl::AsyncContext ctx : {pool_ctx, inline_ctx}) {
+            for(int round = 0; round < 8; ++round) {
+                mglsl::ModuleSet set;
+                mglsl::Shader shader;
+                CHECK_OK(mglsl::sync_wait(import_and_assemble(ctx, set, list, shader)));
+                CHECK(set.size() == MODULE_COUNT + 1);
+                CHECK(shader.view() == expected.view());
+            }
+        }
+
+        // nothing is added unless every file was loaded
+        mglsl::ModuleSet set;
+        CHECK_EC(mglsl::sync_wait(mglsl::import_files_async(pool_ctx, set, "m0.glsl,missing.glsl", test_dir())),
+                 MGLSL_E_FILE_NOT_FOUND);
+        CHECK(set.size() == 0);
+
+        mglsl_Module module;
+        CHECK_OK(mglsl::sync_wait(mglsl::load_module(pool_ctx, &module, test_path("m1.glsl"))));
+        CHECK(!std::strcmp(mglsl_str(module.name), "m1"));
+        mglsl_free_module(&module);
+
+        mglsl_ModuleHandle handle;
+        CHECK_OK(mglsl::sync_wait(mglsl::add_file_async(pool_ctx, set, test_path("m2.glsl"), &handle)));
+        CHECK(set.size() == 1 && set.get(handle) != nullptr);
+        CHECK_EC(mglsl::sync_wait(mglsl::add_file_async(pool_ctx, set, test_path("m2.glsl"))),
+                 MGLSL_E_MODULE_EXISTS);
+    }
+
+    return test_done("async");
+}
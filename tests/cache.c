@@ -0,0 +1,85 @@
+// Shader cache, MGLSL_CACHE.
+//
+// # gcc -std=c99 cache.c -o cache && ./cache
+
+#define _POSIX_C_SOURCE 200809L
+#define MGLSL_DEBUG
+#define MGLSL_CACHE
+#include "../mglsl.h"
+#include "test.h"
+
+static void import(mglsl_ModuleArr * arr) {
+    CHECK_OK(mglsl_import_module_file_list_from_string(arr, "common.glsl,main.glsl", test_dir()));
+}
+
+static void free_arr(mglsl_ModuleArr arr) {
+    for(size_t i=0; i<arr.size; i++) mglsl_free_module(arr.data + i);
+    mglsl_free_imported_module_arr(arr);
+}
+
+int main(void) {
+    test_write("common.glsl", "#module common\nfloat helper() { return 1.0; }\n");
+    test_write("main.glsl", "#module main\n#require common\nvoid main() { helper(); }\n");
+
+    // entries are <hash>.mglslc files in cache directory
+    CHECK(mkdir(test_path("cache"), 0755) == 0);
+    char cache_dir[128];
+    strcpy(cache_dir, test_path("cache"));
+
+    mglsl_AssembleOptions options;
+    memset(&options, 0, sizeof(options));
+    options.flags = MGLSL_ASSEMBLE_LINE_DIRECTIVES;
+
+    mglsl_CachedShader cached;
+    CHECK_EC(mglsl_cache_load(&cached, cache_dir, "main", &options), MGLSL_E_CACHE_MISS);
+
+    mglsl_ModuleArr arr;
+    import(&arr);
+
+    char * reference = NULL;
+    CHECK_OK(mglsl_assemble_shader_ex(&reference, "main", arr, &options));
+
+    // miss assembles and stores
+    CHECK_OK(mglsl_assemble_shader_cached(&cached, cache_dir, "main", arr, &options));
+    CHECK(cached._map == NULL && reference && cached.size == strlen(reference));
+    CHECK(cached.data && reference && !strcmp(cached.data, reference));
+    mglsl_free_cached_shader(&cached);
+
+    // then it hits, mapped
+    CHECK_OK(mglsl_assemble_shader_cached(&cached, cache_dir, "main", arr, &options));
+    CHECK(cached._map != NULL && cached.data && reference && !strcmp(cached.data, reference));
+    mglsl_free_cached_shader(&cached);
+
+    // load does not need modules
+    CHECK_OK(mglsl_cache_load(&cached, cache_dir, "main", &options));
+    CHECK(cached.data && reference && !strcmp(cached.data, reference));
+    mglsl_free_cached_shader(&cached);
+
+    // other options are another entry
+    CHECK_EC(mglsl_cache_load(&cached, cache_dir, "main", NULL), MGLSL_E_CACHE_MISS);
+
+    // changed module file misses, both for load and for changed modules
+    free_arr(arr);
+    test_write("common.glsl", "#module common\nfloat helper() { return 2.0; }\n");
+    test_touch("common.glsl", 2);
+    CHECK_EC(mglsl_cache_load(&cached, cache_dir, "main", &options), MGLSL_E_CACHE_MISS);
+
+    import(&arr);
+    CHECK_OK(mglsl_assemble_shader_cached(&cached, cache_dir, "main", arr, &options));
+    CHECK(cached._map == NULL && test_contains(cached.data, "return 2.0;"));
+    mglsl_free_cached_shader(&cached);
+
+    CHECK_OK(mglsl_assemble_shader_cached(&cached, cache_dir, "main", arr, &options));
+    CHECK(cached._map != NULL && test_contains(cached.data, "return 2.0;"));
+    mglsl_free_cached_shader(&cached);
+
+    if(reference) mglsl_free_shader(reference);
+    free_arr(arr);
+
+    // entries are not tracked by name
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", cache_dir);
+    CHECK(system(cmd) == 0);
+
+    return test_done("cache");
+}
@@ -0,0 +1,74 @@
+// Dead code elimination, MGLSL_ASSEMBLE_STRIP_UNUSED.
+//
+// # gcc -std=c99 dce.c -o dce && ./dce
+
+#define _POSIX_C_SOURCE 200809L
+#define MGLSL_DEBUG
+#include "../mglsl.h"
+#include "test.h"
+
+static const char * common_src =
+    "#module common\n"
+    "struct Light { vec3 dir; };\n"
+    "struct Unused { float x; };\n"
+    "float helper(float x) { return x * 2.0; }\n"
+    "float shade(Light l) { return helper(l.dir.x); }\n"
+    "float never_called() { return 0.0; }\n"
+    "const float UNUSED_CONST = 3.0;\n";
+
+static const char * main_src =
+    "#module main\n"
+    "#require common\n"
+    "#version 330\n"
+    "uniform Light u_light;\n"
+    "out vec4 color;\n"
+    "#define SCALE 2.0\n"
+    "void main() { color = vec4(shade(u_light) * SCALE); }\n";
+
+int main(void) {
+    mglsl_Module modules[2];
+    CHECK_OK(mglsl_create_module_from_source(modules + 0, common_src));
+    CHECK_OK(mglsl_create_module_from_source(modules + 1, main_src));
+    mglsl_ModuleArr arr = { modules, 2 };
+
+    mglsl_AssembleOptions options;
+    memset(&options, 0, sizeof(options));
+    options.flags = MGLSL_ASSEMBLE_STRIP_UNUSED;
+
+    char * shader = NULL;
+    CHECK_OK(mglsl_assemble_shader_ex(&shader, "main", arr, &options));
+
+    // reachable from main and interface declarations
+    CHECK(test_contains(shader, "void main()"));
+    CHECK(test_contains(shader, "float shade(Light l)"));
+    CHECK(test_contains(shader, "float helper(float x)"));
+    CHECK(test_contains(shader, "struct Light"));
+    CHECK(test_contains(shader, "uniform Light u_light;"));
+    CHECK(test_contains(shader, "out vec4 color;"));
+    CHECK(test_contains(shader, "#define SCALE 2.0"));
+    CHECK(test_contains(shader, "#version 330"));
+
+    // not reachable
+    CHECK(!test_contains(shader, "never_called"));
+    CHECK(!test_contains(shader, "struct Unused"));
+    CHECK(!test_contains(shader, "UNUSED_CONST"));
+    if(shader) mglsl_free_shader(shader);
+
+    // without the flag everything stays
+    CHECK_OK(mglsl_assemble_shader_ex(&shader, "main", arr, NULL));
+    CHECK(test_contains(shader, "never_called"));
+    if(shader) mglsl_free_shader(shader);
+
+    // shader it cannot make sense of is left untouched
+    mglsl_Module odd;
+    CHECK_OK(mglsl_create_module_from_source(&odd, "#module odd\nvoid main() { if(true) {\n"));
+    mglsl_ModuleArr odd_arr = { &odd, 1 };
+    CHECK_OK(mglsl_assemble_shader_ex(&shader, "odd", odd_arr, &options));
+    CHECK(test_contains(shader, "void main() { if(true) {"));
+    if(shader) mglsl_free_shader(shader);
+    mglsl_free_module(&odd);
+
+    mglsl_free_module(modules + 0);
+    mglsl_free_module(modules + 1);
+    return test_done("dce");
+}
@@ -0,0 +1,55 @@
+// Module graph kept between assemblies of the same array.
+//
+// # gcc -std=c99 graph.c -o graph && ./graph
+
+#define _POSIX_C_SOURCE 200809L
+#define MGLSL_DEBUG
+#include "../mglsl.h"
+#include "test.h"
+
+// Whether first appears before second in shader.
+static int before(const char * shader, const char * first, const char * second) {
+    const char * a = shader ? strstr(shader, first) : NULL;
+    const char * b = shader ? strstr(shader, second) : NULL;
+    return a && b && a < b;
+}
+
+int main(void) {
+    mglsl_Module modules[3];
+    CHECK_OK(mglsl_create_module_from_source(modules, "#module a\n#require b\nfloat a_term() { return 1.0; }\n"));
+    CHECK_OK(mglsl_create_module_from_source(modules + 1, "#module b\nfloat b_term() { return 1.0; }\n"));
+    CHECK_OK(mglsl_create_module_from_source(modules + 2, "#module c\n#require a\nvoid main() {}\n"));
+    mglsl_ModuleArr arr = { modules, 3 };
+
+    char * shader = NULL;
+    CHECK_OK(mglsl_assemble_shader(&shader, "c", arr));
+    CHECK(before(shader, "b_term", "a_term") && before(shader, "a_term", "main"));
+    if(shader) mglsl_free_shader(shader);
+
+    // swapped by hand, without creating or freeing any module
+    mglsl_Module tmp = modules[0];
+    modules[0] = modules[1];
+    modules[1] = tmp;
+
+    CHECK_OK(mglsl_assemble_shader(&shader, "c", arr));
+    CHECK(before(shader, "b_term", "a_term") && before(shader, "a_term", "main"));
+    if(shader) mglsl_free_shader(shader);
+
+    // refilled with another module of the same array
+    mglsl_Module other;
+    CHECK_OK(mglsl_create_module_from_source(&other, "#module c\nvoid main() {}\n"));
+    CHECK_OK(mglsl_assemble_shader(&shader, "c", arr));
+    if(shader) mglsl_free_shader(shader);
+
+    tmp = modules[2];
+    modules[2] = other;
+    other = tmp;
+
+    CHECK_OK(mglsl_assemble_shader(&shader, "c", arr));
+    CHECK(shader && !test_contains(shader, "a_term") && !test_contains(shader, "b_term"));
+    if(shader) mglsl_free_shader(shader);
+
+    mglsl_free_module(&other);
+    for(size_t i=0; i<3; i++) mglsl_free_module(modules + i);
+    return test_done("graph");
+}
@@ -0,0 +1,81 @@
+// Line maps and '#line' directives.
+//
+// # gcc -std=c99 line_map.c -o line_map && ./line_map
+
+#define _POSIX_C_SOURCE 200809L
+#define MGLSL_DEBUG
+#include "../mglsl.h"
+#include "test.h"
+
+// Returns line of assembled shader that contains str, 0 if there is none.
+static size_t line_of(const char * shader, const char * str) {
+    const char * found = shader ? strstr(shader, str) : NULL;
+    if(!found) return 0;
+
+    size_t line = 1;
+    for(const char * cur = shader; cur < found; cur++) line += *cur == '\n';
+    return line;
+}
+
+int main(void) {
+    test_write("common.glsl",
+        "#module common\n"
+        "\n"
+        "float helper() {\n"       // 3
+        "    return 1.0;\n"
+        "}\n");
+    test_write("main.glsl",
+        "#version 330\n"           // 1
+        "#require common\n"
+        "// comment\n"
+        "void main() {\n"          // 4
+        "    float x = helper();\n" // 5
+        "}\n");
+
+    mglsl_ModuleArr arr;
+    CHECK_OK(mglsl_import_module_file_list_from_string(&arr, "common.glsl,main.glsl", test_dir()));
+
+    mglsl_LineMap line_map;
+    mglsl_AssembleOptions options;
+    memset(&options, 0, sizeof(options));
+    options.line_map = &line_map;
+
+    char * shader = NULL;
+    CHECK_OK(mglsl_assemble_shader_ex(&shader, "main", arr, &options));
+
+    // module name is inferred from file name, path is the one it was imported from
+    mglsl_SourceLoc loc;
+    CHECK_OK(mglsl_line_map_lookup(&loc, &line_map, arr, line_of(shader, "float x")));
+    CHECK(loc.line == 5);
+    CHECK(loc.name && !strcmp(loc.name, "main"));
+    CHECK(loc.path && test_contains(loc.path, "main.glsl"));
+
+    CHECK_OK(mglsl_line_map_lookup(&loc, &line_map, arr, line_of(shader, "float helper")));
+    CHECK(loc.line == 3);
+    CHECK(loc.name && !strcmp(loc.name, "common"));
+
+    // lines past the stripped '#require' still line up
+    CHECK_OK(mglsl_line_map_lookup(&loc, &line_map, arr, line_of(shader, "void main")));
+    CHECK(loc.line == 4);
+
+    // header comments are generated, not mapped
+    CHECK_EC(mglsl_line_map_lookup(&loc, &line_map, arr, line_of(shader, "// ==== main")),
+             MGLSL_E_LINE_NOT_MAPPED);
+    CHECK_EC(mglsl_line_map_lookup(&loc, &line_map, arr, 100000), MGLSL_E_LINE_NOT_MAPPED);
+
+    if(shader) mglsl_free_shader(shader);
+    mglsl_free_line_map(&line_map);
+
+    // '#line <line> <module index>' wherever output stops following one module file,
+    // '#version' stays first
+    options.line_map = NULL;
+    options.flags = MGLSL_ASSEMBLE_LINE_DIRECTIVES;
+    CHECK_OK(mglsl_assemble_shader_ex(&shader, "main", arr, &options));
+    CHECK(test_contains(shader, "#line 2 0\n"));
+    CHECK(test_contains(shader, "#version 330\n#line 3 1\n"));
+    if(shader) mglsl_free_shader(shader);
+
+    for(size_t i=0; i<arr.size; i++) mglsl_free_module(arr.data + i);
+    mglsl_free_imported_module_arr(arr);
+    return test_done("line_map");
+}
@@ -0,0 +1,87 @@
+// Compressed module sources, MGLSL_COMPRESS_SOURCES.
+//
+// # gcc -std=c99 lz4.c -o lz4 && ./lz4
+
+#define _POSIX_C_SOURCE 200809L
+#define MGLSL_DEBUG
+#define MGLSL_NO_MODULE_HEADER_COMMENT
+#define MGLSL_COMPRESS_SOURCES
+#include "../mglsl.h"
+#include "test.h"
+
+#define FUNCTION_COUNT 200
+
+typedef struct {
+    char * data;
+    size_t len;
+} Stream;
+
+static int write_stream(const char * data, size_t len, void * user) {
+    Stream * stream = (Stream*)user;
+    char * grown = (char*)realloc(stream->data, stream->len + len + 1);
+    if(!grown) return MGLSL_E_ALLOC;
+    memcpy(grown + stream->len, data, len);
+    stream->data = grown;
+    stream->len += len;
+    stream->data[stream->len] = '\0';
+    return MGLSL_E_SUCCESS;
+}
+
+int main(void) {
+    // shader sources repeat themselves a lot, generated one even more so
+    static char body[FUNCTION_COUNT * 64];
+    size_t body_len = 0;
+    for(int i=0; i<FUNCTION_COUNT; i++)
+        body_len += sprintf(body + body_len, "float term_%03d(float x) { return x * 0.5; }\n", i);
+
+    static char src[sizeof(body) + 64];
+    sprintf(src, "#module big\n%s", body);
+
+    mglsl_Module modules[2];
+    CHECK_OK(mglsl_create_module_from_source(modules + 0, src));
+    CHECK_OK(mglsl_create_module_from_source(modules + 1, "#module small\n#require big\nvoid main() {}\n"));
+    mglsl_ModuleArr arr = { modules, 2 };
+
+    CHECK(modules[0]._packed_len != 0 && modules[0]._packed_len < body_len / 4);
+    // stays as it is unless it gets smaller
+    CHECK(modules[1]._packed_len == 0);
+
+    // decompressed straight into shader
+    char * shader = NULL;
+    CHECK_OK(mglsl_assemble_shader(&shader, "small", arr));
+    CHECK(test_contains(shader, body));
+    CHECK(test_contains(shader, "void main() {}"));
+
+    // and through copy on the way, which streaming and '#line' directives take
+    Stream stream = { NULL, 0 };
+    CHECK_OK(mglsl_assemble_shader_stream(write_stream, &stream, "small", arr, NULL));
+    CHECK(stream.data && shader && !strcmp(stream.data, shader));
+    free(stream.data);
+    if(shader) mglsl_free_shader(shader);
+
+    mglsl_AssembleOptions options;
+    memset(&options, 0, sizeof(options));
+    options.flags = MGLSL_ASSEMBLE_LINE_DIRECTIVES;
+    CHECK_OK(mglsl_assemble_shader_ex(&shader, "small", arr, &options));
+    CHECK(test_contains(shader, body));
+    if(shader) mglsl_free_shader(shader);
+
+    // lines of compressed module are mapped as well
+    mglsl_LineMap line_map;
+    options.flags = 0;
+    options.line_map = &line_map;
+    CHECK_OK(mglsl_assemble_shader_ex(&shader, "small", arr, &options));
+
+    mglsl_SourceLoc loc;
+    const char * last = shader ? strstr(shader, "term_199") : NULL;
+    size_t line = 1;
+    for(const char * cur = shader; last && cur < last; cur++) line += *cur == '\n';
+    CHECK_OK(mglsl_line_map_lookup(&loc, &line_map, arr, line));
+    CHECK(loc.module_idx == 0 && loc.line == FUNCTION_COUNT + 1);
+    if(shader) mglsl_free_shader(shader);
+    mglsl_free_line_map(&line_map);
+
+    mglsl_free_module(modules + 0);
+    mglsl_free_module(modules + 1);
+    return test_done("lz4");
+}
@@ -0,0 +1,97 @@
+// Minification, MGLSL_ASSEMBLE_MINIFY and MGLSL_ASSEMBLE_MINIFY_IDENTIFIERS.
+//
+// # gcc -std=c99 minify.c -o minify && ./minify
+
+#define _POSIX_C_SOURCE 200809L
+#define MGLSL_DEBUG
+#define MGLSL_NO_MODULE_HEADER_COMMENT
+#include "../mglsl.h"
+#include "test.h"
+
+static const char * src =
+    "#module main\n"
+    "#version 330\n"
+    "// comment\n"
+    "#define SCALE(v) ((v) * gain)\n"
+    "struct Light { vec3 dir; float power; };\n"
+    "uniform Light u_light;\n"
+    "out vec4 color;\n"
+    "\n"
+    "float shade(float gain, float intensity) {\n"
+    "    /* block\n"
+    "       comment */\n"
+    "    float result = intensity + 1.0;\n"
+    "    return SCALE(result);\n"
+    "}\n"
+    "\n"
+    "void main() {\n"
+    "    vec3 direction = normalize(u_light.dir);\n"
+    "    for(int index = 0; index < 4; index++) direction *= 0.5;\n"
+    "    color = vec4(direction * shade(1.0, u_light.power), 1.0);\n"
+    "}\n";
+
+static char * assemble(mglsl_ModuleArr arr, unsigned int flags) {
+    mglsl_AssembleOptions options;
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+
+    char * shader = NULL;
+    CHECK_OK(mglsl_assemble_shader_ex(&shader, "main", arr, &options));
+    return shader;
+}
+
+int main(void) {
+    mglsl_Module module;
+    CHECK_OK(mglsl_create_module_from_source(&module, src));
+    mglsl_ModuleArr arr = { &module, 1 };
+
+    char * plain = assemble(arr, 0);
+    char * minified = assemble(arr, MGLSL_ASSEMBLE_MINIFY);
+    char * renamed = assemble(arr, MGLSL_ASSEMBLE_MINIFY_IDENTIFIERS);
+
+    // comments and whitespace go, directives stay intact on their own lines
+    CHECK(minified && plain && strlen(minified) < strlen(plain));
+    CHECK(!test_contains(minified, "comment"));
+    CHECK(test_contains(minified, "#version 330\n"));
+    CHECK(test_contains(minified, "#define SCALE(v) ((v) * gain)\n"));
+    CHECK(test_contains(minified, "float shade(float gain,float intensity){"));
+    CHECK(test_contains(minified, "float result=intensity+1.0;"));
+
+    // locals and parameters get short names, unless a macro body refers to them
+    CHECK(renamed && minified && strlen(renamed) < strlen(minified));
+    CHECK(!test_contains(renamed, "intensity"));
+    CHECK(!test_contains(renamed, "result"));
+    CHECK(!test_contains(renamed, "direction"));
+    CHECK(!test_contains(renamed, "index"));
+    CHECK(test_contains(renamed, "float gain"));
+
+    // globals, struct members, types and builtins keep their names
+    CHECK(test_contains(renamed, "u_light.dir"));
+    CHECK(test_contains(renamed, "u_light.power"));
+    CHECK(test_contains(renamed, "struct Light{vec3 dir;float power;};"));
+    CHECK(test_contains(renamed, "normalize("));
+    CHECK(test_contains(renamed, "float shade("));
+    CHECK(test_contains(renamed, "void main(){vec3 _a=normalize"));
+
+    if(plain) mglsl_free_shader(plain);
+    if(minified) mglsl_free_shader(minified);
+    if(renamed) mglsl_free_shader(renamed);
+
+    // lines are kept when line map is asked for
+    mglsl_LineMap line_map;
+    mglsl_AssembleOptions options;
+    memset(&options, 0, sizeof(options));
+    options.flags = MGLSL_ASSEMBLE_MINIFY;
+    options.line_map = &line_map;
+
+    char * shader = NULL;
+    CHECK_OK(mglsl_assemble_shader_ex(&shader, "main", arr, &options));
+    mglsl_SourceLoc loc;
+    CHECK_OK(mglsl_line_map_lookup(&loc, &line_map, arr, 12));
+    CHECK(loc.line == 13);
+    if(shader) mglsl_free_shader(shader);
+    mglsl_free_line_map(&line_map);
+
+    mglsl_free_module(&module);
+    return test_done("minify");
+}
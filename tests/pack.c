@@ -0,0 +1,66 @@
+// Modules read out of tar archives, MGLSL_PACK_FILES.
+//
+// # gcc -std=c99 pack.c -o pack && ./pack
+
+#define _POSIX_C_SOURCE 200809L
+#define MGLSL_DEBUG
+#define MGLSL_NO_LOGGING // missing files are looked up on purpose
+#define MGLSL_PACK_FILES
+#include "../mglsl.h"
+#include "test.h"
+
+// Packs loose files of scratch directory into name.
+static void pack(const char * name) {
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "tar cf '%s' -C '%s' common.glsl main.glsl", test_path(name), test_dir());
+    if(system(cmd)) {
+        fprintf(stderr, "%s failed\n", cmd);
+        exit(1);
+    }
+    test_track(name);
+}
+
+int main(void) {
+    test_write("common.glsl", "#module common\nfloat helper() { return 1.0; }\n");
+    test_write("main.glsl", "#module main\n#require common\nvoid main() { helper(); }\n");
+    pack("shaders.tar");
+
+    // nothing is on disk under mount directory, pack owns it
+    char pack_path[128], mount_dir[128];
+    strcpy(pack_path, test_path("shaders.tar"));
+    strcpy(mount_dir, test_path("shaders"));
+    CHECK_OK(mglsl_mount_pack(pack_path, mount_dir));
+
+    mglsl_ModuleArr arr;
+    CHECK_OK(mglsl_import_module_file_list_from_string(&arr, "common.glsl,main.glsl", mount_dir));
+
+    char * shader = NULL;
+    CHECK_OK(mglsl_assemble_shader(&shader, "main", arr));
+    CHECK(test_contains(shader, "return 1.0;") && test_contains(shader, "void main()"));
+    if(shader) mglsl_free_shader(shader);
+
+    mglsl_ModuleArr missing;
+    CHECK(mglsl_import_module_file_list_from_string(&missing, "other.glsl", mount_dir) != MGLSL_E_SUCCESS);
+
+    // pack replaced by renaming over is remapped, its changed files get dirty
+    test_write("common.glsl", "#module common\nfloat helper() { return 2.0; }\n");
+    pack("shaders.new.tar");
+    CHECK(rename(test_path("shaders.new.tar"), pack_path) == 0);
+
+    CHECK_EC(mglsl_file_change_watch(arr), MGLSL_E_FILE_CHANGED);
+    CHECK(arr.data[0].flags & MGLSL_DIRTY);
+    CHECK(!(arr.data[1].flags & MGLSL_DIRTY));
+    CHECK_OK(mglsl_swap_dirty_modules(arr));
+    CHECK_OK(mglsl_file_change_watch(arr));
+
+    CHECK_OK(mglsl_assemble_shader(&shader, "main", arr));
+    CHECK(test_contains(shader, "return 2.0;"));
+    if(shader) mglsl_free_shader(shader);
+
+    for(size_t i=0; i<arr.size; i++) mglsl_free_module(arr.data + i);
+    mglsl_free_imported_module_arr(arr);
+
+    CHECK_OK(mglsl_unmount_pack(NULL));
+    CHECK(mglsl_import_module_file_list_from_string(&missing, "main.glsl", mount_dir) != MGLSL_E_SUCCESS);
+    return test_done("pack");
+}
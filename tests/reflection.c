@@ -0,0 +1,88 @@
+// Reflection of top-level declarations, MGLSL_REFLECTION.
+//
+// # gcc -std=c99 reflection.c -o reflection && ./reflection
+
+#define _POSIX_C_SOURCE 200809L
+#define MGLSL_DEBUG
+#define MGLSL_REFLECTION
+#include "../mglsl.h"
+#include "test.h"
+
+static const char * common_src =
+    "#module common\n"
+    "struct Light { vec3 dir; float power; };\n"
+    "layout(std140, binding = 2) uniform Frame { mat4 view; Light lights[4]; } frame;\n";
+
+static const char * main_src =
+    "#module main\n"
+    "#require common\n"
+    "layout(location = 1) in vec3 a_normal;\n"
+    "out vec4 color;\n"
+    "uniform sampler2D u_tex, u_shadow[3];\n"
+    "#ifdef USE_SSBO\n"
+    "layout(binding = 5, set = 1) buffer Data { float values[]; };\n"
+    "#endif\n"
+    "float helper() { return 1.0; }\n"
+    "void main() { color = vec4(a_normal, helper()); }\n";
+
+static const mglsl_ReflectDecl * find(mglsl_Reflection refl, const char * name) {
+    for(size_t i=0; i<refl.size; i++) {
+        const char * decl_name = mglsl_str(refl.data[i].name);
+        if(decl_name && !strcmp(decl_name, name)) return refl.data + i;
+    }
+    return NULL;
+}
+
+int main(void) {
+    mglsl_Module modules[2];
+    CHECK_OK(mglsl_create_module_from_source(modules + 0, common_src));
+    CHECK_OK(mglsl_create_module_from_source(modules + 1, main_src));
+    mglsl_ModuleArr arr = { modules, 2 };
+
+    mglsl_Reflection common = mglsl_module_reflection(modules + 0);
+    const mglsl_ReflectDecl * light = find(common, "Light");
+    CHECK(light && light->kind == MGLSL_REFLECT_STRUCT && light->members == 2);
+    CHECK(light && light[1].kind == MGLSL_REFLECT_MEMBER && !strcmp(mglsl_str(light[1].type), "vec3"));
+
+    const mglsl_ReflectDecl * frame = find(common, "frame");
+    CHECK(frame && frame->kind == MGLSL_REFLECT_UNIFORM && frame->is_block);
+    CHECK(frame && !strcmp(mglsl_str(frame->type), "Frame") && frame->binding == 2);
+    CHECK(frame && frame->members == 2 && frame[2].array_len == 4);
+
+    mglsl_Reflection main_refl = mglsl_module_reflection(modules + 1);
+    const mglsl_ReflectDecl * normal = find(main_refl, "a_normal");
+    CHECK(normal && normal->kind == MGLSL_REFLECT_IN && normal->location == 1);
+    CHECK(normal && normal->binding == MGLSL_REFLECT_NONE && normal->array_len == MGLSL_REFLECT_NONE);
+
+    const mglsl_ReflectDecl * color = find(main_refl, "color");
+    CHECK(color && color->kind == MGLSL_REFLECT_OUT);
+
+    // variables declared together get a record each
+    const mglsl_ReflectDecl * shadow = find(main_refl, "u_shadow");
+    CHECK(find(main_refl, "u_tex") != NULL);
+    CHECK(shadow && shadow->kind == MGLSL_REFLECT_UNIFORM && shadow->array_len == 3);
+
+    // both branches of '#if' are recorded, functions are not
+    const mglsl_ReflectDecl * data = find(main_refl, "values");
+    CHECK(data && data[-1].kind == MGLSL_REFLECT_BUFFER && data[-1].binding == 5 && data[-1].set == 1);
+    CHECK(data && data->array_len == 0);
+    CHECK(find(main_refl, "helper") == NULL);
+
+    // merged reflection of assembled shader knows which module each record comes from
+    mglsl_Reflection merged;
+    mglsl_AssembleOptions options;
+    memset(&options, 0, sizeof(options));
+    options.reflection = &merged;
+
+    char * shader = NULL;
+    CHECK_OK(mglsl_assemble_shader_ex(&shader, "main", arr, &options));
+    CHECK(merged.size == common.size + main_refl.size);
+    CHECK(find(merged, "frame") && find(merged, "frame")->module_idx == 0);
+    CHECK(find(merged, "color") && find(merged, "color")->module_idx == 1);
+    if(shader) mglsl_free_shader(shader);
+    mglsl_free_reflection(&merged);
+
+    mglsl_free_module(modules + 0);
+    mglsl_free_module(modules + 1);
+    return test_done("reflection");
+}
@@ -0,0 +1,96 @@
+// Hot reload spread over frames, mglsl_swap_dirty_modules_budgeted.
+//
+// # gcc -std=c99 reload.c -o reload && ./reload
+
+#define _POSIX_C_SOURCE 200809L
+#define MGLSL_DEBUG
+#include "../mglsl.h"
+#include "test.h"
+
+#define MODULE_COUNT 8
+
+static void write_module(int i, const char * value) {
+    char name[32], src[128];
+    snprintf(name, sizeof(name), "m%d.glsl", i);
+    snprintf(src, sizeof(src), "#module m%d\nfloat f%d() { return %s; }\n", i, i, value);
+    test_write(name, src);
+}
+
+static int count(const char * str, const char * sub) {
+    int n = 0;
+    for(const char * cur = str; cur && (cur = strstr(cur, sub)); cur++) n++;
+    return n;
+}
+
+static int count_in_shader(mglsl_ModuleArr arr, const char * sub) {
+    char * shader = NULL;
+    CHECK_OK(mglsl_assemble_shader(&shader, "main", arr));
+    int n = count(shader, sub);
+    if(shader) mglsl_free_shader(shader);
+    return n;
+}
+
+int main(void) {
+    char list[256] = "main.glsl";
+    for(int i=0; i<MODULE_COUNT; i++) {
+        write_module(i, "0.0");
+        sprintf(list + strlen(list), ",m%d.glsl", i);
+    }
+    test_write("main.glsl", "#module main\n#require m0, m1, m2, m3, m4, m5, m6, m7\nvoid main() {}\n");
+
+    mglsl_ModuleArr arr;
+    CHECK_OK(mglsl_import_module_file_list_from_string(&arr, list, test_dir()));
+    CHECK_OK(mglsl_file_change_watch(arr));
+    CHECK(count_in_shader(arr, "return 0.0;") == MODULE_COUNT);
+
+    // half of modules change, in the same second they were written
+    for(int i=0; i<MODULE_COUNT; i+=2) {
+        write_module(i, "1.0");
+        char name[32];
+        snprintf(name, sizeof(name), "m%d.glsl", i);
+        test_touch(name, 2);
+    }
+    CHECK_EC(mglsl_file_change_watch(arr), MGLSL_E_FILE_CHANGED);
+
+    // budget too small for anything still reads one module per call, the change set
+    // is swapped at once after the last one
+    mglsl_Reload reload;
+    memset(&reload, 0, sizeof(reload));
+
+    int calls = 0, ec;
+    while((ec = mglsl_swap_dirty_modules_budgeted(&reload, arr, 0)) == MGLSL_E_RELOAD_PENDING) {
+        CHECK(count_in_shader(arr, "return 1.0;") == 0);
+        if(++calls > MODULE_COUNT) break;
+    }
+    CHECK_OK(ec);
+    CHECK(calls == MODULE_COUNT / 2 - 1);
+    CHECK(count_in_shader(arr, "return 1.0;") == MODULE_COUNT / 2);
+    CHECK_OK(mglsl_file_change_watch(arr));
+
+    // with budget to spare it is done in one call
+    write_module(1, "2.0");
+    test_touch("m1.glsl", 4);
+    CHECK_EC(mglsl_file_change_watch(arr), MGLSL_E_FILE_CHANGED);
+    CHECK_OK(mglsl_swap_dirty_modules_budgeted(&reload, arr, 1000000));
+    CHECK(count_in_shader(arr, "return 2.0;") == 1);
+
+    // reload freed halfway drops what it read, modules still dirty are picked up again
+    for(int i=0; i<MODULE_COUNT; i+=2) {
+        char name[32];
+        snprintf(name, sizeof(name), "m%d.glsl", i);
+        write_module(i, "3.0");
+        test_touch(name, 6);
+    }
+    CHECK_EC(mglsl_file_change_watch(arr), MGLSL_E_FILE_CHANGED);
+    CHECK_EC(mglsl_swap_dirty_modules_budgeted(&reload, arr, 0), MGLSL_E_RELOAD_PENDING);
+    CHECK_OK(mglsl_free_reload(&reload));
+    CHECK(count_in_shader(arr, "return 3.0;") == 0);
+
+    CHECK_OK(mglsl_swap_dirty_modules(arr));
+    CHECK(count_in_shader(arr, "return 3.0;") == MODULE_COUNT / 2);
+
+    CHECK_OK(mglsl_free_reload(&reload));
+    for(size_t i=0; i<arr.size; i++) mglsl_free_module(arr.data + i);
+    mglsl_free_imported_module_arr(arr);
+    return test_done("reload");
+}
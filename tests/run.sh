@@ -0,0 +1,39 @@
+#!/bin/sh
+# Builds and runs every test, with warnings as errors. Exits with 1 if any of them failed.
+#
+# # sh run.sh
+#
+# CC and CXX pick compilers, CFLAGS and CXXFLAGS are added, e.g. for sanitizers:
+# # CFLAGS=-fsanitize=address,undefined CXXFLAGS=-fsanitize=address,undefined sh run.sh
+
+cd "$(dirname "$0")" || exit 1
+
+CC=${CC:-gcc}
+CXX=${CXX:-g++}
+WARN="-Wall -Wextra -Werror"
+OUT=$(mktemp -d) || exit 1
+trap 'rm -rf "$OUT"' EXIT
+
+failed=0
+
+run() {
+    name=$1
+    shift
+    if ! "$@" -o "$OUT/$name"; then
+        echo "$name: build FAILED"
+        failed=1
+    elif ! "$OUT/$name"; then
+        failed=1
+    fi
+}
+
+for test in line_map dce minify variants graph reflection cache lz4 pack reload; do
+    run $test $CC -std=c99 $WARN $CFLAGS $test.c
+done
+run shm $CC -std=c99 $WARN $CFLAGS shm.c -lrt
+
+run wrapper17 $CXX -std=c++17 $WARN $CXXFLAGS wrapper.cpp
+run wrapper20 $CXX -std=c++20 $WARN $CXXFLAGS wrapper.cpp
+run async $CXX -std=c++20 $WARN $CXXFLAGS async.cpp -pthread
+
+exit $failed
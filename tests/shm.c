@@ -0,0 +1,81 @@
+// Modules shared between processes, MGLSL_SHARED_MODULES.
+//
+// # gcc -std=c99 shm.c -o shm -lrt && ./shm
+
+#define _POSIX_C_SOURCE 200809L
+#define MGLSL_DEBUG
+#define MGLSL_SHARED_MODULES
+#include "../mglsl.h"
+#include "test.h"
+
+#include <sys/wait.h>
+
+// Assembles out of modules attached in another process, returns its exit status.
+static int assemble_in_child(const char * shm_name, const char * expected) {
+    pid_t pid = fork();
+    if(pid < 0) return -1;
+    if(pid == 0) {
+        mglsl_SharedModules shared;
+        char * shader = NULL;
+        int ok = !mglsl_attach_shared_modules(&shared, shm_name) &&
+                 !mglsl_assemble_shader(&shader, "main", shared.modules) &&
+                 !strcmp(shader, expected);
+        if(shader) mglsl_free_shader(shader);
+        mglsl_detach_shared_modules(&shared);
+        _exit(ok ? 0 : 1);
+    }
+
+    int status;
+    if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+int main(void) {
+    char shm_name[64];
+    snprintf(shm_name, sizeof(shm_name), "/mglsl_test_%ld", (long)getpid());
+
+    mglsl_Module modules[2];
+    CHECK_OK(mglsl_create_module_from_source(modules + 0, "#module common\nfloat helper() { return 1.0; }\n"));
+    CHECK_OK(mglsl_create_module_from_source(modules + 1, "#module main\n#require common\nvoid main() { helper(); }\n"));
+    mglsl_ModuleArr arr = { modules, 2 };
+
+    char * expected = NULL;
+    CHECK_OK(mglsl_assemble_shader(&expected, "main", arr));
+
+    mglsl_SharedModules shared;
+    CHECK_EC(mglsl_attach_shared_modules(&shared, shm_name), MGLSL_E_SHM_NOT_READY);
+
+    // first one publishes, the rest attach
+    CHECK_OK(mglsl_publish_shared_modules(shm_name, arr));
+    CHECK_EC(mglsl_publish_shared_modules(shm_name, arr), MGLSL_E_SHM_EXISTS);
+
+    CHECK_OK(mglsl_attach_shared_modules(&shared, shm_name));
+    CHECK(shared.modules.size == 2);
+    char * shader = NULL;
+    CHECK_OK(mglsl_assemble_shader(&shader, "main", shared.modules));
+    CHECK(shader && expected && !strcmp(shader, expected));
+    if(shader) mglsl_free_shader(shader);
+    CHECK_OK(mglsl_detach_shared_modules(&shared));
+
+    CHECK(expected && assemble_in_child(shm_name, expected) == 0);
+
+    // object left behind by publisher that died before it was ready is taken over
+    CHECK_OK(mglsl_unlink_shared_modules(shm_name));
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    char junk[256];
+    memset(junk, 0, sizeof(junk));
+    CHECK(fd >= 0 && write(fd, junk, sizeof(junk)) == (ssize_t)sizeof(junk));
+    if(fd >= 0) close(fd);
+
+    CHECK_EC(mglsl_attach_shared_modules(&shared, shm_name), MGLSL_E_SHM_NOT_READY);
+    CHECK_OK(mglsl_publish_shared_modules(shm_name, arr));
+    CHECK(expected && assemble_in_child(shm_name, expected) == 0);
+
+    CHECK_OK(mglsl_unlink_shared_modules(shm_name));
+    CHECK_OK(mglsl_unlink_shared_modules(shm_name));
+
+    if(expected) mglsl_free_shader(expected);
+    mglsl_free_module(modules + 0);
+    mglsl_free_module(modules + 1);
+    return test_done("shm");
+}
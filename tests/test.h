@@ -0,0 +1,105 @@
+// Shared by the test programs, included right after mglsl.h. Each test is a standalone
+// program, one per feature, which exits with 0 if all of its checks passed. Failed checks
+// are printed and the test goes on, so one run reports all of them.
+//
+// To run all of them:
+// # sh run.sh
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>     // AT_FDCWD
+#include <sys/stat.h>  // utimensat
+
+static int test_failed = 0;
+
+#define CHECK(COND) \
+    ((COND) ? (void)0 : (void)(test_failed = 1, \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND)))
+
+// Checks that call returns given mglsl_ErrorCode.
+#define CHECK_EC(CALL, EC) do { \
+        int check_ec_ = (CALL); \
+        if(check_ec_ != (EC)) { \
+            test_failed = 1; \
+            fprintf(stderr, "%s:%d: %s returned %d (%s), expected %d\n", \
+                    __FILE__, __LINE__, #CALL, check_ec_, mglsl_err_desc(check_ec_), (EC)); \
+        } \
+    } while(0)
+
+#define CHECK_OK(CALL) CHECK_EC(CALL, MGLSL_E_SUCCESS)
+
+static inline int test_contains(const char * str, const char * sub) {
+    return str && strstr(str, sub) != NULL;
+}
+
+// Scratch directory of the test, files written to it are removed by test_done.
+static char test_dir_buf[64];
+static char test_files[32][128];
+static int test_files_len = 0;
+
+static inline const char * test_dir(void) {
+    if(!test_dir_buf[0]) {
+        strcpy(test_dir_buf, "/tmp/mglsl_test_XXXXXX");
+        if(!mkdtemp(test_dir_buf)) {
+            perror("mkdtemp");
+            exit(1);
+        }
+    }
+    return test_dir_buf;
+}
+
+// Path of name inside of the scratch directory, in a static buffer.
+static inline const char * test_path(const char * name) {
+    static char path[128];
+    snprintf(path, sizeof(path), "%s/%s", test_dir(), name);
+    return path;
+}
+
+static inline void test_write(const char * name, const char * src) {
+    const char * path = test_path(name);
+    FILE * file = fopen(path, "w");
+    if(!file || fputs(src, file) < 0 || fclose(file)) {
+        perror(path);
+        exit(1);
+    }
+
+    for(int i=0; i<test_files_len; i++)
+        if(!strcmp(test_files[i], path)) return;
+    if(test_files_len < 32) strcpy(test_files[test_files_len++], path);
+}
+
+// Registers file written some other way, so that it is removed too.
+static inline void test_track(const char * name) {
+    if(test_files_len < 32) strcpy(test_files[test_files_len++], test_path(name));
+}
+
+// Moves mtime of written file forward, so that file change watch sees it changed
+// even within the same second.
+static inline void test_touch(const char * name, int seconds) {
+    struct stat st;
+    const char * path = test_path(name);
+    if(stat(path, &st)) return;
+
+    struct timespec times[2];
+    times[0].tv_sec = times[1].tv_sec = st.st_mtime + seconds;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    utimensat(AT_FDCWD, path, times, 0);
+}
+
+static inline int test_done(const char * name) {
+    for(int i=0; i<test_files_len; i++) unlink(test_files[i]);
+    if(test_dir_buf[0]) rmdir(test_dir_buf);
+
+    mglsl_clear_diags();
+#ifdef _MGLSL_STATS
+    // everything the test allocated through mglsl is freed
+    mglsl_Stats stats;
+    mglsl_get_stats(&stats);
+    CHECK(stats.live_bytes == 0);
+#endif
+
+    printf("%s: %s\n", name, test_failed ? "FAILED" : "ok");
+    return test_failed;
+}
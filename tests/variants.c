@@ -0,0 +1,93 @@
+// Shader variants, conditional requirements and stages.
+//
+// # gcc -std=c99 variants.c -o variants && ./variants
+
+#define _POSIX_C_SOURCE 200809L
+#define MGLSL_DEBUG
+#include "../mglsl.h"
+#include "test.h"
+
+static const char * main_src =
+    "#module main\n"
+    "#version 330\n"
+    "#ifdef USE_SHADOWS\n"
+    "#require shadows\n"
+    "#endif\n"
+    "#if QUALITY > 1\n"
+    "#require fancy\n"
+    "#endif\n"
+    "#define LOCAL_FEATURE\n"
+    "#ifdef LOCAL_FEATURE\n"
+    "#require local\n"
+    "#endif\n"
+    "void main() {}\n";
+
+static const char * sources[] = {
+    "#module shadows\nfloat shadow_term() { return 1.0; }\n",
+    "#module fancy\nfloat fancy_term() { return 1.0; }\n",
+    "#module local\nfloat local_term() { return 1.0; }\n",
+    "#module stages\n#type vert, frag\n#require vert_only, frag_only\nvoid main() {}\n",
+    "#module vert_only\n#type vert\nfloat vert_term() { return 1.0; }\n",
+    "#module frag_only\n#type frag\nfloat frag_term() { return 1.0; }\n",
+};
+
+#define MODULE_COUNT (1 + sizeof(sources)/sizeof(sources[0]))
+
+int main(void) {
+    mglsl_Module modules[MODULE_COUNT];
+    CHECK_OK(mglsl_create_module_from_source(modules, main_src));
+    for(size_t i=1; i<MODULE_COUNT; i++)
+        CHECK_OK(mglsl_create_module_from_source(modules + i, sources[i - 1]));
+    mglsl_ModuleArr arr = { modules, MODULE_COUNT };
+
+    mglsl_Define shadows[] = { {"USE_SHADOWS", NULL}, {"QUALITY", "1"} };
+    mglsl_Define fancy[] = { {"QUALITY", "2"} };
+    mglsl_DefineArr variants[] = { {shadows, 2}, {fancy, 1}, {NULL, 0} };
+
+    char * shader = NULL;
+    CHECK_OK(mglsl_assemble_shader_variant(&shader, "main", arr, variants[0], NULL));
+    CHECK(test_contains(shader, "shadow_term"));
+    CHECK(!test_contains(shader, "fancy_term"));
+    // macros the module defines itself are always taken as met
+    CHECK(test_contains(shader, "local_term"));
+    // defines go to the top, as the shader does not start with '#version'
+    CHECK(shader && !strncmp(shader, "#define USE_SHADOWS\n#define QUALITY 1\n", 38));
+    if(shader) mglsl_free_shader(shader);
+
+    char * bufs[3] = { NULL, NULL, NULL };
+    CHECK_OK(mglsl_assemble_shader_variants(bufs, "main", arr, variants, 3, NULL));
+    CHECK(test_contains(bufs[0], "shadow_term") && !test_contains(bufs[0], "fancy_term"));
+    CHECK(!test_contains(bufs[1], "shadow_term") && test_contains(bufs[1], "fancy_term"));
+    CHECK(!test_contains(bufs[2], "shadow_term") && !test_contains(bufs[2], "fancy_term"));
+    CHECK(test_contains(bufs[2], "local_term"));
+    for(int i=0; i<3; i++) if(bufs[i]) mglsl_free_shader(bufs[i]);
+
+    // so are macros other modules of the shader define
+    mglsl_Module fog_modules[3];
+    CHECK_OK(mglsl_create_module_from_source(fog_modules, "#module config\n#define USE_FOG 1\n"));
+    CHECK_OK(mglsl_create_module_from_source(fog_modules + 1,
+        "#module main\n#require config\n#ifdef USE_FOG\n#require fog\n#endif\nvoid main() {}\n"));
+    CHECK_OK(mglsl_create_module_from_source(fog_modules + 2, "#module fog\nfloat fog_term() { return 1.0; }\n"));
+    mglsl_ModuleArr fog_arr = { fog_modules, 3 };
+    mglsl_DefineArr no_defines = { NULL, 0 };
+
+    CHECK_OK(mglsl_assemble_shader_variant(&shader, "main", fog_arr, no_defines, NULL));
+    CHECK(test_contains(shader, "fog_term"));
+    if(shader) mglsl_free_shader(shader);
+    for(size_t i=0; i<3; i++) mglsl_free_module(fog_modules + i);
+
+    // each stage gets only the modules it needs
+    char * stages[MGLSL_SHADER_TYPE_COUNT];
+    memset(stages, 0, sizeof(stages));
+    CHECK_OK(mglsl_assemble_program(stages, "stages", arr, MGLSL_STAGE(VERT) | MGLSL_STAGE(FRAG), NULL));
+    CHECK(test_contains(stages[VERT], "vert_term") && !test_contains(stages[VERT], "frag_term"));
+    CHECK(test_contains(stages[FRAG], "frag_term") && !test_contains(stages[FRAG], "vert_term"));
+    CHECK(stages[GEOM] == NULL);
+    for(int i=0; i<MGLSL_SHADER_TYPE_COUNT; i++) if(stages[i]) mglsl_free_shader(stages[i]);
+
+    CHECK(mglsl_module_type(modules + 5) == VERT);
+    CHECK(mglsl_module_type(modules + 4) == NONE);
+
+    for(size_t i=0; i<MODULE_COUNT; i++) mglsl_free_module(modules + i);
+    return test_done("variants");
+}
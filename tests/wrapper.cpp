@@ -0,0 +1,111 @@
+// C++ wrapper, mglsl.hpp. Builds as C++17 and C++20, which adds the compile-time assembly.
+//
+// # g++ -std=c++17 wrapper.cpp -o wrapper && ./wrapper
+
+#define MGLSL_DEBUG
+#define MGLSL_NO_LOGGING // errors are provoked on purpose
+#include "../mglsl.hpp"
+#include "test.h"
+
+#include <string>
+
+// Counts what the library allocates through it.
+struct CountingResource : std::pmr::memory_resource {
+    std::size_t live = 0;
+    std::size_t count = 0;
+
+    void * do_allocate(std::size_t size, std::size_t align) override {
+        live += size;
+        count++;
+        return std::pmr::new_delete_resource()->allocate(size, align);
+    }
+
+    void do_deallocate(void * ptr, std::size_t size, std::size_t align) override {
+        live -= size;
+        std::pmr::new_delete_resource()->deallocate(ptr, size, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override {
+        return this == &other;
+    }
+};
+
+#if __cplusplus >= 202002L && defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+inline constexpr mglsl::Literal common_lit = "#module common\nfloat helper() { return 1.0; }\n";
+inline constexpr mglsl::Literal main_lit = "#module main\n#require common\nvoid main() { helper(); }\n";
+constexpr auto & static_main = mglsl::static_shader<"main", common_lit, main_lit>;
+#endif
+
+int main() {
+    CountingResource resource;
+    mglsl::set_memory_resource(&resource);
+
+    {
+        mglsl::ModuleSet set;
+        mglsl_ModuleHandle main_handle, common_handle;
+
+        // sources are taken as string_view, they need not be null-terminated
+        std::string main_src = "#module main\n#require common\nvoid main() { helper(); }\n<garbage>";
+        CHECK_OK(set.add_source(std::string_view(main_src).substr(0, main_src.size() - 9), &main_handle));
+        CHECK_OK(set.add_source("#module common\nfloat helper() { return 1.0; }\n", &common_handle));
+        CHECK_EC(set.add_source("#module common\n"), MGLSL_E_MODULE_EXISTS);
+        CHECK(set.size() == 2);
+        CHECK(resource.count > 0);
+
+        mglsl::Shader shader;
+        CHECK_OK(set.assemble(shader, "main", 0, true));
+        CHECK(shader && shader.size() == std::strlen(shader.c_str()));
+        CHECK(test_contains(shader.c_str(), "return 1.0;"));
+        CHECK(!test_contains(shader.c_str(), "garbage"));
+        CHECK(shader.line_map().size > 0);
+
+#if __cplusplus >= 202002L && defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+        // same rules as the library, so the same shader
+        static_assert(static_main.size() > 0);
+        CHECK(static_main.view() == shader.view());
+#endif
+
+        // into caller memory, and in chunks
+        char buf[4096];
+        std::size_t written = 0;
+        CHECK_OK(set.assemble_into(buf, sizeof(buf), &written, "main"));
+        CHECK(std::string_view(buf, written) == shader.view());
+        CHECK_EC(set.assemble_into(buf, 8, &written, "main"), MGLSL_E_BUF_TOO_SMALL);
+#ifdef __cpp_lib_span
+        CHECK_OK(set.assemble_into(std::span<char>(buf), &written, "main"));
+#endif
+
+        std::string streamed;
+        CHECK_OK(set.assemble_stream([&](std::string_view chunk) { streamed += chunk; return true; }, "main"));
+        CHECK(streamed == shader.view());
+        CHECK(set.assemble_stream([](std::string_view) { return false; }, "main") != MGLSL_E_SUCCESS);
+
+        // handles survive replacements and removals of other modules
+        CHECK_OK(set.replace_source(common_handle, "#module common\nfloat helper() { return 2.0; }\n"));
+        CHECK_OK(set.assemble(shader, "main"));
+        CHECK(test_contains(shader.c_str(), "return 2.0;"));
+
+        CHECK_OK(set.remove("main"));
+        CHECK(set.get(main_handle) == nullptr);
+        CHECK(set.get(common_handle) != nullptr);
+        CHECK_EC(set.remove("main"), MGLSL_E_MODULE_NOT_FOUND);
+
+        // ownership moves along
+        mglsl::ModuleSet moved = std::move(set);
+        mglsl::Shader moved_shader = std::move(shader);
+        CHECK(set.size() == 0 && moved.size() == 1);
+        CHECK(!shader && moved_shader);
+        CHECK_OK(moved.assemble(moved_shader, "common"));
+
+        test_write("lit.glsl", "#module lit\n#require common\nvoid main() {}\n");
+        CHECK_OK(moved.import_files("lit.glsl", test_dir()));
+        CHECK_EC(moved.import_files("lit.glsl", test_dir()), MGLSL_E_MODULE_EXISTS);
+        CHECK(moved.size() == 2);
+        CHECK_OK(moved.assemble(moved_shader, "lit"));
+    }
+
+    // diagnostics keep names of what failed
+    mglsl_clear_diags();
+    CHECK(resource.live == 0);
+    return test_done(__cplusplus >= 202002L ? "wrapper (C++20)" : "wrapper (C++17)");
+}
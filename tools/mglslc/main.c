@@ -0,0 +1,411 @@
+// Offline shader assembler.
+//
+// Imports a module list once and assembles every root of a manifest, across all cores.
+// Outputs, and their depfiles, are only written when their contents change, so build
+// systems can tell which shaders are up to date.
+//
+// To compile simply:
+// # gcc -O2 main.c -o mglslc
+//
+// Usage:
+//   mglslc -l LIST [options] MANIFEST
+//
+//   -l LIST     module file list, as for mglsl_import_module_file_list_from_file
+//   -I PATHS    colon-separated search paths of module files
+//   -j JOBS     number of worker processes                  (default number of cores)
+//   -d          write Make/Ninja depfile OUTPUT.d next to every output
+//   -L          emit #line directives
+//   -S          strip unused functions
+//   -m          minify
+//   -M          minify, renaming identifiers
+//   -v          print every output written or left as it was
+//
+// Every non-empty MANIFEST line, which is not a '#' comment, is a root module name
+// and the path of the shader assembled from it:
+//
+//   lit       build/lit.glsl
+//   shadow    build/shadow.glsl
+//
+// Depfile lists module files shader was assembled from, and LIST, as dependencies.
+// Every module a root could require is listed, also those required conditionally.
+// With Ninja, restat = 1 lets outputs left as they were stop the rebuild.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../../mglsl.h"
+
+typedef struct {
+    const char * list_path;
+    const char * search_paths;
+    long jobs;
+    int depfiles;
+    unsigned int flags;
+    int verbose;
+} Config;
+
+typedef struct {
+    const char * root;
+    const char * output;
+} Job;
+
+static Config cfg;
+static mglsl_ModuleArr modules;
+static size_t * by_name; // module indices sorted by name id
+
+static char * read_file(const char * path) {
+    FILE * file = fopen(path, "rb");
+    if(!file) return NULL;
+
+    fseek(file, 0L, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    char * buf = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if(buf && fread(buf, 1, (size_t)size, file) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    if(buf) buf[size] = '\0';
+
+    fclose(file);
+    return buf;
+}
+
+// Splits manifest in place, jobs point into it.
+static Job * parse_manifest(char * src, size_t * count) {
+    size_t cap = 16;
+    Job * jobs = malloc(cap * sizeof(Job));
+    *count = 0;
+
+    for(char * line = src; jobs && line && *line;) {
+        char * next = strchr(line, '\n');
+        if(next) *(next++) = '\0';
+
+        char * words[3] = { NULL, NULL, NULL };
+        size_t word_count = 0;
+
+        for(char * cur = line; *cur && *cur != '#' && word_count < 3;) {
+            while(*cur == ' ' || *cur == '\t' || *cur == '\r') *(cur++) = '\0';
+            if(!*cur || *cur == '#') break;
+
+            words[word_count++] = cur;
+            while(*cur && *cur != ' ' && *cur != '\t' && *cur != '\r' && *cur != '#') cur++;
+            if(*cur == '#') *cur = '\0';
+        }
+
+        if(word_count == 1 || word_count == 3) {
+            fprintf(stderr, "mglslc: manifest line '%s' is not 'ROOT OUTPUT'\n", words[0]);
+            free(jobs);
+            return NULL;
+        }
+
+        if(word_count == 2) {
+            if(*count == cap) {
+                Job * grown = realloc(jobs, (cap *= 2) * sizeof(Job));
+                if(!grown) free(jobs);
+                jobs = grown;
+                if(!jobs) break;
+            }
+            jobs[*count].root = words[0];
+            jobs[*count].output = words[1];
+            (*count)++;
+        }
+        line = next;
+    }
+
+    return jobs;
+}
+
+//
+// DEPENDENCIES
+
+static int compare_name(const void * a, const void * b) {
+    mglsl_StrId x = modules.data[*(const size_t*)a].name;
+    mglsl_StrId y = modules.data[*(const size_t*)b].name;
+    return x < y ? -1 : x > y;
+}
+
+static long find_module(mglsl_StrId name) {
+    size_t lo = 0, hi = modules.size;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        mglsl_StrId id = modules.data[by_name[mid]].name;
+        if(id == name) return (long)by_name[mid];
+        if(id < name) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+// Writes indices of modules reachable from root into deps, returns their count.
+static size_t collect_deps(size_t * deps, unsigned char * seen, mglsl_StrId root) {
+    size_t count = 0, done = 0;
+    memset(seen, 0, modules.size);
+
+    long idx = find_module(root);
+    if(idx < 0) return 0;
+
+    seen[idx] = 1;
+    deps[count++] = (size_t)idx;
+
+    // deps doubles as queue
+    while(done < count) {
+        const mglsl_Module * module = modules.data + deps[done++];
+        for(size_t d=0; d<module->deps_len; d++) {
+            idx = find_module(module->deps[d]);
+            if(idx < 0 || seen[idx]) continue;
+            seen[idx] = 1;
+            deps[count++] = (size_t)idx;
+        }
+    }
+    return count;
+}
+
+//
+// OUTPUT
+
+typedef struct {
+    char * data;
+    size_t len, cap;
+} Buf;
+
+static int buf_put(Buf * buf, const char * str, size_t len) {
+    if(buf->len + len + 1 > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 256;
+        while(cap < buf->len + len + 1) cap *= 2;
+        char * grown = realloc(buf->data, cap);
+        if(!grown) return -1;
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, str, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+// Escapes path the way both Make and Ninja read it back.
+static int buf_put_path(Buf * buf, const char * path) {
+    int err = 0;
+    for(const char * c = path; *c && !err; c++) {
+        if(*c == ' ' || *c == '#' || *c == '\\') err = buf_put(buf, "\\", 1);
+        else if(*c == '$') err = buf_put(buf, "$", 1);
+        if(!err) err = buf_put(buf, c, 1);
+    }
+    return err;
+}
+
+static int same_contents(const char * path, const char * data, size_t len) {
+    FILE * file = fopen(path, "rb");
+    if(!file) return 0;
+
+    char chunk[4096];
+    size_t off = 0, read_len;
+    int same = 1;
+
+    while(same && (read_len = fread(chunk, 1, sizeof(chunk), file))) {
+        same = read_len <= len - off && !memcmp(chunk, data + off, read_len);
+        off += read_len;
+    }
+    fclose(file);
+
+    return same && off == len;
+}
+
+// Returns 1 if file was written, 0 if it already had the contents, -1 on failure.
+// File is replaced by rename, so it never is seen half-written.
+static int write_if_changed(const char * path, const char * data, size_t len) {
+    if(same_contents(path, data, len)) return 0;
+
+    char tmp[4096];
+    if(snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid()) >= (int)sizeof(tmp)) return -1;
+
+    FILE * file = fopen(tmp, "wb");
+    if(!file) {
+        perror(path);
+        return -1;
+    }
+
+    int ok = fwrite(data, 1, len, file) == len;
+    ok = !fclose(file) && ok;
+
+    if(!ok || rename(tmp, path)) {
+        perror(path);
+        remove(tmp);
+        return -1;
+    }
+    return 1;
+}
+
+//
+// BUILD
+
+static int build(const Job * job, size_t * deps, unsigned char * seen) {
+    char * shader;
+    mglsl_AssembleOptions options;
+    memset(&options, 0, sizeof(options));
+    options.flags = cfg.flags;
+
+    int ec = mglsl_assemble_shader_ex(&shader, job->root, modules, &options);
+    if(ec) {
+        fprintf(stderr, "mglslc: %s: %s\n", job->root, mglsl_err_desc(ec));
+        return -1;
+    }
+
+    int written = write_if_changed(job->output, shader, strlen(shader));
+    mglsl_free_shader(shader);
+    if(written < 0) return -1;
+
+    if(cfg.verbose) printf("%s %s\n", written ? "wrote" : "unchanged", job->output);
+
+    if(!cfg.depfiles) return 0;
+
+    char path[4096];
+    if(snprintf(path, sizeof(path), "%s.d", job->output) >= (int)sizeof(path)) return -1;
+
+    Buf depfile = { NULL, 0, 0 };
+    int err = buf_put_path(&depfile, job->output) || buf_put(&depfile, ":", 1) ||
+              buf_put(&depfile, " ", 1) || buf_put_path(&depfile, cfg.list_path);
+
+    size_t count = collect_deps(deps, seen, mglsl_str_id(job->root));
+    for(size_t i=0; i<count && !err; i++) {
+        const char * dep = mglsl_module_path(modules.data + deps[i]);
+        if(dep) err = buf_put(&depfile, " \\\n  ", 5) || buf_put_path(&depfile, dep);
+    }
+    if(!err) err = buf_put(&depfile, "\n", 1);
+
+    if(!err) err = write_if_changed(path, depfile.data, depfile.len) < 0;
+    free(depfile.data);
+    return err ? -1 : 0;
+}
+
+// Takes job indices off the pipe until it is drained, so that faster workers take more.
+static int worker(const Job * jobs, int queue_fd) {
+    size_t * deps = malloc(modules.size * sizeof(size_t) + 1);
+    unsigned char * seen = malloc(modules.size + 1);
+    if(!deps || !seen) return 1;
+
+    int failed = 0;
+    unsigned int job_idx;
+    while(read(queue_fd, &job_idx, sizeof(job_idx)) == sizeof(job_idx))
+        if(build(jobs + job_idx, deps, seen)) failed = 1;
+
+    free(deps);
+    free(seen);
+    return failed;
+}
+
+// Modules are imported before workers are forked, so they share them copy-on-write.
+static int run(const Job * jobs, size_t count) {
+    int queue[2];
+    if(pipe(queue)) {
+        perror("mglslc: pipe");
+        return 1;
+    }
+
+    long spawned = 0;
+    for(; spawned < cfg.jobs; spawned++) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid < 0) {
+            perror("mglslc: fork");
+            break;
+        }
+        if(pid == 0) {
+            close(queue[1]);
+            int failed = worker(jobs, queue[0]);
+            fflush(stdout);
+            _exit(failed);
+        }
+    }
+    close(queue[0]);
+
+    int failed = spawned == 0;
+    for(unsigned int i=0; i<count && spawned; i++) {
+        if(write(queue[1], &i, sizeof(i)) != sizeof(i)) {
+            perror("mglslc: write");
+            failed = 1;
+            break;
+        }
+    }
+    close(queue[1]);
+
+    for(long i=0; i<spawned; i++) {
+        int status;
+        if(wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) failed = 1;
+    }
+    return failed;
+}
+
+int main(int argc, char ** argv) {
+    int opt;
+
+    cfg.search_paths = "";
+    cfg.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while((opt = getopt(argc, argv, "l:I:j:dLSmMv")) != -1) {
+        switch(opt) {
+        case 'l': cfg.list_path = optarg; break;
+        case 'I': cfg.search_paths = optarg; break;
+        case 'j': cfg.jobs = strtol(optarg, NULL, 10); break;
+        case 'd': cfg.depfiles = 1; break;
+        case 'L': cfg.flags |= MGLSL_ASSEMBLE_LINE_DIRECTIVES; break;
+        case 'S': cfg.flags |= MGLSL_ASSEMBLE_STRIP_UNUSED; break;
+        case 'm': cfg.flags |= MGLSL_ASSEMBLE_MINIFY; break;
+        case 'M': cfg.flags |= MGLSL_ASSEMBLE_MINIFY_IDENTIFIERS; break;
+        case 'v': cfg.verbose = 1; break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if(!cfg.list_path || optind != argc - 1) {
+        fprintf(stderr, "usage: %s -l list [-I paths] [-j jobs] [-d] [-L] [-S] [-m] [-M] [-v] manifest\n", argv[0]);
+        return 1;
+    }
+
+    char * manifest = read_file(argv[optind]);
+    if(!manifest) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    size_t count;
+    Job * jobs = parse_manifest(manifest, &count);
+    if(!jobs) {
+        free(manifest);
+        return 1;
+    }
+
+    int ec = mglsl_import_module_file_list_from_file(&modules, cfg.list_path, cfg.search_paths);
+    if(ec) fprintf(stderr, "mglslc: %s: %s\n", cfg.list_path, mglsl_err_desc(ec));
+
+    int failed = ec != 0;
+    if(!failed && count) {
+        by_name = malloc(modules.size * sizeof(size_t) + 1);
+        for(size_t i=0; by_name && i<modules.size; i++) by_name[i] = i;
+        if(by_name) qsort(by_name, modules.size, sizeof(size_t), compare_name);
+
+        if(cfg.jobs < 1) cfg.jobs = 1;
+        if((size_t)cfg.jobs > count) cfg.jobs = (long)count;
+
+        failed = !by_name || run(jobs, count);
+        free(by_name);
+    }
+
+    if(!ec) {
+        for(size_t i=0; i<modules.size; i++) mglsl_free_module(modules.data + i);
+        mglsl_free_imported_module_arr(modules);
+    }
+
+    free(jobs);
+    free(manifest);
+    return failed;
+}
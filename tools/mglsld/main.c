@@ -0,0 +1,518 @@
+// Local shader daemon.
+//
+// Owns imported modules and the only mglsl_file_change_watch loop over them, and serves
+// assembled shaders to any number of clients over a Unix domain socket. Clients ask for a
+// root and get its source or hash, and can subscribe to be told when it changes, instead
+// of importing and polling module files themselves.
+//
+// To compile simply:
+// # gcc -O2 main.c -o mglsld
+//
+// Usage:
+//   mglsld -l LIST [-I PATHS] [-s SOCKET] [-p MS] [-v]      serve
+//   mglsld [-s SOCKET] [-L] [-S] [-m] [-M] -g|-x|-w ROOT     query running daemon
+//
+//   -l LIST     module file list, as for mglsl_import_module_file_list_from_file
+//   -I PATHS    colon-separated search paths of module files
+//   -s SOCKET   socket path                                  (default mglsld.sock)
+//   -p MS       milliseconds between file change watches     (default 250)
+//   -v          print reloads and clients coming and going
+//   -g ROOT     print shader assembled from ROOT
+//   -x ROOT     print hash of shader assembled from ROOT
+//   -w ROOT     print hash of shader assembled from ROOT, then again whenever it changes
+//   -L -S -m -M assemble flags, as for mglslc
+//
+// Protocol. Every message starts with a fixed header, in native byte order of the host,
+// followed by len bytes. Clients send requests:
+//
+//   uint32 op        OP_GET, OP_HASH or OP_SUBSCRIBE
+//   uint32 flags     mglsl_AssembleFlags
+//   uint32 len       length of root module name which follows
+//   uint32 reserved  zero
+//
+// and get one reply for each of them, in order. Subscribed clients also get OP_CHANGED
+// replies, with root name following, whenever shader of that root turns out different
+// after modules were reloaded:
+//
+//   uint32 op        op of the request, or OP_CHANGED
+//   int32  status    mglsl_ErrorCode of the assembly
+//   uint64 hash      64-bit FNV-1a of the shader, 0 if status is not 0
+//   uint32 reloads   number of times modules were reloaded so far
+//   uint32 len       length of shader source for OP_GET, root name for OP_CHANGED, else 0
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../../mglsl.h"
+
+enum { OP_GET = 1, OP_HASH = 2, OP_SUBSCRIBE = 3, OP_CHANGED = 4 };
+
+typedef struct {
+    uint32_t op;
+    uint32_t flags;
+    uint32_t len;
+    uint32_t reserved;
+} Request;
+
+typedef struct {
+    uint32_t op;
+    int32_t status;
+    uint64_t hash;
+    uint32_t reloads;
+    uint32_t len;
+} Reply;
+
+#define MAX_CLIENTS 256
+#define MAX_SUBS 64
+#define IN_BUF_LEN (sizeof(Request) + MGLSL_MAX_NAME_LEN + 1)
+
+typedef struct {
+    char * data;
+    size_t len, cap;
+} Buf;
+
+typedef struct {
+    char root[MGLSL_MAX_NAME_LEN + 1];
+    uint32_t flags;
+    int32_t status;
+    uint64_t hash; // last one client was told of
+} Sub;
+
+typedef struct {
+    int fd;
+    char in[IN_BUF_LEN];
+    size_t in_len;
+    Buf out;
+    size_t out_off;
+    Sub subs[MAX_SUBS];
+    size_t subs_len;
+} Client;
+
+// Shaders assembled since last reload.
+typedef struct {
+    char root[MGLSL_MAX_NAME_LEN + 1];
+    uint32_t flags;
+    int32_t status;
+    uint64_t hash;
+    char * source;
+    size_t len;
+} Entry;
+
+typedef struct {
+    const char * list_path;
+    const char * search_paths;
+    const char * socket_path;
+    long poll_ms;
+    int verbose;
+} Config;
+
+static Config cfg;
+static mglsl_ModuleArr modules;
+static uint32_t reloads;
+
+static Client * clients[MAX_CLIENTS];
+static size_t clients_len;
+
+static Entry * entries;
+static size_t entries_len, entries_cap;
+
+static volatile sig_atomic_t quit;
+
+static void on_signal(int sig) {
+    (void)sig;
+    quit = 1;
+}
+
+static unsigned long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+static uint64_t fnv1a(const char * data, size_t len) {
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i=0; i<len; i++) hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+    return hash;
+}
+
+static int buf_put(Buf * buf, const void * data, size_t len) {
+    if(!len) return 0;
+    if(buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while(cap < buf->len + len) cap *= 2;
+        char * grown = realloc(buf->data, cap);
+        if(!grown) return -1;
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+//
+// SHADERS
+
+static void clear_entries(void) {
+    for(size_t i=0; i<entries_len; i++)
+        if(!entries[i].status) mglsl_free_shader(entries[i].source);
+    entries_len = 0;
+}
+
+// Assembles root once per reload, every client asking after that gets the same one.
+static const Entry * get_entry(const char * root, uint32_t flags) {
+    for(size_t i=0; i<entries_len; i++)
+        if(entries[i].flags == flags && !strcmp(entries[i].root, root)) return entries + i;
+
+    if(entries_len == entries_cap) {
+        size_t cap = entries_cap ? entries_cap * 2 : 16;
+        Entry * grown = realloc(entries, cap * sizeof(Entry));
+        if(!grown) return NULL;
+        entries = grown;
+        entries_cap = cap;
+    }
+
+    Entry * entry = entries + entries_len++;
+    memset(entry, 0, sizeof(Entry));
+    strcpy(entry->root, root);
+    entry->flags = flags;
+
+    mglsl_AssembleOptions options;
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+
+    entry->status = mglsl_assemble_shader_ex(&entry->source, root, modules, &options);
+    if(!entry->status) {
+        entry->len = strlen(entry->source);
+        entry->hash = fnv1a(entry->source, entry->len);
+    } else {
+        entry->source = NULL;
+    }
+    return entry;
+}
+
+//
+// CLIENTS
+
+static int send_reply(Client * client, uint32_t op, const Entry * entry, const char * payload, size_t len) {
+    Reply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.op = op;
+    reply.status = entry ? entry->status : MGLSL_E_ALLOC;
+    reply.hash = entry ? entry->hash : 0;
+    reply.reloads = reloads;
+    reply.len = (uint32_t)len;
+
+    return buf_put(&client->out, &reply, sizeof(reply)) || buf_put(&client->out, payload, len);
+}
+
+static int handle_request(Client * client, const Request * req, const char * root) {
+    if(req->op != OP_GET && req->op != OP_HASH && req->op != OP_SUBSCRIBE) return -1;
+
+    const Entry * entry = get_entry(root, req->flags);
+
+    switch(req->op) {
+    case OP_GET:
+        return send_reply(client, OP_GET, entry, entry ? entry->source : NULL, entry ? entry->len : 0);
+
+    case OP_HASH:
+        return send_reply(client, OP_HASH, entry, NULL, 0);
+
+    case OP_SUBSCRIBE: {
+        Sub * sub = NULL;
+        for(size_t i=0; i<client->subs_len && !sub; i++)
+            if(client->subs[i].flags == req->flags && !strcmp(client->subs[i].root, root)) sub = client->subs + i;
+
+        if(!sub && client->subs_len < MAX_SUBS) {
+            sub = client->subs + client->subs_len++;
+            strcpy(sub->root, root);
+            sub->flags = req->flags;
+        }
+        if(sub && entry) {
+            sub->status = entry->status;
+            sub->hash = entry->hash;
+        }
+        // too many subscriptions are told with status, as allocation failure
+        return send_reply(client, OP_SUBSCRIBE, sub ? entry : NULL, NULL, 0);
+    }
+    }
+    return 0;
+}
+
+// Returns non-zero if client has to be dropped.
+static int client_read(Client * client) {
+    ssize_t got = read(client->fd, client->in + client->in_len, sizeof(client->in) - client->in_len);
+    if(got == 0) return -1;
+    if(got < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    client->in_len += (size_t)got;
+
+    for(;;) {
+        Request req;
+        if(client->in_len < sizeof(req)) return 0;
+        memcpy(&req, client->in, sizeof(req));
+
+        if(req.len > MGLSL_MAX_NAME_LEN) return -1;
+        size_t msg_len = sizeof(req) + req.len;
+        if(client->in_len < msg_len) return 0;
+
+        char root[MGLSL_MAX_NAME_LEN + 1];
+        memcpy(root, client->in + sizeof(req), req.len);
+        root[req.len] = '\0';
+
+        if(handle_request(client, &req, root)) return -1;
+
+        memmove(client->in, client->in + msg_len, client->in_len - msg_len);
+        client->in_len -= msg_len;
+    }
+}
+
+static int client_write(Client * client) {
+    while(client->out_off < client->out.len) {
+        ssize_t sent = write(client->fd, client->out.data + client->out_off, client->out.len - client->out_off);
+        if(sent < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        client->out_off += (size_t)sent;
+    }
+    client->out.len = client->out_off = 0;
+    return 0;
+}
+
+static void drop_client(size_t idx) {
+    Client * client = clients[idx];
+    if(cfg.verbose) printf("mglsld: client %d gone\n", client->fd);
+
+    close(client->fd);
+    free(client->out.data);
+    free(client);
+    clients[idx] = clients[--clients_len];
+}
+
+static void accept_clients(int listen_fd) {
+    int fd;
+    while((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        Client * client = clients_len < MAX_CLIENTS ? calloc(1, sizeof(Client)) : NULL;
+        if(!client) {
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        client->fd = fd;
+        clients[clients_len++] = client;
+        if(cfg.verbose) printf("mglsld: client %d came\n", fd);
+    }
+}
+
+//
+// WATCH
+
+// Tells subscribers which of their shaders came out different.
+static void reload(void) {
+    int ec = mglsl_swap_dirty_modules(modules);
+    if(ec) fprintf(stderr, "mglsld: reload: %s\n", mglsl_err_desc(ec));
+
+    reloads++;
+    clear_entries();
+    if(cfg.verbose) printf("mglsld: reload %u\n", (unsigned)reloads);
+
+    for(size_t c=0; c<clients_len; c++) {
+        Client * client = clients[c];
+        for(size_t s=0; s<client->subs_len; s++) {
+            Sub * sub = client->subs + s;
+            const Entry * entry = get_entry(sub->root, sub->flags);
+            if(!entry || (entry->status == sub->status && entry->hash == sub->hash)) continue;
+
+            sub->status = entry->status;
+            sub->hash = entry->hash;
+            send_reply(client, OP_CHANGED, entry, sub->root, strlen(sub->root));
+        }
+    }
+}
+
+static int serve(void) {
+    int ec = mglsl_import_module_file_list_from_file(&modules, cfg.list_path, cfg.search_paths);
+    if(ec) {
+        fprintf(stderr, "mglsld: %s: %s\n", cfg.list_path, mglsl_err_desc(ec));
+        return 1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(cfg.socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "mglsld: socket path is too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, cfg.socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(cfg.socket_path);
+    if(listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(listen_fd, 64)) {
+        perror("mglsld: socket");
+        return 1;
+    }
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    struct pollfd fds[MAX_CLIENTS + 1];
+    unsigned long long next_watch = now_ms() + cfg.poll_ms;
+
+    while(!quit) {
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for(size_t c=0; c<clients_len; c++) {
+            fds[c + 1].fd = clients[c]->fd;
+            fds[c + 1].events = POLLIN | (clients[c]->out.len ? POLLOUT : 0);
+        }
+
+        unsigned long long now = now_ms();
+        int timeout = next_watch > now ? (int)(next_watch - now) : 0;
+        int ready = poll(fds, clients_len + 1, timeout);
+        if(ready < 0 && errno != EINTR) {
+            perror("mglsld: poll");
+            break;
+        }
+
+        // backwards, so dropped clients do not move those still to be looked at
+        size_t polled = clients_len;
+        for(size_t c=polled; ready > 0 && c-- > 0;) {
+            short revents = fds[c + 1].revents;
+            int drop = (revents & POLLIN) && client_read(clients[c]);
+            if(!drop && (revents & (POLLERR | POLLHUP)) && !(revents & POLLIN)) drop = 1;
+            if(!drop) drop = client_write(clients[c]);
+            if(drop) drop_client(c);
+        }
+        if(ready > 0 && (fds[0].revents & POLLIN)) accept_clients(listen_fd);
+
+        if(now_ms() >= next_watch) {
+            ec = mglsl_file_change_watch(modules);
+            if(ec == MGLSL_E_FILE_CHANGED) reload();
+            else if(ec) fprintf(stderr, "mglsld: watch: %s\n", mglsl_err_desc(ec));
+
+            for(size_t c=clients_len; c-- > 0;)
+                if(client_write(clients[c])) drop_client(c);
+
+            next_watch = now_ms() + cfg.poll_ms;
+        }
+        fflush(stdout);
+    }
+
+    while(clients_len) drop_client(clients_len - 1);
+    close(listen_fd);
+    unlink(cfg.socket_path);
+
+    clear_entries();
+    free(entries);
+    for(size_t i=0; i<modules.size; i++) mglsl_free_module(modules.data + i);
+    mglsl_free_imported_module_arr(modules);
+    return 0;
+}
+
+//
+// CLIENT MODE
+
+static int read_all(int fd, void * data, size_t len) {
+    for(size_t off=0; off<len;) {
+        ssize_t got = read(fd, (char*)data + off, len - off);
+        if(got <= 0) return -1;
+        off += (size_t)got;
+    }
+    return 0;
+}
+
+static int query(uint32_t op, uint32_t flags, const char * root) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, cfg.socket_path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        perror("mglsld: connect");
+        return 1;
+    }
+
+    Request req;
+    memset(&req, 0, sizeof(req));
+    req.op = op;
+    req.flags = flags;
+    req.len = (uint32_t)strlen(root);
+
+    if(write(fd, &req, sizeof(req)) != sizeof(req) || write(fd, root, req.len) != (ssize_t)req.len) {
+        perror("mglsld: write");
+        return 1;
+    }
+
+    Reply reply;
+    while(!read_all(fd, &reply, sizeof(reply))) {
+        char * payload = malloc((size_t)reply.len + 1);
+        if(!payload || read_all(fd, payload, reply.len)) break;
+        payload[reply.len] = '\0';
+
+        if(reply.status) fprintf(stderr, "mglsld: %s: %s\n", root, mglsl_err_desc(reply.status));
+        else if(op == OP_GET) fputs(payload, stdout);
+        else printf("%016llx %u\n", (unsigned long long)reply.hash, (unsigned)reply.reloads);
+        fflush(stdout);
+        free(payload);
+
+        if(op != OP_SUBSCRIBE) {
+            close(fd);
+            return reply.status != 0;
+        }
+    }
+
+    close(fd);
+    return 1;
+}
+
+int main(int argc, char ** argv) {
+    uint32_t op = 0, flags = 0;
+    const char * root = NULL;
+    int opt;
+
+    cfg.search_paths = "";
+    cfg.socket_path = "mglsld.sock";
+    cfg.poll_ms = 250;
+
+    while((opt = getopt(argc, argv, "l:I:s:p:vg:x:w:LSmM")) != -1) {
+        switch(opt) {
+        case 'l': cfg.list_path = optarg; break;
+        case 'I': cfg.search_paths = optarg; break;
+        case 's': cfg.socket_path = optarg; break;
+        case 'p': cfg.poll_ms = strtol(optarg, NULL, 10); break;
+        case 'v': cfg.verbose = 1; break;
+        case 'g': op = OP_GET; root = optarg; break;
+        case 'x': op = OP_HASH; root = optarg; break;
+        case 'w': op = OP_SUBSCRIBE; root = optarg; break;
+        case 'L': flags |= MGLSL_ASSEMBLE_LINE_DIRECTIVES; break;
+        case 'S': flags |= MGLSL_ASSEMBLE_STRIP_UNUSED; break;
+        case 'm': flags |= MGLSL_ASSEMBLE_MINIFY; break;
+        case 'M': flags |= MGLSL_ASSEMBLE_MINIFY_IDENTIFIERS; break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if(optind != argc || (!op && !cfg.list_path)) {
+        fprintf(stderr, "usage: %s -l list [-I paths] [-s socket] [-p ms] [-v]\n"
+                        "       %s [-s socket] [-L] [-S] [-m] [-M] -g|-x|-w root\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    if(cfg.poll_ms < 1) cfg.poll_ms = 1;
+    return op ? query(op, flags, root) : serve();
+}